@@ -39,17 +39,40 @@
 #include <pwd.h>
 #include <ctype.h>
 #include <unistd.h>
+#include <dirent.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <math.h>
+#include <pthread.h>
 
 #include "nss_ndb.h"
 #include "ndb.h"
 
+/* Line offsets in the source file found per pass */
+#define NDB_LINEV 4096
+
 int debug_f = 0;
 int print_f = 0;
 int unique_f = 0;
 int verbose_f = 0;
 int key_f = 0;
+int fold_f = 0;
+int zip_f = 0;
+int intern_f = 0;
+int warm_f = 0;
+int check_f = 0;
+int sum_f = 0;
+int scan_f = 0;
+int binid_f = 0;
+
+NDB db_pwname;          /* For -I */
+char *p_pwuid = NULL;
+double bloom_fpr = 0;
+int nshards = 0;
 
 char *
 trim(char *buf) {
@@ -114,13 +137,20 @@ add_user_group(NDB *db,
     if (rc == 0) {
       /* Old record - append */
       int found;
-      char *grp, *grplist = val.data;
+      char *grp, *grplist, *tmp;
       char *buf = malloc(val.size + 64);
       if (!buf)
 	return -1;
       
       strcpy(buf, val.data);
       
+      /* Don't modify the record returned by the database */
+      grplist = tmp = strdup(buf);
+      if (!tmp) {
+	free(buf);
+	return -1;
+      }
+      
       if (debug_f)
 	fprintf(stderr, "*** add_user_group: %s: Old Record: %s\n", cp, grplist);
 
@@ -137,6 +167,7 @@ add_user_group(NDB *db,
 	  break;
 	}
       }
+      free(tmp);
 
       if (!found) {
 	if (debug_f)
@@ -154,11 +185,11 @@ add_user_group(NDB *db,
 	  if (debug_f)
 	    fprintf(stderr, "*** add_user_group: %.*s: db->put: %s\n",
 		    (int) key.size, (char *) key.data, strerror(errno));
+	  free(buf);
 	  return -1;
 	}
-	
-	free(buf);
       }
+      free(buf);
       
     } else if (rc == 1) {
       /* New record - create*/
@@ -198,25 +229,2093 @@ add_user_group(NDB *db,
 }
 
 
+/*
+ * Add an entry to a case-folded name index. Two different names that
+ * fold to the same key are ambiguous - the first one wins.
+ */
+int
+add_lcname(NDB *db,
+	   char *name,
+	   DBT *rec) {
+  DBT key, val;
+  char lcname[256];
+  int rc;
+
+
+  if (!_ndb_strfold(lcname, name, sizeof(lcname))) {
+    fprintf(stderr, "*** add_lcname: %s: name too long\n", name);
+    return -1;
+  }
+
+  memset(&key, 0, sizeof(key));
+  memset(&val, 0, sizeof(val));
+  
+  key.data = lcname;
+  key.size = strlen(lcname);
+
+  rc = _ndb_get(db, &key, &val, 0);
+  if (rc < 0)
+    return -1;
+  
+  if (rc == 0) {
+    size_t len = strlen(name);
+
+    /* Existing record for another name? */
+    if (val.size <= len ||
+	strncmp(val.data, name, len) != 0 ||
+	((char *) val.data)[len] != ':') {
+      if (debug_f)
+	fprintf(stderr, "*** add_lcname: %s: Folded name collides with: %.*s\n",
+		name, (int) val.size, (char *) val.data);
+      return 1;
+    }
+  }
+  
+  rc = _ndb_put(db, &key, rec, 0);
+  if (rc < 0) {
+    if (debug_f)
+      fprintf(stderr, "*** add_lcname: %s: db->put: %s\n",
+	      lcname, strerror(errno));
+    return -1;
+  }
+
+  return 0;
+}
+
+
+/*
+ * Locate the member field (after the third ':') of a group record
+ */
+static char *
+grmem_field(const char *rec,
+	    size_t len) {
+  size_t i;
+  int nc = 0;
+
+
+  for (i = 0; i < len && rec[i]; i++)
+    if (rec[i] == ':' && ++nc == 3)
+      return (char *) rec+i+1;
+
+  return NULL;
+}
+
+
+/*
+ * Replace a group record with one with a front-coded (-z) or
+ * interned (-I) member list
+ */
+int
+pack_group(DBT *val) {
+  char *rec = val->data, *mem, *nrec;
+  size_t hlen, nsize;
+  int rc;
+
+
+  mem = grmem_field(rec, val->size);
+  if (!mem || !*mem)
+    return 0;
+
+  /* A uid may take up to 6 characters */
+  hlen = mem-rec;
+  nsize = intern_f ? hlen + (val->size-hlen)*6 + 2 : val->size+1;
+  nrec = malloc(nsize);
+  if (!nrec)
+    return -1;
+  
+  memcpy(nrec, rec, hlen);
+  if (intern_f)
+    rc = _ndb_grmem_intern(nrec+hlen, nsize-hlen, mem, &db_pwname, p_pwuid);
+  else
+    rc = _ndb_grmem_encode(nrec+hlen, nsize-hlen, mem);
+  if (rc < 0) {
+    free(nrec);
+    return -1;
+  }
+
+  free(rec);
+  val->data = nrec;
+  val->size = hlen+rc+1;
+  return 0;
+}
+
+
+/*
+ * Dump formats (-F): text (one record per line), nul (NUL terminated
+ * records) or json (one object with the key & value per line)
+ */
+#define DUMP_TEXT 0
+#define DUMP_NUL  1
+#define DUMP_JSON 2
+
+int dump_fmt = DUMP_TEXT;
+
+typedef struct dumpargs {
+  const char *byuid;     /* Name table for interned group members */
+  int idfmt;
+  DBT prefix;
+  DBT first;             /* Key range */
+  DBT last;              /* (not included) */
+} DUMPARGS;
+
+
+/* Same order as the default Btree comparison */
+static int
+keycmp(const DBT *a,
+       const DBT *b) {
+  size_t len = a->size < b->size ? a->size : b->size;
+  int rc;
+
+  
+  rc = memcmp(a->data, b->data, len);
+  if (rc)
+    return rc;
+  return a->size < b->size ? -1 : a->size > b->size;
+}
+
+
+/*
+ * The key as text, with binary (-n) ids as decimal numbers. Returns
+ * NULL for the key format record.
+ */
+static const DBT *
+key_text(const DBT *key,
+	 int idfmt,
+	 DBT *tmp,
+	 char *buf,
+	 size_t bsize) {
+  unsigned long id;
+
+  
+  if (idfmt != NDB_IDKEY_BE32)
+    return key;
+  
+  if (_ndb_keyid(key, idfmt, &id) < 0)
+    return NULL;
+  
+  tmp->data = buf;
+  tmp->size = snprintf(buf, bsize, "%lu", id);
+  return tmp;
+}
+
+
+static void
+json_put(const char *str,
+	 size_t len) {
+  size_t i, j;
+
+  
+  putchar('"');
+  for (i = j = 0; i < len; i++) {
+    unsigned char c = str[i];
+    
+    if (c >= 0x20 && c != '"' && c != '\\')
+      continue;
+    
+    fwrite(str+j, 1, i-j, stdout);
+    switch (c) {
+    case '"':
+    case '\\':
+      putchar('\\');
+      putchar(c);
+      break;
+    case '\n':
+      fputs("\\n", stdout);
+      break;
+    case '\t':
+      fputs("\\t", stdout);
+      break;
+    default:
+      printf("\\u%04x", c);
+    }
+    j = i+1;
+  }
+  fwrite(str+j, 1, i-j, stdout);
+  putchar('"');
+}
+
+
+/*
+ * Print a record, with front-coded or interned group member lists
+ * expanded (using the name table of 'byuid')
+ */
+void
+print_rec(const DBT *key,
+	  const DBT *val,
+	  const char *byuid) {
+  static char *tmp = NULL;
+  static size_t tsize = 0;
+  const char *vp = val->data, *mem;
+  size_t vlen = strnlen(vp, val->size);
+  size_t klen = strnlen(key->data, key->size);
+  size_t hlen, size;
+  int rc = -1;
+
+
+  mem = grmem_field(vp, val->size);
+  if (mem && (*mem == NDB_GRMEM_FC || *mem == NDB_GRMEM_ID)) {
+    hlen = mem - vp;
+    
+    for (size = hlen + val->size*4; ; size = tsize*2) {
+      if (tsize < size) {
+	char *ntmp = realloc(tmp, size);
+	
+	if (!ntmp)
+	  break;
+	tmp = ntmp;
+	tsize = size;
+      }
+      rc = _ndb_grmem_decode(tmp+hlen, tsize-hlen, mem, val->size-hlen, byuid);
+      if (rc >= 0 || errno != ERANGE)
+	break;
+    }
+    
+    if (rc >= 0) {
+      memcpy(tmp, vp, hlen);
+      vp = tmp;
+      vlen = strlen(tmp);
+    }
+  }
+
+  switch (dump_fmt) {
+  case DUMP_NUL:
+    if (key_f) {
+      fwrite(key->data, 1, klen, stdout);
+      putchar('\0');
+    }
+    fwrite(vp, 1, vlen, stdout);
+    putchar('\0');
+    break;
+
+  case DUMP_JSON:
+    fputs("{\"key\":", stdout);
+    json_put(key->data, klen);
+    fputs(",\"value\":", stdout);
+    json_put(vp, vlen);
+    fputs("}\n", stdout);
+    break;
+    
+  default:
+    if (key_f)
+      printf("%-14.*s\t", (int) klen, (char *) key->data);
+    fwrite(vp, 1, vlen, stdout);
+    putchar('\n');
+  }
+}
+
+
+/*
+ * _ndb_scan() callback for -p. The scan starts at the first key of the
+ * range (or the prefix) so the first key outside ends it.
+ */
+int
+dump_rec(const DBT *key,
+	 const DBT *val,
+	 void *xp) {
+  DUMPARGS *dap = (DUMPARGS *) xp;
+  char kbuf[NDB_IDKEY_SIZE];
+  DBT tmp;
+
+  
+  if (dap->prefix.data &&
+      (key->size < dap->prefix.size ||
+       memcmp(key->data, dap->prefix.data, dap->prefix.size) != 0))
+    return 1;
+  
+  if (dap->last.data && keycmp(key, &dap->last) >= 0)
+    return 1;
+  
+  key = key_text(key, dap->idfmt, &tmp, kbuf, sizeof(kbuf));
+  if (!key)
+    return 0;
+  
+  print_rec(key, val, dap->byuid);
+  return ferror(stdout) ? -1 : 0;
+}
+
+
+/*
+ * -p with -r: the records of an id keyed map (passwd.byuid or
+ * group.bygid) with ids in [first, last), in id order, via a range
+ * cursor so only those records are read.
+ */
+static int
+dump_idrange(const char *path,
+	     unsigned long first,
+	     unsigned long last,
+	     DUMPARGS *dap) {
+  NDB_RANGE *rp;
+  char kbuf[NDB_IDKEY_SIZE];
+  unsigned long id;
+  DBT key, val;
+  int rc;
+
+  
+  rp = _ndb_range_open(path, first, last);
+  if (!rp)
+    return -1;
+  
+  while ((rc = _ndb_range_next(rp, &id, &key, &val)) > 0) {
+    key.data = kbuf;
+    key.size = snprintf(kbuf, sizeof(kbuf), "%lu", id);
+    print_rec(&key, &val, dap->byuid);
+    if (ferror(stdout)) {
+      rc = -1;
+      break;
+    }
+  }
+  
+  _ndb_range_close(rp);
+  return rc;
+}
+
+
+/*
+ * Netgroups. Nested netgroups are expanded when building the databases
+ * so no recursive lookups are needed at runtime:
+ *
+ *   netgroup.byname:    netgroup -> netgroup:(host,user,domain) ...
+ *   netgroup.bytriple:  netgroup:host,user,domain -> netgroup:(host,user,domain)
+ *
+ * netgroup.bytriple contains one key per triple and combination of fields
+ * replaced by "*" (so innetgr() queries with NULL fields also map to keys).
+ */
+typedef struct netgroup {
+  char *name;
+  char **mv;     /* Members: "(host,user,domain)" or netgroup names */
+  int mc;
+  char **tv;     /* Flattened & sorted triples */
+  int tc;
+  int ts;
+  int state;     /* 0 = not expanded, 1 = expanding, 2 = done */
+  int looped;
+} NETGROUP;
+
+static NETGROUP *ngv = NULL;
+static int ngc = 0;
+
+
+static int
+ng_cmp(const void *a,
+       const void *b) {
+  return strcmp(((const NETGROUP *) a)->name, ((const NETGROUP *) b)->name);
+}
+
+
+static int
+str_cmp(const void *a,
+	const void *b) {
+  return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+
+static NETGROUP *
+ng_find(const char *name) {
+  NETGROUP key;
+
+  key.name = (char *) name;
+  return bsearch(&key, ngv, ngc, sizeof(NETGROUP), ng_cmp);
+}
+
+
+static int
+ng_addtriple(NETGROUP *ng,
+	     char *triple) {
+  if (ng->tc >= ng->ts) {
+    int ns = ng->ts ? ng->ts*2 : 16;
+    char **nv = realloc(ng->tv, ns*sizeof(char *));
+    
+    if (!nv)
+      return -1;
+    ng->tv = nv;
+    ng->ts = ns;
+  }
+  
+  ng->tv[ng->tc++] = triple;
+  return 0;
+}
+
+
+/*
+ * Normalize a "(host, user, domain)" triple into "(host,user,domain)"
+ */
+static char *
+ng_triple(char *str) {
+  char *fv[3], *cp, *res;
+  int i;
+
+  
+  for (i = 0; i < 3; i++) {
+    fv[i] = strsep(&str, ",");
+    if (!fv[i])
+      return NULL;
+    trim(fv[i]);
+  }
+  if (str)
+    return NULL;
+
+  for (i = 0; i < 3; i++)
+    for (cp = fv[i]; *cp; cp++)
+      if (isspace(*cp) || *cp == '(' || *cp == ')')
+	return NULL;
+  
+  res = malloc(strlen(fv[0])+strlen(fv[1])+strlen(fv[2])+5);
+  if (!res)
+    return NULL;
+  
+  sprintf(res, "(%s,%s,%s)", fv[0], fv[1], fv[2]);
+  return res;
+}
+
+
+/*
+ * Parse netgroup(5) format: "name member member ...", where each member
+ * is a (host,user,domain) triple or the name of another netgroup.
+ * Lines may be continued with a backslash.
+ */
+static int
+ng_parse(char *buf,
+	 int *nw) {
+  char *cp, *lp, *name, *tok, *triple;
+  NETGROUP *ng;
+  int line = 0, i;
+
+  
+  /* Join continued lines */
+  for (cp = buf; (cp = strchr(cp, '\\')) != NULL; ) {
+    if (cp[1] == '\n') {
+      *cp++ = ' ';
+      *cp++ = ' ';
+    } else
+      ++cp;
+  }
+  
+  cp = buf;
+  while ((lp = cp) && *lp) {
+    cp = strchr(lp, '\n');
+    if (cp)
+      *cp++ = 0;
+    else
+      cp = lp+strlen(lp);
+
+    ++line;
+    trim(lp);
+    if (*lp == '#' || !*lp)
+      continue;
+
+    name = strsep(&lp, " \t");
+    
+    ng = realloc(ngv, (ngc+1)*sizeof(NETGROUP));
+    if (!ng)
+      return -1;
+    ngv = ng;
+    ng = &ngv[ngc++];
+    memset(ng, 0, sizeof(*ng));
+    ng->name = name;
+
+    while (lp && *lp) {
+      while (isspace(*lp))
+	++lp;
+      if (!*lp)
+	break;
+      
+      if (*lp == '(') {
+	tok = ++lp;
+	lp = strchr(lp, ')');
+	if (!lp) {
+	  fprintf(stderr, "makendb: %s: line %d: Missing ')'\n", name, line);
+	  ++*nw;
+	  break;
+	}
+	*lp++ = '\0';
+	
+	triple = ng_triple(tok);
+	if (!triple) {
+	  fprintf(stderr, "makendb: %s: line %d: (%s): Invalid triple\n", name, line, tok);
+	  ++*nw;
+	  continue;
+	}
+      } else {
+	triple = strsep(&lp, " \t");
+      }
+
+      ng->mv = realloc(ng->mv, (ng->mc+1)*sizeof(char *));
+      if (!ng->mv)
+	return -1;
+      ng->mv[ng->mc++] = triple;
+    }
+  }
+
+  qsort(ngv, ngc, sizeof(NETGROUP), ng_cmp);
+  for (i = 1; i < ngc; i++) {
+    if (strcmp(ngv[i-1].name, ngv[i].name) == 0) {
+      fprintf(stderr, "makendb: %s: Netgroup defined more than once\n", ngv[i].name);
+      ++*nw;
+    }
+  }
+  
+  return ngc;
+}
+
+
+/*
+ * Expand a netgroup. Returns 1 if the result is incomplete due to a loop
+ * (only the netgroup the expansion was started from is then correct).
+ */
+static int
+ng_flatten(NETGROUP *ng,
+	   int *nw) {
+  NETGROUP *sub;
+  int i, j, rc, partial = 0;
+
+  
+  if (ng->state == 2)
+    return 0;
+  
+  if (ng->state == 1) {
+    if (!ng->looped++) {
+      fprintf(stderr, "makendb: %s: Netgroup loop detected\n", ng->name);
+      ++*nw;
+    }
+    return 1;
+  }
+  
+  ng->state = 1;
+  
+  for (i = 0; i < ng->mc; i++) {
+    if (*ng->mv[i] == '(') {
+      if (ng_addtriple(ng, ng->mv[i]) < 0)
+	return -1;
+      continue;
+    }
+    
+    sub = ng_find(ng->mv[i]);
+    if (!sub) {
+      fprintf(stderr, "makendb: %s: %s: No such netgroup\n", ng->name, ng->mv[i]);
+      ++*nw;
+      continue;
+    }
+    
+    rc = ng_flatten(sub, nw);
+    if (rc < 0)
+      return -1;
+
+    for (j = 0; j < sub->tc; j++)
+      if (ng_addtriple(ng, sub->tv[j]) < 0)
+	return -1;
+
+    if (rc > 0) {
+      /* Incomplete - expand it again later */
+      if (sub->state == 2) {
+	sub->state = 0;
+	sub->tc = 0;
+      }
+      partial = 1;
+    }
+  }
+
+  /* Sort & remove duplicates */
+  if (ng->tc > 1) {
+    qsort(ng->tv, ng->tc, sizeof(char *), str_cmp);
+    for (i = j = 1; i < ng->tc; i++)
+      if (strcmp(ng->tv[i], ng->tv[j-1]) != 0)
+	ng->tv[j++] = ng->tv[i];
+    ng->tc = j;
+  }
+  
+  ng->state = 2;
+  return partial;
+}
+
+
+static int
+ng_put_triples(NDB *db,
+	       NETGROUP *ng,
+	       const char *triple) {
+  char tbuf[1024], kbuf[2048], vbuf[2048], *fv[3];
+  const char *kv[3];
+  DBT key, val;
+  int i, n, rc;
+  
+
+  if (strlen(triple) >= sizeof(tbuf)) {
+    errno = ERANGE;
+    return -1;
+  }
+  
+  /* Strip parentheses */
+  strcpy(tbuf, triple+1);
+  tbuf[strlen(tbuf)-1] = '\0';
+
+  fv[0] = tbuf;
+  fv[1] = strchr(fv[0], ',');
+  *fv[1]++ = '\0';
+  fv[2] = strchr(fv[1], ',');
+  *fv[2]++ = '\0';
+  
+  (void) _ndb_strfold(fv[0], fv[0], strlen(fv[0])+1);
+
+  rc = snprintf(vbuf, sizeof(vbuf), "%s:%s", ng->name, triple);
+  if (rc < 0 || rc >= sizeof(vbuf)) {
+    errno = ERANGE;
+    return -1;
+  }
+  
+  memset(&val, 0, sizeof(val));
+  val.data = vbuf;
+  val.size = rc+1;
+  
+  for (n = 0; n < 8; n++) {
+    for (i = 0; i < 3; i++)
+      kv[i] = (n & (1<<i)) ? "*" : fv[i];
+    
+    rc = snprintf(kbuf, sizeof(kbuf), "%s:%s,%s,%s", ng->name, kv[0], kv[1], kv[2]);
+    if (rc < 0 || rc >= sizeof(kbuf)) {
+      errno = ERANGE;
+      return -1;
+    }
+    
+    memset(&key, 0, sizeof(key));
+    key.data = kbuf;
+    key.size = rc;
+
+    if (_ndb_put(db, &key, &val, 0) < 0)
+      return -1;
+  }
+
+  return 0;
+}
+
+
+int
+import_netgroup(NDB *db_name,
+		const char *p_name,
+		NDB *db_triple,
+		const char *p_triple,
+		char *buf,
+		int *nw) {
+  NETGROUP *ng;
+  DBT key, val;
+  char *vbuf, *cp;
+  size_t len;
+  int i, j, rc;
+
+  
+  if (ng_parse(buf, nw) < 0) {
+    fprintf(stderr, "makendb: netgroup: %s\n", strerror(errno));
+    return -1;
+  }
+
+  for (i = 0; i < ngc; i++) {
+    ng = &ngv[i];
+    
+    if (ng_flatten(ng, nw) < 0) {
+      fprintf(stderr, "makendb: %s: %s\n", ng->name, strerror(errno));
+      return -1;
+    }
+
+    len = strlen(ng->name)+2;
+    for (j = 0; j < ng->tc; j++)
+      len += strlen(ng->tv[j])+1;
+
+    vbuf = malloc(len);
+    if (!vbuf) {
+      fprintf(stderr, "makendb: %s: malloc(%lu bytes): %s\n", ng->name, (unsigned long) len, strerror(errno));
+      return -1;
+    }
+    
+    cp = vbuf + sprintf(vbuf, "%s:", ng->name);
+    for (j = 0; j < ng->tc; j++)
+      cp += sprintf(cp, "%s%s", j > 0 ? " " : "", ng->tv[j]);
+    
+    if (debug_f)
+      printf("[%s]\n", vbuf);
+    
+    memset(&key, 0, sizeof(key));
+    memset(&val, 0, sizeof(val));
+    
+    key.data = ng->name;
+    key.size = strlen(ng->name);
+    
+    val.data = vbuf;
+    val.size = strlen(vbuf)+1;
+    
+    rc = _ndb_put(db_name, &key, &val, unique_f ? DB_NOOVERWRITE : 0);
+    if (rc < 0) {
+      fprintf(stderr, "makendb: %s: %s: db->put: %s\n", p_name, ng->name, strerror(errno));
+      return -1;
+    } else if (rc > 0) {
+      fprintf(stderr, "makendb: %s: %s: Key already exists in database\n", p_name, ng->name);
+      ++*nw;
+    }
+    
+    free(vbuf);
+
+    for (j = 0; j < ng->tc; j++) {
+      if (ng_put_triples(db_triple, ng, ng->tv[j]) < 0) {
+	fprintf(stderr, "makendb: %s: %s: %s: db->put: %s\n", p_triple, ng->name, ng->tv[j], strerror(errno));
+	return -1;
+      }
+    }
+  }
+
+  return ngc;
+}
+
+
+
+/*
+ * Append a line to a (newline separated) multi-line record
+ */
+static int
+add_line(NDB *db,
+	 const char *name,
+	 const char *line) {
+  DBT key, val;
+  char *buf, *cp;
+  size_t olen, llen = strlen(line);
+  int rc;
+  
+  
+  memset(&key, 0, sizeof(key));
+  memset(&val, 0, sizeof(val));
+
+  key.data = (char *) name;
+  key.size = strlen(name);
+
+  rc = _ndb_get(db, &key, &val, 0);
+  if (rc < 0)
+    return -1;
+
+  olen = (rc == 0 && val.data) ? strnlen(val.data, val.size) : 0;
+  
+  /* Already listed? */
+  for (cp = val.data; olen && cp && cp < (char *) val.data + olen; ) {
+    if (strncmp(cp, line, llen) == 0 && (cp[llen] == '\n' || cp[llen] == '\0'))
+      return 1;
+    cp = memchr(cp, '\n', olen - (cp - (char *) val.data));
+    if (cp)
+      ++cp;
+  }
+
+  buf = malloc(olen + llen + 2);
+  if (!buf)
+    return -1;
+  
+  if (olen) {
+    memcpy(buf, val.data, olen);
+    buf[olen++] = '\n';
+  }
+  strcpy(buf+olen, line);
+
+  memset(&val, 0, sizeof(val));
+  val.data = buf;
+  val.size = olen + llen + 1;
+
+  rc = _ndb_put(db, &key, &val, 0);
+  free(buf);
+  
+  return rc < 0 ? -1 : 0;
+}
+
+
+/*
+ * Import a hosts(5) file:
+ *
+ *   hosts.byname:  lower case name & aliases -> "address name alias..." lines
+ *   hosts.byaddr:  inet_ntop(3) address      -> "address name alias..." lines
+ */
+int
+import_hosts(NDB *db_name,
+	     const char *p_name,
+	     NDB *db_addr,
+	     const char *p_addr,
+	     char *buf,
+	     int *nw) {
+  unsigned char abin[sizeof(struct in6_addr)];
+  char abuf[INET6_ADDRSTRLEN], lcname[NI_MAXHOST];
+  char *cp, *lp, *tok, *namev[MAXHOSTALIASES];
+  char line[8192], *ep;
+  int ni = 0, lno = 0, nn, i, j, af;
+
+  
+  cp = buf;
+  while ((lp = cp) && *lp) {
+    cp = strchr(lp, '\n');
+    if (cp)
+      *cp++ = 0;
+    else
+      cp = lp+strlen(lp);
+
+    ++lno;
+    
+    /* Strip comments */
+    if ((ep = strchr(lp, '#')) != NULL)
+      *ep = '\0';
+    trim(lp);
+    if (!*lp)
+      continue;
+
+    tok = strsep(&lp, " \t");
+    af = strchr(tok, ':') ? AF_INET6 : AF_INET;
+    if (inet_pton(af, tok, abin) != 1 ||
+	!inet_ntop(af, abin, abuf, sizeof(abuf))) {
+      fprintf(stderr, "makendb: line %d: %s: Invalid address\n", lno, tok);
+      ++*nw;
+      continue;
+    }
+
+    nn = 0;
+    while (lp && (tok = strsep(&lp, " \t")) != NULL) {
+      if (!*tok)
+	continue;
+      if (nn >= MAXHOSTALIASES) {
+	fprintf(stderr, "makendb: line %d: %s: Too many aliases\n", lno, abuf);
+	++*nw;
+	break;
+      }
+      namev[nn++] = tok;
+    }
+    
+    if (nn == 0) {
+      fprintf(stderr, "makendb: line %d: %s: No host name\n", lno, abuf);
+      ++*nw;
+      continue;
+    }
+    
+    /* Normalized line */
+    ep = line + snprintf(line, sizeof(line), "%s", abuf);
+    for (i = 0; i < nn && ep < line+sizeof(line); i++)
+      ep += snprintf(ep, sizeof(line)-(ep-line), " %s", namev[i]);
+    if (ep >= line+sizeof(line)) {
+      fprintf(stderr, "makendb: line %d: %s: Line too long\n", lno, abuf);
+      ++*nw;
+      continue;
+    }
+
+    if (debug_f)
+      printf("[%s]\n", line);
+    
+    if (add_line(db_addr, abuf, line) < 0) {
+      fprintf(stderr, "makendb: %s: %s: db->put: %s\n", p_addr, abuf, strerror(errno));
+      return -1;
+    }
+
+    for (i = 0; i < nn; i++) {
+      if (!_ndb_strfold(lcname, namev[i], sizeof(lcname))) {
+	fprintf(stderr, "makendb: line %d: %s: Name too long\n", lno, namev[i]);
+	++*nw;
+	continue;
+      }
+
+      /* Same name (in another case) already handled for this line? */
+      for (j = 0; j < i && strcasecmp(namev[j], namev[i]) != 0; j++)
+	;
+      if (j < i)
+	continue;
+      
+      if (add_line(db_name, lcname, line) < 0) {
+	fprintf(stderr, "makendb: %s: %s: db->put: %s\n", p_name, lcname, strerror(errno));
+	return -1;
+      }
+    }
+
+    ++ni;
+  }
+
+  return ni;
+}
+
+
+/*
+ * Add a record unless the key already exists (first entry wins)
+ */
+static int
+put_first(NDB *db,
+	  const char *name,
+	  const char *line) {
+  DBT key, val;
+  
+  
+  memset(&key, 0, sizeof(key));
+  memset(&val, 0, sizeof(val));
+
+  key.data = (char *) name;
+  key.size = strlen(name);
+
+  val.data = (char *) line;
+  val.size = strlen(line)+1;
+
+  return _ndb_put(db, &key, &val, DB_NOOVERWRITE);
+}
+
+
+/*
+ * Split a services(5), protocols(5) or rpc(5) line into whitespace
+ * separated fields (comments removed) and join them again normalized
+ */
+static int
+split_line(char *lp,
+	   char **fv,
+	   int fs,
+	   char *line,
+	   size_t lsize) {
+  char *cp;
+  int fc = 0, i;
+  size_t len = 0;
+  
+
+  if ((cp = strchr(lp, '#')) != NULL)
+    *cp = '\0';
+  
+  while (fc < fs && (cp = strsep(&lp, " \t\r")) != NULL)
+    if (*cp)
+      fv[fc++] = cp;
+  if (lp && lp[strspn(lp, " \t\r")])
+    return -1;
+  
+  for (i = 0; i < fc; i++) {
+    size_t flen = strlen(fv[i]);
+    
+    if (len + flen + 2 > lsize)
+      return -1;
+    if (i > 0)
+      line[len++] = ' ';
+    memcpy(line+len, fv[i], flen);
+    len += flen;
+  }
+  line[len] = '\0';
+
+  return fc;
+}
+
+
+/*
+ * Import a services(5) file:
+ *
+ *   services.byname:  "name/proto", "alias/proto", "name", "alias"
+ *                     and "port" -> "name port/proto alias..."
+ *   services.byport:  "port/proto" -> "name port/proto alias..."
+ */
+int
+import_services(NDB *db_name,
+		const char *p_name,
+		NDB *db_port,
+		const char *p_port,
+		char *buf,
+		int *nw) {
+  char *cp, *lp, *proto, *fv[MAXSVFIELDS];
+  char line[8192], kbuf[1024];
+  unsigned int port;
+  int ni = 0, lno = 0, fc, i, rc;
+
+  
+  cp = buf;
+  while ((lp = cp) && *lp) {
+    cp = strchr(lp, '\n');
+    if (cp)
+      *cp++ = 0;
+    else
+      cp = lp+strlen(lp);
+
+    ++lno;
+    fc = split_line(lp, fv, MAXSVFIELDS, line, sizeof(line));
+    if (fc == 0)
+      continue;
+    
+    if (fc < 2) {
+      fprintf(stderr, "makendb: line %d: Invalid services entry\n", lno);
+      ++*nw;
+      continue;
+    }
+    
+    proto = strchr(fv[1], '/');
+    if (!proto || sscanf(fv[1], "%u", &port) != 1 || port > 65535 || !*++proto) {
+      fprintf(stderr, "makendb: line %d: %s: Invalid port/protocol\n", lno, fv[1]);
+      ++*nw;
+      continue;
+    }
+
+    if (debug_f)
+      printf("[%s]\n", line);
+    
+    snprintf(kbuf, sizeof(kbuf), "%u/%s", port, proto);
+    rc = put_first(db_port, kbuf, line);
+    if (rc < 0) {
+      fprintf(stderr, "makendb: %s: %s: db->put: %s\n", p_port, kbuf, strerror(errno));
+      return -1;
+    } else if (rc > 0 && verbose_f) {
+      /* Only reachable via the name index */
+      fprintf(stderr, "makendb: line %d: %s: Port already defined\n", lno, kbuf);
+    }
+
+    snprintf(kbuf, sizeof(kbuf), "%u", port);
+    if (put_first(db_name, kbuf, line) < 0) {
+      fprintf(stderr, "makendb: %s: %s: db->put: %s\n", p_name, kbuf, strerror(errno));
+      return -1;
+    }
+    
+    for (i = 0; i < fc; i++) {
+      if (i == 1)
+	continue;
+
+      rc = snprintf(kbuf, sizeof(kbuf), "%s/%s", fv[i], proto);
+      if (rc < 0 || rc >= sizeof(kbuf) ||
+	  put_first(db_name, kbuf, line) < 0 ||
+	  put_first(db_name, fv[i], line) < 0) {
+	fprintf(stderr, "makendb: %s: %s: db->put: %s\n", p_name, fv[i], strerror(errno));
+	return -1;
+      }
+    }
+
+    ++ni;
+  }
+
+  return ni;
+}
+
+
+/*
+ * Import a protocols(5) or rpc(5) file:
+ *
+ *   <type>.byname:    name & aliases -> "name number alias..."
+ *   <type>.bynumber:  number         -> "name number alias..."
+ */
+int
+import_numbered(NDB *db_name,
+		const char *p_name,
+		NDB *db_number,
+		const char *p_number,
+		char *buf,
+		int *nw) {
+  char *cp, *lp, *fv[MAXSVFIELDS];
+  char line[8192], kbuf[64];
+  int ni = 0, lno = 0, fc, i, rc, number;
+
+  
+  cp = buf;
+  while ((lp = cp) && *lp) {
+    cp = strchr(lp, '\n');
+    if (cp)
+      *cp++ = 0;
+    else
+      cp = lp+strlen(lp);
+
+    ++lno;
+    fc = split_line(lp, fv, MAXSVFIELDS, line, sizeof(line));
+    if (fc == 0)
+      continue;
+    
+    if (fc < 2 || sscanf(fv[1], "%d", &number) != 1) {
+      fprintf(stderr, "makendb: line %d: Invalid entry\n", lno);
+      ++*nw;
+      continue;
+    }
+
+    if (debug_f)
+      printf("[%s]\n", line);
+    
+    snprintf(kbuf, sizeof(kbuf), "%d", number);
+    rc = put_first(db_number, kbuf, line);
+    if (rc < 0) {
+      fprintf(stderr, "makendb: %s: %s: db->put: %s\n", p_number, kbuf, strerror(errno));
+      return -1;
+    } else if (rc > 0 && verbose_f) {
+      /* Only reachable via the name index (like 'ip' & 'hopopt' in protocols) */
+      fprintf(stderr, "makendb: line %d: %s: Number already defined\n", lno, kbuf);
+    }
+
+    for (i = 0; i < fc; i++) {
+      if (i == 1)
+	continue;
+
+      if (put_first(db_name, fv[i], line) < 0) {
+	fprintf(stderr, "makendb: %s: %s: db->put: %s\n", p_name, fv[i], strerror(errno));
+	return -1;
+      }
+    }
+
+    ++ni;
+  }
+
+  return ni;
+}
+
+
+/*
+ * Open a database for update. With -S it is created as a sharded map
+ * (unless it already is one), else an existing shard manifest is used.
+ */
+int
+open_db(NDB *ndb,
+	const char *path) {
+  int n;
+
+  
+  if (nshards > 0) {
+    n = _ndb_shards(path);
+    if (n < 0)
+      return -1;
+    
+    if (n > 0 && n != nshards) {
+      fprintf(stderr, "makendb: %s: Already split in %d shards (remove it to change)\n", path, n);
+      errno = EEXIST;
+      return -1;
+    }
+    
+    if (n == 0 && _ndb_shards_write(path, nshards) < 0)
+      return -1;
+  }
+  
+  return _ndb_open(ndb, path, 1);
+}
+
+
+static int
+first_rec(const DBT *key,
+	  const DBT *val,
+	  void *xp) {
+  *(int *) xp = 1;
+  return 1;
+}
+
+/*
+ * -n: binary id keys in a new passwd.byuid or group.bygid. A map that
+ * has them keeps them.
+ */
+int
+init_idkeys(NDB *ndb,
+	    const char *path) {
+  int fmt, found = 0;
+
+  
+  fmt = _ndb_idformat(ndb);
+  if (fmt < 0 || (binid_f && fmt != NDB_IDKEY_BE32 &&
+		  _ndb_scan(ndb, NULL, first_rec, &found) < 0)) {
+    fprintf(stderr, "makendb: %s: Reading key format: %s\n", path, strerror(errno));
+    return -1;
+  }
+
+  if (!binid_f || fmt == NDB_IDKEY_BE32)
+    return 0;
+  
+  if (found) {
+    fprintf(stderr, "makendb: %s: Already has decimal keys (remove it to change)\n", path);
+    return -1;
+  }
+  
+  if (_ndb_idformat_write(ndb) < 0) {
+    fprintf(stderr, "makendb: %s: Writing key format: %s\n", path, strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+
+/*
+ * Write a Bloom filter sidecar (<path>.bloom) for all keys in a database.
+ * It is written to a temporary file that is renamed into place, and
+ * stamped with the inode, size & mtime of the database, so the module
+ * ignores it if the database is changed afterwards.
+ */
+int
+bloom_write(const char *path,
+	    double fpr) {
+  NDB ndb;
+  DBT key, val;
+  NDB_BLOOM *bp = NULL;
+  uint64_t *hv = NULL, *tv, nbytes;
+  size_t hn = 0, hs = 0, i;
+  char bpath[PATH_MAX], tpath[PATH_MAX];
+  struct stat sb;
+  int rc, fd = -1;
+
+  
+  memset(&ndb, 0, sizeof(ndb));
+  if (_ndb_open(&ndb, path, 0) < 0)
+    return -1;
+  
+  do {
+    key.data = NULL;
+    key.size = 0;
+    
+    val.data = NULL;
+    val.size = 0;
+    
+    rc = _ndb_get(&ndb, &key, &val, DB_NEXT);
+    if (rc == 0) {
+      if (hn >= hs) {
+	hs = hs ? hs*2 : 1024;
+	tv = realloc(hv, hs*sizeof(*hv));
+	if (!tv) {
+	  rc = -1;
+	  break;
+	}
+	hv = tv;
+      }
+      hv[hn++] = _ndb_bloom_hash(key.data, key.size);
+    }
+  } while (rc == 0);
+  
+  _ndb_close(&ndb);
+  if (rc < 0)
+    goto Fail;
+
+  /* Stamp it with the database as it is now (after it was closed) */
+  if (_ndb_stat(path, &sb) < 0)
+    goto Fail;
+
+  /* m = -n*ln(p)/ln(2)^2 bits and k = m/n*ln(2) hashes */
+  nbytes = (uint64_t) ceil(-(double) (hn ? hn : 1) * log(fpr) / (M_LN2 * M_LN2) / 8);
+  if (nbytes < 8)
+    nbytes = 8;
+
+  bp = calloc(1, sizeof(*bp) + nbytes);
+  if (!bp)
+    goto Fail;
+
+  memcpy(bp->magic, NDB_BLOOM_MAGIC, sizeof(bp->magic));
+  bp->version = NDB_BLOOM_VERSION;
+  bp->nbits = nbytes * 8;
+  bp->nkeys = hn;
+  bp->nhash = (uint32_t) (-log(fpr) / M_LN2 + 0.5);
+  if (bp->nhash < 1)
+    bp->nhash = 1;
+  if (bp->nhash > 32)
+    bp->nhash = 32;
+  _ndb_bloom_stamp(bp, &sb);
+  
+  for (i = 0; i < hn; i++)
+    _ndb_bloom_add(bp, hv[i]);
+
+  rc = snprintf(bpath, sizeof(bpath), "%s%s", path, NDB_BLOOM_SUFFIX);
+  if (rc < 0 || rc >= sizeof(bpath) ||
+      (rc = snprintf(tpath, sizeof(tpath), "%s.%d", bpath, (int) getpid())) < 0 ||
+      rc >= sizeof(tpath)) {
+    errno = ENAMETOOLONG;
+    goto Fail;
+  }
+  
+  /* Same access as the database (shadow is root-only) */
+  fd = open(tpath, O_WRONLY|O_CREAT|O_TRUNC, sb.st_mode & 0666);
+  if (fd < 0)
+    goto Fail;
+  
+  if (fchmod(fd, sb.st_mode & 0666) < 0 ||
+      write(fd, bp, sizeof(*bp) + nbytes) != sizeof(*bp) + nbytes ||
+      close(fd) < 0) {
+    fd = -1;
+    unlink(tpath);
+    goto Fail;
+  }
+  fd = -1;
+  
+  if (rename(tpath, bpath) < 0) {
+    unlink(tpath);
+    goto Fail;
+  }
+
+  if (verbose_f)
+    fprintf(stderr, "%s: %lu keys, %lu bits, %u hashes\n",
+	    bpath, (unsigned long) hn, (unsigned long) bp->nbits, bp->nhash);
+  
+  free(bp);
+  free(hv);
+  return 0;
+
+ Fail:
+  if (fd >= 0)
+    close(fd);
+  free(bp);
+  free(hv);
+  return -1;
+}
+
+
+/*
+ * Warm up a database (or all files in a database directory)
+ */
+int
+warm_db(const char *argv0,
+	const char *path,
+	long long *tot) {
+  char fpath[2048];
+  struct stat sb;
+  struct dirent *dep;
+  DIR *dp;
+  long long rc;
+
+
+  if (stat(path, &sb) == 0 && S_ISDIR(sb.st_mode)) {
+    dp = opendir(path);
+    if (!dp) {
+      fprintf(stderr, "%s: %s: opendir: %s\n", argv0, path, strerror(errno));
+      return -1;
+    }
+    
+    while ((dep = readdir(dp)) != NULL) {
+      snprintf(fpath, sizeof(fpath), "%s/%s", path, dep->d_name);
+      if (*dep->d_name == '.' || stat(fpath, &sb) < 0 || !S_ISREG(sb.st_mode))
+	continue;
+      
+      rc = _ndb_warm(fpath, warm_f);
+      if (rc < 0) {
+	fprintf(stderr, "%s: %s: %s\n", argv0, fpath, strerror(errno));
+	closedir(dp);
+	return -1;
+      }
+      if (verbose_f > 1)
+	fprintf(stderr, "%s: %lld bytes\n", fpath, rc);
+      *tot += rc;
+    }
+    closedir(dp);
+    return 0;
+  }
+  
+  rc = _ndb_warm(path, warm_f);
+  if (rc < 0) {
+    fprintf(stderr, "%s: %s: %s\n", argv0, path, strerror(errno));
+    return -1;
+  }
+  if (verbose_f > 1)
+    fprintf(stderr, "%s: %lld bytes\n", path, rc);
+  *tot += rc;
+  return 0;
+}
+
+
+/*
+ * Integrity scan (-x). Checks the checksum of every record (in a sealed
+ * map) and the digest of the database file(s). Problems are printed
+ * (one per line) on stdout.
+ */
+typedef struct scanargs {
+  const char *path;
+  int idfmt;
+  int crc;
+  unsigned long n;
+  unsigned long sealed;
+  unsigned long bad;
+} SCANARGS;
+
+static int
+scan_rec(const DBT *key,
+	 const DBT *val,
+	 void *xp) {
+  SCANARGS *sp = (SCANARGS *) xp;
+  DBT v = *val, tmp;
+  char kbuf[NDB_IDKEY_SIZE];
+
+  
+  ++sp->n;
+  switch (sp->crc ? _ndb_crc_check(&v, 1) : 0) {
+  case 1:
+    ++sp->sealed;
+    break;
+    
+  case -1:
+    ++sp->bad;
+    key = key_text(key, sp->idfmt, &tmp, kbuf, sizeof(kbuf));
+    printf("%s: %.*s: Checksum mismatch\n", sp->path,
+	   key ? (int) key->size : 0, key ? (char *) key->data : "");
+    break;
+  }
+  
+  return 0;
+}
+
+long
+scan_map(const char *argv0,
+	 const char *path) {
+  static const char *dsv[] = { "ok", "missing", "stale", "mismatch" };
+  SCANARGS sa;
+  NDB ndb;
+  int drc;
+  long np;
+
+  
+  memset(&ndb, 0, sizeof(ndb));
+  if (_ndb_open(&ndb, path, 0) < 0) {
+    fprintf(stderr, "%s: %s: dbopen: %s\n", argv0, path, strerror(errno));
+    return -1;
+  }
+
+  memset(&sa, 0, sizeof(sa));
+  sa.path = path;
+  sa.idfmt = _ndb_idformat(&ndb);
+  sa.crc = _ndb_sealed(&ndb);
+  if (sa.idfmt < 0 || _ndb_scan(&ndb, NULL, scan_rec, &sa) < 0) {
+    fprintf(stderr, "%s: %s: read: %s\n", argv0, path, strerror(errno));
+    _ndb_close(&ndb);
+    return -1;
+  }
+  _ndb_close(&ndb);
+
+  np = sa.bad;
+  if (sa.sealed > 0 && sa.sealed+sa.bad < sa.n) {
+    printf("%s: %lu records without checksum\n", path, sa.n-sa.sealed-sa.bad);
+    ++np;
+  }
+
+  drc = _ndb_digest(path, NDB_DIGEST_CHECK);
+  if (drc < 0) {
+    fprintf(stderr, "%s: %s: digest: %s\n", argv0, path, strerror(errno));
+    return -1;
+  }
+  if (drc == NDB_DIGEST_MISMATCH) {
+    printf("%s: File digest mismatch\n", path);
+    ++np;
+  } else if (drc == NDB_DIGEST_STALE)
+    printf("%s: File digest is stale\n", path);
+
+  if (verbose_f)
+    fprintf(stderr, "%s: %lu records (%lu with checksum, %lu bad), digest %s\n",
+	    path, sa.n, sa.sealed, sa.bad, dsv[drc]);
+  
+  /* -s: (re)seal the file(s) if the records were fine */
+  if (sum_f && np == 0 && drc != NDB_DIGEST_OK &&
+      _ndb_digest(path, NDB_DIGEST_WRITE) < 0) {
+    fprintf(stderr, "%s: %s: Writing digest: %s\n", argv0, path, strerror(errno));
+    return -1;
+  }
+  
+  return np;
+}
+
+/*
+ * Scan a database (or all maps in a database directory)
+ */
+long
+scan_db(const char *argv0,
+	const char *path) {
+  char fpath[2048];
+  struct stat sb;
+  struct dirent *dep;
+  DIR *dp;
+  size_t len, slen = strlen(NDB_SHARDS_SUFFIX);
+  long rc, np = 0;
+  int sharded;
+
+  
+  if (stat(path, &sb) < 0 || !S_ISDIR(sb.st_mode))
+    return scan_map(argv0, path);
+  
+  dp = opendir(path);
+  if (!dp) {
+    fprintf(stderr, "%s: %s: opendir: %s\n", argv0, path, strerror(errno));
+    return -1;
+  }
+  
+  while ((dep = readdir(dp)) != NULL) {
+    if (*dep->d_name == '.')
+      continue;
+    
+    /* Plain maps, and sharded ones by their manifest */
+    len = strlen(dep->d_name);
+    sharded = (len > slen && strcmp(dep->d_name+len-slen, NDB_SHARDS_SUFFIX) == 0);
+    if (sharded)
+      len -= slen;
+    if (len < 3 || strncmp(dep->d_name+len-3, ".db", 3) != 0)
+      continue;
+    
+    snprintf(fpath, sizeof(fpath), "%s/%.*s", path, (int) len, dep->d_name);
+    if (!sharded && (stat(fpath, &sb) < 0 || !S_ISREG(sb.st_mode)))
+      continue;
+    
+    rc = scan_map(argv0, fpath);
+    if (rc < 0) {
+      closedir(dp);
+      return -1;
+    }
+    np += rc;
+  }
+  closedir(dp);
+  
+  return np;
+}
+
+
+/*
+ * Cross-index verification (-c). The passwd & group maps of a database
+ * directory are loaded in parallel (one thread per map) into tables
+ * sorted by key or id that are then checked against each other, also
+ * in parallel. Problems are printed (one per line) on stdout.
+ */
+#define VM_PWNAME 0
+#define VM_PWUID  1
+#define VM_GRNAME 2
+#define VM_GRGID  3
+#define VM_USER   4
+#define VM_MAX    5
+
+typedef struct vrec {
+  char *key;
+  char *rec;             /* Record (with the group members decoded) */
+  char *name;
+  unsigned long id;      /* uid or gid (ULONG_MAX if malformed) */
+  unsigned long gid;     /* Primary gid (passwd) */
+  const char *mem;       /* Member (or gid) list in rec, NULL if none */
+} VREC;
+
+typedef struct vmap {
+  const char *name;
+  int nf;                /* Fields (passwd: 7, group: 4, byuser: 2) */
+  int byid;
+  int idfmt;             /* Key format (NDB_IDKEY_*) */
+  char path[PATH_MAX];
+  const char *byuid;
+  VREC *v;
+  size_t n, size;
+  int ec;                /* errno if the map couldn't be read */
+  pthread_t tid;
+} VMAP;
+
+typedef struct vpair {
+  const char *user;
+  unsigned long gid;
+  const char *group;
+} VPAIR;
+
+VMAP vmap[VM_MAX] = {
+  { "passwd.byname", 7, 0 },
+  { "passwd.byuid",  7, 1 },
+  { "group.byname",  4, 0 },
+  { "group.bygid",   4, 1 },
+  { "group.byuser",  2, 0 },
+};
+
+VPAIR *vpair = NULL;
+size_t vpairs = 0;
+
+
+static int
+vrec_keycmp(const void *a,
+	    const void *b) {
+  return strcmp(((const VREC *) a)->key, ((const VREC *) b)->key);
+}
+
+static int
+vrec_idcmp(const void *a,
+	   const void *b) {
+  const VREC *ra = (const VREC *) a;
+  const VREC *rb = (const VREC *) b;
+
+  return ra->id < rb->id ? -1 : ra->id > rb->id;
+}
+
+static int
+vrec_idpcmp(const void *a,
+	    const void *b) {
+  return vrec_idcmp(*(const VREC **) a, *(const VREC **) b);
+}
+
+static int
+vpair_cmp(const void *a,
+	  const void *b) {
+  const VPAIR *pa = (const VPAIR *) a;
+  const VPAIR *pb = (const VPAIR *) b;
+  int rc = strcmp(pa->user, pb->user);
+
+  if (rc)
+    return rc;
+  return pa->gid < pb->gid ? -1 : pa->gid > pb->gid;
+}
+
+
+static VREC *
+vfind_key(VMAP *mp,
+	  const char *key) {
+  VREC r;
+
+  r.key = (char *) key;
+  return bsearch(&r, mp->v, mp->n, sizeof(VREC), vrec_keycmp);
+}
+
+static VREC *
+vfind_id(VMAP *mp,
+	 unsigned long id) {
+  VREC r;
+
+  r.id = id;
+  return bsearch(&r, mp->v, mp->n, sizeof(VREC), vrec_idcmp);
+}
+
+static int
+vpair_find(const char *user,
+	   unsigned long gid) {
+  VPAIR p;
+
+  p.user = user;
+  p.gid = gid;
+  return bsearch(&p, vpair, vpairs, sizeof(VPAIR), vpair_cmp) != NULL;
+}
+
+
+/* Is gid on a comma separated list? */
+static int
+gidlist_has(const char *list,
+	    unsigned long gid) {
+  char *ep;
+
+  
+  while (list && *list) {
+    if (strtoul(list, &ep, 10) == gid && (*ep == ',' || !*ep))
+      return 1;
+    list = strchr(list, ',');
+    if (list)
+      ++list;
+  }
+  return 0;
+}
+
+
+static void
+vrec_parse(VMAP *mp,
+	   VREC *rp) {
+  char *fv[7], *cp, *ep;
+  int i;
+
+
+  rp->id = ULONG_MAX;
+  
+  for (i = 0, cp = rp->rec; i < mp->nf-1 && cp; i++) {
+    fv[i] = cp;
+    cp = strchr(cp, ':');
+    if (cp)
+      ++cp;
+  }
+  if (!cp)
+    return;
+  fv[i] = cp;
+  
+  rp->name = strndup(fv[0], strcspn(fv[0], ":"));
+  
+  if (mp->nf == 2) {
+    rp->mem = fv[1];
+    return;
+  }
+  
+  rp->id = strtoul(fv[2], &ep, 10);
+  if (ep == fv[2] || *ep != ':')
+    rp->id = ULONG_MAX;
+  
+  if (mp->nf == 7)
+    rp->gid = strtoul(fv[3], NULL, 10);
+  else if (*fv[3])
+    rp->mem = fv[3];
+}
+
+
+static int
+verify_rec(const DBT *key,
+	   const DBT *val,
+	   void *xp) {
+  VMAP *mp = (VMAP *) xp;
+  VREC *rp;
+  const char *mem;
+  size_t hlen, size;
+  char *tmp, kbuf[NDB_IDKEY_SIZE];
+  DBT ktmp;
+  int rc;
+
+  
+  key = key_text(key, mp->idfmt, &ktmp, kbuf, sizeof(kbuf));
+  if (!key)
+    return 0;
+  
+  if (mp->n >= mp->size) {
+    VREC *nv = realloc(mp->v, (mp->size = mp->size ? mp->size*2 : 4096)*sizeof(VREC));
+
+    if (!nv)
+      return -1;
+    mp->v = nv;
+  }
+  
+  rp = &mp->v[mp->n];
+  memset(rp, 0, sizeof(*rp));
+  
+  rp->key = strndup(key->data, strnlen(key->data, key->size));
+  if (!rp->key)
+    return -1;
+
+  mem = mp->nf == 4 ? grmem_field(val->data, val->size) : NULL;
+  if (mem && (*mem == NDB_GRMEM_FC || *mem == NDB_GRMEM_ID)) {
+    hlen = mem - (char *) val->data;
+    
+    for (size = val->size*4+hlen; ; size *= 2) {
+      tmp = realloc(rp->rec, size);
+      if (!tmp)
+	return -1;
+      rp->rec = tmp;
+      rc = _ndb_grmem_decode(tmp+hlen, size-hlen, mem, val->size-hlen, mp->byuid);
+      if (rc >= 0)
+	break;
+      if (errno != ERANGE)
+	return -1;
+    }
+    memcpy(rp->rec, val->data, hlen);
+  } else
+    rp->rec = strndup(val->data, strnlen(val->data, val->size));
+  if (!rp->rec)
+    return -1;
+
+  vrec_parse(mp, rp);
+  ++mp->n;
+  return 0;
+}
+
+
+static void *
+verify_load(void *xp) {
+  VMAP *mp = (VMAP *) xp;
+  NDB ndb;
+
+  
+  memset(&ndb, 0, sizeof(ndb));
+  if (_ndb_open(&ndb, mp->path, 0) < 0 ||
+      (mp->idfmt = _ndb_idformat(&ndb)) < 0 ||
+      _ndb_scan(&ndb, NULL, verify_rec, mp) < 0)
+    mp->ec = errno ? errno : EIO;
+  _ndb_close(&ndb);
+  
+  if (!mp->ec)
+    qsort(mp->v, mp->n, sizeof(VREC), mp->byid ? vrec_idcmp : vrec_keycmp);
+  return NULL;
+}
+
+
+/*
+ * passwd.byname <-> passwd.byuid (or group.byname <-> group.bygid)
+ */
+static unsigned long
+verify_byid(FILE *fp,
+	    VMAP *np,
+	    VMAP *ip,
+	    const char *what) {
+  VREC *rp, *xp, **iv;
+  unsigned long ne = 0;
+  size_t i, j;
+
+
+  for (i = 0; i < np->n; i++) {
+    rp = &np->v[i];
+    if (rp->id == ULONG_MAX) {
+      fprintf(fp, "%s: %s: Malformed record\n", np->name, rp->key);
+      ++ne;
+      continue;
+    }
+    if (strcmp(rp->key, rp->name) != 0) {
+      fprintf(fp, "%s: %s: Key doesn't match the %s name (%s)\n", np->name, rp->key, what, rp->name);
+      ++ne;
+    }
+
+    xp = vfind_id(ip, rp->id);
+    if (!xp) {
+      fprintf(fp, "%s: %s: Id %lu missing in %s\n", np->name, rp->key, rp->id, ip->name);
+      ++ne;
+    } else if (strcmp(xp->rec, rp->rec) != 0 && strcmp(xp->name, rp->name) == 0) {
+      fprintf(fp, "%s: %s: Record differs from %s\n", np->name, rp->key, ip->name);
+      ++ne;
+    }
+  }
+
+  for (i = 0; i < ip->n; i++) {
+    rp = &ip->v[i];
+    if (rp->id == ULONG_MAX) {
+      fprintf(fp, "%s: %s: Malformed record\n", ip->name, rp->key);
+      ++ne;
+      continue;
+    }
+    if (strtoul(rp->key, NULL, 10) != rp->id) {
+      fprintf(fp, "%s: %s: Key doesn't match the id (%lu)\n", ip->name, rp->key, rp->id);
+      ++ne;
+    }
+    
+    xp = vfind_key(np, rp->name);
+    if (!xp) {
+      fprintf(fp, "%s: %s: %s %s missing in %s\n", ip->name, rp->key, what, rp->name, np->name);
+      ++ne;
+    } else if (xp->id != rp->id) {
+      fprintf(fp, "%s: %s: %s %s has id %lu in %s\n", ip->name, rp->key, what, rp->name, xp->id, np->name);
+      ++ne;
+    }
+  }
+
+  /* Names sharing an id (only one of them can be found by id) */
+  iv = malloc(np->n * sizeof(VREC *) + 1);
+  if (!iv) {
+    fprintf(fp, "%s: malloc: %s\n", np->name, strerror(errno));
+    return ne+1;
+  }
+  for (i = 0; i < np->n; i++)
+    iv[i] = &np->v[i];
+  qsort(iv, np->n, sizeof(VREC *), vrec_idpcmp);
+  
+  for (i = 0; i < np->n; i = j) {
+    for (j = i+1; j < np->n && iv[j]->id == iv[i]->id; j++)
+      ;
+    if (j-i > 1 && iv[i]->id != ULONG_MAX) {
+      fprintf(fp, "%s: Duplicate id %lu:", np->name, iv[i]->id);
+      for (; i < j; i++)
+	fprintf(fp, " %s", iv[i]->key);
+      putc('\n', fp);
+      ++ne;
+    }
+  }
+  free(iv);
+  
+  return ne;
+}
+
+
+/*
+ * group.byname members -> group.byuser & passwd.byname
+ */
+static unsigned long
+verify_members(FILE *fp) {
+  VMAP *up = &vmap[VM_USER];
+  unsigned long ne = 0;
+  VREC *rp;
+  size_t i;
+
+
+  for (i = 0; i < vpairs; i++) {
+    if (vmap[VM_PWNAME].n && !vfind_key(&vmap[VM_PWNAME], vpair[i].user)) {
+      fprintf(fp, "%s: %s: Member %s missing in %s\n",
+	      vmap[VM_GRNAME].name, vpair[i].group, vpair[i].user, vmap[VM_PWNAME].name);
+      ++ne;
+    }
+    
+    if (!up->n)
+      continue;
+    
+    rp = vfind_key(up, vpair[i].user);
+    if (!rp) {
+      fprintf(fp, "%s: %s: Member %s missing in %s\n",
+	      vmap[VM_GRNAME].name, vpair[i].group, vpair[i].user, up->name);
+      ++ne;
+    } else if (!gidlist_has(rp->mem, vpair[i].gid)) {
+      fprintf(fp, "%s: %s: Member %s, but gid %lu missing in %s\n",
+	      vmap[VM_GRNAME].name, vpair[i].group, vpair[i].user, vpair[i].gid, up->name);
+      ++ne;
+    }
+  }
+  
+  return ne;
+}
+
+
+/*
+ * group.byuser -> group.bygid members. The uid and primary gid of a
+ * user, and the gid of a group (with no members) by the same name are
+ * also accepted, since makendb adds those.
+ */
+static unsigned long
+verify_user(FILE *fp) {
+  VMAP *up = &vmap[VM_USER];
+  unsigned long ne = 0, gid;
+  const char *cp;
+  char *ep;
+  VREC *rp, *pp, *gp, *xp;
+  size_t i;
+
+
+  for (i = 0; i < up->n; i++) {
+    rp = &up->v[i];
+    if (!rp->mem) {
+      fprintf(fp, "%s: %s: Malformed record\n", up->name, rp->key);
+      ++ne;
+      continue;
+    }
+    
+    pp = vfind_key(&vmap[VM_PWNAME], rp->key);
+    xp = vfind_key(&vmap[VM_GRNAME], rp->key);
+    if (!pp && !xp && vmap[VM_PWNAME].n) {
+      fprintf(fp, "%s: %s: User missing in %s\n", up->name, rp->key, vmap[VM_PWNAME].name);
+      ++ne;
+    }
+    
+    for (cp = rp->mem; cp && *cp; cp = *ep ? ep+1 : NULL) {
+      gid = strtoul(cp, &ep, 10);
+      if (ep == cp || (*ep && *ep != ',')) {
+	fprintf(fp, "%s: %s: Malformed record\n", up->name, rp->key);
+	++ne;
+	break;
+      }
+      
+      if (vpair_find(rp->key, gid) ||
+	  (pp && (gid == pp->id || gid == pp->gid)) ||
+	  (xp && gid == xp->id))
+	continue;
+
+      gp = vfind_id(&vmap[VM_GRGID], gid);
+      if (!gp)
+	fprintf(fp, "%s: %s: Gid %lu missing in %s\n", up->name, rp->key, gid, vmap[VM_GRGID].name);
+      else
+	fprintf(fp, "%s: %s: Not a member of %s (%lu)\n", up->name, rp->key, gp->name, gid);
+      ++ne;
+    }
+  }
+  
+  return ne;
+}
+
+
+typedef struct vcheck {
+  int what;
+  FILE *fp;
+  char *buf;
+  size_t len;
+  unsigned long ne;
+  pthread_t tid;
+} VCHECK;
+
+static void *
+verify_check(void *xp) {
+  VCHECK *cp = (VCHECK *) xp;
+
+  
+  switch (cp->what) {
+  case 0:
+    if (vmap[VM_PWNAME].n && vmap[VM_PWUID].n)
+      cp->ne = verify_byid(cp->fp, &vmap[VM_PWNAME], &vmap[VM_PWUID], "User");
+    break;
+  case 1:
+    if (vmap[VM_GRNAME].n && vmap[VM_GRGID].n)
+      cp->ne = verify_byid(cp->fp, &vmap[VM_GRNAME], &vmap[VM_GRGID], "Group");
+    break;
+  case 2:
+    cp->ne = verify_members(cp->fp);
+    break;
+  case 3:
+    cp->ne = verify_user(cp->fp);
+    break;
+  }
+  return NULL;
+}
+
+
+/*
+ * Returns the number of problems found, or -1 on error
+ */
+long
+verify_db(const char *argv0,
+	  const char *dir) {
+  VCHECK cv[4];
+  unsigned long ne = 0;
+  char *cp, *ep;
+  VREC *rp;
+  size_t i, n;
+  int j;
+
+  
+  for (j = 0; j < VM_MAX; j++) {
+    snprintf(vmap[j].path, sizeof(vmap[j].path), "%s/%s.db", dir, vmap[j].name);
+    vmap[j].byuid = vmap[VM_PWUID].path;
+  }
+  
+  for (j = 0; j < VM_MAX; j++)
+    if (pthread_create(&vmap[j].tid, NULL, verify_load, &vmap[j]) != 0) {
+      fprintf(stderr, "%s: pthread_create: %s\n", argv0, strerror(errno));
+      return -1;
+    }
+  
+  for (j = 0; j < VM_MAX; j++) {
+    pthread_join(vmap[j].tid, NULL);
+    if (vmap[j].ec == ENOENT) {
+      if (verbose_f)
+	fprintf(stderr, "%s: %s: Not found, skipped\n", argv0, vmap[j].path);
+      vmap[j].n = 0;
+    } else if (vmap[j].ec) {
+      fprintf(stderr, "%s: %s: %s\n", argv0, vmap[j].path, strerror(vmap[j].ec));
+      return -1;
+    } else if (verbose_f)
+      fprintf(stderr, "%s: %lu records\n", vmap[j].path, (unsigned long) vmap[j].n);
+  }
+
+  /*
+   * (user, gid) for all group members, sorted. The member list copies
+   * the pairs point into, like the records in vmap[].v, are never
+   * freed - makendb exits right after the check.
+   */
+  for (n = i = 0; i < vmap[VM_GRNAME].n; i++)
+    for (cp = (char *) vmap[VM_GRNAME].v[i].mem; cp; cp = strchr(cp+1, ','))
+      ++n;
+  vpair = malloc(n * sizeof(VPAIR) + 1);
+  if (!vpair) {
+    fprintf(stderr, "%s: malloc: %s\n", argv0, strerror(errno));
+    return -1;
+  }
+  for (i = 0; i < vmap[VM_GRNAME].n; i++) {
+    rp = &vmap[VM_GRNAME].v[i];
+    if (!rp->mem)
+      continue;
+    if (!(cp = strdup(rp->mem))) {
+      fprintf(stderr, "%s: strdup: %s\n", argv0, strerror(errno));
+      return -1;
+    }
+    for (; cp && *cp; cp = ep) {
+      ep = strchr(cp, ',');
+      if (ep)
+	*ep++ = '\0';
+      vpair[vpairs].user = cp;
+      vpair[vpairs].gid = rp->id;
+      vpair[vpairs].group = rp->key;
+      ++vpairs;
+    }
+  }
+  qsort(vpair, vpairs, sizeof(VPAIR), vpair_cmp);
+  
+  for (j = 0; j < 4; j++) {
+    memset(&cv[j], 0, sizeof(cv[j]));
+    cv[j].what = j;
+    cv[j].fp = open_memstream(&cv[j].buf, &cv[j].len);
+    if (!cv[j].fp ||
+	pthread_create(&cv[j].tid, NULL, verify_check, &cv[j]) != 0) {
+      fprintf(stderr, "%s: %s\n", argv0, strerror(errno));
+      return -1;
+    }
+  }
+  
+  for (j = 0; j < 4; j++) {
+    pthread_join(cv[j].tid, NULL);
+    fclose(cv[j].fp);
+    fwrite(cv[j].buf, 1, cv[j].len, stdout);
+    free(cv[j].buf);
+    ne += cv[j].ne;
+  }
+  
+  return ne;
+}
+
+
 int
 main(int argc,
      char *argv[]) {
-  NDB db_id, db_name, db_user, db;
+  NDB db_id, db_name, db_user, db_lcname, db;
   DBT key, val;
   int rc, ni,line, fd;
-  char *name, *cp, *buf;
+  char *name, *cp, *ep, *buf, *lbuf;
+  size_t lv[NDB_LINEV], nl, il, off, end;
   char *id = NULL;
   char *type = NULL;
-  char path[2048], *p_name, *p_id, *p_user;
+  char path[2048], *p_name, *p_id, *p_user, *p_lcname;
   int i, j;
   char *delim = ":";
+  char kbuf[NDB_IDKEY_SIZE];
   int nw = 0;
   ssize_t len;
   struct stat sb;
+  DUMPARGS dump;
+  unsigned long id_first = 0, id_last = ULONG_MAX;
+  int idrange_f = 0;
+  char *np;
   
+  memset(&dump, 0, sizeof(dump));
   memset(&db_id, 0, sizeof(db_id));
   memset(&db_name, 0, sizeof(db_name));
   memset(&db_user, 0, sizeof(db_user));
+  memset(&db_lcname, 0, sizeof(db_lcname));
   memset(&db, 0, sizeof(db));
   
   for (i = 1; i < argc && argv[i][0] == '-'; i++) {
@@ -239,14 +2338,124 @@ main(int argc,
 	++key_f;
 	break;
 	
+      case 'i':
+	++fold_f;
+	break;
+	
+      case 'z':
+	++zip_f;
+	break;
+	
+      case 'I':
+	++intern_f;
+	break;
+	
+      case 'w':
+	warm_f |= NDB_WARM_FAULT;
+	break;
+	
+      case 'L':
+	warm_f |= NDB_WARM_FAULT|NDB_WARM_LOCK;
+	break;
+	
       case 'p':
 	++print_f;
 	break;
 	
+      case 'c':
+	++check_f;
+	break;
+	
+      case 's':
+	++sum_f;
+	break;
+	
+      case 'n':
+	++binid_f;
+	break;
+	
+      case 'x':
+	++scan_f;
+	break;
+	
       case 'u':
 	++unique_f;
 	break;
 	
+      case 'F':
+	if (argv[i][j+1])
+	  cp = argv[i]+j+1;
+	else if (i+1 < argc)
+	  cp = argv[++i];
+	else
+	  cp = NULL;
+	if (cp && strcmp(cp, "text") == 0)
+	  dump_fmt = DUMP_TEXT;
+	else if (cp && strcmp(cp, "nul") == 0)
+	  dump_fmt = DUMP_NUL;
+	else if (cp && strcmp(cp, "json") == 0)
+	  dump_fmt = DUMP_JSON;
+	else {
+	  fprintf(stderr, "%s: %s: Invalid format (text, nul or json)\n",
+		  argv[0], cp ? cp : "<null>");
+	  exit(1);
+	}
+	goto NextArg;
+	
+      case 'R':
+	if (argv[i][j+1])
+	  cp = argv[i]+j+1;
+	else if (i+1 < argc)
+	  cp = argv[++i];
+	else
+	  cp = NULL;
+	if (!cp || !(ep = strstr(cp, ".."))) {
+	  fprintf(stderr, "%s: %s: Invalid key range (<first>..<last>)\n",
+		  argv[0], cp ? cp : "<null>");
+	  exit(1);
+	}
+	if (ep > cp) {
+	  dump.first.data = strndup(cp, ep-cp);
+	  dump.first.size = ep-cp;
+	}
+	if (ep[2]) {
+	  dump.last.data = strdup(ep+2);
+	  dump.last.size = strlen(ep+2);
+	}
+	goto NextArg;
+	
+      case 'r':
+	if (argv[i][j+1])
+	  cp = argv[i]+j+1;
+	else if (i+1 < argc)
+	  cp = argv[++i];
+	else
+	  cp = NULL;
+	if (!cp || !(ep = strstr(cp, "..")) ||
+	    (ep > cp && (!isdigit((unsigned char) *cp) ||
+			 (id_first = strtoul(cp, &np, 10), np != ep))) ||
+	    (ep[2] && (!isdigit((unsigned char) ep[2]) ||
+		       (id_last = strtoul(ep+2, &np, 10), *np)))) {
+	  fprintf(stderr, "%s: %s: Invalid id range (<first>..<last>)\n",
+		  argv[0], cp ? cp : "<null>");
+	  exit(1);
+	}
+	++idrange_f;
+	goto NextArg;
+	
+      case 'P':
+	if (argv[i][j+1])
+	  cp = argv[i]+j+1;
+	else if (i+1 < argc)
+	  cp = argv[++i];
+	else
+	  cp = NULL;
+	if (cp && *cp) {
+	  dump.prefix.data = strdup(cp);
+	  dump.prefix.size = strlen(cp);
+	}
+	goto NextArg;
+	
       case 'D':
 	if (argv[i][j+1])
 	  cp = argv[i]+j+1;
@@ -257,6 +2466,61 @@ main(int argc,
 	delim = strxdup(cp);
 	goto NextArg;
 	
+      case 'b':
+	if (argv[i][j+1])
+	  cp = argv[i]+j+1;
+	else if (i+1 < argc)
+	  cp = argv[++i];
+	else
+	  cp = NULL;
+	if (!cp || sscanf(cp, "%lf", &bloom_fpr) != 1 ||
+	    bloom_fpr <= 0 || bloom_fpr >= 1) {
+	  fprintf(stderr, "%s: %s: Invalid Bloom filter false positive rate\n",
+		  argv[0], cp ? cp : "<null>");
+	  exit(1);
+	}
+	goto NextArg;
+	
+      case 'E':
+	if (argv[i][j+1])
+	  cp = argv[i]+j+1;
+	else if (i+1 < argc)
+	  cp = argv[++i];
+	else
+	  cp = NULL;
+	_ndb_dbenv(cp);
+	goto NextArg;
+	
+      case 'C':
+	if (argv[i][j+1])
+	  cp = argv[i]+j+1;
+	else if (i+1 < argc)
+	  cp = argv[++i];
+	else
+	  cp = NULL;
+#if DB_VERSION_MAJOR >= 4
+	_ndb_container(cp);
+#else
+	fprintf(stderr, "%s: -C: Containers need Berkeley DB 4 or later\n", argv[0]);
+	exit(1);
+#endif
+	goto NextArg;
+	
+      case 'S':
+	if (argv[i][j+1])
+	  cp = argv[i]+j+1;
+	else if (i+1 < argc)
+	  cp = argv[++i];
+	else
+	  cp = NULL;
+	if (!cp || sscanf(cp, "%d", &nshards) != 1 ||
+	    nshards < 1 || nshards > NDB_SHARDS_MAX) {
+	  fprintf(stderr, "%s: %s: Invalid number of shards (1-%d)\n",
+		  argv[0], cp ? cp : "<null>", NDB_SHARDS_MAX);
+	  exit(1);
+	}
+	goto NextArg;
+	
       case 'T':
 	if (argv[i][j+1])
 	  cp = argv[i]+j+1;
@@ -268,7 +2532,7 @@ main(int argc,
 	goto NextArg;
 	
       case 'h':
-	printf("Usage: %s [-h] [-V] [-v] [-u] [-p] [-k] [-T passwd|group] [-D <delim>] <db-path> <src-file>\n", argv[0]);
+	printf("Usage: %s [-h] [-V] [-v] [-u] [-p] [-c] [-x] [-s] [-n] [-k] [-F <format>] [-R <first>..<last>] [-r <first>..<last>] [-P <prefix>] [-i] [-z] [-I] [-w] [-L] [-b <fpr>] [-S <shards>] [-E <dbenv>] [-C <container>] [-T <type>] [-D <delim>] <db-path> <src-file>\n", argv[0]);
 	exit(0);
 	
       default:
@@ -284,8 +2548,76 @@ main(int argc,
     exit(1);
   }
 
-  if (print_f) {
+  if (zip_f && intern_f) {
+    fprintf(stderr, "%s: -z and -I can not be combined\n", argv[0]);
+    exit(1);
+  }
+
+  if (warm_f) {
+    long long tot = 0;
+    
+    for (; i < argc; i++) {
+      if (warm_db(argv[0], argv[i], &tot) < 0)
+	exit(1);
+    }
 
+    if (verbose_f)
+      fprintf(stderr, "%lld bytes %s\n", tot,
+	      (warm_f & NDB_WARM_LOCK) ? "locked in memory" : "read");
+    
+    if (warm_f & NDB_WARM_LOCK) {
+      /* Keep the pages locked until we are killed */
+      for (;;)
+	pause();
+    }
+    return 0;
+  }
+  
+  if (check_f) {
+    long ne, tot = 0;
+    
+    for (; i < argc; i++) {
+      ne = verify_db(argv[0], argv[i]);
+      if (ne < 0)
+	exit(1);
+      tot += ne;
+    }
+    
+    if (verbose_f)
+      fprintf(stderr, "%ld problem%s found\n", tot, tot == 1 ? "" : "s");
+    return tot ? 1 : 0;
+  }
+  
+  if (scan_f) {
+    long np, tot = 0;
+    
+    for (; i < argc; i++) {
+      np = scan_db(argv[0], argv[i]);
+      if (np < 0)
+	exit(1);
+      tot += np;
+    }
+    
+    if (verbose_f)
+      fprintf(stderr, "%ld problem%s found\n", tot, tot == 1 ? "" : "s");
+    return tot ? 1 : 0;
+  }
+  
+  if (print_f) {
+    DBT first;
+    
+    if (idrange_f && (dump.first.data || dump.last.data || dump.prefix.data)) {
+      fprintf(stderr, "%s: -r can not be combined with -R or -P\n", argv[0]);
+      exit(1);
+    }
+    
+    /* Start at the range or the prefix, whichever comes last */
+    first = dump.first;
+    if (dump.prefix.data && (!first.data || keycmp(&dump.prefix, &first) > 0))
+      first = dump.prefix;
+    
+    setvbuf(stdout, NULL, _IOFBF, 1024*1024);
+    
     for (; i < argc; i++) {
       int rc;
 
@@ -307,37 +2639,46 @@ main(int argc,
 
       p_name = strdup(path);
 
-      _ndb_setent(&db, 1, path);
-
-      do {
-	key.data = NULL;
-	key.size = 0;
-
-	val.data = NULL;
-	val.size = 0;
-
-	rc = _ndb_get(&db, &key, &val, DB_NEXT);
-	if (rc == 0) {
-	  if (key_f)
-	    printf("%-14.*s\t", (int) key.size, (char *) key.data);
-	  printf("%.*s\n", (int) val.size, (char *) val.data);
-	}
-      } while (rc == 0);
-
-      _ndb_close(&db);
+      /* Name table for interned group members, in the same directory */
+      cp = strrchr(p_name, '/');
+      sprintf(path, "%.*s/passwd.byuid.db", cp ? (int) (cp-p_name) : 1, cp ? p_name : ".");
+      dump.byuid = p_pwuid = strdup(path);
+      dump.idfmt = _ndb_idformat(&db);
+      
+      if (idrange_f) {
+	_ndb_close(&db);
+	rc = dump_idrange(p_name, id_first, id_last, &dump);
+      } else {
+	rc = _ndb_scan(&db, &first, dump_rec, &dump);
+	_ndb_close(&db);
+      }
+      
+      if (rc < 0 && !ferror(stdout)) {
+	fprintf(stderr, "%s: %s: read: %s\n",
+		argv[0], p_name, strerror(errno));
+	exit(1);
+      }
+    }
+    
+    if (fflush(stdout) != 0 || ferror(stdout)) {
+      fprintf(stderr, "%s: write: %s\n", argv[0], strerror(errno));
+      exit(1);
     }
     return 0;
   }
 
-  p_id = p_name = p_user = NULL;
+  if (sum_f)
+    _ndb_checksums(1);
+  
+  p_id = p_name = p_user = p_lcname = NULL;
     
   if (type == NULL) {
 
     sprintf(path, "%s", argv[i]);
-    rc = _ndb_open(&db_name, path, 1);
+    rc = open_db(&db_name, path);
     if (rc < 0) {
       sprintf(path, "%s.db", argv[i]);
-      rc = _ndb_open(&db_name, path, 1);
+      rc = open_db(&db_name, path);
     }
     if (rc < 0) {
       fprintf(stderr, "%s: %s: dbopen: %s\n", argv[0], path, strerror(errno));
@@ -348,15 +2689,17 @@ main(int argc,
   } else if (strcmp(type, "passwd") == 0) {
     
     sprintf(path, "%s/passwd.byuid.db", argv[i]);
-    rc = _ndb_open(&db_id, path, 1);
+    rc = open_db(&db_id, path);
     if (rc < 0) {
       fprintf(stderr, "%s: %s: dbopen: %s\n", argv[0], path, strerror(errno));
       exit(1);
     }
     p_id = strdup(path);
+    if (init_idkeys(&db_id, p_id) < 0)
+      exit(1);
     
     sprintf(path, "%s/passwd.byname.db", argv[i]);
-    rc = _ndb_open(&db_name, path, 1);
+    rc = open_db(&db_name, path);
     if (rc < 0) {
       fprintf(stderr, "%s: %s: dbopen: %s\n", argv[0], path, strerror(errno));
       exit(1);
@@ -364,25 +2707,37 @@ main(int argc,
     p_name = strdup(path);
     
     sprintf(path, "%s/group.byuser.db", argv[i]);
-    rc = _ndb_open(&db_user, path, 1);
+    rc = open_db(&db_user, path);
     if (rc < 0) {
       fprintf(stderr, "%s: %s: dbopen: %s\n", argv[0], path, strerror(errno));
       exit(1);
     }
     p_user = strdup(path);
+
+    if (fold_f) {
+      sprintf(path, "%s/passwd.bylcname.db", argv[i]);
+      rc = open_db(&db_lcname, path);
+      if (rc < 0) {
+	fprintf(stderr, "%s: %s: dbopen: %s\n", argv[0], path, strerror(errno));
+	exit(1);
+      }
+      p_lcname = strdup(path);
+    }
     
   } else if (strcmp(type, "group") == 0) {
     
     sprintf(path, "%s/group.bygid.db", argv[i]);
-    rc = _ndb_open(&db_id, path, 1);
+    rc = open_db(&db_id, path);
     if (rc < 0) {
       fprintf(stderr, "%s: %s: dbopen: %s\n", argv[0], path, strerror(errno));
       exit(1);
     }
     p_id = strdup(path);
+    if (init_idkeys(&db_id, p_id) < 0)
+      exit(1);
     
     sprintf(path, "%s/group.byname.db", argv[i]);
-    rc = _ndb_open(&db_name, path, 1);
+    rc = open_db(&db_name, path);
     if (rc < 0) {
       fprintf(stderr, "%s: %s: dbopen: %s\n", argv[0], path, strerror(errno));
       exit(1);
@@ -390,13 +2745,112 @@ main(int argc,
     p_name = strdup(path);
     
     sprintf(path, "%s/group.byuser.db", argv[i]);
-    rc = _ndb_open(&db_user, path, 1);
+    rc = open_db(&db_user, path);
     if (rc < 0) {
       fprintf(stderr, "%s: %s: dbopen: %s\n", argv[0], path, strerror(errno));
       exit(1);
     }
     p_user = strdup(path);
     
+    if (intern_f) {
+      sprintf(path, "%s/passwd.byuid.db", argv[i]);
+      p_pwuid = strdup(path);
+      
+      sprintf(path, "%s/passwd.byname.db", argv[i]);
+      rc = _ndb_open(&db_pwname, path, 0);
+      if (rc < 0 || !_ndb_names_load(p_pwuid)) {
+	fprintf(stderr, "%s: %s%s: Missing name table (import passwd with -I first): %s\n",
+		argv[0], p_pwuid, NDB_NAMES_SUFFIX, strerror(errno));
+	exit(1);
+      }
+    }
+    
+    if (fold_f) {
+      sprintf(path, "%s/group.bylcname.db", argv[i]);
+      rc = open_db(&db_lcname, path);
+      if (rc < 0) {
+	fprintf(stderr, "%s: %s: dbopen: %s\n", argv[0], path, strerror(errno));
+	exit(1);
+      }
+      p_lcname = strdup(path);
+    }
+    
+  } else if (strcmp(type, "shadow") == 0) {
+    
+    /* Password hashes - make sure only root can read the database */
+    (void) umask(077);
+    
+    sprintf(path, "%s/shadow.byname.db", argv[i]);
+    rc = open_db(&db_name, path);
+    if (rc < 0) {
+      fprintf(stderr, "%s: %s: dbopen: %s\n", argv[0], path, strerror(errno));
+      exit(1);
+    }
+    if (!db_name.shard && chmod(path, 0600) < 0) {
+      fprintf(stderr, "%s: %s: chmod: %s\n", argv[0], path, strerror(errno));
+      exit(1);
+    }
+    p_name = strdup(path);
+    
+  } else if (strcmp(type, "netgroup") == 0) {
+    
+    sprintf(path, "%s/netgroup.byname.db", argv[i]);
+    rc = open_db(&db_name, path);
+    if (rc < 0) {
+      fprintf(stderr, "%s: %s: dbopen: %s\n", argv[0], path, strerror(errno));
+      exit(1);
+    }
+    p_name = strdup(path);
+    
+    /* The (host,user,domain) index */
+    sprintf(path, "%s/netgroup.bytriple.db", argv[i]);
+    rc = open_db(&db_id, path);
+    if (rc < 0) {
+      fprintf(stderr, "%s: %s: dbopen: %s\n", argv[0], path, strerror(errno));
+      exit(1);
+    }
+    p_id = strdup(path);
+    
+  } else if (strcmp(type, "hosts") == 0) {
+    
+    sprintf(path, "%s/hosts.byname.db", argv[i]);
+    rc = open_db(&db_name, path);
+    if (rc < 0) {
+      fprintf(stderr, "%s: %s: dbopen: %s\n", argv[0], path, strerror(errno));
+      exit(1);
+    }
+    p_name = strdup(path);
+    
+    /* The address index */
+    sprintf(path, "%s/hosts.byaddr.db", argv[i]);
+    rc = open_db(&db_id, path);
+    if (rc < 0) {
+      fprintf(stderr, "%s: %s: dbopen: %s\n", argv[0], path, strerror(errno));
+      exit(1);
+    }
+    p_id = strdup(path);
+    
+  } else if (strcmp(type, "services") == 0 ||
+	     strcmp(type, "protocols") == 0 ||
+	     strcmp(type, "rpc") == 0) {
+    
+    sprintf(path, "%s/%s.byname.db", argv[i], type);
+    rc = open_db(&db_name, path);
+    if (rc < 0) {
+      fprintf(stderr, "%s: %s: dbopen: %s\n", argv[0], path, strerror(errno));
+      exit(1);
+    }
+    p_name = strdup(path);
+    
+    /* The port or number index */
+    sprintf(path, "%s/%s.%s.db", argv[i], type, strcmp(type, "services") == 0 ? "byport" : "bynumber");
+    rc = open_db(&db_id, path);
+    if (rc < 0) {
+      fprintf(stderr, "%s: %s: dbopen: %s\n", argv[0], path, strerror(errno));
+      exit(1);
+    }
+    p_id = strdup(path);
+    
   } else {
   
     fprintf(stderr, "%s: %s: Invalid DB type\n", argv[0], type);
@@ -439,14 +2893,50 @@ main(int argc,
   buf[len] = 0;
   close(fd);
 
-  cp = buf;
+  if (type && strcmp(type, "netgroup") == 0) {
+    ni = import_netgroup(&db_name, p_name, &db_id, p_id, buf, &nw);
+    if (ni < 0)
+      exit(1);
+    goto Close;
+  }
+  
+  if (type && strcmp(type, "hosts") == 0) {
+    ni = import_hosts(&db_name, p_name, &db_id, p_id, buf, &nw);
+    if (ni < 0)
+      exit(1);
+    goto Close;
+  }
+  
+  if (type && strcmp(type, "services") == 0) {
+    ni = import_services(&db_name, p_name, &db_id, p_id, buf, &nw);
+    if (ni < 0)
+      exit(1);
+    goto Close;
+  }
+  
+  if (type && (strcmp(type, "protocols") == 0 || strcmp(type, "rpc") == 0)) {
+    ni = import_numbered(&db_name, p_name, &db_id, p_id, buf, &nw);
+    if (ni < 0)
+      exit(1);
+    goto Close;
+  }
+  
+  /* The newlines are found NDB_LINEV at a time */
+  lbuf = cp = buf;
+  end = strlen(buf);
+  off = nl = il = 0;
   while ((buf = cp) && *buf) {
     char *ptr = NULL;
     
-    cp = strchr(buf, '\n');
-    if (cp)
+    if (il == nl && off < end) {
+      nl = _ndb_delims(lbuf, off, end, "\n", lv, NDB_LINEV);
+      off = nl == NDB_LINEV ? lv[nl-1]+1 : end;
+      il = 0;
+    }
+    if (il < nl) {
+      cp = lbuf+lv[il++];
       *cp++ = 0;
-    else
+    } else
       cp = buf+strlen(buf);
 
     ++line;
@@ -460,17 +2950,22 @@ main(int argc,
     val.data = strdup(buf);
     val.size = strlen(buf)+1;
 
+    if ((zip_f || intern_f) && type && strcmp(type, "group") == 0 && pack_group(&val) < 0) {
+      fprintf(stderr, "%s: %s: Encoding member list: %s\n", argv[0], buf, strerror(errno));
+      exit(1);
+    }
+
     ptr = buf;
     name = strsep(&ptr, delim);
 
-    if (db_id.db) {
+    if (db_id.path) {
       (void) strsep(&ptr, delim); /* ignore pass */
       id = strsep(&ptr, delim);
 
-      if (id) {
-	key.data = id;
-	key.size = strlen(id);
-	
+      if (id && _ndb_idkey_str(&db_id, &key, kbuf, sizeof(kbuf), id) < 0) {
+	fprintf(stderr, "%s: %s: %s: Invalid id\n", argv[0], p_id, id);
+	nw++;
+      } else if (id) {
 	rc = _ndb_put(&db_id, &key, &val, unique_f ? DB_NOOVERWRITE : 0);
 	if (rc < 0) {
 	  fprintf(stderr, "%s: %s: %s: db->put: %s\n", argv[0], p_id, id, strerror(errno));
@@ -494,7 +2989,18 @@ main(int argc,
       nw++;
     }
 
-    if (db_user.db && id && type) {
+    if (db_lcname.path) {
+      rc = add_lcname(&db_lcname, name, &val);
+      if (rc < 0) {
+	fprintf(stderr, "%s: %s: %s: db->put: %s\n", argv[0], p_lcname, name, strerror(errno));
+	exit(1);
+      } else if (rc > 0) {
+	fprintf(stderr, "%s: %s: %s: Case-folded name already exists in database\n", argv[0], p_lcname, name);
+	nw++;
+      }
+    }
+
+    if (db_user.path && id && type) {
       if (strcmp(type, "group") == 0 && ptr && *ptr) {
 	add_user_group(&db_user, id, ptr);
       } else {
@@ -505,9 +3011,50 @@ main(int argc,
     ++ni;
   }
 
+ Close:
   _ndb_close(&db_name);
   _ndb_close(&db_id);
   _ndb_close(&db_user);
+  _ndb_close(&db_lcname);
+  _ndb_close(&db_pwname);
+
+  {
+    char *pv[] = { p_name, p_id, p_user, p_lcname };
+
+    for (j = 0; j < sizeof(pv)/sizeof(pv[0]); j++) {
+      if (pv[j] && (rc = _ndb_shards(pv[j])) > 0 && _ndb_shards_write(pv[j], rc) < 0) {
+	fprintf(stderr, "%s: %s%s: Writing shard manifest: %s\n",
+		argv[0], pv[j], NDB_SHARDS_SUFFIX, strerror(errno));
+	exit(1);
+      }
+    }
+    
+    if (type && strcmp(type, "passwd") == 0) {
+      sprintf(path, "%s%s", p_id, NDB_NAMES_SUFFIX);
+      if ((intern_f || access(path, F_OK) == 0) && _ndb_names_write(p_id) < 0) {
+	fprintf(stderr, "%s: %s: Writing name table: %s\n",
+		argv[0], path, strerror(errno));
+	exit(1);
+      }
+    }
+    
+    for (j = 0; bloom_fpr > 0 && j < sizeof(pv)/sizeof(pv[0]); j++) {
+      if (pv[j] && bloom_write(pv[j], bloom_fpr) < 0) {
+	fprintf(stderr, "%s: %s%s: Writing Bloom filter: %s\n",
+		argv[0], pv[j], NDB_BLOOM_SUFFIX, strerror(errno));
+	exit(1);
+      }
+    }
+
+    /* Last, when the files won't change any more */
+    for (j = 0; j < sizeof(pv)/sizeof(pv[0]); j++) {
+      if (pv[j] && _ndb_digest(pv[j], sum_f ? NDB_DIGEST_WRITE : NDB_DIGEST_UPDATE) < 0) {
+	fprintf(stderr, "%s: %s: Writing digest: %s\n",
+		argv[0], pv[j], strerror(errno));
+	exit(1);
+      }
+    }
+  }
 
   if (verbose_f)
     fprintf(stderr, "%u entries imported (%u warning%s)\n", ni, nw, nw == 1 ? "" : "s");
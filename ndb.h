@@ -41,25 +41,191 @@
 #include <db.h>
 #endif
 
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
 #ifndef DB_VERSION_MAJOR
 #define DB_VERSION_MAJOR 0
 #define DB_NEXT R_NEXT
+#define DB_PREV R_PREV
 #define DB_NOOVERWRITE R_NOOVERWRITE
+#define DB_SET_RANGE R_CURSOR
 #endif
 
-typedef struct {
-  pid_t pid;
+/* Identity of a map file when opened (see _ndb_ndbstamp()) */
+typedef struct ndb_stamp {
+  uint64_t ino;
+  uint64_t size;
+  int64_t mtime;
+  int64_t mtime_ns;
+} NDB_STAMP;
+
+typedef struct ndb {
+  unsigned int gen;      /* Fork generation when opened */
   DB *db;
 #if DB_VERSION_MAJOR >= 4
   DBC *dbc;
-  DB_ENV *dbe;
 #endif
   char *path;
   int stayopen;
   int prev_f;
+  int nshards;           /* Sharded map: <path>.0 .. <path>.<nshards-1> */
+  int cshard;            /* Current shard when enumerating */
+  struct ndb *shard;
+  int crc;               /* Append a checksum to records written */
+  int idfmt;             /* NDB_IDKEY_* (0 until looked up) */
+  int sealed;            /* NDB_SEALED_* (0 until looked up) */
+  NDB_STAMP stamp;       /* Map file when opened (if stamped) */
+  int stamped;
 } NDB;
 
 
+/*
+ * Shard manifest (<db-path>.shards) written by "makendb -S". A text
+ * file with a single "shards <n>" line. If present the map is split in
+ * <n> database files by key hash, and the manifest is rewritten
+ * whenever the map is updated.
+ */
+#define NDB_SHARDS_SUFFIX ".shards"
+#define NDB_SHARDS_MAX    256
+
+
+/*
+ * Id key format of passwd.byuid & group.bygid. Decimal strings, or
+ * with "makendb -n" 4 bytes big endian, in which case the map has a
+ * NDB_KEYFORMAT_KEY record with the value NDB_KEYFORMAT_BE32. In a
+ * sharded map it is only in the shard its key hashes to, like any
+ * other record.
+ */
+#define NDB_KEYFORMAT_KEY  "#keyformat"
+#define NDB_KEYFORMAT_BE32 "be32"
+#define NDB_IDKEY_SIZE     24
+
+#define NDB_IDKEY_DEC      1
+#define NDB_IDKEY_BE32     2
+
+
+/*
+ * Cursor over the ids in [lo, hi) of an id keyed map, in id order
+ */
+typedef struct ndb_range NDB_RANGE;
+
+
+/*
+ * Bloom filter sidecar file (<db-path>.bloom) written by "makendb -b".
+ * The stamp (inode, size & modification time of the database, or of
+ * the shard manifest, when the filter was built) must match or it
+ * is ignored.
+ * The filter bits follow directly after the header.
+ */
+#define NDB_BLOOM_MAGIC   "NDBBLOOM"
+#define NDB_BLOOM_VERSION 1
+#define NDB_BLOOM_SUFFIX  ".bloom"
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t nhash;        /* Bits set per key */
+  uint64_t nbits;
+  uint64_t nkeys;
+  uint64_t db_ino;
+  uint64_t db_size;
+  int64_t db_mtime;
+  int64_t db_mtime_ns;
+} NDB_BLOOM;
+
+
+/*
+ * Record checksums ("makendb -s"). The (NUL terminated) value of each
+ * record is followed by the CRC32C of it, 4 bytes little endian. A map
+ * is sealed if its first NUL terminated record has a matching one
+ * (_ndb_sealed()), and only then does _ndb_get() strip it (and check
+ * it if "verify" is enabled).
+ *
+ * The whole database file can also have a digest sidecar
+ * (<db-file>.crc) with the CRC32C of all of it, stamped like the
+ * Bloom filter.
+ */
+#define NDB_CRC_SIZE       4
+#define NDB_DIGEST_MAGIC   "NDBCRC32"
+#define NDB_DIGEST_VERSION 1
+#define NDB_DIGEST_SUFFIX  ".crc"
+
+#define NDB_SEALED_NO      1
+#define NDB_SEALED_YES     2
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t crc;
+  uint64_t db_ino;
+  uint64_t db_size;
+  int64_t db_mtime;
+  int64_t db_mtime_ns;
+} NDB_DIGEST;
+
+/* _ndb_digest() modes & results */
+#define NDB_DIGEST_CHECK   0
+#define NDB_DIGEST_UPDATE  1     /* Rewrite it if there is one */
+#define NDB_DIGEST_WRITE   2
+
+#define NDB_DIGEST_OK       0
+#define NDB_DIGEST_MISSING  1
+#define NDB_DIGEST_STALE    2    /* Database changed since */
+#define NDB_DIGEST_MISMATCH 3    /* Same stamp, different contents */
+
+
+/*
+ * Compressed group member list ("makendb -z"). The member field of a
+ * group record starts with NDB_GRMEM_FC and the (sorted) names are
+ * front-coded: each name is one byte with the length of the prefix it
+ * shares with the previous name plus one, followed by the rest of the
+ * name. Names are still separated by commas. The prefix is limited so
+ * that the length byte can never be a ',' or ':' (or NUL).
+ */
+#define NDB_GRMEM_FC      '\001'
+#define NDB_GRMEM_PFXMAX  42
+
+
+/*
+ * Interned group members ("makendb -I"). The member field starts with
+ * NDB_GRMEM_ID and each member is stored as the uid of the user, in
+ * base 64 digits ("./0-9A-Za-z"), or as "=" and the name if it isn't
+ * the (primary) name of a user. The names are looked up in a table
+ * (<passwd.byuid path>.names) with all uids & names, sorted by uid,
+ * which is rewritten whenever passwd is updated. Renaming a user thus
+ * doesn't change any group records.
+ */
+#define NDB_GRMEM_ID      '\002'
+#define NDB_NAMES_MAGIC   "NDBNAMES"
+#define NDB_NAMES_VERSION 1
+#define NDB_NAMES_SUFFIX  ".names"
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t n;            /* Entries that follow, then the names */
+} NDB_NAMES;
+
+typedef struct {
+  uint32_t uid;
+  uint32_t off;          /* Of the (NUL terminated) name in the file */
+} NDB_NAMES_ENT;
+
+
+/*
+ * _ndb_warm() flags. Without any the files are just queued for
+ * (asynchronous) readahead.
+ */
+#define NDB_WARM_FAULT    0x01   /* mmap() & touch every page */
+#define NDB_WARM_LOCK     0x02   /* ... and mlock() them (kept mapped) */
+
+
+/* Max number of different delimiter characters for _ndb_delims() */
+#define NDB_DELIMS_MAX    4
+
+
 extern int
 _ndb_open(NDB *ndb,
 	  const char *path,
@@ -68,6 +234,16 @@ _ndb_open(NDB *ndb,
 extern void
 _ndb_close(NDB *ndb);
 
+extern void
+_ndb_dbenv(const char *home);
+
+extern void
+_ndb_container(const char *path);
+
+extern long long
+_ndb_warm(const char *path,
+	  int flags);
+
 extern int
 _ndb_get(NDB *ndb,
 	 DBT *key,
@@ -80,6 +256,96 @@ _ndb_put(NDB *ndb,
 	 DBT *val,
 	 int flags);
 
+extern int
+_ndb_shards(const char *path);
+
+extern int
+_ndb_shards_write(const char *path,
+		  int n);
+
+extern int
+_ndb_stat(const char *path,
+	  struct stat *sp);
+
+extern int
+_ndb_del(NDB *ndb,
+	 DBT *key);
+
+extern int
+_ndb_scan(NDB *ndb,
+	  const DBT *from,
+	  int (*fn)(const DBT *key, const DBT *val, void *xp),
+	  void *xp);
+
+extern size_t
+_ndb_delims(const char *buf,
+	    size_t off,
+	    size_t len,
+	    const char *delims,
+	    size_t *ov,
+	    size_t on);
+
+extern uint32_t
+_ndb_crc32c(uint32_t crc,
+	    const void *buf,
+	    size_t len);
+
+extern int
+_ndb_crc_check(DBT *val,
+	       int verify);
+
+extern void
+_ndb_checksums(int on);
+
+extern int
+_ndb_sealed(NDB *ndb);
+
+extern int
+_ndb_digest(const char *path,
+	    int mode);
+
+extern int
+_ndb_idformat(NDB *ndb);
+
+extern int
+_ndb_idformat_write(NDB *ndb);
+
+extern int
+_ndb_idkey(NDB *ndb,
+	   DBT *key,
+	   char *buf,
+	   size_t bsize,
+	   unsigned long id);
+
+extern int
+_ndb_idkey_str(NDB *ndb,
+	       DBT *key,
+	       char *buf,
+	       size_t bsize,
+	       const char *id);
+
+extern int
+_ndb_keyid(const DBT *key,
+	   int fmt,
+	   unsigned long *idp);
+
+extern NDB_RANGE *
+_ndb_range_open(const char *path,
+		unsigned long lo,
+		unsigned long hi);
+
+extern int
+_ndb_range_next(NDB_RANGE *rp,
+		unsigned long *idp,
+		DBT *key,
+		DBT *val);
+
+extern void
+_ndb_range_unget(NDB_RANGE *rp);
+
+extern void
+_ndb_range_close(NDB_RANGE *rp);
+
 extern int
 _ndb_setent(NDB *ndb,
 	    int stayopen,
@@ -88,4 +354,50 @@ _ndb_setent(NDB *ndb,
 extern int
 _ndb_endent(NDB *ndb);
 
+extern uint64_t
+_ndb_bloom_hash(const void *key,
+		size_t len);
+
+extern void
+_ndb_bloom_add(NDB_BLOOM *bp,
+	       uint64_t h);
+
+extern void
+_ndb_bloom_stamp(NDB_BLOOM *bp,
+		 const struct stat *sp);
+
+extern char *
+_ndb_strfold(char *buf,
+	     const char *str,
+	     size_t bsize);
+
+extern int
+_ndb_grmem_encode(char *buf,
+		  size_t bsize,
+		  const char *members);
+
+extern int
+_ndb_grmem_intern(char *buf,
+		  size_t bsize,
+		  const char *members,
+		  NDB *byname,
+		  const char *byuid);
+
+extern int
+_ndb_grmem_decode(char *buf,
+		  size_t bsize,
+		  const char *str,
+		  size_t len,
+		  const char *byuid);
+
+extern int
+_ndb_names_write(const char *byuid);
+
+extern const NDB_NAMES *
+_ndb_names_load(const char *byuid);
+
+extern const char *
+_ndb_names_get(const NDB_NAMES *np,
+	       uint32_t uid);
+
 #endif
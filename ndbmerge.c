@@ -0,0 +1,986 @@
+/*
+ * ndbmerge.c - Apply a sorted TSV/CSV export to the NDB databases
+ *
+ * Copyright (c) 2017-2020 Peter Eriksson <pen@lysator.liu.se>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * The export is read one row at a time and merged against a cursor walk
+ * of the current map (both sorted by name), so memory use only depends
+ * on the number of changes. The databases are only read (and read-locked)
+ * while comparing, and all changes are then written in one go.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <db.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <errno.h>
+#include <string.h>
+#include <pwd.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "nss_ndb.h"
+#include "ndb.h"
+
+int verbose_f = 0;
+int dryrun_f = 0;
+int expunge_f = 0;
+int force_f = 0;
+int zip_f = 0;
+int intern_f = 0;
+
+NDB db_pwname;                 /* For -I */
+char p_pwuid[PATH_MAX];
+
+char *argv0 = "ndbmerge";
+
+
+typedef struct {
+  const char *type;
+  const char *byname;        /* Primary map, keyed by name */
+  const char *byid;          /* Index keyed by a record field, or NULL */
+  int idfield;
+  const char *bylcname;      /* Case-folded index (only updated if it exists) */
+  int minfields;             /* Export columns */
+  int maxfields;
+  int (*mkrec)(char **fv, int fc, char *buf, size_t bsize);
+} MAPTYPE;
+
+
+typedef struct {
+  char *key;
+  char *orec;                /* Old record, NULL if added */
+  char *nrec;                /* New record, NULL if deleted */
+} CHANGE;
+
+CHANGE *chv = NULL;
+size_t chn = 0;
+size_t chs = 0;
+
+
+/*
+ * One cursor per shard (or just one), merged in btree key order
+ */
+typedef struct {
+  NDB ndb;
+  DBT key;
+  DBT val;
+  int eof;
+} CURSOR;
+
+typedef struct {
+  int n;
+  CURSOR *cv;
+  CURSOR *head;
+} STREAM;
+
+
+
+void
+version(FILE *fp) {
+  fprintf(fp,
+	  "[ndbmerge, version %s - Copyright (c) 2017-2020 Peter Eriksson <pen@lysator.liu.se>]\n",
+	  PACKAGE_VERSION);
+}
+
+
+/* Same order as the default Berkeley DB btree comparison */
+static int
+keycmp(const void *a,
+       size_t alen,
+       const void *b,
+       size_t blen) {
+  int rc = memcmp(a, b, alen < blen ? alen : blen);
+
+
+  if (rc)
+    return rc;
+
+  return alen < blen ? -1 : (alen > blen ? 1 : 0);
+}
+
+
+/* Length of a stored record without the terminating NUL */
+static size_t
+reclen(const DBT *val) {
+  size_t len = val->size;
+
+
+  while (len > 0 && ((char *) val->data)[len-1] == '\0')
+    --len;
+
+  return len;
+}
+
+
+static int
+is_number(const char *str) {
+  if (!*str)
+    return 0;
+
+  while (isdigit(*str))
+    ++str;
+
+  return *str == '\0';
+}
+
+
+/*
+ * Copy field 'n' of a ':' separated record
+ */
+static char *
+recfield(const char *rec,
+	 int n,
+	 char *buf,
+	 size_t bsize) {
+  const char *cp;
+  size_t len;
+
+
+  while (n-- > 0) {
+    rec = strchr(rec, ':');
+    if (!rec)
+      return NULL;
+    ++rec;
+  }
+
+  cp = strchr(rec, ':');
+  len = cp ? (size_t) (cp-rec) : strlen(rec);
+  if (len >= bsize)
+    return NULL;
+
+  memcpy(buf, rec, len);
+  buf[len] = '\0';
+  return buf;
+}
+
+
+
+/*
+ * Export columns: name, uid, gid, gecos, home, shell [, expire]
+ */
+static int
+mk_passwd(char **fv,
+	  int fc,
+	  char *buf,
+	  size_t bsize) {
+  const char *shell = fv[5];
+
+
+  if (!is_number(fv[1]) || !is_number(fv[2]) || (fc > 6 && *fv[6] && !is_number(fv[6])))
+    return -1;
+
+  /* Same default as ndbsync */
+  if (!*shell)
+    shell = (fv[0][strlen(fv[0])-1] == '$' ? "/bin/nologin" : "/bin/sh");
+
+#ifdef _PATH_MASTERPASSWD
+  return snprintf(buf, bsize, "%s:*:%s:%s::0:%s:%s:%s:%s",
+		  fv[0], fv[1], fv[2], fc > 6 && *fv[6] ? fv[6] : "0",
+		  fv[3], fv[4], shell);
+#else
+  return snprintf(buf, bsize, "%s:*:%s:%s:%s:%s:%s",
+		  fv[0], fv[1], fv[2], fv[3], fv[4], shell);
+#endif
+}
+
+
+/*
+ * Export columns: name, gid [, member,member,...]
+ * With -z (or -I) the member list is written front-coded (or interned),
+ * like "makendb -z" (-I).
+ */
+static int
+mk_group(char **fv,
+	 int fc,
+	 char *buf,
+	 size_t bsize) {
+  int len, rc;
+
+  
+  if (!is_number(fv[1]))
+    return -1;
+
+  if (!zip_f && !intern_f)
+    return snprintf(buf, bsize, "%s:*:%s:%s",
+		    fv[0], fv[1], fc > 2 ? fv[2] : "");
+
+  len = snprintf(buf, bsize, "%s:*:%s:", fv[0], fv[1]);
+  if (len < 0 || len >= bsize)
+    return len;
+  
+  if (intern_f)
+    rc = _ndb_grmem_intern(buf+len, bsize-len, fc > 2 ? fv[2] : "",
+			   &db_pwname, p_pwuid);
+  else
+    rc = _ndb_grmem_encode(buf+len, bsize-len, fc > 2 ? fv[2] : "");
+  if (rc < 0)
+    return errno == ERANGE ? bsize : -1;
+  
+  return len+rc;
+}
+
+
+/*
+ * Export columns: name [, gid,gid,...]
+ */
+static int
+mk_usergroups(char **fv,
+	      int fc,
+	      char *buf,
+	      size_t bsize) {
+  return snprintf(buf, bsize, "%s:%s",
+		  fv[0], fc > 1 ? fv[1] : "");
+}
+
+
+MAPTYPE maptypes[] = {
+  { "passwd", "passwd.byname.db", "passwd.byuid.db", 2, "passwd.bylcname.db", 6, 7, mk_passwd },
+  { "group", "group.byname.db", "group.bygid.db", 2, "group.bylcname.db", 2, 3, mk_group },
+  { "usergroups", "group.byuser.db", NULL, 0, NULL, 1, 2, mk_usergroups },
+  { NULL, NULL, NULL, 0, NULL, 0, 0, NULL },
+};
+
+
+
+/*
+ * Split a row in place. With a TAB delimiter MySQL escapes (\t, \n,
+ * \\ etc & \N for NULL) are decoded, else double quotes (CSV) are.
+ */
+static int
+split_row(char *buf,
+	  int delim,
+	  char **fv,
+	  int fmax) {
+  char *rp = buf, *wp = buf;
+  int fc = 0;
+
+
+  while (1) {
+    if (fc >= fmax)
+      return -1;
+    fv[fc++] = wp;
+
+    if (delim == '\t') {
+      if (rp[0] == '\\' && rp[1] == 'N' && (rp[2] == '\t' || rp[2] == '\0')) {
+	rp += 2;
+      } else {
+	while (*rp && *rp != '\t') {
+	  if (*rp == '\\' && rp[1]) {
+	    switch (*++rp) {
+	    case 't':
+	      *wp++ = '\t';
+	      break;
+	    case 'n':
+	      *wp++ = '\n';
+	      break;
+	    case 'r':
+	      *wp++ = '\r';
+	      break;
+	    case '0':
+	      *wp++ = '\0';
+	      break;
+	    default:
+	      *wp++ = *rp;
+	    }
+	    ++rp;
+	  } else
+	    *wp++ = *rp++;
+	}
+      }
+    } else if (*rp == '"') {
+      ++rp;
+      while (*rp) {
+	if (*rp == '"') {
+	  if (rp[1] != '"')
+	    break;
+	  ++rp;
+	}
+	*wp++ = *rp++;
+      }
+      if (*rp != '"')
+	return -1;
+      ++rp;
+      if (*rp && *rp != delim)
+	return -1;
+    } else {
+      while (*rp && *rp != delim)
+	*wp++ = *rp++;
+    }
+
+    if (!*rp) {
+      *wp = '\0';
+      return fc;
+    }
+
+    ++rp;
+    *wp++ = '\0';
+  }
+}
+
+
+
+static int
+stream_next(CURSOR *cp) {
+  int rc;
+
+
+  cp->key.data = NULL;
+  cp->key.size = 0;
+  cp->val.data = NULL;
+  cp->val.size = 0;
+
+  rc = _ndb_get(&cp->ndb, &cp->key, &cp->val, DB_NEXT);
+  if (rc < 0)
+    return -1;
+
+  cp->eof = (rc != 0);
+  return 0;
+}
+
+
+static void
+stream_head(STREAM *sp) {
+  int i;
+
+
+  sp->head = NULL;
+  for (i = 0; i < sp->n; i++) {
+    CURSOR *cp = &sp->cv[i];
+
+    if (cp->eof)
+      continue;
+
+    if (!sp->head || keycmp(cp->key.data, cp->key.size,
+			    sp->head->key.data, sp->head->key.size) < 0)
+      sp->head = cp;
+  }
+}
+
+
+/*
+ * Open a map for reading in key order. A sharded map is read as a merge
+ * of its (individually sorted) shards. A missing map is empty.
+ */
+static int
+stream_open(STREAM *sp,
+	    const char *path) {
+  char spath[PATH_MAX];
+  int i, n;
+
+
+  memset(sp, 0, sizeof(*sp));
+
+  n = _ndb_shards(path);
+  if (n < 0)
+    return -1;
+
+  sp->n = n ? n : 1;
+  sp->cv = calloc(sp->n, sizeof(CURSOR));
+  if (!sp->cv)
+    return -1;
+
+  for (i = 0; i < sp->n; i++) {
+    CURSOR *cp = &sp->cv[i];
+
+    if (n) {
+      if (snprintf(spath, sizeof(spath), "%s.%d", path, i) >= sizeof(spath)) {
+	errno = ENAMETOOLONG;
+	return -1;
+      }
+    } else
+      strcpy(spath, path);
+
+    if (_ndb_open(&cp->ndb, spath, 0) < 0) {
+      if (errno != ENOENT)
+	return -1;
+      cp->eof = 1;
+      continue;
+    }
+
+    if (stream_next(cp) < 0)
+      return -1;
+  }
+
+  stream_head(sp);
+  return 0;
+}
+
+
+static int
+stream_advance(STREAM *sp) {
+  if (stream_next(sp->head) < 0)
+    return -1;
+
+  stream_head(sp);
+  return 0;
+}
+
+
+static void
+stream_close(STREAM *sp) {
+  int i;
+
+
+  for (i = 0; i < sp->n; i++)
+    _ndb_close(&sp->cv[i].ndb);
+  free(sp->cv);
+  memset(sp, 0, sizeof(*sp));
+}
+
+
+
+static void
+add_change(const char *key,
+	   size_t klen,
+	   const char *orec,
+	   size_t olen,
+	   const char *nrec) {
+  CHANGE *cp;
+
+
+  if (chn >= chs) {
+    chs = chs ? chs*2 : 1024;
+    chv = realloc(chv, chs*sizeof(*chv));
+    if (!chv) {
+      fprintf(stderr, "%s: realloc: %s\n", argv0, strerror(errno));
+      exit(1);
+    }
+  }
+
+  cp = &chv[chn++];
+  cp->key = strndup(key, klen);
+  cp->orec = orec ? strndup(orec, olen) : NULL;
+  cp->nrec = nrec ? strdup(nrec) : NULL;
+  if (!cp->key || (orec && !cp->orec) || (nrec && !cp->nrec)) {
+    fprintf(stderr, "%s: strdup: %s\n", argv0, strerror(errno));
+    exit(1);
+  }
+
+  if (verbose_f > 1 || dryrun_f)
+    printf("%s: %s%s\n", cp->key,
+	   !orec ? "Added" : !nrec ? "Deleted" : "Updated",
+	   dryrun_f ? " (NOT)" : "");
+}
+
+
+/*
+ * Compare the (sorted) export with the map and collect the changes
+ */
+static int
+diff_map(MAPTYPE *mp,
+	 const char *path,
+	 FILE *fp,
+	 int delim,
+	 size_t *nrows) {
+  STREAM s;
+  char *line = NULL, *prev = NULL;
+  size_t lsize = 0;
+  ssize_t len;
+  char *fv[16];
+  char *rec = NULL;
+  size_t rsize = 0;
+  int fc, rc, lno = 0;
+
+
+  if (stream_open(&s, path) < 0) {
+    fprintf(stderr, "%s: %s: dbopen: %s\n", argv0, path, strerror(errno));
+    return -1;
+  }
+
+  while ((len = getline(&line, &lsize, fp)) >= 0) {
+    ++lno;
+
+    while (len > 0 && (line[len-1] == '\n' || line[len-1] == '\r'))
+      line[--len] = '\0';
+    if (!*line || *line == '#')
+      continue;
+
+    fc = split_row(line, delim, fv, sizeof(fv)/sizeof(fv[0]));
+    if (fc < mp->minfields || fc > mp->maxfields) {
+      fprintf(stderr, "%s: line %d: Invalid number of columns (%d)\n", argv0, lno, fc);
+      return -1;
+    }
+
+    for (rc = 0; rc < fc; rc++) {
+      if (strpbrk(fv[rc], ":\n")) {
+	fprintf(stderr, "%s: line %d: %s: Invalid character in column %d\n", argv0, lno, fv[0], rc+1);
+	return -1;
+      }
+    }
+
+    if (!*fv[0]) {
+      fprintf(stderr, "%s: line %d: Missing name\n", argv0, lno);
+      return -1;
+    }
+
+    if (prev && keycmp(prev, strlen(prev), fv[0], strlen(fv[0])) >= 0) {
+      fprintf(stderr, "%s: line %d: %s: Not sorted (or duplicate) - sort with LC_ALL=C\n", argv0, lno, fv[0]);
+      return -1;
+    }
+    free(prev);
+    prev = strdup(fv[0]);
+
+    /* Grow the record buffer until the entry fits */
+    while ((rc = (*mp->mkrec)(fv, fc, rec, rsize)) >= 0 && rc >= rsize) {
+      rsize = rsize ? rsize*2 : 8192;
+      if (rsize <= rc)
+	rsize = rc+1;
+      rec = realloc(rec, rsize);
+      if (!rec) {
+	fprintf(stderr, "%s: realloc: %s\n", argv0, strerror(errno));
+	exit(1);
+      }
+    }
+    if (rc < 0) {
+      fprintf(stderr, "%s: line %d: %s: Invalid entry\n", argv0, lno, fv[0]);
+      return -1;
+    }
+    ++*nrows;
+
+    /* Names only in the database */
+    while (s.head &&
+	   keycmp(s.head->key.data, s.head->key.size, fv[0], strlen(fv[0])) < 0) {
+      if (expunge_f)
+	add_change(s.head->key.data, s.head->key.size,
+		   s.head->val.data, reclen(&s.head->val), NULL);
+      if (stream_advance(&s) < 0)
+	goto Fail;
+    }
+
+    if (s.head &&
+	keycmp(s.head->key.data, s.head->key.size, fv[0], strlen(fv[0])) == 0) {
+      if (force_f ||
+	  keycmp(s.head->val.data, reclen(&s.head->val), rec, strlen(rec)) != 0)
+	add_change(fv[0], strlen(fv[0]),
+		   s.head->val.data, reclen(&s.head->val), rec);
+      if (stream_advance(&s) < 0)
+	goto Fail;
+    } else
+      add_change(fv[0], strlen(fv[0]), NULL, 0, rec);
+  }
+
+  while (s.head) {
+    if (expunge_f)
+      add_change(s.head->key.data, s.head->key.size,
+		 s.head->val.data, reclen(&s.head->val), NULL);
+    if (stream_advance(&s) < 0)
+      goto Fail;
+  }
+
+  free(rec);
+  free(line);
+  free(prev);
+  stream_close(&s);
+  return 0;
+
+ Fail:
+  fprintf(stderr, "%s: %s: db->seq: %s\n", argv0, path, strerror(errno));
+  free(rec);
+  return -1;
+}
+
+
+
+/*
+ * Keys are names or ids (in the key format of the map, see makendb -n)
+ */
+static int
+put_rec(NDB *db,
+	const char *path,
+	const char *key,
+	const char *rec) {
+  char kbuf[NDB_IDKEY_SIZE];
+  DBT k, v;
+
+
+  memset(&k, 0, sizeof(k));
+  memset(&v, 0, sizeof(v));
+  if (_ndb_idkey_str(db, &k, kbuf, sizeof(kbuf), key) < 0) {
+    fprintf(stderr, "%s: %s: %s: Invalid key: %s\n", argv0, path, key, strerror(errno));
+    return -1;
+  }
+  v.data = (void *) rec;
+  v.size = strlen(rec)+1;
+
+  if (_ndb_put(db, &k, &v, 0) < 0) {
+    fprintf(stderr, "%s: %s: %s: db->put: %s\n", argv0, path, key, strerror(errno));
+    return -1;
+  }
+
+  return 0;
+}
+
+
+/*
+ * Returns 1 if 'key' in an index points to the entry for 'name'
+ * (or if 'key' isn't there and 'missing' is set)
+ */
+static int
+owned_by(NDB *db,
+	 const char *key,
+	 const char *name,
+	 int missing) {
+  char kbuf[NDB_IDKEY_SIZE];
+  DBT k, v;
+  size_t len = strlen(name);
+
+
+  memset(&k, 0, sizeof(k));
+  memset(&v, 0, sizeof(v));
+  if (_ndb_idkey_str(db, &k, kbuf, sizeof(kbuf), key) < 0 ||
+      _ndb_get(db, &k, &v, 0) != 0)
+    return missing;
+
+  return (v.size > len && memcmp(v.data, name, len) == 0 &&
+	  ((char *) v.data)[len] == ':');
+}
+
+
+static int
+map_exists(const char *path) {
+  NDB ndb;
+  int rc;
+
+
+  /* Could be sharded or in a container, so just try to open it */
+  memset(&ndb, 0, sizeof(ndb));
+  rc = _ndb_open(&ndb, path, 0);
+  _ndb_close(&ndb);
+  return rc == 0;
+}
+
+
+/*
+ * Write all changes. Index entries that go away are removed first, so
+ * ids & names that move between entries in the same run end up right.
+ */
+static int
+apply_changes(MAPTYPE *mp,
+	      const char *dir) {
+  NDB db_name, db_id, db_lcname;
+  char p_name[PATH_MAX], p_id[PATH_MAX], p_lcname[PATH_MAX];
+  char oid[256], nid[256], lcname[256], kbuf[NDB_IDKEY_SIZE];
+  DBT key;
+  size_t i;
+  int rc = -1;
+
+
+  memset(&db_name, 0, sizeof(db_name));
+  memset(&db_id, 0, sizeof(db_id));
+  memset(&db_lcname, 0, sizeof(db_lcname));
+  memset(&key, 0, sizeof(key));
+
+  snprintf(p_name, sizeof(p_name), "%s/%s", dir, mp->byname);
+  if (_ndb_open(&db_name, p_name, 1) < 0) {
+    fprintf(stderr, "%s: %s: dbopen: %s\n", argv0, p_name, strerror(errno));
+    goto End;
+  }
+
+  if (mp->byid) {
+    snprintf(p_id, sizeof(p_id), "%s/%s", dir, mp->byid);
+    if (_ndb_open(&db_id, p_id, 1) < 0) {
+      fprintf(stderr, "%s: %s: dbopen: %s\n", argv0, p_id, strerror(errno));
+      goto End;
+    }
+  }
+
+  if (mp->bylcname) {
+    snprintf(p_lcname, sizeof(p_lcname), "%s/%s", dir, mp->bylcname);
+    if (map_exists(p_lcname) && _ndb_open(&db_lcname, p_lcname, 1) < 0) {
+      fprintf(stderr, "%s: %s: dbopen: %s\n", argv0, p_lcname, strerror(errno));
+      goto End;
+    }
+  }
+
+  for (i = 0; i < chn; i++) {
+    CHANGE *cp = &chv[i];
+
+    if (!cp->orec)
+      continue;
+
+    if (db_id.path && recfield(cp->orec, mp->idfield, oid, sizeof(oid)) &&
+	(!cp->nrec ||
+	 !recfield(cp->nrec, mp->idfield, nid, sizeof(nid)) ||
+	 strcmp(oid, nid) != 0) &&
+	owned_by(&db_id, oid, cp->key, 0)) {
+      if (_ndb_idkey_str(&db_id, &key, kbuf, sizeof(kbuf), oid) < 0 ||
+	  _ndb_del(&db_id, &key) < 0) {
+	fprintf(stderr, "%s: %s: %s: db->del: %s\n", argv0, p_id, oid, strerror(errno));
+	goto End;
+      }
+    }
+
+    if (cp->nrec)
+      continue;
+
+    if (db_lcname.path && _ndb_strfold(lcname, cp->key, sizeof(lcname)) &&
+	owned_by(&db_lcname, lcname, cp->key, 0)) {
+      key.data = lcname;
+      key.size = strlen(lcname);
+      if (_ndb_del(&db_lcname, &key) < 0) {
+	fprintf(stderr, "%s: %s: %s: db->del: %s\n", argv0, p_lcname, lcname, strerror(errno));
+	goto End;
+      }
+    }
+
+    key.data = cp->key;
+    key.size = strlen(cp->key);
+    if (_ndb_del(&db_name, &key) < 0) {
+      fprintf(stderr, "%s: %s: %s: db->del: %s\n", argv0, p_name, cp->key, strerror(errno));
+      goto End;
+    }
+  }
+
+  for (i = 0; i < chn; i++) {
+    CHANGE *cp = &chv[i];
+
+    if (!cp->nrec)
+      continue;
+
+    if (put_rec(&db_name, p_name, cp->key, cp->nrec) < 0)
+      goto End;
+
+    if (db_id.path && recfield(cp->nrec, mp->idfield, nid, sizeof(nid)) &&
+	put_rec(&db_id, p_id, nid, cp->nrec) < 0)
+      goto End;
+
+    if (db_lcname.path && _ndb_strfold(lcname, cp->key, sizeof(lcname))) {
+      /* Like makendb: the first name that folds to the same key wins */
+      if (!owned_by(&db_lcname, lcname, cp->key, 1))
+	fprintf(stderr, "%s: %s: %s: Case-folded name already exists in database\n",
+		argv0, p_lcname, cp->key);
+      else if (put_rec(&db_lcname, p_lcname, lcname, cp->nrec) < 0)
+	goto End;
+    }
+  }
+
+  rc = 0;
+
+ End:
+  _ndb_close(&db_name);
+  _ndb_close(&db_id);
+  _ndb_close(&db_lcname);
+
+  /* The name table of interned group members follows passwd */
+  if (rc == 0 && mp->byid && strcmp(mp->byid, "passwd.byuid.db") == 0) {
+    char npath[PATH_MAX+8];
+
+    snprintf(npath, sizeof(npath), "%s%s", p_id, NDB_NAMES_SUFFIX);
+    if (access(npath, F_OK) == 0 && _ndb_names_write(p_id) < 0) {
+      fprintf(stderr, "%s: %s: Writing name table: %s\n", argv0, npath, strerror(errno));
+      rc = -1;
+    }
+  }
+  
+  /* New manifests, so Bloom filters for the old contents are ignored */
+  if (rc == 0) {
+    const char *pv[] = { p_name, mp->byid ? p_id : NULL, mp->bylcname ? p_lcname : NULL };
+    int j, n;
+
+    for (j = 0; j < sizeof(pv)/sizeof(pv[0]); j++) {
+      if (pv[j] && (n = _ndb_shards(pv[j])) > 0 && _ndb_shards_write(pv[j], n) < 0) {
+	fprintf(stderr, "%s: %s%s: Writing shard manifest: %s\n",
+		argv0, pv[j], NDB_SHARDS_SUFFIX, strerror(errno));
+	rc = -1;
+      }
+    }
+
+    /* Digests are kept up to date if there are any */
+    for (j = 0; rc == 0 && j < sizeof(pv)/sizeof(pv[0]); j++) {
+      if (pv[j] && _ndb_digest(pv[j], NDB_DIGEST_UPDATE) < 0) {
+	fprintf(stderr, "%s: %s: Writing digest: %s\n",
+		argv0, pv[j], strerror(errno));
+	rc = -1;
+      }
+    }
+  }
+
+  return rc;
+}
+
+
+
+int
+main(int argc,
+     char *argv[]) {
+  MAPTYPE *mp = NULL;
+  char *type = NULL, *cp, path[PATH_MAX];
+  int delim = '\t';
+  size_t nrows = 0, na = 0, nu = 0, nd = 0, k;
+  FILE *fp = stdin;
+  int i, j;
+
+
+  argv0 = argv[0];
+
+  for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+    for (j = 1; argv[i][j]; j++) {
+      switch (argv[i][j]) {
+      case 'V':
+	version(stdout);
+	exit(0);
+
+      case 'v':
+	++verbose_f;
+	break;
+
+      case 'n':
+	++dryrun_f;
+	break;
+
+      case 'x':
+	++expunge_f;
+	break;
+
+      case 'f':
+	++force_f;
+	break;
+
+      case 'z':
+	++zip_f;
+	break;
+
+      case 'I':
+	++intern_f;
+	break;
+
+      case 'D':
+	if (argv[i][j+1])
+	  cp = argv[i]+j+1;
+	else if (i+1 < argc)
+	  cp = argv[++i];
+	else
+	  cp = NULL;
+	if (!cp || strlen(cp) != 1) {
+	  fprintf(stderr, "%s: %s: Invalid delimiter\n", argv[0], cp ? cp : "<null>");
+	  exit(1);
+	}
+	delim = *cp;
+	goto NextArg;
+
+      case 'T':
+	if (argv[i][j+1])
+	  cp = argv[i]+j+1;
+	else if (i+1 < argc)
+	  cp = argv[++i];
+	else
+	  cp = NULL;
+	type = cp;
+	goto NextArg;
+
+      case 'h':
+	printf("Usage: %s [-h] [-V] [-v] [-n] [-x] [-f] [-z] [-I] [-D <delim>] -T <type> <db-dir> [<export-file>]\n", argv[0]);
+	exit(0);
+
+      default:
+	fprintf(stderr, "%s: %s: Invalid switch\n", argv[0], argv[i]);
+	exit(1);
+      }
+    }
+  NextArg:;
+  }
+
+  if (verbose_f)
+    version(stderr);
+
+  if (!type) {
+    fprintf(stderr, "%s: Missing required type (-T)\n", argv[0]);
+    exit(1);
+  }
+
+  for (mp = &maptypes[0]; mp->type && strcmp(mp->type, type) != 0; mp++)
+    ;
+  if (!mp->type) {
+    fprintf(stderr, "%s: %s: Invalid type\n", argv[0], type);
+    exit(1);
+  }
+
+  if (i >= argc) {
+    fprintf(stderr, "%s: Missing required database directory\n", argv[0]);
+    exit(1);
+  }
+
+  if (zip_f && intern_f) {
+    fprintf(stderr, "%s: -z and -I can not be combined\n", argv[0]);
+    exit(1);
+  }
+  
+  if (intern_f && strcmp(mp->type, "group") == 0) {
+    snprintf(p_pwuid, sizeof(p_pwuid), "%s/passwd.byuid.db", argv[i]);
+    snprintf(path, sizeof(path), "%s/passwd.byname.db", argv[i]);
+    if (_ndb_open(&db_pwname, path, 0) < 0 || !_ndb_names_load(p_pwuid)) {
+      fprintf(stderr, "%s: %s%s: Missing name table: %s\n",
+	      argv[0], p_pwuid, NDB_NAMES_SUFFIX, strerror(errno));
+      exit(1);
+    }
+  }
+
+  if (i+1 < argc && strcmp(argv[i+1], "-") != 0) {
+    fp = fopen(argv[i+1], "r");
+    if (!fp) {
+      fprintf(stderr, "%s: %s: fopen: %s\n", argv[0], argv[i+1], strerror(errno));
+      exit(1);
+    }
+  }
+
+  if (snprintf(path, sizeof(path), "%s/%s", argv[i], mp->byname) >= sizeof(path)) {
+    fprintf(stderr, "%s: %s: %s\n", argv[0], argv[i], strerror(ENAMETOOLONG));
+    exit(1);
+  }
+
+  if (diff_map(mp, path, fp, delim, &nrows) < 0)
+    exit(1);
+
+  if (fp != stdin)
+    fclose(fp);
+
+  if (!dryrun_f && chn > 0 && apply_changes(mp, argv[i]) < 0)
+    exit(1);
+
+  for (k = 0; k < chn; k++) {
+    if (!chv[k].orec)
+      ++na;
+    else if (!chv[k].nrec)
+      ++nd;
+    else
+      ++nu;
+  }
+
+  if (verbose_f)
+    fprintf(stderr, "%lu entries read: %lu added, %lu updated, %lu deleted%s\n",
+	    (unsigned long) nrows,
+	    (unsigned long) na, (unsigned long) nu, (unsigned long) nd,
+	    dryrun_f ? " (dry run)" : "");
+
+  return 0;
+}
@@ -39,8 +39,30 @@
 #include <stdlib.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <ctype.h>
 #include <sys/stat.h>
 #include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __FreeBSD__
+#include <rpc/rpc.h>
+#endif
+#ifdef __linux__
+#include <shadow.h>
+#include <sys/eventfd.h>
+#endif
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define NDB_CRC32C_SSE42 1
+#define NDB_DELIMS_SIMD  1
+#endif
 
 #include "ndb.h"
 #include "nss_ndb.h"
@@ -48,21 +70,92 @@
 #define MAX_GETENT_SIZE 1024
 #define MAX_GETOBJ_SIZE 32768
 
+/* Group member offsets kept on the stack in str2group() */
+#define NDB_GRMEM_OFFS  512
+
+/* Buffer for bulk reads (DB_MULTIPLE_KEY) in _ndb_scan(), a multiple of 1024 */
+#define NDB_BULK_SIZE   (1024*1024)
+
 static char *path_passwd_byname     = PATH_NSS_NDB_PASSWD_BY_NAME;
 static char *path_passwd_byuid      = PATH_NSS_NDB_PASSWD_BY_UID;
 static char *path_group_byname      = PATH_NSS_NDB_GROUP_BY_NAME;
 static char *path_group_bygid       = PATH_NSS_NDB_GROUP_BY_GID;
 static char *path_usergroups_byname = PATH_NSS_NDB_USERGROUPS_BY_NAME;
+static char *path_passwd_bylcname   = PATH_NSS_NDB_PASSWD_BY_LCNAME;
+static char *path_group_bylcname    = PATH_NSS_NDB_GROUP_BY_LCNAME;
+static char *path_netgroup_byname   = PATH_NSS_NDB_NETGROUP_BY_NAME;
+static char *path_netgroup_bytriple = PATH_NSS_NDB_NETGROUP_BY_TRIPLE;
+static char *path_hosts_byname      = PATH_NSS_NDB_HOSTS_BY_NAME;
+static char *path_hosts_byaddr      = PATH_NSS_NDB_HOSTS_BY_ADDR;
+static char *path_services_byname   = PATH_NSS_NDB_SERVICES_BY_NAME;
+static char *path_services_byport   = PATH_NSS_NDB_SERVICES_BY_PORT;
+static char *path_protocols_byname  = PATH_NSS_NDB_PROTOCOLS_BY_NAME;
+static char *path_protocols_bynumber = PATH_NSS_NDB_PROTOCOLS_BY_NUMBER;
+static char *path_rpc_byname        = PATH_NSS_NDB_RPC_BY_NAME;
+static char *path_rpc_bynumber      = PATH_NSS_NDB_RPC_BY_NUMBER;
+#ifdef __linux__
+static char *path_shadow_byname     = PATH_NSS_NDB_SHADOW_BY_NAME;
+#endif
 
 static __thread NDB ndb_pwd_byname;
 static __thread NDB ndb_pwd_byuid;
+static __thread NDB ndb_pwd_bylcname;
+
+#ifdef __linux__
+static __thread NDB ndb_spw_byname;
+#endif
 
 static __thread NDB ndb_grp_byname;
 static __thread NDB ndb_grp_bygid;
 static __thread NDB ndb_grp_byuser;
+static __thread NDB ndb_grp_bylcname;
+
+static __thread NDB ndb_ngr_byname;
+static __thread NDB ndb_ngr_bytriple;
+
+static __thread NDB ndb_hst_byname;
+static __thread NDB ndb_hst_byaddr;
+
+static __thread NDB ndb_svc_byname;
+static __thread NDB ndb_svc_byport;
+
+static __thread NDB ndb_pro_byname;
+static __thread NDB ndb_pro_bynumber;
+
+static __thread NDB ndb_rpc_byname;
+static __thread NDB ndb_rpc_bynumber;
+
+/* Calls fn() for each handle of the calling thread */
+static void
+_ndb_thread_handles(void (*fn)(NDB *ndb)) {
+  NDB *ndbv[] = {
+    &ndb_pwd_byname, &ndb_pwd_byuid, &ndb_pwd_bylcname,
+#ifdef __linux__
+    &ndb_spw_byname,
+#endif
+    &ndb_grp_byname, &ndb_grp_bygid, &ndb_grp_byuser, &ndb_grp_bylcname,
+    &ndb_ngr_byname, &ndb_ngr_bytriple,
+    &ndb_hst_byname, &ndb_hst_byaddr,
+    &ndb_svc_byname, &ndb_svc_byport,
+    &ndb_pro_byname, &ndb_pro_bynumber,
+    &ndb_rpc_byname, &ndb_rpc_bynumber,
+  };
+  int i;
+
+  
+  for (i = 0; i < sizeof(ndbv)/sizeof(ndbv[0]); i++)
+    (*fn)(ndbv[i]);
+}
 
 
 static __thread int f_nss_ndb_init  = 0;
+
+/*
+ * Bumped in the child after fork(), so handles inherited from the parent
+ * are noticed (without a getpid() per lookup) and reopened.
+ */
+static volatile unsigned int ndb_fork_gen = 1;
+static pthread_once_t ndb_atfork_once = PTHREAD_ONCE_INIT;
 #ifdef NDB_DEBUG
 static __thread int f_nss_ndb_debug = 0;
 #endif
@@ -74,8 +167,83 @@ static __thread int f_nss_ndb_debug = 0;
 #define DEFAULT_REALM NULL
 #endif
 
+#ifndef DEFAULT_CASEFOLD
+#define DEFAULT_CASEFOLD CASEFOLD_FALLBACK
+#endif
+
 static __thread const char *f_strip_workgroup = DEFAULT_WORKGROUP;
 static __thread const char *f_strip_realm     = DEFAULT_REALM;
+static __thread int f_casefold                = DEFAULT_CASEFOLD;
+static __thread int f_bloom                   = 1;
+static __thread int f_warmup                  = 0;
+static __thread int f_verify                  = 0;
+static __thread const char *f_dbenv           = NULL;
+static __thread const char *f_container       = NULL;
+#if DB_VERSION_MAJOR >= 4
+static __thread unsigned long long f_cachesize = 0;
+#endif
+
+
+#if defined(ENABLE_CONFIG_FILE) || defined(NSS_NDB_CONF_VAR)
+static int
+str2casefold(const char *vp) {
+  if (!vp)
+    return CASEFOLD_FALLBACK;
+  
+  if (strcasecmp(vp, "always") == 0)
+    return CASEFOLD_ALWAYS;
+  
+  if (strcasecmp(vp, "no") == 0 ||
+      strcasecmp(vp, "off") == 0 ||
+      strcmp(vp, "0") == 0)
+    return CASEFOLD_NO;
+
+  return CASEFOLD_FALLBACK;
+}
+
+
+static int
+str2bool(const char *vp) {
+  if (!vp)
+    return 1;
+  
+  if (strcasecmp(vp, "no") == 0 ||
+      strcasecmp(vp, "off") == 0 ||
+      strcasecmp(vp, "false") == 0 ||
+      strcmp(vp, "0") == 0)
+    return 0;
+
+  return 1;
+}
+
+
+#if DB_VERSION_MAJOR >= 4
+/*
+ * Sizes like "65536", "512K", "64M" or "1G"
+ */
+static unsigned long long
+str2size(const char *vp) {
+  unsigned long long v = 0;
+  char c = 0;
+  
+  if (!vp || sscanf(vp, "%llu%c", &v, &c) < 1)
+    return 0;
+
+  switch (toupper(c)) {
+  case 'G':
+    v <<= 10;
+    /* FALLTHRU */
+  case 'M':
+    v <<= 10;
+    /* FALLTHRU */
+  case 'K':
+    v <<= 10;
+  }
+  
+  return v;
+}
+#endif
+#endif
 
 static void
 _nss_ndb_init(void) {
@@ -131,6 +299,49 @@ _nss_ndb_init(void) {
 	    vp = "";
 	  f_strip_realm = strdup(vp);
 	} 
+	
+      } else if (strcmp(cp, "casefold") == 0) {
+	
+	f_casefold = str2casefold(vp);
+	
+      } else if (strcmp(cp, "bloom") == 0) {
+	
+	f_bloom = str2bool(vp);
+	
+      } else if (strcmp(cp, "warmup") == 0) {
+	
+	f_warmup = str2bool(vp);
+	
+      } else if (strcmp(cp, "verify") == 0) {
+	
+	f_verify = str2bool(vp);
+	
+      } else if (strcmp(cp, "dbenv") == 0) {
+	
+	if (f_dbenv) {
+	  free((void *) f_dbenv);
+	  f_dbenv = NULL;
+	}
+	
+	if (vp)
+	  f_dbenv = strdup(vp);
+	
+      } else if (strcmp(cp, "container") == 0) {
+	
+	if (f_container) {
+	  free((void *) f_container);
+	  f_container = NULL;
+	}
+	
+	if (vp)
+	  f_container = strdup(vp);
+	
+      } else if (strcmp(cp, "cachesize") == 0) {
+	
+#if DB_VERSION_MAJOR >= 4
+	f_cachesize = str2size(vp);
+#endif
+	
 #ifdef NDB_DEBUG	
       } else if (strcmp(cp, "debug") == 0) {
 	if (vp)
@@ -188,6 +399,48 @@ _nss_ndb_init(void) {
 	  f_strip_realm = strdup(vp);
 	}
 	
+      } else if (strcmp(cp, "casefold") == 0) {
+
+	f_casefold = str2casefold(vp);
+	
+      } else if (strcmp(cp, "bloom") == 0) {
+
+	f_bloom = str2bool(vp);
+	
+      } else if (strcmp(cp, "warmup") == 0) {
+
+	f_warmup = str2bool(vp);
+	
+      } else if (strcmp(cp, "verify") == 0) {
+
+	f_verify = str2bool(vp);
+	
+      } else if (strcmp(cp, "dbenv") == 0) {
+
+	if (f_dbenv) {
+	  free((void *) f_dbenv);
+	  f_dbenv = NULL;
+	}
+	
+	if (vp)
+	  f_dbenv = strdup(vp);
+	
+      } else if (strcmp(cp, "container") == 0) {
+
+	if (f_container) {
+	  free((void *) f_container);
+	  f_container = NULL;
+	}
+	
+	if (vp)
+	  f_container = strdup(vp);
+	
+      } else if (strcmp(cp, "cachesize") == 0) {
+
+#if DB_VERSION_MAJOR >= 4
+	f_cachesize = str2size(vp);
+#endif
+	
 #ifdef NDB_DEBUG	
       } else if (strcmp(cp, "debug") == 0) {
 
@@ -221,29 +474,163 @@ balloc(size_t size,
 }
 
 
+/*
+ * Finds the offsets of all delimiter characters (up to NDB_DELIMS_MAX of
+ * them, in 'delims') in buf[off..len) in one pass. Uses AVX2 (32 bytes
+ * at a time) or SSE2 (16 bytes) if available, else a byte loop. Stores
+ * at most 'on' offsets in 'ov' and returns the number stored - if that
+ * is 'on' the caller continues at ov[on-1]+1.
+ */
+static size_t
+_ndb_delims_c(const unsigned char *p,
+	      size_t i,
+	      size_t len,
+	      const unsigned char *dv,
+	      size_t *ov,
+	      size_t n,
+	      size_t on) {
+  for (; i < len && n < on; i++)
+    if (p[i] == dv[0] || p[i] == dv[1] || p[i] == dv[2] || p[i] == dv[3])
+      ov[n++] = i;
+  return n;
+}
+
+#ifdef NDB_DELIMS_SIMD
+static int delims_avx2 = 0;
+static pthread_once_t delims_once = PTHREAD_ONCE_INIT;
+
+static void
+_ndb_delims_init(void) {
+  __builtin_cpu_init();
+  delims_avx2 = __builtin_cpu_supports("avx2");
+}
+
+static size_t
+_ndb_delims_sse2(const unsigned char *p,
+		 size_t i,
+		 size_t len,
+		 const unsigned char *dv,
+		 size_t *ov,
+		 size_t on) {
+  __m128i d0 = _mm_set1_epi8(dv[0]), d1 = _mm_set1_epi8(dv[1]);
+  __m128i d2 = _mm_set1_epi8(dv[2]), d3 = _mm_set1_epi8(dv[3]);
+  __m128i v;
+  unsigned int m;
+  size_t n = 0;
+
+  
+  for (; i+16 <= len; i += 16) {
+    v = _mm_loadu_si128((const __m128i *) (p+i));
+    m = _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, d0),
+						    _mm_cmpeq_epi8(v, d1)),
+				       _mm_or_si128(_mm_cmpeq_epi8(v, d2),
+						    _mm_cmpeq_epi8(v, d3))));
+    for (; m; m &= m-1) {
+      if (n >= on)
+	return n;
+      ov[n++] = i+__builtin_ctz(m);
+    }
+  }
+  
+  return _ndb_delims_c(p, i, len, dv, ov, n, on);
+}
+
+__attribute__((target("avx2")))
+static size_t
+_ndb_delims_avx2(const unsigned char *p,
+		 size_t i,
+		 size_t len,
+		 const unsigned char *dv,
+		 size_t *ov,
+		 size_t on) {
+  __m256i d0 = _mm256_set1_epi8(dv[0]), d1 = _mm256_set1_epi8(dv[1]);
+  __m256i d2 = _mm256_set1_epi8(dv[2]), d3 = _mm256_set1_epi8(dv[3]);
+  __m256i v;
+  unsigned int m;
+  size_t n = 0;
+
+  
+  for (; i+32 <= len; i += 32) {
+    v = _mm256_loadu_si256((const __m256i *) (p+i));
+    m = _mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, d0),
+							     _mm256_cmpeq_epi8(v, d1)),
+					     _mm256_or_si256(_mm256_cmpeq_epi8(v, d2),
+							     _mm256_cmpeq_epi8(v, d3))));
+    for (; m; m &= m-1) {
+      if (n >= on)
+	return n;
+      ov[n++] = i+__builtin_ctz(m);
+    }
+  }
+  
+  return _ndb_delims_c(p, i, len, dv, ov, n, on);
+}
+#endif
+
+size_t
+_ndb_delims(const char *buf,
+	    size_t off,
+	    size_t len,
+	    const char *delims,
+	    size_t *ov,
+	    size_t on) {
+  const unsigned char *p = (const unsigned char *) buf;
+  unsigned char dv[NDB_DELIMS_MAX];
+  int i;
+
+
+  if (!*delims || on == 0)
+    return 0;
+  
+  for (i = 0; i < NDB_DELIMS_MAX && delims[i]; i++)
+    dv[i] = delims[i];
+  /* Unused slots repeat the first delimiter */
+  for (; i < NDB_DELIMS_MAX; i++)
+    dv[i] = dv[0];
+  
+#ifdef NDB_DELIMS_SIMD
+  (void) pthread_once(&delims_once, _ndb_delims_init);
+  
+  if (delims_avx2)
+    return _ndb_delims_avx2(p, off, len, dv, ov, on);
+  return _ndb_delims_sse2(p, off, len, dv, ov, on);
+#else
+  return _ndb_delims_c(p, off, len, dv, ov, 0, on);
+#endif
+}
+
+
 static int
 strsplit(char *buf,
 	 int sep,
 	 char *fv[],
 	 int fs) {
+  char dv[2];
+  size_t ov[16], len, off, no, i;
   int n = 0;
-  char *cp;
 
   
   if (!buf)
     return 0;
   
-  while ((cp = strchr(buf, sep)) != NULL) {
-    if (n >= fs) {
-      errno = EOVERFLOW;
-      return -1;
+  dv[0] = sep;
+  dv[1] = '\0';
+  len = strlen(buf);
+  off = 0;
+  do {
+    no = _ndb_delims(buf, off, len, dv, ov, sizeof(ov)/sizeof(ov[0]));
+    for (i = 0; i < no; i++) {
+      if (n >= fs) {
+	errno = EOVERFLOW;
+	return -1;
+      }
+      
+      fv[n++] = buf+off;
+      buf[ov[i]] = '\0';
+      off = ov[i]+1;
     }
-    
-    fv[n++] = buf;
-    *cp++ = '\0';
-    buf = cp;
-    
-  }
+  } while (no == sizeof(ov)/sizeof(ov[0]));
+  buf += off;
   
   if (n >= fs) {
     errno = EOVERFLOW;
@@ -258,6 +645,38 @@ strsplit(char *buf,
 }
 
 
+/*
+ * Split a string at (runs of) blanks
+ */
+static int
+strwsplit(char *buf,
+	  char *fv[],
+	  int fs) {
+  int n = 0;
+  char *cp;
+
+  
+  if (!buf)
+    return 0;
+  
+  while ((cp = strsep(&buf, " \t")) != NULL) {
+    if (!*cp)
+      continue;
+    
+    if (n >= fs) {
+      errno = EOVERFLOW;
+      return -1;
+    }
+    fv[n++] = cp;
+  }
+  
+  if (n < fs)
+    fv[n] = NULL;
+
+  return n;
+}
+
+
 static char *
 strbdup(const char *str,
 	char **buf,
@@ -282,53 +701,674 @@ strbdup(const char *str,
   return rstr;
 }
 
-
-static int
-str2passwd(char *str,
-	   size_t size,
-	   struct passwd *pp,
-	   char **buf,
-	   size_t *blen,
-	   size_t maxsize) {
-  char *btmp;
-  char *fv[MAXPWFIELDS];
-  int fc, rc, i;
+
+/*
+ * Fold a name to lower case (ASCII only, so UTF-8 names are left intact).
+ * Used both when building and when looking up the *.bylcname indexes.
+ */
+char *
+_ndb_strfold(char *buf,
+	     const char *str,
+	     size_t bsize) {
+  size_t i;
 
   
-  if (!str || !pp) {
-    errno = EINVAL;
-    return -1;
+  if (!str || !buf)
+    return NULL;
+  
+  for (i = 0; str[i]; i++) {
+    if (i+1 >= bsize) {
+      errno = ERANGE;
+      return NULL;
+    }
+    buf[i] = ((unsigned char) str[i] < 0x80 ? tolower((unsigned char) str[i]) : str[i]);
   }
+  buf[i] = '\0';
+  
+  return buf;
+}
 
-  memset(pp, 0, sizeof(*pp));
 
-  btmp = strndup(str, size);
-  if (!btmp) {
+static int
+strpcmp(const void *a,
+	const void *b) {
+  return strcmp(* (char * const *) a, * (char * const *) b);
+}
+
+
+/*
+ * Front-code a comma separated group member list (see NDB_GRMEM_FC).
+ * The plain list is copied as is if the encoded one isn't shorter.
+ * Returns the length written (excluding the NUL), or -1.
+ */
+int
+_ndb_grmem_encode(char *buf,
+		  size_t bsize,
+		  const char *members) {
+  char *tmp = NULL, *cp, **mv = NULL;
+  size_t len, n, i, pos, plen, slen;
+
+
+  len = strlen(members);
+  if (!*members || *members == NDB_GRMEM_FC)
+    goto Plain;
+
+  tmp = strdup(members);
+  if (!tmp)
+    return -1;
+
+  for (n = 1, cp = tmp; *cp; cp++)
+    if (*cp == ',')
+      ++n;
+
+  mv = malloc(n*sizeof(char *));
+  if (!mv) {
+    free(tmp);
     return -1;
   }
 
-  fc = strsplit(btmp, ':', fv, MAXPWFIELDS);
-  if (fc != 7
-#ifdef _PATH_MASTERPASSWD
-      && fc != 10
-#endif
-      ) {
-    goto Fail;
+  for (i = 0, cp = tmp; i < n; i++)
+    mv[i] = strsep(&cp, ",");
+  qsort(mv, n, sizeof(mv[0]), strpcmp);
+
+  pos = 0;
+  if (bsize < 1)
+    goto Plain;
+  buf[pos++] = NDB_GRMEM_FC;
+
+  for (i = 0; i < n; i++) {
+    plen = 0;
+    if (i > 0)
+      while (plen < NDB_GRMEM_PFXMAX && mv[i-1][plen] &&
+	     mv[i-1][plen] == mv[i][plen])
+	++plen;
+
+    slen = strlen(mv[i]+plen);
+    if (pos+slen+3 > bsize || pos+slen+2 >= len)
+      goto Plain;
+
+    if (i > 0)
+      buf[pos++] = ',';
+    buf[pos++] = plen+1;
+    memcpy(buf+pos, mv[i]+plen, slen);
+    pos += slen;
   }
-  
-  pp->pw_name = strbdup(fv[0], buf, blen);
-  if (!pp->pw_name) {
-    goto Fail;
+  buf[pos] = '\0';
+
+  free(mv);
+  free(tmp);
+  return pos;
+
+ Plain:
+  free(mv);
+  free(tmp);
+  if (len >= bsize) {
+    errno = ERANGE;
+    return -1;
   }
+  memcpy(buf, members, len+1);
+  return len;
+}
+
+
+/*
+ * Base 64 digits for interned uids - no ',', ':' or '='
+ */
+static const char b64digits[] =
+  "./0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+
+static int
+b64value(int c) {
+  if (c == '.' || c == '/')
+    return c - '.';
+  if (c >= '0' && c <= '9')
+    return c - '0' + 2;
+  if (c >= 'A' && c <= 'Z')
+    return c - 'A' + 12;
+  if (c >= 'a' && c <= 'z')
+    return c - 'a' + 38;
+  return -1;
+}
+
+
+static int
+uid2b64(char *buf,
+	size_t bsize,
+	uint32_t uid) {
+  char tmp[8];
+  int n = 0, i;
+
+
+  do {
+    tmp[n++] = b64digits[uid & 63];
+    uid >>= 6;
+  } while (uid);
+
+  if (n >= bsize)
+    return -1;
+  for (i = 0; i < n; i++)
+    buf[i] = tmp[n-1-i];
   
-  pp->pw_passwd = strbdup(fv[1], buf, blen);
-  if (!pp->pw_passwd) {
-    goto Fail;
-  }
+  return n;
+}
+
+
+static int
+b642uid(const char *str,
+	size_t len,
+	uint32_t *uid) {
+  uint64_t v = 0;
+  int d;
+
+
+  if (len == 0 || len > 6)
+    return -1;
   
-  if ((rc = sscanf(fv[2], "%u", &pp->pw_uid)) != 1) {
-    errno = EINVAL;
-    goto Fail;
+  while (len-- > 0) {
+    if ((d = b64value((unsigned char) *str++)) < 0)
+      return -1;
+    v = (v << 6) | d;
+  }
+  if (v > UINT32_MAX)
+    return -1;
+  
+  *uid = v;
+  return 0;
+}
+
+
+/*
+ * The uid to name table of a passwd.byuid database. It is mmap()ed
+ * once per thread and kept until the file is replaced (like the Bloom
+ * filters it stays valid in children after fork()).
+ */
+typedef struct {
+  char *path;
+  ino_t ino;
+  off_t size;
+  time_t mtime;
+  NDB_NAMES *np;
+} NAMESREF;
+
+static __thread NAMESREF names_cache;
+
+
+const NDB_NAMES *
+_ndb_names_load(const char *byuid) {
+  NAMESREF *nr = &names_cache;
+  char npath[PATH_MAX];
+  const NDB_NAMES_ENT *ev;
+  const char *base;
+  NDB_NAMES *np;
+  struct stat sb;
+  uint32_t i;
+  int fd, rc;
+
+  
+  rc = snprintf(npath, sizeof(npath), "%s%s", byuid, NDB_NAMES_SUFFIX);
+  if (rc < 0 || rc >= sizeof(npath)) {
+    errno = ENAMETOOLONG;
+    return NULL;
+  }
+
+  if (stat(npath, &sb) < 0)
+    return NULL;
+
+  if (nr->np && strcmp(nr->path, byuid) == 0 &&
+      nr->ino == sb.st_ino && nr->size == sb.st_size && nr->mtime == sb.st_mtime)
+    return nr->np;
+
+  if (nr->np)
+    munmap(nr->np, nr->size);
+  free(nr->path);
+  memset(nr, 0, sizeof(*nr));
+  
+  fd = open(npath, O_RDONLY|O_CLOEXEC);
+  if (fd < 0)
+    return NULL;
+  
+  if (fstat(fd, &sb) < 0 || sb.st_size < sizeof(*np)) {
+    close(fd);
+    errno = EINVAL;
+    return NULL;
+  }
+  
+  np = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (np == MAP_FAILED)
+    return NULL;
+
+  base = (const char *) np;
+  ev = (const NDB_NAMES_ENT *) (np+1);
+  if (memcmp(np->magic, NDB_NAMES_MAGIC, sizeof(np->magic)) != 0 ||
+      np->version != NDB_NAMES_VERSION ||
+      np->n > (sb.st_size - sizeof(*np)) / sizeof(*ev) ||
+      base[sb.st_size-1] != '\0')
+    goto Invalid;
+
+  for (i = 0; i < np->n; i++)
+    if (ev[i].off < sizeof(*np) + np->n*sizeof(*ev) || ev[i].off >= sb.st_size ||
+	(i > 0 && ev[i].uid <= ev[i-1].uid))
+      goto Invalid;
+
+  nr->path = strdup(byuid);
+  if (!nr->path) {
+    munmap(np, sb.st_size);
+    return NULL;
+  }
+  nr->ino = sb.st_ino;
+  nr->size = sb.st_size;
+  nr->mtime = sb.st_mtime;
+  nr->np = np;
+  return np;
+
+ Invalid:
+#if NDB_DEBUG
+  if (f_nss_ndb_debug)
+    fprintf(stderr, "_ndb_names_load(\"%s\"): Invalid name table\n", npath);
+#endif
+  munmap(np, sb.st_size);
+  errno = EINVAL;
+  return NULL;
+}
+
+
+const char *
+_ndb_names_get(const NDB_NAMES *np,
+	       uint32_t uid) {
+  const NDB_NAMES_ENT *ev = (const NDB_NAMES_ENT *) (np+1);
+  uint32_t lo = 0, hi = np->n, mid;
+
+
+  while (lo < hi) {
+    mid = lo + (hi-lo)/2;
+    if (ev[mid].uid == uid)
+      return (const char *) np + ev[mid].off;
+    if (ev[mid].uid < uid)
+      lo = mid+1;
+    else
+      hi = mid;
+  }
+  
+  return NULL;
+}
+
+
+static int
+namesentcmp(const void *a,
+	  const void *b) {
+  const NDB_NAMES_ENT *x = a, *y = b;
+
+  return x->uid < y->uid ? -1 : x->uid > y->uid;
+}
+
+
+/*
+ * (Re)write the name table of a passwd.byuid database. Written to a
+ * temporary file that is renamed into place.
+ */
+int
+_ndb_names_write(const char *byuid) {
+  char npath[PATH_MAX], tpath[PATH_MAX];
+  NDB_NAMES hdr;
+  NDB_NAMES_ENT *ev = NULL;
+  char *pool = NULL, *cp;
+  size_t n = 0, ns = 0, plen = 0, psize = 0, len, i;
+  unsigned long uid;
+  NDB ndb;
+  DBT key, val;
+  FILE *fp;
+  int rc, fmt;
+
+  
+  rc = snprintf(npath, sizeof(npath), "%s%s", byuid, NDB_NAMES_SUFFIX);
+  if (rc < 0 || rc >= sizeof(npath) ||
+      (rc = snprintf(tpath, sizeof(tpath), "%s.%d", npath, (int) getpid())) < 0 ||
+      rc >= sizeof(tpath)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+
+  memset(&ndb, 0, sizeof(ndb));
+  if (_ndb_open(&ndb, byuid, 0) < 0)
+    return -1;
+
+  fmt = _ndb_idformat(&ndb);
+  if (fmt < 0)
+    goto Fail;
+  
+  while (1) {
+    memset(&key, 0, sizeof(key));
+    memset(&val, 0, sizeof(val));
+    
+    rc = _ndb_get(&ndb, &key, &val, DB_NEXT);
+    if (rc < 0)
+      goto Fail;
+    if (rc > 0)
+      break;
+
+    cp = memchr(val.data, ':', val.size);
+    if (!cp)
+      continue;
+    len = cp - (char *) val.data;
+    
+    if (n >= ns) {
+      ns = ns ? ns*2 : 1024;
+      if (!(cp = realloc(ev, ns*sizeof(*ev))))
+	goto Fail;
+      ev = (NDB_NAMES_ENT *) cp;
+    }
+    if (plen+len+1 > psize) {
+      psize = psize ? psize*2 + len : 16384;
+      if (!(cp = realloc(pool, psize)))
+	goto Fail;
+      pool = cp;
+    }
+
+    if (_ndb_keyid(&key, fmt, &uid) < 0)
+      continue;
+    ev[n].uid = uid;
+    
+    ev[n++].off = plen;
+    memcpy(pool+plen, val.data, len);
+    pool[plen+len] = '\0';
+    plen += len+1;
+  }
+  _ndb_close(&ndb);
+
+  qsort(ev, n, sizeof(*ev), namesentcmp);
+  for (i = 0; i < n; i++)
+    ev[i].off += sizeof(hdr) + n*sizeof(*ev);
+
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, NDB_NAMES_MAGIC, sizeof(hdr.magic));
+  hdr.version = NDB_NAMES_VERSION;
+  hdr.n = n;
+
+  fp = fopen(tpath, "w");
+  if (!fp)
+    goto Fail;
+
+  if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1 ||
+      (n > 0 && fwrite(ev, sizeof(*ev), n, fp) != n) ||
+      (plen > 0 && fwrite(pool, 1, plen, fp) != plen) ||
+      (plen == 0 && putc('\0', fp) == EOF)) {
+    fclose(fp);
+    unlink(tpath);
+    goto Fail;
+  }
+  if (fclose(fp) != 0 || rename(tpath, npath) < 0) {
+    unlink(tpath);
+    goto Fail;
+  }
+
+  free(ev);
+  free(pool);
+  return 0;
+
+ Fail:
+  rc = errno;
+  _ndb_close(&ndb);
+  free(ev);
+  free(pool);
+  errno = rc;
+  return -1;
+}
+
+
+/*
+ * Like _ndb_grmem_encode(), but store members that are users (with the
+ * same name in the name table) as their uids. 'byname' is the
+ * passwd.byname database and 'byuid' the path of passwd.byuid.
+ */
+int
+_ndb_grmem_intern(char *buf,
+		  size_t bsize,
+		  const char *members,
+		  NDB *byname,
+		  const char *byuid) {
+  const NDB_NAMES *np;
+  const char *nm;
+  char *tmp = NULL, *cp, *name, *vp;
+  size_t pos = 0, len;
+  uint32_t uid;
+  DBT key, val;
+  int rc;
+
+
+  if (!*members) {
+    if (bsize < 1)
+      goto Range;
+    *buf = '\0';
+    return 0;
+  }
+  
+  np = _ndb_names_load(byuid);
+  if (!np)
+    return -1;
+
+  tmp = strdup(members);
+  if (!tmp)
+    return -1;
+
+  if (bsize < 2)
+    goto Range;
+  buf[pos++] = NDB_GRMEM_ID;
+  
+  for (cp = tmp; (name = strsep(&cp, ",")) != NULL; ) {
+    if (pos > 1)
+      buf[pos++] = ',';
+
+    memset(&key, 0, sizeof(key));
+    memset(&val, 0, sizeof(val));
+    key.data = name;
+    key.size = strlen(name);
+
+    nm = NULL;
+    rc = _ndb_get(byname, &key, &val, 0);
+    if (rc < 0) {
+      free(tmp);
+      return -1;
+    }
+    
+    /* The uid is the third field of the passwd record */
+    if (rc == 0 &&
+	(vp = memchr(val.data, ':', val.size)) != NULL &&
+	(vp = memchr(vp+1, ':', val.size - (vp+1 - (char *) val.data))) != NULL &&
+	sscanf(vp+1, "%u", &uid) == 1)
+      nm = _ndb_names_get(np, uid);
+
+    if (nm && strcmp(nm, name) == 0) {
+      rc = uid2b64(buf+pos, bsize-pos, uid);
+      if (rc < 0)
+	goto Range;
+      pos += rc;
+    } else {
+      len = strlen(name);
+      if (pos+len+2 > bsize)
+	goto Range;
+      buf[pos++] = '=';
+      memcpy(buf+pos, name, len);
+      pos += len;
+    }
+    if (pos+1 >= bsize)
+      goto Range;
+  }
+  buf[pos] = '\0';
+  
+  free(tmp);
+  return pos;
+
+ Range:
+  free(tmp);
+  errno = ERANGE;
+  return -1;
+}
+
+
+/*
+ * Expand an interned member field to a plain comma separated list
+ */
+static int
+_ndb_grmem_expand(char *buf,
+		  size_t bsize,
+		  const char *str,
+		  size_t len,
+		  const char *byuid) {
+  const NDB_NAMES *np;
+  const char *nm, *ep;
+  size_t i, elen, nlen, n = 0, pos = 0;
+  uint32_t uid;
+
+  
+  np = _ndb_names_load(byuid);
+  if (!np)
+    return -1;
+
+  if (bsize < 1) {
+    errno = ERANGE;
+    return -1;
+  }
+
+  for (i = 1; i < len && str[i]; i += elen+1) {
+    ep = memchr(str+i, ',', len-i);
+    elen = (ep ? ep - (str+i) : strnlen(str+i, len-i));
+    
+    if (str[i] == '=') {
+      nm = str+i+1;
+      nlen = elen-1;
+    } else if (b642uid(str+i, elen, &uid) == 0 && (nm = _ndb_names_get(np, uid)) != NULL)
+      nlen = strlen(nm);
+    else
+      continue;                 /* Removed user */
+
+    if (pos+nlen+2 > bsize) {
+      errno = ERANGE;
+      return -1;
+    }
+    if (n++ > 0)
+      buf[pos++] = ',';
+    memcpy(buf+pos, nm, nlen);
+    pos += nlen;
+  }
+  buf[pos] = '\0';
+  
+  return pos;
+}
+
+
+/*
+ * Expand a (possibly front-coded or interned) group member field of
+ * 'len' bytes to a plain comma separated list. Interned members are
+ * looked up in the name table of the passwd.byuid database 'byuid'.
+ * Returns the length written (excluding the NUL), or -1.
+ */
+int
+_ndb_grmem_decode(char *buf,
+		  size_t bsize,
+		  const char *str,
+		  size_t len,
+		  const char *byuid) {
+  size_t i, n, pos, start, prev, plen;
+
+
+  if (len > 0 && *str == NDB_GRMEM_ID)
+    return _ndb_grmem_expand(buf, bsize, str, len, byuid);
+  
+  if (len == 0 || *str != NDB_GRMEM_FC) {
+    if (len >= bsize) {
+      errno = ERANGE;
+      return -1;
+    }
+    memcpy(buf, str, len);
+    buf[len] = '\0';
+    return strlen(buf);
+  }
+
+  n = pos = start = prev = 0;
+  for (i = 1; i < len && str[i]; n++) {
+    plen = (unsigned char) str[i++] - 1;
+    if (plen > prev) {
+      errno = EINVAL;
+      return -1;
+    }
+
+    if (n > 0) {
+      if (pos+1 >= bsize)
+	goto Range;
+      buf[pos++] = ',';
+    }
+    if (pos+plen >= bsize)
+      goto Range;
+    memcpy(buf+pos, buf+start, plen);
+    start = pos;
+    pos += plen;
+
+    while (i < len && str[i] && str[i] != ',') {
+      if (pos+1 >= bsize)
+	goto Range;
+      buf[pos++] = str[i++];
+    }
+    if (i < len && str[i] == ',')
+      ++i;
+
+    prev = pos-start;
+  }
+  buf[pos] = '\0';
+  return pos;
+
+ Range:
+  errno = ERANGE;
+  return -1;
+}
+
+
+static int
+str2passwd(char *str,
+	   size_t size,
+	   struct passwd *pp,
+	   char **buf,
+	   size_t *blen,
+	   size_t maxsize) {
+  char *btmp;
+  char *fv[MAXPWFIELDS];
+  int fc, rc, i;
+
+  
+  if (!str || !pp) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  memset(pp, 0, sizeof(*pp));
+
+  btmp = strndup(str, size);
+  if (!btmp) {
+    return -1;
+  }
+
+  fc = strsplit(btmp, ':', fv, MAXPWFIELDS);
+  if (fc != 7
+#ifdef _PATH_MASTERPASSWD
+      && fc != 10
+#endif
+      ) {
+    goto Fail;
+  }
+  
+  pp->pw_name = strbdup(fv[0], buf, blen);
+  if (!pp->pw_name) {
+    goto Fail;
+  }
+  
+  pp->pw_passwd = strbdup(fv[1], buf, blen);
+  if (!pp->pw_passwd) {
+    goto Fail;
+  }
+  
+  if ((rc = sscanf(fv[2], "%u", &pp->pw_uid)) != 1) {
+    errno = EINVAL;
+    goto Fail;
   }
   
   if ((rc = sscanf(fv[3], "%u", &pp->pw_gid)) != 1) {
@@ -389,56 +1429,157 @@ str2passwd(char *str,
 
 
 
+#ifdef __linux__
+/*
+ * Empty numeric shadow fields mean "not set" and are returned as -1
+ */
 static int
-str2group(char *str,
-	  size_t size,
-	  struct group *gp,
-	  char **buf,
-	  size_t *blen,
-	  size_t maxsize) {
-  char *tmp, *members, *btmp;
-  int ng = 0;
-  char *fv[MAXGRFIELDS];
-  int fc, rc, i;
+str2splong(const char *str,
+	   long *vp) {
+  char *end;
 
+  
+  if (!*str) {
+    *vp = -1;
+    return 0;
+  }
 
-  if (!str || !gp) {
+  errno = 0;
+  *vp = strtol(str, &end, 10);
+  if (errno || *end) {
     errno = EINVAL;
     return -1;
   }
 
-  memset(gp, 0, sizeof(*gp));
+  return 0;
+}
+
+
+static int
+str2spwd(char *str,
+	 size_t size,
+	 struct spwd *sp,
+	 char **buf,
+	 size_t *blen,
+	 size_t maxsize) {
+  char *btmp;
+  char *fv[MAXSPFIELDS];
+  long flag;
+  int fc;
+
   
+  if (!str || !sp) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  memset(sp, 0, sizeof(*sp));
+
   btmp = strndup(str, size);
-  if (!btmp)
+  if (!btmp) {
     return -1;
-  
-  fc = strsplit(btmp, ':', fv, MAXGRFIELDS);
-  if (fc != 4)
+  }
+
+  fc = strsplit(btmp, ':', fv, MAXSPFIELDS);
+  if (fc != MAXSPFIELDS) {
+    errno = EINVAL;
     goto Fail;
+  }
   
-  gp->gr_name = strbdup(fv[0], buf, blen);
-  if (!gp->gr_name)
+  sp->sp_namp = strbdup(fv[0], buf, blen);
+  if (!sp->sp_namp) {
     goto Fail;
+  }
   
-  gp->gr_passwd = strbdup(fv[1], buf, blen);
-  if (!gp->gr_passwd)
+  sp->sp_pwdp = strbdup(fv[1], buf, blen);
+  if (!sp->sp_pwdp) {
     goto Fail;
-  
-  if ((rc = sscanf(fv[2], "%u", &gp->gr_gid)) != 1) {
-    errno = EINVAL;
+  }
+
+  if (str2splong(fv[2], &sp->sp_lstchg) < 0 ||
+      str2splong(fv[3], &sp->sp_min) < 0 ||
+      str2splong(fv[4], &sp->sp_max) < 0 ||
+      str2splong(fv[5], &sp->sp_warn) < 0 ||
+      str2splong(fv[6], &sp->sp_inact) < 0 ||
+      str2splong(fv[7], &sp->sp_expire) < 0 ||
+      str2splong(fv[8], &flag) < 0) {
     goto Fail;
   }
+  sp->sp_flag = (unsigned long) flag;
+  
+  free(btmp);
+  return 0;
 
-  if (size < maxsize) {
-    members = fv[3];
-    if (members) {
-      char *cp;
-      
-      ++ng;
-      for (cp = members; *cp; cp++)
-	if (*cp == ',')
-	  ++ng;
+ Fail:
+  free(btmp);
+  return -1;
+}
+#endif
+
+
+
+static int
+str2group(char *str,
+	  size_t size,
+	  struct group *gp,
+	  char **buf,
+	  size_t *blen,
+	  size_t maxsize) {
+  char *tmp, *members, *btmp;
+  int ng = 0;
+  char *fv[MAXGRFIELDS];
+  int fc, rc, i, k, mode = 0;
+  size_t mov[NDB_GRMEM_OFFS], *mv = mov;
+  size_t nc = 0, mlen = 0, s, e, plen, slen, prevlen = 0;
+  const NDB_NAMES *np = NULL;
+  const char *nm;
+  uint32_t uid;
+
+
+  if (!str || !gp) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  memset(gp, 0, sizeof(*gp));
+  
+  btmp = strndup(str, size);
+  if (!btmp)
+    return -1;
+  
+  fc = strsplit(btmp, ':', fv, MAXGRFIELDS);
+  if (fc != 4)
+    goto Fail;
+  
+  gp->gr_name = strbdup(fv[0], buf, blen);
+  if (!gp->gr_name)
+    goto Fail;
+  
+  gp->gr_passwd = strbdup(fv[1], buf, blen);
+  if (!gp->gr_passwd)
+    goto Fail;
+  
+  if ((rc = sscanf(fv[2], "%u", &gp->gr_gid)) != 1) {
+    errno = EINVAL;
+    goto Fail;
+  }
+
+  if (size < maxsize) {
+    members = fv[3];
+    if (members) {
+      /* Find all the commas in one pass */
+      mlen = strlen(members);
+      nc = _ndb_delims(members, 0, mlen, ",", mv, NDB_GRMEM_OFFS);
+      if (nc == NDB_GRMEM_OFFS) {
+	mv = malloc(mlen*sizeof(*mv));
+	if (!mv) {
+	  mv = mov;
+	  goto Fail;
+	}
+	memcpy(mv, mov, sizeof(mov));
+	nc += _ndb_delims(members, mv[nc-1]+1, mlen, ",", mv+nc, mlen-nc);
+      }
+      ng = nc+1;
     }
     
     gp->gr_mem = balloc((ng+1)*sizeof(char *), buf, blen);
@@ -446,13 +1587,62 @@ str2group(char *str,
       goto Fail;
     }
     
+    /* Member k is members[s..e), after the marker byte (if any) */
     i = 0;
-    if (members) {
-      for (; (tmp = strsep(&members, ",")) != NULL; i++) {
-	gp->gr_mem[i] = strbdup(tmp, buf, blen);
+    if (members)
+      mode = *members;
+    for (k = 0; k < ng; k++) {
+      s = k > 0 ? mv[k-1]+1 : (mode == NDB_GRMEM_FC || mode == NDB_GRMEM_ID);
+      e = k < nc ? mv[k] : mlen;
+      members[e] = '\0';
+      tmp = members+s;
+      
+      if (mode == NDB_GRMEM_FC) {
+	/* Front-coded: rebuild each name from the previous one in 'buf' */
+	if (s == e) {
+	  if (nc == 0)
+	    break;      /* Empty list */
+	  errno = EINVAL;
+	  goto Fail;
+	}
+	plen = (unsigned char) *tmp++ - 1;
+	if (plen > prevlen) {
+	  errno = EINVAL;
+	  goto Fail;
+	}
+	slen = e-s-1;
+	
+	gp->gr_mem[i] = balloc(plen+slen+1, buf, blen);
 	if (!gp->gr_mem[i]) {
 	  goto Fail;
 	}
+	if (plen > 0)
+	  memcpy(gp->gr_mem[i], gp->gr_mem[i-1], plen);
+	memcpy(gp->gr_mem[i]+plen, tmp, slen);
+	gp->gr_mem[i][plen+slen] = '\0';
+	prevlen = plen+slen;
+	i++;
+      } else if (mode == NDB_GRMEM_ID) {
+	/* Interned: uids (or "=name") to look up in the name table */
+	if (!np && (np = _ndb_names_load(path_passwd_byuid)) == NULL) {
+	  goto Fail;
+	}
+	
+	if (*tmp == '=')
+	  nm = tmp+1;
+	else if (b642uid(tmp, e-s, &uid) < 0 ||
+		 (nm = _ndb_names_get(np, uid)) == NULL)
+	  continue;     /* Removed user */
+	
+	gp->gr_mem[i] = strbdup(nm, buf, blen);
+	if (!gp->gr_mem[i++]) {
+	  goto Fail;
+	}
+      } else {
+	gp->gr_mem[i] = strbdup(tmp, buf, blen);
+	if (!gp->gr_mem[i++]) {
+	  goto Fail;
+	}
       }
     }
   } else {
@@ -470,695 +1660,6051 @@ str2group(char *str,
     i = 1;
   }
   
+  if (mv != mov)
+    free(mv);
   free(btmp);
   gp->gr_mem[i] = NULL;
   return 0;
 
  Fail:
+  if (mv != mov)
+    free(mv);
   free(btmp);
   return -1;
 }
 
 
-
-int
-_ndb_get(NDB *ndb,
-	 DBT *key,
-	 DBT *val,
-	 int flags) {
-  if (!ndb)
-    return -1;
-
+/*
+ * hosts.byname & hosts.byaddr format:
+ *   address name alias alias ...
+ *
+ * possibly multiple lines separated by newlines. Only lines with an address
+ * of the requested family (preset in hp->h_addrtype) are used. The names
+ * come from the first such line, the addresses from all of them.
+ *
+ * Returns 1 if no line has an address of the requested family.
+ */
+static int
+str2hostent(char *str,
+	    size_t size,
+	    struct hostent *hp,
+	    char **buf,
+	    size_t *blen,
+	    size_t maxsize) {
+  unsigned char addrv[MAXHOSTADDRS][sizeof(struct in6_addr)];
+  char *namev[MAXHOSTALIASES];
+  char *btmp, *lp, *line, *tok;
+  int af, alen, na, nn, i;
 
-  if (!key->data) {
-#if DB_VERSION_MAJOR < 4
-    return ndb->db->seq(ndb->db, key, val, flags);
-#else
-    return ndb->dbc->get(ndb->dbc, key, val, flags);
-#endif
-  } else {
-    return ndb->db->get(ndb->db,
-#if DB_VERSION_MAJOR >= 4
-			NULL,
-#endif
-			key, val, flags);
+  
+  if (!str || !hp) {
+    errno = EINVAL;
+    return -1;
   }
-}
 
-int
-_ndb_put(NDB *ndb,
-	 DBT *key,
-	 DBT *val,
-	 int flags) {
-  if (!ndb)
+  af = hp->h_addrtype;
+  switch (af) {
+  case AF_INET:
+    alen = sizeof(struct in_addr);
+    break;
+  case AF_INET6:
+    alen = sizeof(struct in6_addr);
+    break;
+  default:
+    errno = EAFNOSUPPORT;
     return -1;
-
-
-  return ndb->db->put(ndb->db,
-#if DB_VERSION_MAJOR >= 4
-		 NULL,
-#endif
-		 key, val, flags);
+  }
   
-}
-
+  memset(hp, 0, sizeof(*hp));
 
+  btmp = strndup(str, size);
+  if (!btmp)
+    return -1;
+  
+  na = nn = 0;
+  lp = btmp;
+  while (na < MAXHOSTADDRS && (line = strsep(&lp, "\n")) != NULL) {
+    tok = strsep(&line, " \t");
+    if (!tok || inet_pton(af, tok, addrv[na]) != 1)
+      continue;
+    ++na;
+    
+    if (nn == 0) {
+      while (nn < MAXHOSTALIASES && (tok = strsep(&line, " \t")) != NULL)
+	if (*tok)
+	  namev[nn++] = tok;
+    }
+  }
 
-void
-_ndb_close(NDB *ndb) {
-  if (!ndb)
-    return;
+  if (na == 0 || nn == 0) {
+    free(btmp);
+    return 1;
+  }
 
-#if NDB_DEBUG
-  if (f_nss_ndb_debug)
-    fprintf(stderr, "_ndb_close(%p) [%s])\n",
-	  ndb,
-	  ndb && ndb->path ? ndb->path : "<null>");
-#endif
+  /* Pointer arrays first to keep them aligned */
+  hp->h_aliases = balloc(nn*sizeof(char *), buf, blen);
+  if (!hp->h_aliases)
+    goto Fail;
+  
+  hp->h_addr_list = balloc((na+1)*sizeof(char *), buf, blen);
+  if (!hp->h_addr_list)
+    goto Fail;
 
-#if DB_VERSION_MAJOR >= 4
-  if (ndb->dbc) {
-    ndb->dbc->close(ndb->dbc);
+  for (i = 0; i < na; i++) {
+    hp->h_addr_list[i] = balloc(alen, buf, blen);
+    if (!hp->h_addr_list[i])
+      goto Fail;
+    memcpy(hp->h_addr_list[i], addrv[i], alen);
   }
-#endif
+  hp->h_addr_list[i] = NULL;
   
-  if (ndb->db) {
-    ndb->db->close(ndb->db
-#if DB_VERSION_MAJOR >= 4
-		   , 0
-#endif
-		   );
-  }
+  hp->h_name = strbdup(namev[0], buf, blen);
+  if (!hp->h_name)
+    goto Fail;
 
-  if (ndb->path) {
-    free(ndb->path);
+  for (i = 1; i < nn; i++) {
+    hp->h_aliases[i-1] = strbdup(namev[i], buf, blen);
+    if (!hp->h_aliases[i-1])
+      goto Fail;
   }
+  hp->h_aliases[i-1] = NULL;
 
-  memset(ndb, 0, sizeof(*ndb));
+  hp->h_addrtype = af;
+  hp->h_length = alen;
+  
+  free(btmp);
+  return 0;
+
+ Fail:
+  free(btmp);
+  return -1;
 }
 
+/*
+ * Copy a vector of strings into buf as a NULL terminated array
+ */
+static char **
+strbvdup(char **fv,
+	 int fc,
+	 char **buf,
+	 size_t *blen) {
+  char **av;
+  int i;
 
-int
-_ndb_open(NDB *ndb,
-	  const char *path,
-	  int rdwr_f) {
-#if DB_VERSION_MAJOR >= 4
-  int ret;
-#endif
-  pid_t pid = getpid();
+  
+  av = balloc((fc+1)*sizeof(char *), buf, blen);
+  if (!av)
+    return NULL;
 
-#if NDB_DEBUG
-  if (f_nss_ndb_debug)
-    fprintf(stderr, "_ndb_open(%p, \"%s\") -> ", ndb, path);
-#endif
+  for (i = 0; i < fc; i++) {
+    av[i] = strbdup(fv[i], buf, blen);
+    if (!av[i])
+      return NULL;
+  }
+  av[i] = NULL;
   
-  if (!ndb->db || ndb->pid != pid) {
-    if (ndb->path) {
-      free(ndb->path);
-    }
-    memset(ndb, 0, sizeof(*ndb));
-    ndb->pid = pid;
-    
-#if DB_VERSION_MAJOR >= 4
-    ret = db_env_create(&ndb->dbe, 0);
-    if (ret) {
-#if NDB_DEBUG
-      if (f_nss_ndb_debug)
-	fprintf(stderr, "FAIL (db_env_create)\n");
-#endif
-      return -1;
-    }
-    
-    ret = db_create(&ndb->db, NULL, 0);
-    if (ret) {
-#if NDB_DEBUG
-      if (f_nss_ndb_debug)
-	fprintf(stderr, "FAIL (db_create)\n");
-#endif
-      
-      ndb->dbe->close(ndb->dbe, 0);
-      ndb->dbe = NULL;
-      
-      return -1;
-    }
+  return av;
+}
 
-#if NDB_DEBUG
-    if (f_nss_ndb_debug)
-      fprintf(stderr, "created -> ");
-#endif
 
-    ret = ndb->db->open(ndb->db, NULL, path, NULL, DB_BTREE, (rdwr_f ? DB_CREATE : DB_RDONLY), 0644);
-    if (ret) {
-#if NDB_DEBUG
-      if (f_nss_ndb_debug)
-	fprintf(stderr, "FAIL (db->open)\n");
-#endif
-      
-      ndb->db->close(ndb->db, 0);
-      ndb->db = NULL;
-      
-      ndb->dbe->close(ndb->dbe, 0);
-      ndb->dbe = NULL;
-      
-      return -1;
-    }
+/*
+ * services.byname & services.byport format:
+ *   name port/proto alias alias ...
+ */
+static int
+str2servent(char *str,
+	    size_t size,
+	    struct servent *sp,
+	    char **buf,
+	    size_t *blen,
+	    size_t maxsize) {
+  char *fv[MAXSVFIELDS], *btmp, *proto;
+  unsigned int port;
+  int fc;
 
-    /* XXX: DB_Env - do locking? */
-    
-#else
-    ndb->db = dbopen(path, (rdwr_f ? O_RDWR|O_CREAT|O_EXLOCK : O_RDONLY|O_SHLOCK), 0644, DB_BTREE, NULL);
-    if (!ndb->db) {
-#if NDB_DEBUG
-      if (f_nss_ndb_debug)
-	fprintf(stderr, "FAIL (dbopen)\n");
-#endif
-      return -1;
-    }
-#endif
+  
+  if (!str || !sp) {
+    errno = EINVAL;
+    return -1;
+  }
 
-  ndb->path = strdup(path);
+  memset(sp, 0, sizeof(*sp));
   
-#if NDB_DEBUG
-  if (f_nss_ndb_debug)
-    fprintf(stderr, "opened -> ");
-#endif
+  btmp = strndup(str, size);
+  if (!btmp)
+    return -1;
+  
+  fc = strwsplit(btmp, fv, MAXSVFIELDS);
+  if (fc < 2) {
+    errno = EINVAL;
+    goto Fail;
+  }
+
+  proto = strchr(fv[1], '/');
+  if (!proto || sscanf(fv[1], "%u", &port) != 1 || port > 65535) {
+    errno = EINVAL;
+    goto Fail;
   }
+  ++proto;
   
-#if NDB_DEBUG
-  if (f_nss_ndb_debug)
-    fprintf(stderr, "%p\n", ndb);
-#endif
+  /* Pointer array first to keep it aligned */
+  sp->s_aliases = strbvdup(fv+2, fc-2, buf, blen);
+  if (!sp->s_aliases)
+    goto Fail;
+  
+  sp->s_name = strbdup(fv[0], buf, blen);
+  if (!sp->s_name)
+    goto Fail;
+  
+  sp->s_proto = strbdup(proto, buf, blen);
+  if (!sp->s_proto)
+    goto Fail;
+
+  sp->s_port = htons(port);
+  
+  free(btmp);
   return 0;
-}
 
-
-static int
-_ndb_getkey_r(NDB *ndb,
-	     const char *path,
-	     STR2OBJ str2obj,
-	     void *rv,
-	     void *mdata,
-	     char *name,
-	     void *pbuf,
-	     char *buf,
-	     size_t bsize,
-	     int *res) {
-  int ec = NS_SUCCESS;
-  void **ptr = rv;
-  DBT key, val;
-  int rc;
+ Fail:
+  free(btmp);
+  return -1;
+}
+
+
+/*
+ * protocols.byname & protocols.bynumber format:
+ *   name number alias alias ...
+ */
+static int
+str2protoent(char *str,
+	     size_t size,
+	     struct protoent *pp,
+	     char **buf,
+	     size_t *blen,
+	     size_t maxsize) {
+  char *fv[MAXSVFIELDS], *btmp;
+  int fc;
 
   
-  if (_ndb_open(ndb, path, 0) < 0)
-    return NS_UNAVAIL;
-  
-  *ptr = 0;
-  
-  memset(&key, 0, sizeof(key));
-  memset(&val, 0, sizeof(val));
+  if (!str || !pp) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  memset(pp, 0, sizeof(*pp));
   
-  key.data = name;
-  key.size = strlen(name);
+  btmp = strndup(str, size);
+  if (!btmp)
+    return -1;
   
-  rc = _ndb_get(ndb, &key, &val, 0);
-  if (rc < 0) {
-    *res = errno;
-    ec = NS_UNAVAIL;
-  } else if (rc > 0)
-    ec = NS_NOTFOUND;
-  else {
-    if ((*str2obj)(val.data, val.size, pbuf, &buf, &bsize, MAX_GETOBJ_SIZE) < 0) {
-      *res = errno;
-      ec = NS_UNAVAIL;
-    } else
-      *ptr = pbuf;
+  fc = strwsplit(btmp, fv, MAXSVFIELDS);
+  if (fc < 2 || sscanf(fv[1], "%d", &pp->p_proto) != 1) {
+    errno = EINVAL;
+    goto Fail;
   }
 
-  if (!ndb->stayopen)
-    _ndb_close(ndb);
+  pp->p_aliases = strbvdup(fv+2, fc-2, buf, blen);
+  if (!pp->p_aliases)
+    goto Fail;
   
-  return ec;
-}
+  pp->p_name = strbdup(fv[0], buf, blen);
+  if (!pp->p_name)
+    goto Fail;
   
+  free(btmp);
+  return 0;
+
+ Fail:
+  free(btmp);
+  return -1;
+}
 
+
+/*
+ * rpc.byname & rpc.bynumber format:
+ *   name number alias alias ...
+ */
 static int
-_ndb_getent_r(NDB *ndb,
-	     const char *path,
-	     STR2OBJ str2obj,
-	     void *rv,
-	     void *mdata,
-	     void *pbuf,
-	     char *buf,
-	     size_t bsize,
-	     int *res) {
-  void **ptr = rv;
-  int rc, ec = NS_SUCCESS;
-  DBT key, val;
-  
+str2rpcent(char *str,
+	   size_t size,
+	   struct rpcent *rp,
+	   char **buf,
+	   size_t *blen,
+	   size_t maxsize) {
+  char *fv[MAXSVFIELDS], *btmp;
+  int fc;
 
-  if (_ndb_open(ndb, path, 0) < 0) 
-    return NS_UNAVAIL;
+  
+  if (!str || !rp) {
+    errno = EINVAL;
+    return -1;
+  }
 
-#if DB_VERSION_MAJOR >= 4
-  if (!ndb->dbc) {
-    if ((rc = ndb->db->cursor(ndb->db, NULL, &ndb->dbc, 0)) || !ndb->dbc) {
-      return NS_UNAVAIL;
-    }
+  memset(rp, 0, sizeof(*rp));
+  
+  btmp = strndup(str, size);
+  if (!btmp)
+    return -1;
+  
+  fc = strwsplit(btmp, fv, MAXSVFIELDS);
+  if (fc < 2 || sscanf(fv[1], "%d", &rp->r_number) != 1) {
+    errno = EINVAL;
+    goto Fail;
   }
-#endif
+
+  rp->r_aliases = strbvdup(fv+2, fc-2, buf, blen);
+  if (!rp->r_aliases)
+    goto Fail;
   
-  *ptr = 0;
+  rp->r_name = strbdup(fv[0], buf, blen);
+  if (!rp->r_name)
+    goto Fail;
+  
+  free(btmp);
+  return 0;
 
-  memset(&key, 0, sizeof(key));
-  memset(&val, 0, sizeof(val));
+ Fail:
+  free(btmp);
+  return -1;
+}
 
-#if DB_VERSION_MAJOR >= 4
-  rc = ndb->dbc->get(ndb->dbc, &key, &val, ndb->prev_f ? DB_PREV : DB_NEXT);
-#else
-  rc = ndb->db->seq(ndb->db, &key, &val, ndb->prev_f ? R_PREV : R_NEXT);
-#endif
 
-  ndb->prev_f = 0;
+
+
+/*
+ * CRC32C (Castagnoli). Uses the SSE 4.2 crc32 instruction (8 bytes at
+ * a time) if the CPU has it, else a table.
+ */
+static uint32_t crc32c_table[256];
+static int crc32c_hw = 0;
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+static void
+_ndb_crc32c_init(void) {
+  uint32_t c;
+  int i, j;
+
   
-  if (rc < 0) {
-    _ndb_close(ndb);
-    *res = errno;
-    ec = NS_UNAVAIL;
-  } else if (rc > 0)
-    ec = NS_NOTFOUND;
-  else {
+  for (i = 0; i < 256; i++) {
+    for (c = i, j = 0; j < 8; j++)
+      c = (c & 1) ? (c >> 1) ^ 0x82F63B78 : c >> 1;
+    crc32c_table[i] = c;
+  }
+#ifdef NDB_CRC32C_SSE42
+  __builtin_cpu_init();
+  crc32c_hw = __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+#ifdef NDB_CRC32C_SSE42
+__attribute__((target("sse4.2")))
+static uint32_t
+_ndb_crc32c_sse42(uint32_t crc,
+		  const unsigned char *p,
+		  size_t len) {
+  uint64_t c = crc, v;
+
   
-    if ((*str2obj)(val.data, val.size, pbuf, &buf, &bsize, MAX_GETENT_SIZE) < 0) {
-      *res = errno;
-   
-      /* If errno == ERANGE (data can't fit in buffer), retry same record next time */
-      if (errno == ERANGE)
-	ndb->prev_f = 1;
-      
-      ec = NS_NOTFOUND;
-    } else
-      *ptr = pbuf;
+  while (len > 0 && ((uintptr_t) p & 7)) {
+    c = _mm_crc32_u8(c, *p++);
+    --len;
+  }
+  while (len >= 8) {
+    memcpy(&v, p, 8);
+    c = _mm_crc32_u64(c, v);
+    p += 8;
+    len -= 8;
   }
+  while (len-- > 0)
+    c = _mm_crc32_u8(c, *p++);
   
-  return ec;
+  return c;
 }
+#endif
 
+uint32_t
+_ndb_crc32c(uint32_t crc,
+	    const void *buf,
+	    size_t len) {
+  const unsigned char *p = buf;
 
-int
-_ndb_setent(NDB *ndb,
-	    int stayopen,
-	    const char *path) {
-  _ndb_close(ndb);
   
-  if (_ndb_open(ndb, path, 0) < 0)
-    return NS_UNAVAIL;
+  (void) pthread_once(&crc32c_once, _ndb_crc32c_init);
 
-  ndb->stayopen = stayopen;
-  return NS_SUCCESS;
+  crc = ~crc;
+#ifdef NDB_CRC32C_SSE42
+  if (crc32c_hw)
+    return ~_ndb_crc32c_sse42(crc, p, len);
+#endif
+  while (len-- > 0)
+    crc = crc32c_table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+  return ~crc;
 }
 
 
-
+/*
+ * Checks & strips the checksum trailer (if any) of a record. Returns 1
+ * if it had one (that matched, or wasn't checked), 0 if not and -1 if
+ * it didn't match.
+ */
 int
-_ndb_endent(NDB *ndb) {
-  _ndb_close(ndb);
-  return NS_SUCCESS;
+_ndb_crc_check(DBT *val,
+	       int verify) {
+  const unsigned char *p = val->data;
+  size_t len;
+  uint32_t crc;
+
+
+  if (val->size <= NDB_CRC_SIZE || p[val->size-NDB_CRC_SIZE-1] != '\0')
+    return 0;
+
+  len = val->size-NDB_CRC_SIZE;
+  val->size = len;
+  if (!verify)
+    return 1;
+  
+  crc = p[len] | (p[len+1] << 8) | (p[len+2] << 16) | ((uint32_t) p[len+3] << 24);
+  return _ndb_crc32c(0, p, len) == crc ? 1 : -1;
+}
+
+
+/* If records written from now on should get a checksum */
+static int ndb_crc_f = 0;
+
+void
+_ndb_checksums(int on) {
+  ndb_crc_f = on;
 }
 
 
+
 
+/*
+ * Sharded maps. The manifest is read when the map is opened, and
+ * keys are routed to a shard by (the upper half of) their hash.
+ */
 int
-nss_ndb_getpwnam_r(void *rv,
-		   void *mdata,
-		   va_list ap) {
-  char *name           = va_arg(ap, char *);
-  struct passwd *pbuf  = va_arg(ap, struct passwd *);
-  char *buf            = va_arg(ap, char *);
-  size_t bsize         = va_arg(ap, size_t);         
-  int *res             = va_arg(ap, int *);
-  char *cp;
-  char *nbuf = NULL;
-  int rc;
-
+_ndb_shards(const char *path) {
+  char mpath[PATH_MAX], buf[80], *cp;
+  FILE *fp;
+  int rc, n = 0;
 
-  _nss_ndb_init();
   
-  if (f_strip_workgroup) {
-    size_t len;
-    
-    /* Strip AD workgroup prefix if specified */
-    cp = strchr(name, '\\');
-    if (cp && (f_strip_workgroup[0] == '\0' || /* Accept all workgroups */
-	       cp-name == 0 || /* Empty workgroup specified (\user) */
-	       ((len = strlen(f_strip_workgroup)) == cp-name && 
-		strncasecmp(name, f_strip_workgroup, len) == 0))) /* Exact match */
-      name = cp+1;
+  rc = snprintf(mpath, sizeof(mpath), "%s%s", path, NDB_SHARDS_SUFFIX);
+  if (rc < 0 || rc >= sizeof(mpath)) {
+    errno = ENAMETOOLONG;
+    return -1;
   }
   
-  if (f_strip_realm) {
-    /* Strip Kerberos realm suffix if specified */
-    cp = strrchr(name, '@');
-    if (cp && (f_strip_realm[0] == '\0' ||        /* Accept all realms */
-	       strcasecmp(cp+1, f_strip_realm) == 0)) /* Exact match */
-      name = nbuf = strndup(name, cp-name);
+  fp = fopen(mpath, "r");
+  if (!fp)
+    return errno == ENOENT ? 0 : -1;
+
+  while (fgets(buf, sizeof(buf), fp)) {
+    cp = buf;
+    while (isspace(*cp))
+      ++cp;
+    if (*cp == '#' || !*cp)
+      continue;
+    if (sscanf(cp, "shards %d", &n) != 1)
+      n = -1;
+    break;
   }
   
-  rc = _ndb_getkey_r(&ndb_pwd_byname,
-		     path_passwd_byname,
-		     (STR2OBJ) str2passwd,
-		     rv, mdata,
-		     name, pbuf, buf, bsize, res);
-
-  if (nbuf)
-    free(nbuf);
+  fclose(fp);
   
-  return rc;
+  if (n < 1 || n > NDB_SHARDS_MAX) {
+    errno = EINVAL;
+    return -1;
+  }
+  
+  return n;
 }
 
 
-int
-nss_ndb_getpwuid_r(void *rv,
-		   void *mdata,
-		   va_list ap) {
-  uid_t uid            = va_arg(ap, uid_t);
-  struct passwd *pbuf  = va_arg(ap, struct passwd *);
-  char *buf            = va_arg(ap, char *);
-  size_t bsize         = va_arg(ap, size_t);         
-  int *res             = va_arg(ap, int *);
-  int rc;
-  char uidbuf[64];
+/*
+ * Single-file container (the 'container' setting, Berkeley DB 4 and
+ * later). Every map is a subdatabase, named like its own file, in the
+ * container file, so a process opens one file instead of one per map.
+ * Maps with password hashes (shadow.*) are never stored there, as the
+ * container is readable by everyone.
+ *
+ * Readers use the map's own file instead if it is newer than the
+ * container, as tools that don't know about the container (ndbsync)
+ * update the separate files.
+ *
+ * Returns 1 and sets 'file' to the container if 'path' is in it.
+ */
+#if DB_VERSION_MAJOR >= 4
+static int
+_ndb_newer(const struct stat *a,
+	   const struct stat *b) {
+#if defined(__linux__) || defined(__FreeBSD__)
+  if (a->st_mtime == b->st_mtime)
+    return a->st_mtim.tv_nsec > b->st_mtim.tv_nsec;
+#endif
+  return a->st_mtime > b->st_mtime;
+}
+#endif
+
+static int
+_ndb_subdb(const char *path,
+	   const char **file,
+	   int rdwr_f) {
+#if DB_VERSION_MAJOR >= 4
+  struct stat sb, cb;
+  const char *base;
 
   
-  rc = snprintf(uidbuf, sizeof(uidbuf), "%u", uid);
-  if (rc < 0)
-    return -1;
-  if (rc >= sizeof(uidbuf)) {
-    errno = ENOMEM;
-    return -1;
-  }
+  _nss_ndb_init();
   
-  return _ndb_getkey_r(&ndb_pwd_byuid,
-		      path_passwd_byuid,
-		      (STR2OBJ) str2passwd,
-		      rv, mdata,
-		      uidbuf, pbuf, buf, bsize, res);
-}
+  if (!f_container || !*f_container)
+    return 0;
+  
+  base = strrchr(path, '/');
+  base = base ? base+1 : path;
+  if (strncmp(base, "shadow.", 7) == 0)
+    return 0;
+
+  if (!rdwr_f && stat(path, &sb) == 0 && stat(f_container, &cb) == 0 &&
+      _ndb_newer(&sb, &cb))
+    return 0;
+
+  *file = f_container;
+  return 1;
+#else
+  return 0;
+#endif
+}
+
+
+/*
+ * stat() the file that changes when a map is rebuilt - the manifest
+ * if the map is sharded, else the database itself (or the container
+ * it is stored in).
+ */
+int
+_ndb_stat(const char *path,
+	  struct stat *sp) {
+  char mpath[PATH_MAX];
+  const char *file;
+  int rc;
+
+  
+  rc = snprintf(mpath, sizeof(mpath), "%s%s", path, NDB_SHARDS_SUFFIX);
+  if (rc >= 0 && rc < sizeof(mpath) && stat(mpath, sp) == 0)
+    return 0;
+  
+  if (_ndb_subdb(path, &file, 0) && stat(file, sp) == 0)
+    return 0;
+  
+  return stat(path, sp);
+}
+
+
+/*
+ * Write the shard manifest (<path>.shards). It is written to a temporary
+ * file that is renamed into place, both when a sharded map is created
+ * and after every update (so Bloom filters stamped with the old one
+ * are ignored). Used by makendb & ndbmerge.
+ */
+int
+_ndb_shards_write(const char *path,
+		  int n) {
+  char mpath[PATH_MAX], tpath[PATH_MAX];
+  FILE *fp;
+  int rc;
+
+  
+  rc = snprintf(mpath, sizeof(mpath), "%s%s", path, NDB_SHARDS_SUFFIX);
+  if (rc < 0 || rc >= sizeof(mpath) ||
+      (rc = snprintf(tpath, sizeof(tpath), "%s.%d", mpath, (int) getpid())) < 0 ||
+      rc >= sizeof(tpath)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+
+  fp = fopen(tpath, "w");
+  if (!fp)
+    return -1;
+
+  fprintf(fp, "# nss_ndb shard manifest - written by makendb/ndbmerge\n");
+  fprintf(fp, "shards %d\n", n);
+  if (fclose(fp) != 0) {
+    unlink(tpath);
+    return -1;
+  }
+
+  if (rename(tpath, mpath) < 0) {
+    unlink(tpath);
+    return -1;
+  }
+  
+  return 0;
+}
+
+
+static int
+_ndb_shardof(NDB *ndb,
+	     DBT *key) {
+  return (_ndb_bloom_hash(key->data, key->size) >> 32) % ndb->nshards;
+}
+
+
+/*
+ * Shards are opened on first use when reading, so a lookup only
+ * opens the one file it needs. Returns NULL on failure.
+ */
+static NDB *
+_ndb_shard(NDB *ndb,
+	   int i) {
+  NDB *sp = &ndb->shard[i];
+  char spath[PATH_MAX];
+
+  
+  if (!sp->db) {
+    if (snprintf(spath, sizeof(spath), "%s.%d", ndb->path, i) >= sizeof(spath)) {
+      errno = ENAMETOOLONG;
+      return NULL;
+    }
+    if (_ndb_open(sp, spath, 0) < 0)
+      return NULL;
+  }
+  
+  return sp;
+}
+
+
+
+/* Identity of a map file (see _ndb_stat()) */
+static void
+_ndb_stamp(NDB_STAMP *sp,
+	   const struct stat *sb) {
+  memset(sp, 0, sizeof(*sp));
+  sp->ino = sb->st_ino;
+  sp->size = sb->st_size;
+  sp->mtime = sb->st_mtime;
+#if defined(__linux__) || defined(__FreeBSD__)
+  sp->mtime_ns = sb->st_mtim.tv_nsec;
+#endif
+}
+
+/*
+ * The stamp of the map file of an open handle (the manifest of a
+ * sharded map). Looked up (at most) once per open, so the checks of a
+ * lookup share it.
+ */
+static const NDB_STAMP *
+_ndb_ndbstamp(NDB *ndb) {
+  struct stat sb;
+  int fd = -1;
+
+  
+  if (!ndb->stamped) {
+    if (ndb->shard) {
+      if (!ndb->path || _ndb_stat(ndb->path, &sb) < 0)
+	return NULL;
+    } else {
+      if (!ndb->db)
+	return NULL;
+#if DB_VERSION_MAJOR >= 4
+      if (ndb->db->fd(ndb->db, &fd) != 0)
+	fd = -1;
+#else
+      fd = ndb->db->fd(ndb->db);
+#endif
+      if (fd < 0 || fstat(fd, &sb) < 0)
+	return NULL;
+    }
+    _ndb_stamp(&ndb->stamp, &sb);
+    ndb->stamped = 1;
+  }
+  
+  return &ndb->stamp;
+}
+
+
+
+/*
+ * Key formats & sealed states of the maps last looked at, by path hash
+ * & map file, so lookups in maps that are closed after each call don't
+ * pay for finding them out every time
+ */
+#define NDB_MAPREF_CACHE 4
+
+/* Records looked at to tell if a map is sealed */
+#define NDB_SEALED_PROBE 8
+
+typedef struct mapref {
+  uint64_t h;
+  NDB_STAMP stamp;
+  int idfmt;
+  int sealed;
+} MAPREF;
+
+static __thread MAPREF mapref_cache[NDB_MAPREF_CACHE];
+static __thread unsigned int mapref_next = 0;
+
+/*
+ * The cache entry of the map file of a handle, a new (empty) one if
+ * not there. NULL for handles kept open, those remember it themselves.
+ */
+static MAPREF *
+_ndb_mapref(NDB *ndb) {
+  const NDB_STAMP *sp;
+  MAPREF *mr;
+  uint64_t h;
+  int i;
+
+
+  if (ndb->stayopen || !ndb->path || (sp = _ndb_ndbstamp(ndb)) == NULL)
+    return NULL;
+  
+  h = _ndb_bloom_hash(ndb->path, strlen(ndb->path));
+  for (i = 0; i < NDB_MAPREF_CACHE; i++) {
+    mr = &mapref_cache[i];
+    if (mr->h == h && memcmp(&mr->stamp, sp, sizeof(*sp)) == 0)
+      return mr;
+  }
+  
+  mr = &mapref_cache[mapref_next++ % NDB_MAPREF_CACHE];
+  memset(mr, 0, sizeof(*mr));
+  mr->h = h;
+  mr->stamp = *sp;
+  return mr;
+}
+
+/*
+ * Check if a map has checksums, by looking at the first (NUL
+ * terminated) record: it is sealed if that has a matching checksum
+ * trailer. Updates keep it that way, and only records in sealed maps
+ * have their trailer stripped. A sharded map is sealed if any shard is.
+ */
+int
+_ndb_sealed(NDB *ndb) {
+  MAPREF *mr;
+  DBT key, val, tmp;
+  int i, rc, sealed;
+#if DB_VERSION_MAJOR >= 4
+  DBC *dbc;
+#endif
+
+
+  if (!ndb)
+    return 0;
+  
+  if (ndb->shard) {
+    for (i = 0; i < ndb->nshards; i++)
+      if (_ndb_sealed(_ndb_shard(ndb, i)))
+	return 1;
+    return 0;
+  }
+  
+  if (ndb->sealed || !ndb->db)
+    return ndb->sealed == NDB_SEALED_YES;
+  
+  mr = _ndb_mapref(ndb);
+  if (mr && mr->sealed)
+    return (ndb->sealed = mr->sealed) == NDB_SEALED_YES;
+  
+  memset(&key, 0, sizeof(key));
+  memset(&val, 0, sizeof(val));
+  
+#if DB_VERSION_MAJOR >= 4
+  if (ndb->db->cursor(ndb->db, NULL, &dbc, 0) != 0)
+    return 0;
+#endif
+
+  /*
+   * Only NUL terminated records get a checksum, so look at records
+   * until one has a matching one or is NUL terminated without
+   */
+  sealed = 0;
+  for (i = 0; i < NDB_SEALED_PROBE && !sealed; i++) {
+#if DB_VERSION_MAJOR < 4
+    rc = ndb->db->seq(ndb->db, &key, &val, i ? R_NEXT : R_FIRST);
+#else
+    rc = dbc->get(dbc, &key, &val, i ? DB_NEXT : DB_FIRST);
+#endif
+    if (rc != 0)
+      break;
+    
+    tmp = val;
+    rc = _ndb_crc_check(&tmp, 1);
+    if (rc > 0)
+      sealed = NDB_SEALED_YES;
+    else if (rc == 0 && val.size > 0 && ((char *) val.data)[val.size-1] == '\0')
+      sealed = NDB_SEALED_NO;
+  }
+  
+#if DB_VERSION_MAJOR >= 4
+  dbc->close(dbc);
+#endif
+  
+  /* An empty map may still get sealed records (and don't keep errors) */
+  ndb->sealed = sealed ? sealed : NDB_SEALED_NO;
+  if (mr && sealed)
+    mr->sealed = sealed;
+  
+  return ndb->sealed == NDB_SEALED_YES;
+}
+
+
+
+int
+_ndb_get(NDB *ndb,
+	 DBT *key,
+	 DBT *val,
+	 int flags) {
+  int rc, sealed;
+
+  
+  if (!ndb)
+    return -1;
+
+  if (ndb->shard) {
+    if (key->data)
+      return _ndb_get(_ndb_shard(ndb, _ndb_shardof(ndb, key)), key, val, flags);
+
+    /* Sequential access walks the shards one after another */
+    if (flags != DB_NEXT)
+      return ndb->cshard < ndb->nshards ? _ndb_get(_ndb_shard(ndb, ndb->cshard), key, val, flags) : 1;
+    
+    for (; ndb->cshard < ndb->nshards; ndb->cshard++) {
+      rc = _ndb_get(_ndb_shard(ndb, ndb->cshard), key, val, flags);
+      if (rc != 1)
+	return rc;
+    }
+    return 1;
+  }
+  
+  /*
+   * Looked up before the fetch, as it may move the (DB 1.85) cursor:
+   * if not known yet the cursor wasn't used, so start from an end
+   */
+#if DB_VERSION_MAJOR < 4
+  if (!ndb->sealed && !ndb->crc && !key->data && (flags == DB_NEXT || flags == DB_PREV))
+    flags = (flags == DB_NEXT ? R_FIRST : R_LAST);
+#endif
+  sealed = ndb->crc || _ndb_sealed(ndb);
+
+  /* DB_SET_RANGE positions the cursor at the first key >= key */
+  if (!key->data || flags == DB_SET_RANGE) {
+#if DB_VERSION_MAJOR < 4
+    rc = ndb->db->seq(ndb->db, key, val, flags);
+#else
+    if (!ndb->dbc &&
+	ndb->db->cursor(ndb->db, NULL, &ndb->dbc, 0) != 0)
+      return -1;
+    
+    rc = ndb->dbc->get(ndb->dbc, key, val, flags);
+#endif
+  } else {
+#if DB_VERSION_MAJOR < 4
+    rc = ndb->db->get(ndb->db, key, val, flags);
+#else
+    rc = ndb->db->get(ndb->db, NULL, key, val, flags);
+#endif
+  }
+
+#if DB_VERSION_MAJOR >= 4
+  /* Same convention as DB 1.85: 1 = not found, -1 = error */
+  if (rc == DB_NOTFOUND)
+    return 1;
+  if (rc != 0) {
+    errno = rc > 0 ? rc : EIO;
+    return -1;
+  }
+#else
+  if (rc != 0)
+    return rc;
+#endif
+
+  /* Don't serve a corrupted record */
+  if (sealed && _ndb_crc_check(val, f_verify) < 0) {
+    errno = EBADMSG;
+    return -1;
+  }
+  return 0;
+}
+
+int
+_ndb_put(NDB *ndb,
+	 DBT *key,
+	 DBT *val,
+	 int flags) {
+  DBT cval;
+  unsigned char *p = NULL;
+  uint32_t crc;
+  int rc;
+
+  
+  if (!ndb)
+    return -1;
+
+  if (ndb->shard)
+    return _ndb_put(_ndb_shard(ndb, _ndb_shardof(ndb, key)), key, val, flags);
+
+  /* Append the checksum to (NUL terminated) records */
+  if (ndb->crc && val->size > 0 && ((char *) val->data)[val->size-1] == '\0') {
+    p = malloc(val->size+NDB_CRC_SIZE);
+    if (!p)
+      return -1;
+    
+    memcpy(p, val->data, val->size);
+    crc = _ndb_crc32c(0, p, val->size);
+    p[val->size]   = crc & 0xFF;
+    p[val->size+1] = (crc >> 8) & 0xFF;
+    p[val->size+2] = (crc >> 16) & 0xFF;
+    p[val->size+3] = crc >> 24;
+    
+    memset(&cval, 0, sizeof(cval));
+    cval.data = p;
+    cval.size = val->size+NDB_CRC_SIZE;
+    val = &cval;
+  }
+  
+#if DB_VERSION_MAJOR < 4
+  rc = ndb->db->put(ndb->db, key, val, flags);
+#else
+  rc = ndb->db->put(ndb->db, NULL, key, val, flags);
+  if (rc == DB_KEYEXIST)
+    rc = 1;
+  else if (rc != 0) {
+    errno = rc > 0 ? rc : EIO;
+    rc = -1;
+  }
+#endif
+  
+  if (p) {
+    int ec = errno;
+    
+    free(p);
+    errno = ec;
+  }
+  return rc;
+}
+
+
+int
+_ndb_del(NDB *ndb,
+	 DBT *key) {
+#if DB_VERSION_MAJOR >= 4
+  int rc;
+#endif
+
+  
+  if (!ndb)
+    return -1;
+
+  if (ndb->shard)
+    return _ndb_del(_ndb_shard(ndb, _ndb_shardof(ndb, key)), key);
+
+#if DB_VERSION_MAJOR < 4
+  return ndb->db->del(ndb->db, key, 0);
+#else
+  rc = ndb->db->del(ndb->db, NULL, key, 0);
+  if (rc == DB_NOTFOUND)
+    return 1;
+  if (rc != 0) {
+    errno = rc > 0 ? rc : EIO;
+    return -1;
+  }
+  return 0;
+#endif
+}
+
+/*
+ * Call fn for all records with a key >= from (or all if NULL), in key
+ * order (per shard for sharded maps), until it returns non-zero: > 0
+ * skips the rest of the current file, < 0 ends the scan. With DB 4+
+ * the records are read in bulk (many per call) with DB_MULTIPLE_KEY.
+ */
+int
+_ndb_scan(NDB *ndb,
+	  const DBT *from,
+	  int (*fn)(const DBT *key, const DBT *val, void *xp),
+	  void *xp) {
+  DBT key, val;
+  int i, rc, frc = 0;
+#if DB_VERSION_MAJOR >= 4
+  DBC *dbc;
+  DBT bulk;
+  void *p, *tmp;
+  u_int32_t flags, ulen;
+#endif
+
+  
+  if (!ndb)
+    return -1;
+
+  if (ndb->shard) {
+    for (i = 0; i < ndb->nshards; i++)
+      if (_ndb_scan(_ndb_shard(ndb, i), from, fn, xp) < 0)
+	return -1;
+    return 0;
+  }
+
+  memset(&key, 0, sizeof(key));
+  memset(&val, 0, sizeof(val));
+  if (from && from->data) {
+    key.data = from->data;
+    key.size = from->size;
+  }
+  
+#if DB_VERSION_MAJOR < 4
+  rc = ndb->db->seq(ndb->db, &key, &val, key.data ? R_CURSOR : R_FIRST);
+  while (rc == 0) {
+    frc = (*fn)(&key, &val, xp);
+    if (frc)
+      return frc < 0 ? -1 : 0;
+    rc = ndb->db->seq(ndb->db, &key, &val, R_NEXT);
+  }
+  return rc < 0 ? -1 : 0;
+#else
+  memset(&bulk, 0, sizeof(bulk));
+  bulk.ulen = NDB_BULK_SIZE;
+  bulk.flags = DB_DBT_USERMEM;
+  bulk.data = malloc(bulk.ulen);
+  if (!bulk.data)
+    return -1;
+
+  rc = ndb->db->cursor(ndb->db, NULL, &dbc, 0);
+  if (rc) {
+    free(bulk.data);
+    errno = rc > 0 ? rc : EIO;
+    return -1;
+  }
+
+  flags = key.data ? DB_SET_RANGE : DB_FIRST;
+  for (;;) {
+    rc = dbc->get(dbc, &key, &bulk, flags|DB_MULTIPLE_KEY);
+    if (rc == DB_BUFFER_SMALL) {
+      /*
+       * A record larger than the buffer. Bulk buffers must be a
+       * multiple of 1024 and at least a page (NDB_BULK_SIZE is both)
+       */
+      ulen = (bulk.size*2 + 1023) & ~(u_int32_t) 1023;
+      if (ulen < NDB_BULK_SIZE)
+	ulen = NDB_BULK_SIZE;
+      tmp = realloc(bulk.data, ulen);
+      if (!tmp) {
+	rc = ENOMEM;
+	break;
+      }
+      bulk.data = tmp;
+      bulk.ulen = ulen;
+      continue;
+    }
+    if (rc)
+      break;
+    
+    DB_MULTIPLE_INIT(p, &bulk);
+    for (;;) {
+      DB_MULTIPLE_KEY_NEXT(p, &bulk, key.data, key.size, val.data, val.size);
+      if (!p)
+	break;
+      frc = (*fn)(&key, &val, xp);
+      if (frc)
+	goto End;
+    }
+    flags = DB_NEXT;
+  }
+
+ End:
+  dbc->close(dbc);
+  free(bulk.data);
+
+  if (frc)
+    return frc < 0 ? -1 : 0;
+  if (rc == DB_NOTFOUND)
+    return 0;
+  errno = rc > 0 ? rc : EIO;
+  return -1;
+#endif
+}
+
+
+
+/*
+ * Id (uid/gid) keys are decimal strings, or in maps written with
+ * "makendb -n" 4 bytes big endian - so the btree is in id order. Such
+ * maps have a NDB_KEYFORMAT_KEY record, which is looked up the first
+ * time it is needed (and then remembered until the map file changes).
+ */
+int
+_ndb_idformat(NDB *ndb) {
+  DBT key, val;
+  MAPREF *mr = NULL;
+  int rc;
+
+
+  if (!ndb)
+    return -1;
+  
+  /* Kept in the handle while open, the cache is for those closed after each lookup */
+  if (!ndb->idfmt) {
+    mr = _ndb_mapref(ndb);
+    if (mr && mr->idfmt)
+      return ndb->idfmt = mr->idfmt;
+    
+    memset(&key, 0, sizeof(key));
+    memset(&val, 0, sizeof(val));
+    key.data = NDB_KEYFORMAT_KEY;
+    key.size = sizeof(NDB_KEYFORMAT_KEY)-1;
+    
+    rc = _ndb_get(ndb, &key, &val, 0);
+    if (rc < 0)
+      return -1;
+    
+    ndb->idfmt = (rc == 0 && val.size >= 4 && memcmp(val.data, NDB_KEYFORMAT_BE32, 4) == 0) ?
+      NDB_IDKEY_BE32 : NDB_IDKEY_DEC;
+    
+    if (mr)
+      mr->idfmt = ndb->idfmt;
+  }
+  
+  return ndb->idfmt;
+}
+
+/* Mark a (new, empty) map as having binary id keys */
+int
+_ndb_idformat_write(NDB *ndb) {
+  DBT key, val;
+
+  
+  memset(&key, 0, sizeof(key));
+  memset(&val, 0, sizeof(val));
+  key.data = NDB_KEYFORMAT_KEY;
+  key.size = sizeof(NDB_KEYFORMAT_KEY)-1;
+  val.data = NDB_KEYFORMAT_BE32;
+  val.size = sizeof(NDB_KEYFORMAT_BE32);
+  
+  if (_ndb_put(ndb, &key, &val, 0) < 0)
+    return -1;
+  
+  /* The file may not look changed yet */
+  memset(mapref_cache, 0, sizeof(mapref_cache));
+  ndb->idfmt = NDB_IDKEY_BE32;
+  return 0;
+}
+
+/*
+ * Set 'key' to the key of an id in the map, formatted in 'buf'
+ */
+int
+_ndb_idkey(NDB *ndb,
+	   DBT *key,
+	   char *buf,
+	   size_t bsize,
+	   unsigned long id) {
+  unsigned char *p = (unsigned char *) buf;
+  int rc;
+
+  
+  switch (_ndb_idformat(ndb)) {
+  case NDB_IDKEY_BE32:
+    if (id > 0xFFFFFFFFUL || bsize < 4) {
+      errno = ERANGE;
+      return -1;
+    }
+    p[0] = id >> 24;
+    p[1] = (id >> 16) & 0xFF;
+    p[2] = (id >> 8) & 0xFF;
+    p[3] = id & 0xFF;
+    rc = 4;
+    break;
+
+  case NDB_IDKEY_DEC:
+    rc = snprintf(buf, bsize, "%lu", id);
+    if (rc < 0)
+      return -1;
+    if (rc >= bsize) {
+      errno = ERANGE;
+      return -1;
+    }
+    break;
+    
+  default:
+    return -1;
+  }
+
+  key->data = buf;
+  key->size = rc;
+  return 0;
+}
+
+/*
+ * Same for an id as text (as is in maps with decimal keys)
+ */
+int
+_ndb_idkey_str(NDB *ndb,
+	       DBT *key,
+	       char *buf,
+	       size_t bsize,
+	       const char *id) {
+  unsigned long v;
+  char *ep;
+
+  
+  switch (_ndb_idformat(ndb)) {
+  case NDB_IDKEY_BE32:
+    errno = 0;
+    v = strtoul(id, &ep, 10);
+    if (!isdigit((unsigned char) *id) || *ep || errno) {
+      errno = EINVAL;
+      return -1;
+    }
+    return _ndb_idkey(ndb, key, buf, bsize, v);
+
+  case NDB_IDKEY_DEC:
+    key->data = (void *) id;
+    key->size = strlen(id);
+    return 0;
+  }
+
+  return -1;
+}
+
+/*
+ * Get the id of a key in a map with key format 'fmt'. Returns -1 if
+ * it isn't an id (like the key format record).
+ */
+int
+_ndb_keyid(const DBT *key,
+	   int fmt,
+	   unsigned long *idp) {
+  const unsigned char *p = key->data;
+  unsigned long id = 0;
+  size_t i;
+
+  
+  if (fmt == NDB_IDKEY_BE32) {
+    if (key->size != 4)
+      return -1;
+    *idp = ((unsigned long) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+    return 0;
+  }
+  
+  if (key->size == 0 || key->size > 20)
+    return -1;
+  for (i = 0; i < key->size; i++) {
+    if (!isdigit(p[i]))
+      return -1;
+    id = id*10 + p[i]-'0';
+  }
+  *idp = id;
+  return 0;
+}
+
+
+
+#if DB_VERSION_MAJOR >= 4
+/* Process-wide shared & private environments (see _ndb_env()) */
+static DB_ENV *ndb_env = NULL;
+static pthread_once_t ndb_env_once = PTHREAD_ONCE_INIT;
+static DB_ENV *ndb_penv = NULL;
+static pthread_once_t ndb_penv_once = PTHREAD_ONCE_INIT;
+static const pthread_once_t ndb_once_init = PTHREAD_ONCE_INIT;
+
+/*
+ * Close the file descriptor of a handle inherited from the parent. The
+ * handle itself is just forgotten (see _ndb_forget()), and would leak
+ * it. Other threads' handles are gone in the child, their descriptors
+ * are only closed on exec(). Handles left behind by an earlier fork()
+ * are skipped, their descriptors were closed then.
+ */
+static void
+_ndb_closefd(NDB *ndb) {
+  int i, fd;
+
+  
+  if (ndb->gen != ndb_fork_gen)
+    return;
+  
+  if (ndb->shard)
+    for (i = 0; i < ndb->nshards; i++)
+      _ndb_closefd(&ndb->shard[i]);
+  
+  if (ndb->db && ndb->db->fd(ndb->db, &fd) == 0)
+    (void) close(fd);
+}
+#endif
+
+
+static void
+_ndb_atfork_child(void) {
+#if DB_VERSION_MAJOR >= 4
+  /* All at once, before a new handle could get the same descriptor */
+  _ndb_thread_handles(_ndb_closefd);
+#endif
+  ++ndb_fork_gen;
+#if DB_VERSION_MAJOR >= 4
+  /* The parent's environments may not be used (or closed) in the child */
+  ndb_env = NULL;
+  ndb_env_once = ndb_once_init;
+  ndb_penv = NULL;
+  ndb_penv_once = ndb_once_init;
+#endif
+}
+
+
+static void
+_ndb_atfork_init(void) {
+  (void) pthread_atfork(NULL, NULL, _ndb_atfork_child);
+}
+
+
+/*
+ * Drop a handle inherited from the parent process. The old Berkeley DB
+ * 1.85 handles are private to the process (a file descriptor & cached
+ * pages), so they are closed to not leak them. Berkeley DB 4 handles
+ * may not be used at all after fork() - not even closed - so they are
+ * just forgotten (their descriptors are closed by _ndb_atfork_child()).
+ */
+static void
+_ndb_forget(NDB *ndb) {
+#if DB_VERSION_MAJOR >= 4
+  int i;
+
+  
+  if (ndb->shard) {
+    for (i = 0; i < ndb->nshards; i++)
+      _ndb_forget(&ndb->shard[i]);
+    free(ndb->shard);
+  }
+  
+  if (ndb->path)
+    free(ndb->path);
+  
+  memset(ndb, 0, sizeof(*ndb));
+#else
+  ndb->gen = ndb_fork_gen;
+  _ndb_close(ndb);
+#endif
+}
+
+
+void
+_ndb_close(NDB *ndb) {
+  if (!ndb)
+    return;
+
+  if (ndb->gen != ndb_fork_gen && (ndb->db || ndb->shard)) {
+    _ndb_forget(ndb);
+    return;
+  }
+
+#if NDB_DEBUG
+  if (f_nss_ndb_debug)
+    fprintf(stderr, "_ndb_close(%p) [%s])\n",
+	  ndb,
+	  ndb && ndb->path ? ndb->path : "<null>");
+#endif
+
+  if (ndb->shard) {
+    int i;
+    
+    for (i = 0; i < ndb->nshards; i++)
+      _ndb_close(&ndb->shard[i]);
+    free(ndb->shard);
+  }
+  
+#if DB_VERSION_MAJOR >= 4
+  if (ndb->dbc) {
+    ndb->dbc->close(ndb->dbc);
+  }
+#endif
+  
+  if (ndb->db) {
+    ndb->db->close(ndb->db
+#if DB_VERSION_MAJOR >= 4
+		   , 0
+#endif
+		   );
+  }
+
+  if (ndb->path) {
+    free(ndb->path);
+  }
+
+  memset(ndb, 0, sizeof(*ndb));
+}
+
+
+/*
+ * Optional shared database environment (the 'dbenv' setting). The memory
+ * pool lives in the region files in the environment directory, so its
+ * cache is paid for once per host and not once per process & handle.
+ * It is joined once per process (DB_THREAD, shared by all threads) with
+ * Concurrent Data Store locking, so makendb & ndbmerge can update the
+ * databases through it while others read them. If it doesn't exist it
+ * is created (sized by 'cachesize') if we are allowed to, and if it
+ * can't be joined the databases are opened with a private cache as
+ * before.
+ *
+ * Maps kept open are reopened when their file changes (or is replaced),
+ * see _ndb_changed(). Writes made outside the environment are not
+ * seen in its cache, so ndbsync refuses to run when it is set.
+ */
+#if DB_VERSION_MAJOR >= 4
+#define NDB_ENV_FLAGS (DB_INIT_CDB|DB_INIT_MPOOL|DB_THREAD)
+
+
+/*
+ * Without a shared environment the subdatabases in a container still
+ * need a common (private) one, so the file is opened (and cached) once
+ * and not once per map. It is shared by all threads of the process
+ * (and kept until it exits).
+ */
+static void
+_ndb_env_private_init(void) {
+  DB_ENV *dbe;
+  int ret;
+
+  
+  if (db_env_create(&dbe, 0) != 0)
+    return;
+  
+  if (f_cachesize)
+    dbe->set_cachesize(dbe, (u_int32_t) (f_cachesize >> 30), (u_int32_t) (f_cachesize & 0x3FFFFFFF), 1);
+  
+  ret = dbe->open(dbe, NULL, DB_CREATE|DB_PRIVATE|DB_INIT_MPOOL|DB_THREAD, 0);
+  if (ret) {
+#if NDB_DEBUG
+    if (f_nss_ndb_debug)
+      fprintf(stderr, "_ndb_env_private(): %s\n", db_strerror(ret));
+#endif
+    dbe->close(dbe, 0);
+    return;
+  }
+  
+  ndb_penv = dbe;
+}
+
+static DB_ENV *
+_ndb_env_private(void) {
+  if (!f_container || !*f_container)
+    return NULL;
+  
+  (void) pthread_once(&ndb_penv_once, _ndb_env_private_init);
+  return ndb_penv;
+}
+
+static void
+_ndb_env_init(void) {
+  DB_ENV *dbe;
+  int ret;
+
+  
+  if (db_env_create(&dbe, 0) != 0)
+    return;
+  
+  ret = dbe->open(dbe, f_dbenv, NDB_ENV_FLAGS, 0);
+  if (ret == ENOENT) {
+    dbe->close(dbe, 0);
+    if (db_env_create(&dbe, 0) != 0)
+      return;
+
+    if (f_cachesize)
+      dbe->set_cachesize(dbe, (u_int32_t) (f_cachesize >> 30), (u_int32_t) (f_cachesize & 0x3FFFFFFF), 1);
+    
+    ret = dbe->open(dbe, f_dbenv, DB_CREATE|NDB_ENV_FLAGS, 0644);
+  }
+  
+  if (ret) {
+#if NDB_DEBUG
+    if (f_nss_ndb_debug)
+      fprintf(stderr, "_ndb_env(\"%s\"): %s (using a private cache)\n", f_dbenv, db_strerror(ret));
+#endif
+    dbe->close(dbe, 0);
+    return;
+  }
+
+  ndb_env = dbe;
+}
+
+static DB_ENV *
+_ndb_env(void) {
+  _nss_ndb_init();
+  
+  if (f_dbenv && *f_dbenv) {
+    (void) pthread_once(&ndb_env_once, _ndb_env_init);
+    if (ndb_env)
+      return ndb_env;
+  }
+
+  return _ndb_env_private();
+}
+
+
+/*
+ * Returns 1 if a map (handle) kept open in the shared environment has
+ * been changed or replaced since it was opened, and can be reopened
+ * (no cursor open in it)
+ */
+static int
+_ndb_changed(NDB *ndb,
+	     const char *path) {
+  NDB_STAMP cur;
+  struct stat sb;
+  int i;
+
+  
+  if (!ndb_env || ndb->gen != ndb_fork_gen || (!ndb->db && !ndb->shard))
+    return 0;
+
+  if (ndb->dbc)
+    return 0;
+  for (i = 0; ndb->shard && i < ndb->nshards; i++)
+    if (ndb->shard[i].dbc)
+      return 0;
+  
+  if (_ndb_stat(path, &sb) < 0)
+    return 0;
+  _ndb_stamp(&cur, &sb);
+  
+  return memcmp(&cur, &ndb->stamp, sizeof(cur)) != 0;
+}
+#endif
+
+
+/*
+ * Override the 'container' setting (makendb -C)
+ */
+void
+_ndb_container(const char *path) {
+  _nss_ndb_init();
+  
+  if (f_container)
+    free((void *) f_container);
+  f_container = path ? strdup(path) : NULL;
+}
+
+
+/*
+ * Override the 'dbenv' setting (makendb -E)
+ */
+void
+_ndb_dbenv(const char *home) {
+  _nss_ndb_init();
+  
+  if (f_dbenv)
+    free((void *) f_dbenv);
+  f_dbenv = home ? strdup(home) : NULL;
+}
+
+
+/*
+ * Releases what an exiting thread has open & allocated: its handles
+ * (also those kept open by setpwent() etc), uid to name table and
+ * config strings. The Bloom filters have their own key.
+ */
+static pthread_key_t ndb_thread_key;
+static pthread_once_t ndb_thread_key_once = PTHREAD_ONCE_INIT;
+static __thread int ndb_thread_key_set = 0;
+
+static void
+_ndb_thread_close(NDB *ndb) {
+  if (ndb->db || ndb->shard || ndb->path)
+    _ndb_close(ndb);
+}
+
+static void
+_ndb_thread_exit(void *p) {
+  _ndb_thread_handles(_ndb_thread_close);
+
+  if (names_cache.np)
+    munmap(names_cache.np, names_cache.size);
+  free(names_cache.path);
+  memset(&names_cache, 0, sizeof(names_cache));
+
+  free((void *) f_strip_workgroup);
+  f_strip_workgroup = NULL;
+  free((void *) f_strip_realm);
+  f_strip_realm = NULL;
+  free((void *) f_dbenv);
+  f_dbenv = NULL;
+  free((void *) f_container);
+  f_container = NULL;
+  f_nss_ndb_init = 0;
+  
+  ndb_thread_key_set = 0;
+}
+
+
+static void
+_ndb_thread_key_init(void) {
+  (void) pthread_key_create(&ndb_thread_key, _ndb_thread_exit);
+}
+
+
+int
+_ndb_open(NDB *ndb,
+	  const char *path,
+	  int rdwr_f) {
+#if DB_VERSION_MAJOR >= 4
+  int ret, fd;
+  const char *subdb;
+  struct stat sb;
+#endif
+  const char *file = path;
+  char spath[PATH_MAX];
+  int i, n, stayopen = 0;
+
+#if NDB_DEBUG
+  if (f_nss_ndb_debug)
+    fprintf(stderr, "_ndb_open(%p, \"%s\") -> ", ndb, path);
+#endif
+  
+  (void) pthread_once(&ndb_atfork_once, _ndb_atfork_init);
+  
+  if (!ndb_thread_key_set) {
+    (void) pthread_once(&ndb_thread_key_once, _ndb_thread_key_init);
+    (void) pthread_setspecific(ndb_thread_key, &ndb_thread_key_set);
+    ndb_thread_key_set = 1;
+  }
+  
+#if DB_VERSION_MAJOR >= 4
+  if (!rdwr_f && _ndb_changed(ndb, path)) {
+#if NDB_DEBUG
+    if (f_nss_ndb_debug)
+      fprintf(stderr, "changed -> ");
+#endif
+    stayopen = ndb->stayopen;
+    _ndb_close(ndb);
+  }
+#endif
+
+  if ((!ndb->db && !ndb->shard) || ndb->gen != ndb_fork_gen) {
+    if (ndb->db || ndb->shard)
+      _ndb_forget(ndb);
+    else if (ndb->path) {
+      free(ndb->path);
+    }
+    memset(ndb, 0, sizeof(*ndb));
+    ndb->gen = ndb_fork_gen;
+    ndb->stayopen = stayopen;
+
+#if DB_VERSION_MAJOR >= 4
+    /* Stamped before opening, so a change meanwhile reopens it later */
+    if (!rdwr_f && _ndb_env() && ndb_env && _ndb_stat(path, &sb) == 0) {
+      _ndb_stamp(&ndb->stamp, &sb);
+      ndb->stamped = 1;
+    }
+#endif
+
+    n = _ndb_shards(path);
+    if (n < 0) {
+#if NDB_DEBUG
+      if (f_nss_ndb_debug)
+	fprintf(stderr, "FAIL (shard manifest)\n");
+#endif
+      return -1;
+    }
+    
+    if (n > 0) {
+      ndb->shard = calloc(n, sizeof(NDB));
+      ndb->path = strdup(path);
+      if (!ndb->shard || !ndb->path) {
+	_ndb_close(ndb);
+	return -1;
+      }
+      ndb->nshards = n;
+      
+      /* Opened on demand by _ndb_shard() when reading */
+      for (i = 0; rdwr_f && i < n; i++) {
+	if (snprintf(spath, sizeof(spath), "%s.%d", path, i) >= sizeof(spath)) {
+	  errno = ENAMETOOLONG;
+	  break;
+	}
+	if (_ndb_open(&ndb->shard[i], spath, rdwr_f) < 0)
+	  break;
+      }
+      
+      if (rdwr_f && i < n) {
+	int ec = errno;
+	
+	_ndb_close(ndb);
+	errno = ec;
+	return -1;
+      }
+
+      /* Sealed if any shard is, some may still be empty */
+      for (i = 0; rdwr_f && i < n; i++)
+	ndb->crc |= ndb->shard[i].crc;
+      for (i = 0; ndb->crc && i < n; i++)
+	ndb->shard[i].crc = 1;
+      
+      return 0;
+    }
+    
+#if DB_VERSION_MAJOR >= 4
+    ret = db_create(&ndb->db, _ndb_env(), 0);
+    if (ret) {
+#if NDB_DEBUG
+      if (f_nss_ndb_debug)
+	fprintf(stderr, "FAIL (db_create)\n");
+#endif
+      ndb->db = NULL;
+      errno = ret > 0 ? ret : EIO;
+      return -1;
+    }
+
+#if NDB_DEBUG
+    if (f_nss_ndb_debug)
+      fprintf(stderr, "created -> ");
+#endif
+
+    if (_ndb_subdb(path, &file, rdwr_f)) {
+      subdb = strrchr(path, '/');
+      subdb = subdb ? subdb+1 : path;
+      
+      ret = ndb->db->open(ndb->db, NULL, file, subdb, DB_BTREE, (rdwr_f ? DB_CREATE : DB_RDONLY), 0644);
+      if (ret == ENOENT && !rdwr_f) {
+	/* Not in the container (yet), try a separate file */
+	ndb->db->close(ndb->db, 0);
+	file = path;
+	ret = db_create(&ndb->db, _ndb_env(), 0);
+	if (ret == 0)
+	  ret = ndb->db->open(ndb->db, NULL, path, NULL, DB_BTREE, DB_RDONLY, 0644);
+	else
+	  ndb->db = NULL;
+      }
+    } else
+      ret = ndb->db->open(ndb->db, NULL, path, NULL, DB_BTREE, (rdwr_f ? DB_CREATE : DB_RDONLY), 0644);
+    if (ret) {
+#if NDB_DEBUG
+      if (f_nss_ndb_debug)
+	fprintf(stderr, "FAIL (db->open)\n");
+#endif
+      
+      if (ndb->db)
+	ndb->db->close(ndb->db, 0);
+      ndb->db = NULL;
+      
+      errno = ret > 0 ? ret : EIO;
+      return -1;
+    }
+    
+    /* Not inherited by programs exec()ed, see also _ndb_atfork_child() */
+    if (ndb->db->fd(ndb->db, &fd) == 0)
+      (void) fcntl(fd, F_SETFD, FD_CLOEXEC);
+    
+#else
+    ndb->db = dbopen(path, (rdwr_f ? O_RDWR|O_CREAT|O_EXLOCK : O_RDONLY|O_SHLOCK), 0644, DB_BTREE, NULL);
+    if (!ndb->db) {
+#if NDB_DEBUG
+      if (f_nss_ndb_debug)
+	fprintf(stderr, "FAIL (dbopen)\n");
+#endif
+      return -1;
+    }
+#endif
+
+  ndb->path = strdup(path);
+  
+  if (rdwr_f)
+    ndb->crc = ndb_crc_f || _ndb_sealed(ndb);
+  
+  if (f_warmup && !rdwr_f)
+    (void) _ndb_warm(file, 0);
+  
+#if NDB_DEBUG
+  if (f_nss_ndb_debug)
+    fprintf(stderr, "opened -> ");
+#endif
+  }
+  
+#if NDB_DEBUG
+  if (f_nss_ndb_debug)
+    fprintf(stderr, "%p\n", ndb);
+#endif
+  return 0;
+}
+
+
+
+/*
+ * Warm up a database file after a reboot so the first lookups don't
+ * pay for page faults all over the btree. Returns the file size.
+ */
+static long long
+_ndb_warm_file(const char *path,
+	       int flags) {
+  struct stat sb;
+  volatile const char *p;
+  long pgsize;
+  off_t o;
+  char *mp;
+  int fd;
+  
+  
+  fd = open(path, O_RDONLY|O_CLOEXEC);
+  if (fd < 0)
+    return -1;
+  
+  if (fstat(fd, &sb) < 0) {
+    close(fd);
+    return -1;
+  }
+  
+#ifdef POSIX_FADV_WILLNEED
+  /* Just starts the readahead, doesn't wait for it */
+  (void) posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+#endif
+
+  if (!(flags & (NDB_WARM_FAULT|NDB_WARM_LOCK)) || sb.st_size == 0) {
+    close(fd);
+    return sb.st_size;
+  }
+
+  mp = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mp == MAP_FAILED)
+    return -1;
+
+#ifdef MADV_WILLNEED
+  (void) madvise(mp, sb.st_size, MADV_WILLNEED);
+#endif
+#ifdef MADV_HUGEPAGE
+  (void) madvise(mp, sb.st_size, MADV_HUGEPAGE);
+#endif
+
+  pgsize = sysconf(_SC_PAGESIZE);
+  if (pgsize <= 0)
+    pgsize = 4096;
+  for (p = mp, o = 0; o < sb.st_size; o += pgsize)
+    (void) p[o];
+
+  if (flags & NDB_WARM_LOCK) {
+    /* Stays mapped (and locked) for as long as the process lives */
+    if (mlock(mp, sb.st_size) < 0) {
+      int ec = errno;
+      
+      munmap(mp, sb.st_size);
+      errno = ec;
+      return -1;
+    }
+  } else
+    munmap(mp, sb.st_size);
+  
+  return sb.st_size;
+}
+
+
+/*
+ * Warm up a map (all of its shards if split, or the container it is
+ * in). Returns the number of bytes, or -1 on failure.
+ */
+long long
+_ndb_warm(const char *path,
+	  int flags) {
+  char spath[PATH_MAX];
+  long long rc, tot = 0;
+  int i, n;
+
+  
+  n = _ndb_shards(path);
+  if (n < 0)
+    return -1;
+  
+  if (n == 0) {
+    const char *file;
+    
+    if (access(path, F_OK) < 0 && _ndb_subdb(path, &file, 0))
+      path = file;
+    return _ndb_warm_file(path, flags);
+  }
+
+  for (i = 0; i < n; i++) {
+    if (snprintf(spath, sizeof(spath), "%s.%d", path, i) >= sizeof(spath)) {
+      errno = ENAMETOOLONG;
+      return -1;
+    }
+    rc = _ndb_warm_file(spath, flags);
+    if (rc < 0)
+      return -1;
+    tot += rc;
+  }
+  
+  return tot;
+}
+
+
+
+/*
+ * Bloom filters in front of the databases, so lookups of keys that
+ * are not there (invalid users probed by sshd etc) can be answered
+ * without walking the btree.
+ *
+ * The filters are mmap()ed once per thread and map (path) and kept
+ * until the database changes (also in child processes after fork(),
+ * as they are read-only and not tied to the process) or the thread
+ * exits. The database (or its shard manifest) is stat()ed on every
+ * check, so a filter that doesn't match the current database is never
+ * used.
+ */
+#ifndef NDB_BLOOM_CACHE
+#define NDB_BLOOM_CACHE 32
+#endif
+
+typedef struct {
+  const char *path;  /* One of the path_* strings above */
+  NDB_BLOOM stamp;   /* Database state when the filter was loaded */
+  NDB_BLOOM *bp;     /* mmap()ed sidecar file, or NULL if none/stale */
+  size_t size;
+} BLOOMREF;
+
+static __thread BLOOMREF bloom_cache[NDB_BLOOM_CACHE];
+
+static pthread_key_t bloom_key;
+static pthread_once_t bloom_key_once = PTHREAD_ONCE_INIT;
+
+
+/*
+ * Unmaps the filters of an exiting thread
+ */
+static void
+_ndb_bloom_free(void *p) {
+  BLOOMREF *bv = p;
+  int i;
+
+  
+  for (i = 0; i < NDB_BLOOM_CACHE; i++) {
+    if (bv[i].bp)
+      munmap(bv[i].bp, bv[i].size);
+    memset(&bv[i], 0, sizeof(bv[i]));
+  }
+}
+
+
+static void
+_ndb_bloom_key_init(void) {
+  (void) pthread_key_create(&bloom_key, _ndb_bloom_free);
+}
+
+
+static uint64_t
+_ndb_bloom_mix(uint64_t h) {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+
+uint64_t
+_ndb_bloom_hash(const void *key,
+		size_t len) {
+  const unsigned char *cp = key;
+  uint64_t h = 0xcbf29ce484222325ULL; /* FNV-1a */
+
+  
+  while (len-- > 0) {
+    h ^= *cp++;
+    h *= 0x100000001b3ULL;
+  }
+  
+  return _ndb_bloom_mix(h);
+}
+
+
+/*
+ * Bit i of a key is (h + i*h2) % nbits (double hashing)
+ */
+void
+_ndb_bloom_add(NDB_BLOOM *bp,
+	       uint64_t h) {
+  unsigned char *bits = (unsigned char *) (bp+1);
+  uint64_t b, h2 = _ndb_bloom_mix(h ^ 0x9e3779b97f4a7c15ULL) | 1;
+  uint32_t i;
+
+  
+  for (i = 0; i < bp->nhash; i++, h += h2) {
+    b = h % bp->nbits;
+    bits[b >> 3] |= 1 << (b & 7);
+  }
+}
+
+
+static int
+_ndb_bloom_test(const NDB_BLOOM *bp,
+		uint64_t h) {
+  const unsigned char *bits = (const unsigned char *) (bp+1);
+  uint64_t b, h2 = _ndb_bloom_mix(h ^ 0x9e3779b97f4a7c15ULL) | 1;
+  uint32_t i;
+
+  
+  for (i = 0; i < bp->nhash; i++, h += h2) {
+    b = h % bp->nbits;
+    if (!(bits[b >> 3] & (1 << (b & 7))))
+      return 0;
+  }
+  
+  return 1;
+}
+
+
+void
+_ndb_bloom_stamp(NDB_BLOOM *bp,
+		 const struct stat *sp) {
+  bp->db_ino = sp->st_ino;
+  bp->db_size = sp->st_size;
+  bp->db_mtime = sp->st_mtime;
+#if defined(__linux__) || defined(__FreeBSD__)
+  bp->db_mtime_ns = sp->st_mtim.tv_nsec;
+#else
+  bp->db_mtime_ns = 0;
+#endif
+}
+
+
+static int
+_ndb_bloom_same(const NDB_BLOOM *a,
+		const NDB_BLOOM *b) {
+  return (a->db_ino == b->db_ino &&
+	  a->db_size == b->db_size &&
+	  a->db_mtime == b->db_mtime &&
+	  a->db_mtime_ns == b->db_mtime_ns);
+}
+
+
+static void
+_ndb_bloom_load(BLOOMREF *br) {
+  char bpath[PATH_MAX];
+  struct stat sb;
+  NDB_BLOOM *bp;
+  int fd, rc;
+
+  
+  rc = snprintf(bpath, sizeof(bpath), "%s%s", br->path, NDB_BLOOM_SUFFIX);
+  if (rc < 0 || rc >= sizeof(bpath))
+    return;
+  
+  fd = open(bpath, O_RDONLY|O_CLOEXEC);
+  if (fd < 0)
+    return;
+  
+  if (fstat(fd, &sb) < 0 || sb.st_size < sizeof(*bp)) {
+    close(fd);
+    return;
+  }
+  
+  bp = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (bp == MAP_FAILED)
+    return;
+
+  if (memcmp(bp->magic, NDB_BLOOM_MAGIC, sizeof(bp->magic)) != 0 ||
+      bp->version != NDB_BLOOM_VERSION ||
+      bp->nhash == 0 || bp->nbits == 0 ||
+      (bp->nbits+7)/8 > sb.st_size - sizeof(*bp) ||
+      !_ndb_bloom_same(bp, &br->stamp)) {
+#if NDB_DEBUG
+    if (f_nss_ndb_debug)
+      fprintf(stderr, "_ndb_bloom_load(\"%s\"): Invalid or stale filter\n", bpath);
+#endif
+    munmap(bp, sb.st_size);
+    return;
+  }
+
+  br->bp = bp;
+  br->size = sb.st_size;
+}
+
+
+/*
+ * Returns 1 if the key is definitely not in the database
+ */
+static int
+_ndb_bloom_miss(NDB *ndb,
+		const char *path,
+		const void *key,
+		size_t len) {
+  const NDB_STAMP *sp = NULL;
+  BLOOMREF *br;
+  NDB_BLOOM cur;
+  struct stat sb;
+  int i;
+
+  
+  _nss_ndb_init();
+  
+  if (!f_bloom)
+    return 0;
+
+  for (i = 0; i < NDB_BLOOM_CACHE && bloom_cache[i].path && bloom_cache[i].path != path; i++)
+    ;
+  if (i >= NDB_BLOOM_CACHE)
+    return 0;
+  br = &bloom_cache[i];
+
+  /* Checked against the file once per open of the map, else per lookup */
+  memset(&cur, 0, sizeof(cur));
+  if (ndb && (ndb->db || ndb->shard) && ndb->gen == ndb_fork_gen &&
+      ndb->path && strcmp(ndb->path, path) == 0)
+    sp = _ndb_ndbstamp(ndb);
+  if (sp) {
+    cur.db_ino = sp->ino;
+    cur.db_size = sp->size;
+    cur.db_mtime = sp->mtime;
+    cur.db_mtime_ns = sp->mtime_ns;
+  } else if (_ndb_stat(path, &sb) == 0)
+    _ndb_bloom_stamp(&cur, &sb);
+  else
+    return 0;
+
+  if (!br->path || !_ndb_bloom_same(&br->stamp, &cur)) {
+    if (br->bp)
+      munmap(br->bp, br->size);
+    
+    br->bp = NULL;
+    br->size = 0;
+    br->path = path;
+    br->stamp = cur;
+    
+    _ndb_bloom_load(br);
+    if (br->bp) {
+      (void) pthread_once(&bloom_key_once, _ndb_bloom_key_init);
+      (void) pthread_setspecific(bloom_key, bloom_cache);
+    }
+  }
+
+  return br->bp && !_ndb_bloom_test(br->bp, _ndb_bloom_hash(key, len));
+}
+
+
+
+
+/*
+ * Whole-file digest sidecars (<db-file>.crc). The file is mapped and
+ * checksummed in one sequential pass.
+ */
+static int
+_ndb_digest_file(const char *file,
+		 NDB_DIGEST *dp) {
+  NDB_BLOOM stamp;
+  struct stat sb;
+  void *mp;
+  int fd;
+
+
+  fd = open(file, O_RDONLY|O_CLOEXEC);
+  if (fd < 0)
+    return -1;
+  
+  if (fstat(fd, &sb) < 0) {
+    close(fd);
+    return -1;
+  }
+
+  memset(dp, 0, sizeof(*dp));
+  memcpy(dp->magic, NDB_DIGEST_MAGIC, sizeof(dp->magic));
+  dp->version = NDB_DIGEST_VERSION;
+  
+  _ndb_bloom_stamp(&stamp, &sb);
+  dp->db_ino = stamp.db_ino;
+  dp->db_size = stamp.db_size;
+  dp->db_mtime = stamp.db_mtime;
+  dp->db_mtime_ns = stamp.db_mtime_ns;
+
+  if (sb.st_size == 0) {
+    close(fd);
+    dp->crc = _ndb_crc32c(0, NULL, 0);
+    return 0;
+  }
+  
+  mp = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mp == MAP_FAILED)
+    return -1;
+  
+#ifdef MADV_SEQUENTIAL
+  (void) madvise(mp, sb.st_size, MADV_SEQUENTIAL);
+#endif
+  dp->crc = _ndb_crc32c(0, mp, sb.st_size);
+  munmap(mp, sb.st_size);
+  
+  return 0;
+}
+
+static int
+_ndb_digest_one(const char *file,
+		int mode) {
+  char cpath[PATH_MAX], tpath[PATH_MAX];
+  NDB_DIGEST old, cur;
+  struct stat sb;
+  ssize_t len = 0;
+  int rc, fd;
+
+  
+  rc = snprintf(cpath, sizeof(cpath), "%s%s", file, NDB_DIGEST_SUFFIX);
+  if (rc < 0 || rc >= sizeof(cpath) ||
+      (rc = snprintf(tpath, sizeof(tpath), "%s.%d", cpath, (int) getpid())) < 0 ||
+      rc >= sizeof(tpath)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+
+  if (mode != NDB_DIGEST_WRITE) {
+    fd = open(cpath, O_RDONLY|O_CLOEXEC);
+    if (fd < 0)
+      return errno == ENOENT ? NDB_DIGEST_MISSING : -1;
+    len = read(fd, &old, sizeof(old));
+    close(fd);
+  }
+  
+  if (_ndb_digest_file(file, &cur) < 0)
+    return -1;
+
+  if (mode == NDB_DIGEST_CHECK) {
+    if (len != sizeof(old) ||
+	memcmp(old.magic, NDB_DIGEST_MAGIC, sizeof(old.magic)) != 0 ||
+	old.version != NDB_DIGEST_VERSION)
+      return NDB_DIGEST_MISMATCH;
+    if (old.crc == cur.crc)
+      return NDB_DIGEST_OK;
+    
+    return (old.db_ino == cur.db_ino && old.db_size == cur.db_size &&
+	    old.db_mtime == cur.db_mtime && old.db_mtime_ns == cur.db_mtime_ns) ?
+      NDB_DIGEST_MISMATCH : NDB_DIGEST_STALE;
+  }
+
+  if (stat(file, &sb) < 0)
+    return -1;
+  
+  fd = open(tpath, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, sb.st_mode & 0666);
+  if (fd < 0)
+    return -1;
+  
+  if (fchmod(fd, sb.st_mode & 0666) < 0 ||
+      write(fd, &cur, sizeof(cur)) != sizeof(cur) ||
+      close(fd) < 0 ||
+      rename(tpath, cpath) < 0) {
+    int ec = errno;
+    
+    unlink(tpath);
+    errno = ec;
+    return -1;
+  }
+  
+  return NDB_DIGEST_OK;
+}
+
+/*
+ * Check (or write) the digest(s) of the file(s) of a map. Returns the
+ * worst NDB_DIGEST_* result for any of them, or -1 on error.
+ */
+int
+_ndb_digest(const char *path,
+	    int mode) {
+  char spath[PATH_MAX];
+  int i, n, rc, worst = NDB_DIGEST_OK;
+
+  
+  n = _ndb_shards(path);
+  if (n < 0)
+    return -1;
+  
+  if (n == 0) {
+    const char *file;
+    
+    if (access(path, F_OK) < 0 && _ndb_subdb(path, &file, 0))
+      path = file;
+    return _ndb_digest_one(path, mode);
+  }
+
+  for (i = 0; i < n; i++) {
+    if (snprintf(spath, sizeof(spath), "%s.%d", path, i) >= sizeof(spath)) {
+      errno = ENAMETOOLONG;
+      return -1;
+    }
+    rc = _ndb_digest_one(spath, mode);
+    if (rc < 0)
+      return -1;
+    if (rc > worst)
+      worst = rc;
+  }
+  
+  return worst;
+}
+
+
+
+/*
+ * Look up 'key' in an open map and parse the record
+ */
+static int
+_ndb_lookup_r(NDB *ndb,
+	      STR2OBJ str2obj,
+	      void *rv,
+	      DBT *key,
+	      void *pbuf,
+	      char *buf,
+	      size_t bsize,
+	      int *res) {
+  int ec = NS_SUCCESS;
+  void **ptr = rv;
+  DBT val;
+  int rc;
+
+  
+  memset(&val, 0, sizeof(val));
+  
+  rc = _ndb_get(ndb, key, &val, 0);
+  if (rc < 0) {
+    *res = errno;
+    ec = NS_UNAVAIL;
+  } else if (rc > 0)
+    ec = NS_NOTFOUND;
+  else {
+    rc = (*str2obj)(val.data, val.size, pbuf, &buf, &bsize, MAX_GETOBJ_SIZE);
+    if (rc < 0) {
+      *res = errno;
+      ec = NS_UNAVAIL;
+    } else if (rc > 0)
+      ec = NS_NOTFOUND;
+    else
+      *ptr = pbuf;
+  }
+
+  if (!ndb->stayopen)
+    _ndb_close(ndb);
+  
+  return ec;
+}
+
+
+static int
+_ndb_getkey_r(NDB *ndb,
+	     const char *path,
+	     STR2OBJ str2obj,
+	     void *rv,
+	     void *mdata,
+	     char *name,
+	     void *pbuf,
+	     char *buf,
+	     size_t bsize,
+	     int *res) {
+  void **ptr = rv;
+  DBT key;
+
+  
+  *ptr = 0;
+  
+  /* A handle kept open is checked for changes (reopened) first */
+  if ((ndb->db || ndb->shard) && _ndb_open(ndb, path, 0) < 0)
+    return NS_UNAVAIL;
+  
+  if (_ndb_bloom_miss(ndb, path, name, strlen(name)))
+    return NS_NOTFOUND;
+  
+  if (_ndb_open(ndb, path, 0) < 0)
+    return NS_UNAVAIL;
+  
+  memset(&key, 0, sizeof(key));
+  key.data = name;
+  key.size = strlen(name);
+  
+  return _ndb_lookup_r(ndb, str2obj, rv, &key, pbuf, buf, bsize, res);
+}
+
+
+/*
+ * Look up an uid or gid, in the key format of the map
+ */
+static int
+_ndb_getid_r(NDB *ndb,
+	     const char *path,
+	     STR2OBJ str2obj,
+	     void *rv,
+	     void *mdata,
+	     unsigned long id,
+	     void *pbuf,
+	     char *buf,
+	     size_t bsize,
+	     int *res) {
+  char kbuf[NDB_IDKEY_SIZE];
+  void **ptr = rv;
+  DBT key;
+
+  
+  *ptr = 0;
+  
+  if (_ndb_open(ndb, path, 0) < 0)
+    return NS_UNAVAIL;
+  
+  memset(&key, 0, sizeof(key));
+  if (_ndb_idkey(ndb, &key, kbuf, sizeof(kbuf), id) < 0) {
+    *res = errno;
+    if (!ndb->stayopen)
+      _ndb_close(ndb);
+    return NS_UNAVAIL;
+  }
+  
+  if (_ndb_bloom_miss(ndb, path, key.data, key.size)) {
+    if (!ndb->stayopen)
+      _ndb_close(ndb);
+    return NS_NOTFOUND;
+  }
+  
+  return _ndb_lookup_r(ndb, str2obj, rv, &key, pbuf, buf, bsize, res);
+}
+
+
+/*
+ * Look up a name, possibly via the case-folded index depending
+ * on the 'casefold' setting. A missing case-folded index is not an error.
+ */
+static int
+_ndb_getname_r(NDB *ndb,
+	       const char *path,
+	       NDB *lcndb,
+	       const char *lcpath,
+	       STR2OBJ str2obj,
+	       void *rv,
+	       void *mdata,
+	       char *name,
+	       void *pbuf,
+	       char *buf,
+	       size_t bsize,
+	       int *res) {
+  char lcname[256];
+  int rc, lrc, ores;
+
+
+  if (f_casefold == CASEFOLD_ALWAYS &&
+      _ndb_strfold(lcname, name, sizeof(lcname))) {
+    ores = *res;
+    rc = _ndb_getkey_r(lcndb, lcpath, str2obj, rv, mdata, lcname, pbuf, buf, bsize, res);
+    if (rc != NS_UNAVAIL)
+      return rc;
+    *res = ores;
+  }
+  
+  rc = _ndb_getkey_r(ndb, path, str2obj, rv, mdata, name, pbuf, buf, bsize, res);
+  
+  if (rc == NS_NOTFOUND && f_casefold == CASEFOLD_FALLBACK &&
+      _ndb_strfold(lcname, name, sizeof(lcname))) {
+    ores = *res;
+    lrc = _ndb_getkey_r(lcndb, lcpath, str2obj, rv, mdata, lcname, pbuf, buf, bsize, res);
+    if (lrc != NS_UNAVAIL)
+      rc = lrc;
+    else
+      *res = ores;
+  }
+
+  return rc;
+}
+  
+
+static int
+_ndb_getent_r(NDB *ndb,
+	     const char *path,
+	     STR2OBJ str2obj,
+	     void *rv,
+	     void *mdata,
+	     void *pbuf,
+	     char *buf,
+	     size_t bsize,
+	     int *res) {
+  void **ptr = rv;
+  int rc, ec = NS_SUCCESS;
+  DBT key, val;
+  
+
+  if (_ndb_open(ndb, path, 0) < 0) 
+    return NS_UNAVAIL;
+
+  *ptr = 0;
+
+  memset(&key, 0, sizeof(key));
+  memset(&val, 0, sizeof(val));
+
+  rc = _ndb_get(ndb, &key, &val, ndb->prev_f ? DB_PREV : DB_NEXT);
+
+  ndb->prev_f = 0;
+  
+  if (rc < 0) {
+    _ndb_close(ndb);
+    *res = errno;
+    ec = NS_UNAVAIL;
+  } else if (rc > 0)
+    ec = NS_NOTFOUND;
+  else {
+  
+    if ((*str2obj)(val.data, val.size, pbuf, &buf, &bsize, MAX_GETENT_SIZE) < 0) {
+      *res = errno;
+   
+      /* If errno == ERANGE (data can't fit in buffer), retry same record next time */
+      if (errno == ERANGE)
+	ndb->prev_f = 1;
+      
+      ec = NS_NOTFOUND;
+    } else
+      *ptr = pbuf;
+  }
+  
+  return ec;
+}
+
+
+int
+_ndb_setent(NDB *ndb,
+	    int stayopen,
+	    const char *path) {
+  _ndb_close(ndb);
+  
+  if (_ndb_open(ndb, path, 0) < 0)
+    return NS_UNAVAIL;
+
+  ndb->stayopen = stayopen;
+  return NS_SUCCESS;
+}
+
+
+
+int
+_ndb_endent(NDB *ndb) {
+  _ndb_close(ndb);
+  return NS_SUCCESS;
+}
+
+
+
+/*
+ * Id range cursors over passwd.byuid & group.bygid, returning the
+ * records with ids in [lo, hi) in id order. A range costs (about) as
+ * much as the records in it: the cursor is positioned with
+ * DB_SET_RANGE at the first id. Binary (makendb -n) keys are in id
+ * order already. Decimal keys are in string order, so the ids are
+ * scanned one number of digits at a time, and keys of other lengths
+ * are skipped with a seek past them instead of being read. Sharded
+ * maps have a cursor per shard file that are merged by id.
+ */
+#define NDB_RANGE_MAXDIG 19   /* 10^19 still fits in an uint64_t */
+
+typedef struct {
+  NDB ndb;
+  int state;             /* 0 = not positioned, 1 = at a record, 2 = done */
+  int fmt;
+  int ndig;              /* Decimal keys: digits of the ids scanned */
+  uint64_t id;
+  DBT key;
+  DBT val;
+} NDB_RANGECUR;
+
+struct ndb_range {
+  uint64_t lo;
+  uint64_t hi;
+  int ncur;
+  int last;              /* Cursor of the record returned last, or -1 */
+  NDB_RANGECUR *cur;
+};
+
+
+static uint64_t
+_ndb_pow10(int n) {
+  uint64_t v = 1;
+
+  while (n-- > 0)
+    v *= 10;
+  return v;
+}
+
+
+static int
+_ndb_range_step(NDB_RANGE *rp,
+		NDB_RANGECUR *cp) {
+  char kbuf[NDB_IDKEY_SIZE];
+  const unsigned char *p;
+  uint64_t v, seek = 0;
+  unsigned long id;
+  DBT key, val;
+  int rc, len, seek_f = 0;
+
+  
+  if (cp->state == 2)
+    return 0;
+  
+  if (cp->state == 0) {
+    cp->fmt = _ndb_idformat(&cp->ndb);
+    if (cp->fmt < 0)
+      return -1;
+    
+    if (cp->fmt == NDB_IDKEY_BE32 && rp->lo > 0xFFFFFFFFUL)
+      goto Done;
+    
+    for (cp->ndig = 1; cp->ndig < NDB_RANGE_MAXDIG && rp->lo >= _ndb_pow10(cp->ndig); cp->ndig++)
+      ;
+    seek = rp->lo;
+    seek_f = 1;
+  }
+
+  for (;;) {
+    memset(&key, 0, sizeof(key));
+    memset(&val, 0, sizeof(val));
+    
+    if (seek_f) {
+      if (_ndb_idkey(&cp->ndb, &key, kbuf, sizeof(kbuf), (unsigned long) seek) < 0)
+	return -1;
+      rc = _ndb_get(&cp->ndb, &key, &val, DB_SET_RANGE);
+      seek_f = 0;
+    } else
+      rc = _ndb_get(&cp->ndb, &key, &val, DB_NEXT);
+    
+    if (rc < 0)
+      return -1;
+    if (rc > 0)
+      goto NextLength;
+    
+    if (cp->fmt == NDB_IDKEY_BE32) {
+      /* Skips the key format record */
+      if (_ndb_keyid(&key, cp->fmt, &id) < 0)
+	continue;
+      if (id >= rp->hi)
+	goto Done;
+      v = id;
+      goto Found;
+    }
+    
+    p = key.data;
+    for (len = 0; len < key.size && isdigit(p[len]); len++)
+      ;
+    if (len == 0 || len < key.size)
+      continue;
+    
+    for (v = 0, len = 0; len < key.size && len < cp->ndig; len++)
+      v = v*10 + p[len]-'0';
+    
+    if (key.size == cp->ndig) {
+      if (v >= rp->hi)
+	goto NextLength;
+      goto Found;
+    }
+    
+    if (key.size > cp->ndig) {
+      /* A longer id, skip all with the same leading digits */
+      seek = v+1;
+      if (seek >= rp->hi || seek >= _ndb_pow10(cp->ndig))
+	goto NextLength;
+    } else {
+      /* A shorter id, skip to the next one with (at least) its digits */
+      seek = v*_ndb_pow10(cp->ndig-len);
+      if (seek >= rp->hi)
+	goto NextLength;
+    }
+    seek_f = 1;
+    continue;
+
+  NextLength:
+    if (cp->fmt == NDB_IDKEY_BE32 || cp->ndig >= NDB_RANGE_MAXDIG ||
+	_ndb_pow10(cp->ndig) >= rp->hi)
+      goto Done;
+    seek = _ndb_pow10(cp->ndig++);
+    seek_f = 1;
+  }
+  
+ Found:
+  cp->state = 1;
+  cp->id = v;
+  cp->key = key;
+  cp->val = val;
+  return 1;
+  
+ Done:
+  cp->state = 2;
+  return 0;
+}
+
+
+void
+_ndb_range_close(NDB_RANGE *rp) {
+  int i;
+
+  
+  if (!rp)
+    return;
+  
+  for (i = 0; rp->cur && i < rp->ncur; i++)
+    _ndb_close(&rp->cur[i].ndb);
+  free(rp->cur);
+  free(rp);
+}
+
+
+NDB_RANGE *
+_ndb_range_open(const char *path,
+		unsigned long lo,
+		unsigned long hi) {
+  NDB_RANGE *rp;
+  NDB ndb;
+  char spath[PATH_MAX];
+  int i, nf, fmt;
+
+  
+  nf = _ndb_shards(path);
+  if (nf < 0)
+    return NULL;
+  
+  /* The key format record is only in one of the shards */
+  memset(&ndb, 0, sizeof(ndb));
+  if (_ndb_open(&ndb, path, 0) < 0)
+    return NULL;
+  fmt = _ndb_idformat(&ndb);
+  _ndb_close(&ndb);
+  if (fmt < 0)
+    return NULL;
+  
+  rp = calloc(1, sizeof(*rp));
+  if (!rp)
+    return NULL;
+  
+  rp->lo = lo;
+  rp->hi = hi;
+  rp->last = -1;
+  rp->ncur = nf ? nf : 1;
+  rp->cur = calloc(rp->ncur, sizeof(NDB_RANGECUR));
+  if (!rp->cur)
+    goto Fail;
+  
+  for (i = 0; i < rp->ncur; i++) {
+    if (!nf)
+      strcpy(spath, path);
+    else if (snprintf(spath, sizeof(spath), "%s.%d", path, i) >= sizeof(spath)) {
+      errno = ENAMETOOLONG;
+      goto Fail;
+    }
+    if (_ndb_open(&rp->cur[i].ndb, spath, 0) < 0)
+      goto Fail;
+    rp->cur[i].ndb.idfmt = fmt;
+  }
+
+  return rp;
+
+ Fail:
+  {
+    int ec = errno;
+    
+    _ndb_range_close(rp);
+    errno = ec;
+  }
+  return NULL;
+}
+
+
+/*
+ * Get the next record in the range. Returns 1 (with *idp, key & val
+ * set), 0 at the end or -1 on error. The record stays valid until the
+ * next call.
+ */
+int
+_ndb_range_next(NDB_RANGE *rp,
+		unsigned long *idp,
+		DBT *key,
+		DBT *val) {
+  NDB_RANGECUR *cp;
+  int i, m = -1;
+
+  
+  if (rp->last >= 0) {
+    if (_ndb_range_step(rp, &rp->cur[rp->last]) < 0)
+      return -1;
+    rp->last = -1;
+  }
+  
+  for (i = 0; i < rp->ncur; i++) {
+    cp = &rp->cur[i];
+    if (cp->state == 0 && _ndb_range_step(rp, cp) < 0)
+      return -1;
+    if (cp->state == 1 && (m < 0 || cp->id < rp->cur[m].id))
+      m = i;
+  }
+  if (m < 0)
+    return 0;
+  
+  cp = &rp->cur[m];
+  rp->last = m;
+  if (idp)
+    *idp = cp->id;
+  if (key)
+    *key = cp->key;
+  if (val)
+    *val = cp->val;
+  return 1;
+}
+
+
+/* Return the last record again from the next _ndb_range_next() */
+void
+_ndb_range_unget(NDB_RANGE *rp) {
+  rp->last = -1;
+}
+
+
+struct nss_ndb_range {
+  STR2OBJ str2obj;
+  NDB_RANGE *rp;
+};
+
+
+NSS_NDB_RANGE *
+nss_ndb_range(const char *map,
+	      unsigned long first,
+	      unsigned long last) {
+  NSS_NDB_RANGE *qp;
+  const char *path;
+
+  
+  _nss_ndb_init();
+  
+  if (!map) {
+    errno = EINVAL;
+    return NULL;
+  }
+  
+  qp = calloc(1, sizeof(*qp));
+  if (!qp)
+    return NULL;
+  
+  if (strcmp(map, "passwd") == 0) {
+    path = path_passwd_byuid;
+    qp->str2obj = (STR2OBJ) str2passwd;
+  } else if (strcmp(map, "group") == 0) {
+    path = path_group_bygid;
+    qp->str2obj = (STR2OBJ) str2group;
+  } else {
+    free(qp);
+    errno = EINVAL;
+    return NULL;
+  }
+  
+  qp->rp = _ndb_range_open(path, first, last);
+  if (!qp->rp) {
+    int ec = errno;
+    
+    free(qp);
+    errno = ec;
+    return NULL;
+  }
+  
+  return qp;
+}
+
+
+void
+nss_ndb_range_free(NSS_NDB_RANGE *qp) {
+  if (!qp)
+    return;
+  
+  _ndb_range_close(qp->rp);
+  free(qp);
+}
+
+
+/*
+ * Fill up to n objects (of osize bytes each) from the range, like
+ * _ndb_getpart_r()
+ */
+static int
+_ndb_getrange_r(NSS_NDB_RANGE *qp,
+		void *ov,
+		size_t osize,
+		int n,
+		char *buf,
+		size_t bsize,
+		int *res) {
+  DBT val;
+  int rc, nr = 0;
+
+  
+  if (!qp || n < 1) {
+    *res = EINVAL;
+    return -1;
+  }
+  
+  while (nr < n) {
+    rc = _ndb_range_next(qp->rp, NULL, NULL, &val);
+    if (rc < 0) {
+      *res = errno;
+      return -1;
+    }
+    if (rc == 0)
+      break;
+    
+    rc = (*qp->str2obj)(val.data, val.size, (void **) ((char *) ov + nr*osize), &buf, &bsize, MAX_GETOBJ_SIZE);
+    if (rc < 0 && errno == ERANGE) {
+      _ndb_range_unget(qp->rp);
+      if (nr == 0) {
+	*res = ERANGE;
+	return -1;
+      }
+      break;
+    }
+    
+    /* Skip malformed records */
+    if (rc == 0)
+      ++nr;
+  }
+  
+  return nr;
+}
+
+
+int
+nss_ndb_getpwrange_r(NSS_NDB_RANGE *qp,
+		     struct passwd *pv,
+		     int n,
+		     char *buf,
+		     size_t bsize,
+		     int *res) {
+  return _ndb_getrange_r(qp, pv, sizeof(*pv), n, buf, bsize, res);
+}
+
+
+int
+nss_ndb_getgrrange_r(NSS_NDB_RANGE *qp,
+		     struct group *gv,
+		     int n,
+		     char *buf,
+		     size_t bsize,
+		     int *res) {
+  return _ndb_getrange_r(qp, gv, sizeof(*gv), n, buf, bsize, res);
+}
+
+
+
+/*
+ * Partitioned enumeration for bulk consumers. The map is split in key
+ * ranges (segments) that are scanned with separate handles & cursors,
+ * one thread per partition. A sharded map is split per shard file
+ * first, and each file in key ranges only if there are more partitions
+ * than shards. The split keys are sampled with a single (key only)
+ * pass over each file.
+ */
+#define NDB_PART_SAMPLES 32   /* Sampled keys per segment (at least) */
+
+typedef struct {
+  int shard;             /* <path>.<shard>, or -1 for <path> */
+  DBT lo;                /* First key, or NULL (from the start) */
+  DBT hi;                /* End key (not included), or NULL */
+} NDB_SEGMENT;
+
+typedef struct {
+  int cseg;              /* Current segment */
+  int eseg;              /* End segment (not included) */
+  int pos_f;             /* Cursor positioned in the current segment */
+  NDB ndb;
+  DBT next;              /* Resume at this key (record didn't fit) */
+} NDB_PARTCUR;
+
+struct nss_ndb_part {
+  char *path;
+  STR2OBJ str2obj;
+  int nseg;
+  NDB_SEGMENT *seg;
+  int npart;
+  NDB_PARTCUR *cur;
+};
+
+
+static int
+_ndb_keydup(DBT *dst,
+	    const DBT *src) {
+  memset(dst, 0, sizeof(*dst));
+  if (!src->data)
+    return 0;
+  
+  dst->data = malloc(src->size ? src->size : 1);
+  if (!dst->data)
+    return -1;
+  memcpy(dst->data, src->data, src->size);
+  dst->size = src->size;
+  return 0;
+}
+
+
+/* Same order as the default Btree comparison */
+static int
+_ndb_keycmp(const DBT *a,
+	    const DBT *b) {
+  size_t len = a->size < b->size ? a->size : b->size;
+  int rc;
+
+  
+  rc = memcmp(a->data, b->data, len);
+  if (rc)
+    return rc;
+  return a->size < b->size ? -1 : a->size > b->size;
+}
+
+
+/*
+ * Split one database file in m segments of (about) the same number of
+ * keys. Keys are sampled at a stride that is doubled (and every other
+ * sample dropped) whenever the sample buffer is full, so the memory
+ * needed doesn't depend on the size of the map.
+ */
+static int
+_ndb_part_split(const char *path,
+		int shard,
+		NDB_SEGMENT *sv,
+		int m) {
+  NDB ndb;
+  DBT key, val, *samp;
+  unsigned long n, stride = 1;
+  int i, ns = 0, rc, maxs = 2*m*NDB_PART_SAMPLES;
+
+  
+  samp = calloc(maxs, sizeof(DBT));
+  if (!samp)
+    return -1;
+  
+  memset(&ndb, 0, sizeof(ndb));
+  if (_ndb_open(&ndb, path, 0) < 0) {
+    free(samp);
+    return -1;
+  }
+
+  for (n = 0; ; n++) {
+    memset(&key, 0, sizeof(key));
+    memset(&val, 0, sizeof(val));
+#if DB_VERSION_MAJOR >= 4
+    /* Only the keys are needed */
+    val.flags = DB_DBT_PARTIAL;
+#endif
+    rc = _ndb_get(&ndb, &key, &val, DB_NEXT);
+    if (rc)
+      break;
+    
+    if (n % stride)
+      continue;
+    
+    if (ns == maxs) {
+      for (i = 0; i < ns; i++)
+	if (i & 1)
+	  free(samp[i].data);
+	else
+	  samp[i/2] = samp[i];
+      ns /= 2;
+      stride *= 2;
+      if (n % stride)
+	continue;
+    }
+    
+    if (_ndb_keydup(&samp[ns], &key) < 0) {
+      rc = -1;
+      break;
+    }
+    ++ns;
+  }
+  _ndb_close(&ndb);
+
+  if (rc >= 0) {
+    for (i = 0; i < m; i++) {
+      memset(&sv[i], 0, sizeof(sv[i]));
+      sv[i].shard = shard;
+      if (i > 0 && ns > 0 &&
+	  (_ndb_keydup(&sv[i].lo, &samp[i*ns/m]) < 0 ||
+	   _ndb_keydup(&sv[i-1].hi, &samp[i*ns/m]) < 0))
+	rc = -1;
+    }
+  }
+  
+  for (i = 0; i < ns; i++)
+    free(samp[i].data);
+  free(samp);
+  
+  return rc < 0 ? -1 : 0;
+}
+
+
+void
+nss_ndb_partition_free(NSS_NDB_PART *pp) {
+  int i;
+
+  
+  if (!pp)
+    return;
+  
+  for (i = 0; pp->cur && i < pp->npart; i++) {
+    _ndb_close(&pp->cur[i].ndb);
+    free(pp->cur[i].next.data);
+  }
+  for (i = 0; pp->seg && i < pp->nseg; i++) {
+    free(pp->seg[i].lo.data);
+    free(pp->seg[i].hi.data);
+  }
+  free(pp->cur);
+  free(pp->seg);
+  free(pp->path);
+  free(pp);
+}
+
+
+NSS_NDB_PART *
+nss_ndb_partition(const char *map,
+		  int k) {
+  NSS_NDB_PART *pp;
+  char spath[PATH_MAX];
+  int i, nf, m;
+
+  
+  _nss_ndb_init();
+  
+  if (k < 1 || !map) {
+    errno = EINVAL;
+    return NULL;
+  }
+  
+  pp = calloc(1, sizeof(*pp));
+  if (!pp)
+    return NULL;
+  
+  if (strcmp(map, "passwd") == 0) {
+    pp->path = strdup(path_passwd_byname);
+    pp->str2obj = (STR2OBJ) str2passwd;
+  } else if (strcmp(map, "group") == 0) {
+    pp->path = strdup(path_group_byname);
+    pp->str2obj = (STR2OBJ) str2group;
+  } else {
+    free(pp);
+    errno = EINVAL;
+    return NULL;
+  }
+  if (!pp->path)
+    goto Fail;
+  
+  nf = _ndb_shards(pp->path);
+  if (nf < 0)
+    goto Fail;
+  
+  pp->npart = k;
+  pp->nseg = nf > k ? nf : k;
+  pp->seg = calloc(pp->nseg, sizeof(NDB_SEGMENT));
+  pp->cur = calloc(pp->npart, sizeof(NDB_PARTCUR));
+  if (!pp->seg || !pp->cur)
+    goto Fail;
+
+  if (nf >= k) {
+    /* A (contiguous) group of whole shards per partition */
+    for (i = 0; i < nf; i++)
+      pp->seg[i].shard = i;
+    for (i = 0; i < k; i++) {
+      pp->cur[i].cseg = i*nf/k;
+      pp->cur[i].eseg = (i+1)*nf/k;
+    }
+  } else {
+    if (nf == 0) {
+      if (_ndb_part_split(pp->path, -1, pp->seg, k) < 0)
+	goto Fail;
+    } else {
+      /* k/nf (or one more) segments per shard */
+      NDB_SEGMENT *sp = pp->seg;
+      
+      for (i = 0; i < nf; i++) {
+	m = k/nf + (i < k%nf);
+	if (snprintf(spath, sizeof(spath), "%s.%d", pp->path, i) >= sizeof(spath)) {
+	  errno = ENAMETOOLONG;
+	  goto Fail;
+	}
+	if (_ndb_part_split(spath, i, sp, m) < 0)
+	  goto Fail;
+	sp += m;
+      }
+    }
+    for (i = 0; i < k; i++) {
+      pp->cur[i].cseg = i;
+      pp->cur[i].eseg = i+1;
+    }
+  }
+  
+  return pp;
+
+ Fail:
+  {
+    int ec = errno;
+    
+    nss_ndb_partition_free(pp);
+    errno = ec;
+  }
+  return NULL;
+}
+
+
+int
+nss_ndb_partitions(const NSS_NDB_PART *pp) {
+  return pp ? pp->npart : 0;
+}
+
+
+/*
+ * Fill up to n objects (of osize bytes each) from partition i, with
+ * the strings in buf. Returns the number of objects, 0 at the end of
+ * the partition or -1 (and *res set) on error. A record that doesn't
+ * fit in what's left of buf is returned first by the next call, and
+ * ERANGE only if it doesn't fit at all.
+ */
+static int
+_ndb_getpart_r(NSS_NDB_PART *pp,
+	       int i,
+	       void *ov,
+	       size_t osize,
+	       int n,
+	       char *buf,
+	       size_t bsize,
+	       int *res) {
+  NDB_PARTCUR *cp;
+  NDB_SEGMENT *sp;
+  char spath[PATH_MAX];
+  DBT key, val;
+  int rc, nr = 0;
+
+  
+  if (!pp || i < 0 || i >= pp->npart || n < 1) {
+    *res = EINVAL;
+    return -1;
+  }
+  cp = &pp->cur[i];
+  
+  while (nr < n && cp->cseg < cp->eseg) {
+    sp = &pp->seg[cp->cseg];
+    
+    memset(&key, 0, sizeof(key));
+    memset(&val, 0, sizeof(val));
+    
+    if (!cp->pos_f) {
+      if (sp->shard < 0)
+	strcpy(spath, pp->path);
+      else if (snprintf(spath, sizeof(spath), "%s.%d", pp->path, sp->shard) >= sizeof(spath)) {
+	*res = ENAMETOOLONG;
+	return -1;
+      }
+      
+      if (_ndb_open(&cp->ndb, spath, 0) < 0) {
+	*res = errno;
+	return -1;
+      }
+      
+      if (cp->next.data)
+	key = cp->next;
+      else
+	key = sp->lo;
+      
+      rc = _ndb_get(&cp->ndb, &key, &val, key.data ? DB_SET_RANGE : DB_NEXT);
+      
+      free(cp->next.data);
+      memset(&cp->next, 0, sizeof(cp->next));
+      cp->pos_f = 1;
+    } else
+      rc = _ndb_get(&cp->ndb, &key, &val, DB_NEXT);
+    
+    if (rc < 0) {
+      *res = errno;
+      return -1;
+    }
+    
+    if (rc > 0 || (sp->hi.data && _ndb_keycmp(&key, &sp->hi) >= 0)) {
+      /* End of segment */
+      _ndb_close(&cp->ndb);
+      cp->pos_f = 0;
+      ++cp->cseg;
+      continue;
+    }
+
+    rc = (*pp->str2obj)(val.data, val.size, (void **) ((char *) ov + nr*osize), &buf, &bsize, MAX_GETOBJ_SIZE);
+    if (rc < 0 && errno == ERANGE) {
+      if (_ndb_keydup(&cp->next, &key) < 0) {
+	*res = errno;
+	return -1;
+      }
+      cp->pos_f = 0;
+      if (nr == 0) {
+	*res = ERANGE;
+	return -1;
+      }
+      break;
+    }
+    
+    /* Skip malformed records */
+    if (rc == 0)
+      ++nr;
+  }
+
+  return nr;
+}
+
+
+int
+nss_ndb_getpwpart_r(NSS_NDB_PART *pp,
+		    int i,
+		    struct passwd *pv,
+		    int n,
+		    char *buf,
+		    size_t bsize,
+		    int *res) {
+  return _ndb_getpart_r(pp, i, pv, sizeof(*pv), n, buf, bsize, res);
+}
+
+
+int
+nss_ndb_getgrpart_r(NSS_NDB_PART *pp,
+		    int i,
+		    struct group *gv,
+		    int n,
+		    char *buf,
+		    size_t bsize,
+		    int *res) {
+  return _ndb_getpart_r(pp, i, gv, sizeof(*gv), n, buf, bsize, res);
+}
+
+
+
+/*
+ * Strip the AD workgroup prefix and/or Kerberos realm suffix from
+ * a user name (if enabled). If a copy has to be made it is returned
+ * in *nbuf and must be freed by the caller.
+ */
+static const char *
+_ndb_stripname(const char *name,
+	       char **nbuf) {
+  const char *cp;
+
+  
+  *nbuf = NULL;
+  _nss_ndb_init();
+  
+  if (f_strip_workgroup) {
+    size_t len;
+    
+    /* Strip AD workgroup prefix if specified */
+    cp = strchr(name, '\\');
+    if (cp && (f_strip_workgroup[0] == '\0' || /* Accept all workgroups */
+	       cp-name == 0 || /* Empty workgroup specified (\user) */
+	       ((len = strlen(f_strip_workgroup)) == cp-name && 
+		strncasecmp(name, f_strip_workgroup, len) == 0))) /* Exact match */
+      name = cp+1;
+  }
+  
+  if (f_strip_realm) {
+    /* Strip Kerberos realm suffix if specified */
+    cp = strrchr(name, '@');
+    if (cp && (f_strip_realm[0] == '\0' ||        /* Accept all realms */
+	       strcasecmp(cp+1, f_strip_realm) == 0) && /* Exact match */
+	(*nbuf = strndup(name, cp-name)) != NULL)
+      name = *nbuf;
+  }
+
+  return name;
+}
+
+
+static int
+_ndb_getpwnam_r(void *rv,
+		void *mdata,
+		char *name,
+		struct passwd *pbuf,
+		char *buf,
+		size_t bsize,
+		int *res) {
+  char *nbuf = NULL;
+  int rc;
+
+
+  name = (char *) _ndb_stripname(name, &nbuf);
+  
+  rc = _ndb_getname_r(&ndb_pwd_byname,
+		      path_passwd_byname,
+		      &ndb_pwd_bylcname,
+		      path_passwd_bylcname,
+		      (STR2OBJ) str2passwd,
+		      rv, mdata,
+		      name, pbuf, buf, bsize, res);
+
+  if (nbuf)
+    free(nbuf);
+  
+  return rc;
+}
+
+
+int
+nss_ndb_getpwnam_r(void *rv,
+		   void *mdata,
+		   va_list ap) {
+  char *name           = va_arg(ap, char *);
+  struct passwd *pbuf  = va_arg(ap, struct passwd *);
+  char *buf            = va_arg(ap, char *);
+  size_t bsize         = va_arg(ap, size_t);         
+  int *res             = va_arg(ap, int *);
+
+  return _ndb_getpwnam_r(rv, mdata, name, pbuf, buf, bsize, res);
+}
+
+
+static int
+_ndb_getpwuid_r(void *rv,
+		void *mdata,
+		uid_t uid,
+		struct passwd *pbuf,
+		char *buf,
+		size_t bsize,
+		int *res) {
+  return _ndb_getid_r(&ndb_pwd_byuid,
+		      path_passwd_byuid,
+		      (STR2OBJ) str2passwd,
+		      rv, mdata,
+		      uid, pbuf, buf, bsize, res);
+}
+
+
+int
+nss_ndb_getpwuid_r(void *rv,
+		   void *mdata,
+		   va_list ap) {
+  uid_t uid            = va_arg(ap, uid_t);
+  struct passwd *pbuf  = va_arg(ap, struct passwd *);
+  char *buf            = va_arg(ap, char *);
+  size_t bsize         = va_arg(ap, size_t);         
+  int *res             = va_arg(ap, int *);
+
+  return _ndb_getpwuid_r(rv, mdata, uid, pbuf, buf, bsize, res);
+}
+
+
+int
+nss_ndb_getpwent_r(void *rv,
+		   void *mdata,
+		   va_list ap) {
+  struct passwd *pbuf = va_arg(ap, struct passwd *);
+  char *buf           = va_arg(ap, char *);         
+  size_t bsize        = va_arg(ap, size_t);         
+  int *res            = va_arg(ap, int *);
+
+  return _ndb_getent_r(&ndb_pwd_byname,
+		      path_passwd_byname,
+		      (STR2OBJ) str2passwd,
+		      rv, mdata,
+		      pbuf, buf, bsize, res);
+}
+
+
+int
+nss_ndb_setpwent(void *rv,
+		 void *mdata,
+		 va_list ap) {
+  int stayopen = va_arg(ap, int);
+
+  return _ndb_setent(&ndb_pwd_byname,
+		    stayopen,
+		    path_passwd_byname);
+}
+
+
+int
+nss_ndb_endpwent(void *rv,
+		 void *mdata,
+		 va_list ap) {
+#if 0
+  int *res = va_arg(ap, int *);
+#endif
+  
+  return _ndb_endent(&ndb_pwd_byname);
+}
+
+
+
+#ifdef __linux__
+/*
+ * shadow.byname.db format (the file is only readable by root):
+ *   user:password:lastchg:min:max:warn:inactive:expire:flag
+ */
+static int
+_ndb_getspnam_r(void *rv,
+		void *mdata,
+		const char *name,
+		struct spwd *sbuf,
+		char *buf,
+		size_t bsize,
+		int *res) {
+  char *nbuf = NULL;
+  int rc;
+
+
+  if (!name)
+    return NS_NOTFOUND;
+  
+  name = _ndb_stripname(name, &nbuf);
+  
+  rc = _ndb_getkey_r(&ndb_spw_byname,
+		     path_shadow_byname,
+		     (STR2OBJ) str2spwd,
+		     rv, mdata,
+		     (char *) name, sbuf, buf, bsize, res);
+
+  if (nbuf)
+    free(nbuf);
+  
+  return rc;
+}
+
+
+int
+nss_ndb_getspnam_r(void *rv,
+		   void *mdata,
+		   va_list ap) {
+  const char *name    = va_arg(ap, const char *);
+  struct spwd *sbuf   = va_arg(ap, struct spwd *);
+  char *buf           = va_arg(ap, char *);
+  size_t bsize        = va_arg(ap, size_t);
+  int *res            = va_arg(ap, int *);
+
+  return _ndb_getspnam_r(rv, mdata, name, sbuf, buf, bsize, res);
+}
+
+
+int
+nss_ndb_getspent_r(void *rv,
+		   void *mdata,
+		   va_list ap) {
+  struct spwd *sbuf   = va_arg(ap, struct spwd *);
+  char *buf           = va_arg(ap, char *);
+  size_t bsize        = va_arg(ap, size_t);
+  int *res            = va_arg(ap, int *);
+
+  return _ndb_getent_r(&ndb_spw_byname,
+		       path_shadow_byname,
+		       (STR2OBJ) str2spwd,
+		       rv, mdata,
+		       sbuf, buf, bsize, res);
+}
+
+
+int
+nss_ndb_setspent(void *rv,
+		 void *mdata,
+		 va_list ap) {
+  int stayopen = va_arg(ap, int);
+
+  return _ndb_setent(&ndb_spw_byname,
+		     stayopen,
+		     path_shadow_byname);
+}
+
+
+int
+nss_ndb_endspent(void *rv,
+		 void *mdata,
+		 va_list ap) {
+  return _ndb_endent(&ndb_spw_byname);
+}
+#endif
+
+
+
+
+static int
+_ndb_getgrnam_r(void *rv,
+		void *mdata,
+		char *name,
+		struct group *gbuf,
+		char *buf,
+		size_t bsize,
+		int *res) {
+  char *nbuf = NULL;
+  int rc;
+
+
+  name = (char *) _ndb_stripname(name, &nbuf);
+  
+  rc = _ndb_getname_r(&ndb_grp_byname,
+		      path_group_byname,
+		      &ndb_grp_bylcname,
+		      path_group_bylcname,
+		      (STR2OBJ) str2group,
+		      rv, mdata,
+		      name, gbuf, buf, bsize, res);
+
+  if (nbuf)
+    free(nbuf);
+  
+  return rc;
+}
+
+
+int
+nss_ndb_getgrnam_r(void *rv,
+		   void *mdata,
+		   va_list ap) {
+  char *name          = va_arg(ap, char *);
+  struct group *gbuf  = va_arg(ap, struct group *);
+  char *buf           = va_arg(ap, char *);
+  size_t bsize        = va_arg(ap, size_t);         
+  int *res            = va_arg(ap, int *);
+
+  return _ndb_getgrnam_r(rv, mdata, name, gbuf, buf, bsize, res);
+}
+
+
+static int
+_ndb_getgrgid_r(void *rv,
+		void *mdata,
+		gid_t gid,
+		struct group *gbuf,
+		char *buf,
+		size_t bsize,
+		int *res) {
+  return _ndb_getid_r(&ndb_grp_bygid,
+		      path_group_bygid,
+		      (STR2OBJ) str2group,
+		      rv, mdata,
+		      gid, gbuf, buf, bsize, res);
+}
+
+
+int
+nss_ndb_getgrgid_r(void *rv,
+		   void *mdata,
+		   va_list ap) {
+  gid_t gid          = va_arg(ap, gid_t);
+  struct group *gbuf = va_arg(ap, struct group *);
+  char *buf          = va_arg(ap, char *);
+  size_t bsize       = va_arg(ap, size_t);
+  int *res           = va_arg(ap, int *);
+
+  return _ndb_getgrgid_r(rv, mdata, gid, gbuf, buf, bsize, res);
+}
+
+
+int
+nss_ndb_getgrent_r(void *rv,
+		   void *mdata,
+		   va_list ap) {
+  struct group *gbuf = va_arg(ap, struct group *);
+  char *buf          = va_arg(ap, char *);         
+  size_t bsize       = va_arg(ap, size_t);         
+  int *res           = va_arg(ap, int *);
+
+  
+  return _ndb_getent_r(&ndb_grp_byname,
+		      path_group_byname,
+		      (STR2OBJ) str2group,
+		      rv, mdata,
+		      gbuf, buf, bsize, res);
+}
+
+
+int
+nss_ndb_setgrent(void *rv,
+		 void *mdata,
+		 va_list ap) {
+  int stayopen = va_arg(ap, int);
+
+  return _ndb_setent(&ndb_grp_byname,
+		     stayopen,
+		     path_group_byname);
+}
+
+
+int
+nss_ndb_endgrent(void *rv,
+		 void *mdata,
+		 va_list ap) {
+#if 0
+  int *res = va_arg(ap, int *);
+#endif
+  
+  return _ndb_endent(&ndb_grp_byname);
+}
+
+
+
+/*
+ * Batched lookups, for callers that resolve many uids, gids or names
+ * at once (ls -l, ps, indexers). The map is opened (and the settings
+ * read) once per batch instead of once per key, the keys are sorted in
+ * btree order (per shard, for sharded maps) so consecutive lookups
+ * hit the same pages, and duplicates are only looked up once. The
+ * records are parsed into the caller's array, with the strings in one
+ * buffer.
+ */
+#define NDB_BATCH_NAMELEN 256
+
+typedef struct {
+  DBT key;
+  int shard;
+  int i;                 /* Index in the request */
+  unsigned long id;
+} NDB_BKEY;
+
+
+static int
+_ndb_bkeycmp(const void *a,
+	     const void *b) {
+  const NDB_BKEY *ka = (const NDB_BKEY *) a;
+  const NDB_BKEY *kb = (const NDB_BKEY *) b;
+
+  
+  if (ka->shard != kb->shard)
+    return ka->shard < kb->shard ? -1 : 1;
+  return _ndb_keycmp(&ka->key, &kb->key);
+}
+
+
+/*
+ * Look up the n keys in kv, and set rv[i] to the object (at ov +
+ * i*osize) of each one found or NULL. Returns the number found or -1
+ * (with *res set) on error, ERANGE if the buffer is too small.
+ */
+static int
+_ndb_getmany_r(NDB *ndb,
+	       const char *path,
+	       STR2OBJ str2obj,
+	       NDB_BKEY *kv,
+	       int n,
+	       void **rv,
+	       void *ov,
+	       size_t osize,
+	       char **bufp,
+	       size_t *bsizep,
+	       int *res) {
+  DBT key, val;
+  void *op;
+  int j, rc, nf = 0;
+
+  
+  if (n < 1)
+    return 0;
+  
+  if (_ndb_open(ndb, path, 0) < 0) {
+    *res = errno;
+    return -1;
+  }
+  
+  for (j = 0; j < n; j++)
+    kv[j].shard = ndb->nshards ? _ndb_shardof(ndb, &kv[j].key) : 0;
+  qsort(kv, n, sizeof(*kv), _ndb_bkeycmp);
+  
+  for (j = 0; j < n; j++) {
+    if (j > 0 && _ndb_bkeycmp(&kv[j-1], &kv[j]) == 0) {
+      rv[kv[j].i] = rv[kv[j-1].i];
+      if (rv[kv[j].i])
+	++nf;
+      continue;
+    }
+    
+    rv[kv[j].i] = NULL;
+    if (_ndb_bloom_miss(ndb, path, kv[j].key.data, kv[j].key.size))
+      continue;
+    
+    key = kv[j].key;
+    memset(&val, 0, sizeof(val));
+    rc = _ndb_get(ndb, &key, &val, 0);
+    if (rc < 0)
+      goto Fail;
+    if (rc > 0)
+      continue;
+    
+    op = (char *) ov + kv[j].i*osize;
+    rc = (*str2obj)(val.data, val.size, op, bufp, bsizep, MAX_GETOBJ_SIZE);
+    if (rc < 0)
+      goto Fail;
+    
+    /* Malformed records are not found */
+    if (rc == 0) {
+      rv[kv[j].i] = op;
+      ++nf;
+    }
+  }
+
+  if (!ndb->stayopen)
+    _ndb_close(ndb);
+  return nf;
+
+ Fail:
+  *res = errno;
+  if (!ndb->stayopen)
+    _ndb_close(ndb);
+  return -1;
+}
+
+
+/* kv[].id & kv[].i set, with room for the keys after kv[n-1] */
+static int
+_ndb_getids_r(NDB *ndb,
+	      const char *path,
+	      STR2OBJ str2obj,
+	      NDB_BKEY *kv,
+	      int n,
+	      void **rv,
+	      void *ov,
+	      size_t osize,
+	      char *buf,
+	      size_t bsize,
+	      int *res) {
+  char *kbuf = (char *) (kv+n);
+  int j;
+
+  
+  if (_ndb_open(ndb, path, 0) < 0) {
+    *res = errno;
+    return -1;
+  }
+  
+  for (j = 0; j < n; j++) {
+    memset(&kv[j].key, 0, sizeof(kv[j].key));
+    if (_ndb_idkey(ndb, &kv[j].key, kbuf+j*NDB_IDKEY_SIZE, NDB_IDKEY_SIZE, kv[j].id) < 0) {
+      *res = errno;
+      if (!ndb->stayopen)
+	_ndb_close(ndb);
+      return -1;
+    }
+  }
+  
+  return _ndb_getmany_r(ndb, path, str2obj, kv, n, rv, ov, osize, &buf, &bsize, res);
+}
+
+
+/*
+ * Names are looked up like _ndb_getname_r() does: with "casefold
+ * always" in the case-folded index (or as is if it is missing), and
+ * with "casefold fallback" the names that were not found are looked
+ * up again in it, in a second batch.
+ */
+static int
+_ndb_getnames_r(NDB *ndb,
+		const char *path,
+		NDB *lcndb,
+		const char *lcpath,
+		STR2OBJ str2obj,
+		const char **nv,
+		int n,
+		void **rv,
+		void *ov,
+		size_t osize,
+		char *buf,
+		size_t bsize,
+		int *res) {
+  NDB_BKEY *kv;
+  const char **sv;
+  char **fv, *lcbuf, *done;
+  int j, m, pass, lc_f, rc, nf = 0, ores;
+
+  
+  kv = malloc(n*(sizeof(*kv)+2*sizeof(char *)+NDB_BATCH_NAMELEN+1));
+  if (!kv) {
+    *res = errno;
+    return -1;
+  }
+  sv = (const char **) (kv+n);
+  fv = (char **) (sv+n);
+  lcbuf = (char *) (fv+n);
+  done = lcbuf+n*NDB_BATCH_NAMELEN;
+  
+  for (j = 0; j < n; j++) {
+    rv[j] = NULL;
+    done[j] = 0;
+    sv[j] = _ndb_stripname(nv[j], &fv[j]);
+  }
+  
+  for (pass = 0; pass < 2; pass++) {
+    if (pass > 0 && f_casefold != CASEFOLD_ALWAYS && f_casefold != CASEFOLD_FALLBACK)
+      break;
+    lc_f = (pass == 0) == (f_casefold == CASEFOLD_ALWAYS);
+    
+    for (j = m = 0; j < n; j++) {
+      char *key = (char *) sv[j];
+      
+      if (rv[j] || (done[j] && f_casefold == CASEFOLD_ALWAYS))
+	continue;
+      
+      if (lc_f) {
+	key = lcbuf+j*NDB_BATCH_NAMELEN;
+	if (!_ndb_strfold(key, sv[j], NDB_BATCH_NAMELEN))
+	  continue;
+      }
+      
+      memset(&kv[m], 0, sizeof(kv[m]));
+      kv[m].key.data = key;
+      kv[m].key.size = strlen(key);
+      kv[m].i = j;
+      ++m;
+    }
+    
+    ores = *res;
+    rc = _ndb_getmany_r(lc_f ? lcndb : ndb, lc_f ? lcpath : path, str2obj,
+			kv, m, rv, ov, osize, &buf, &bsize, res);
+    if (rc < 0) {
+      /* A missing case-folded index is not an error */
+      if (!lc_f || *res == ERANGE) {
+	nf = -1;
+	break;
+      }
+      *res = ores;
+      continue;
+    }
+    
+    nf += rc;
+    for (j = 0; j < m; j++)
+      done[kv[j].i] = 1;
+  }
+
+  for (j = 0; j < n; j++)
+    free(fv[j]);
+  free(kv);
+  
+  return nf;
+}
+
+
+static NDB_BKEY *
+_ndb_bkeys(int n,
+	   int *res) {
+  NDB_BKEY *kv;
+
+  
+  kv = malloc(n*(sizeof(*kv)+NDB_IDKEY_SIZE));
+  if (!kv)
+    *res = errno;
+  return kv;
+}
+
+
+int
+nss_ndb_getpwuids_r(const uid_t *uv,
+		    int n,
+		    struct passwd **rv,
+		    struct passwd *pv,
+		    char *buf,
+		    size_t bsize,
+		    int *res) {
+  NDB_BKEY *kv;
+  int j, rc;
+
+  
+  _nss_ndb_init();
+  
+  if (n < 0 || (n > 0 && (!uv || !rv || !pv))) {
+    *res = EINVAL;
+    return -1;
+  }
+  if (n == 0)
+    return 0;
+  
+  kv = _ndb_bkeys(n, res);
+  if (!kv)
+    return -1;
+  for (j = 0; j < n; j++) {
+    kv[j].id = uv[j];
+    kv[j].i = j;
+  }
+  
+  rc = _ndb_getids_r(&ndb_pwd_byuid,
+		     path_passwd_byuid,
+		     (STR2OBJ) str2passwd,
+		     kv, n, (void **) rv, pv, sizeof(*pv), buf, bsize, res);
+  free(kv);
+  return rc;
+}
+
+
+int
+nss_ndb_getgrgids_r(const gid_t *gv,
+		    int n,
+		    struct group **rv,
+		    struct group *ov,
+		    char *buf,
+		    size_t bsize,
+		    int *res) {
+  NDB_BKEY *kv;
+  int j, rc;
+
+  
+  _nss_ndb_init();
+  
+  if (n < 0 || (n > 0 && (!gv || !rv || !ov))) {
+    *res = EINVAL;
+    return -1;
+  }
+  if (n == 0)
+    return 0;
+  
+  kv = _ndb_bkeys(n, res);
+  if (!kv)
+    return -1;
+  for (j = 0; j < n; j++) {
+    kv[j].id = gv[j];
+    kv[j].i = j;
+  }
+  
+  rc = _ndb_getids_r(&ndb_grp_bygid,
+		     path_group_bygid,
+		     (STR2OBJ) str2group,
+		     kv, n, (void **) rv, ov, sizeof(*ov), buf, bsize, res);
+  free(kv);
+  return rc;
+}
+
+
+int
+nss_ndb_getpwnams_r(const char **nv,
+		    int n,
+		    struct passwd **rv,
+		    struct passwd *pv,
+		    char *buf,
+		    size_t bsize,
+		    int *res) {
+  _nss_ndb_init();
+  
+  if (n < 0 || (n > 0 && (!nv || !rv || !pv))) {
+    *res = EINVAL;
+    return -1;
+  }
+  if (n == 0)
+    return 0;
+  
+  return _ndb_getnames_r(&ndb_pwd_byname,
+			 path_passwd_byname,
+			 &ndb_pwd_bylcname,
+			 path_passwd_bylcname,
+			 (STR2OBJ) str2passwd,
+			 nv, n, (void **) rv, pv, sizeof(*pv), buf, bsize, res);
+}
+
+
+int
+nss_ndb_getgrnams_r(const char **nv,
+		    int n,
+		    struct group **rv,
+		    struct group *ov,
+		    char *buf,
+		    size_t bsize,
+		    int *res) {
+  _nss_ndb_init();
+  
+  if (n < 0 || (n > 0 && (!nv || !rv || !ov))) {
+    *res = EINVAL;
+    return -1;
+  }
+  if (n == 0)
+    return 0;
+  
+  return _ndb_getnames_r(&ndb_grp_byname,
+			 path_group_byname,
+			 &ndb_grp_bylcname,
+			 path_group_bylcname,
+			 (STR2OBJ) str2group,
+			 nv, n, (void **) rv, ov, sizeof(*ov), buf, bsize, res);
+}
+
+
+
+/*
+ * Asynchronous lookups for event driven servers. Requests are queued
+ * to a small pool of worker threads that do the same lookups as the
+ * NSS functions (with their own per-thread handles), and completed
+ * requests are returned by nss_ndb_async_poll(), which calls their
+ * callbacks in the caller's thread. A completion fd (an eventfd on
+ * Linux, else a pipe) becomes readable when there are any, for use
+ * in poll/epoll/kqueue loops.
+ *
+ * A request with a deadline that passes (while queued or looked up)
+ * completes with ETIMEDOUT. A worker that is still reading the map
+ * then just drops the result, so the caller may reuse the request at
+ * once. The results are looked up in a buffer of the worker and
+ * copied to the request's buffer when done.
+ */
+#define NDB_ASYNC_THREADS 4
+#define NDB_ASYNC_BUFSIZE (MAX_GETOBJ_SIZE*4)
+
+#define NDB_REQ_QUEUED    1
+#define NDB_REQ_RUNNING   2
+#define NDB_REQ_DONE      3
+
+typedef struct {
+  NSS_NDB_ASYNC *ap;
+  pthread_t tid;
+  NSS_NDB_REQ *cur;      /* Being looked up, or NULL (also if it timed out) */
+} NDB_WORKER;
+
+struct nss_ndb_async {
+  pthread_mutex_t mtx;
+  pthread_cond_t cv;
+  int stop;
+  int fd[2];             /* Completion eventfd (in both) or pipe */
+  int signaled;          /* fd is readable */
+  NSS_NDB_REQ *qhead;    /* Queued */
+  NSS_NDB_REQ *qtail;
+  NSS_NDB_REQ *dhead;    /* Done, for the next nss_ndb_async_poll() */
+  NSS_NDB_REQ *dtail;
+  int nw;
+  NDB_WORKER *wv;
+};
+
+
+static int
+_ndb_async_expired(const NSS_NDB_REQ *rp,
+		   const struct timespec *now) {
+  if (!rp->deadline.tv_sec && !rp->deadline.tv_nsec)
+    return 0;
+  
+  return (now->tv_sec > rp->deadline.tv_sec ||
+	  (now->tv_sec == rp->deadline.tv_sec && now->tv_nsec >= rp->deadline.tv_nsec));
+}
+
+
+/* Called with ap->mtx held */
+static void
+_ndb_async_done(NSS_NDB_ASYNC *ap,
+		NSS_NDB_REQ *rp,
+		int status,
+		int res) {
+  rp->status = status;
+  rp->res = res;
+  rp->state = NDB_REQ_DONE;
+  rp->next = NULL;
+  
+  if (ap->dtail)
+    ap->dtail->next = rp;
+  else
+    ap->dhead = rp;
+  ap->dtail = rp;
+
+  if (!ap->signaled) {
+#ifdef __linux__
+    uint64_t v = 1;
+
+    (void) write(ap->fd[1], &v, sizeof(v));
+#else
+    (void) write(ap->fd[1], "", 1);
+#endif
+    ap->signaled = 1;
+  }
+}
+
+
+static int
+_ndb_pwcopy(struct passwd *dst,
+	    const struct passwd *src,
+	    char *buf,
+	    size_t bsize) {
+  *dst = *src;
+  
+  if (!(dst->pw_name = strbdup(src->pw_name, &buf, &bsize)) ||
+      !(dst->pw_passwd = strbdup(src->pw_passwd, &buf, &bsize)) ||
+#ifdef _PATH_MASTERPASSWD
+      !(dst->pw_class = strbdup(src->pw_class, &buf, &bsize)) ||
+#endif
+      !(dst->pw_gecos = strbdup(src->pw_gecos, &buf, &bsize)) ||
+      !(dst->pw_dir = strbdup(src->pw_dir, &buf, &bsize)) ||
+      !(dst->pw_shell = strbdup(src->pw_shell, &buf, &bsize)))
+    return -1;
+  
+  return 0;
+}
+
+
+static int
+_ndb_grcopy(struct group *dst,
+	    const struct group *src,
+	    char *buf,
+	    size_t bsize) {
+  int i, n;
+
+  
+  *dst = *src;
+  
+  if (src->gr_mem) {
+    /* The pointers first, at the start of buf */
+    for (n = 0; src->gr_mem[n]; n++)
+      ;
+    dst->gr_mem = balloc((n+1)*sizeof(char *), &buf, &bsize);
+    if (!dst->gr_mem)
+      return -1;
+    for (i = 0; i < n; i++)
+      if (!(dst->gr_mem[i] = strbdup(src->gr_mem[i], &buf, &bsize)))
+	return -1;
+    dst->gr_mem[n] = NULL;
+  }
+  
+  if (!(dst->gr_name = strbdup(src->gr_name, &buf, &bsize)) ||
+      !(dst->gr_passwd = strbdup(src->gr_passwd, &buf, &bsize)))
+    return -1;
+  
+  return 0;
+}
+
+
+static void *
+_ndb_async_worker(void *xp) {
+  NDB_WORKER *wp = (NDB_WORKER *) xp;
+  NSS_NDB_ASYNC *ap = wp->ap;
+  NSS_NDB_REQ *rp;
+  struct passwd pw;
+  struct group gr;
+  struct timespec now;
+  unsigned long id;
+  char *buf, *name;
+  void *obj;
+  int type, rc, res;
+
+
+  buf = malloc(NDB_ASYNC_BUFSIZE);
+  
+  pthread_mutex_lock(&ap->mtx);
+  while (!ap->stop) {
+    rp = ap->qhead;
+    if (!rp) {
+      pthread_cond_wait(&ap->cv, &ap->mtx);
+      continue;
+    }
+    ap->qhead = rp->next;
+    if (!ap->qhead)
+      ap->qtail = NULL;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (_ndb_async_expired(rp, &now)) {
+      _ndb_async_done(ap, rp, NS_UNAVAIL, ETIMEDOUT);
+      continue;
+    }
+    
+    /* The request may be reused once it has timed out */
+    type = rp->type;
+    id = rp->id;
+    name = rp->name ? strdup(rp->name) : NULL;
+    if (!buf || (rp->name && !name)) {
+      _ndb_async_done(ap, rp, NS_UNAVAIL, ENOMEM);
+      continue;
+    }
+    rp->state = NDB_REQ_RUNNING;
+    wp->cur = rp;
+    pthread_mutex_unlock(&ap->mtx);
+
+    obj = NULL;
+    res = 0;
+    switch (type) {
+    case NSS_NDB_GETPWNAM:
+      rc = _ndb_getpwnam_r(&obj, NULL, name, &pw, buf, NDB_ASYNC_BUFSIZE, &res);
+      break;
+    case NSS_NDB_GETPWUID:
+      rc = _ndb_getpwuid_r(&obj, NULL, (uid_t) id, &pw, buf, NDB_ASYNC_BUFSIZE, &res);
+      break;
+    case NSS_NDB_GETGRNAM:
+      rc = _ndb_getgrnam_r(&obj, NULL, name, &gr, buf, NDB_ASYNC_BUFSIZE, &res);
+      break;
+    default:
+      rc = _ndb_getgrgid_r(&obj, NULL, (gid_t) id, &gr, buf, NDB_ASYNC_BUFSIZE, &res);
+    }
+    free(name);
+    
+    pthread_mutex_lock(&ap->mtx);
+    if (wp->cur != rp)
+      continue;
+    wp->cur = NULL;
+    
+    rp->result = NULL;
+    if (rc == NS_SUCCESS && obj) {
+      if (type == NSS_NDB_GETPWNAM || type == NSS_NDB_GETPWUID) {
+	if (_ndb_pwcopy(&rp->pw, &pw, rp->buf, rp->bsize) == 0)
+	  rp->result = &rp->pw;
+      } else {
+	if (_ndb_grcopy(&rp->gr, &gr, rp->buf, rp->bsize) == 0)
+	  rp->result = &rp->gr;
+      }
+      if (!rp->result) {
+	rc = NS_UNAVAIL;
+	res = ERANGE;
+      }
+    } else if (rc == NS_SUCCESS)
+      rc = NS_NOTFOUND;
+    
+    _ndb_async_done(ap, rp, rc, rc == NS_UNAVAIL ? res : 0);
+  }
+  pthread_mutex_unlock(&ap->mtx);
+
+  free(buf);
+  return NULL;
+}
+
+
+/*
+ * Stops the workers. Requests that are still queued or being looked up
+ * complete with ECANCELED, and the callbacks of all completed requests
+ * are called (as by nss_ndb_async_poll()) before it returns.
+ */
+void
+nss_ndb_async_destroy(NSS_NDB_ASYNC *ap) {
+  NSS_NDB_REQ *rp;
+  int i;
+
+  
+  if (!ap)
+    return;
+  
+  pthread_mutex_lock(&ap->mtx);
+  ap->stop = 1;
+  while ((rp = ap->qhead) != NULL) {
+    ap->qhead = rp->next;
+    _ndb_async_done(ap, rp, NS_UNAVAIL, ECANCELED);
+  }
+  ap->qtail = NULL;
+  for (i = 0; i < ap->nw; i++) {
+    /* The worker drops the result, like for a timed out request */
+    if ((rp = ap->wv[i].cur) != NULL) {
+      ap->wv[i].cur = NULL;
+      _ndb_async_done(ap, rp, NS_UNAVAIL, ECANCELED);
+    }
+  }
+  pthread_cond_broadcast(&ap->cv);
+  pthread_mutex_unlock(&ap->mtx);
+  
+  if (ap->fd[0] >= 0)
+    (void) nss_ndb_async_poll(ap, 0);
+  
+  for (i = 0; i < ap->nw; i++)
+    pthread_join(ap->wv[i].tid, NULL);
+  
+  if (ap->fd[0] >= 0)
+    close(ap->fd[0]);
+  if (ap->fd[1] >= 0 && ap->fd[1] != ap->fd[0])
+    close(ap->fd[1]);
+  
+  pthread_cond_destroy(&ap->cv);
+  pthread_mutex_destroy(&ap->mtx);
+  free(ap->wv);
+  free(ap);
+}
+
+
+NSS_NDB_ASYNC *
+nss_ndb_async_create(int nthreads) {
+  NSS_NDB_ASYNC *ap;
+  int i, ec;
+
+  
+  if (nthreads < 1)
+    nthreads = NDB_ASYNC_THREADS;
+  
+  ap = calloc(1, sizeof(*ap));
+  if (!ap)
+    return NULL;
+
+  ap->fd[0] = ap->fd[1] = -1;
+  pthread_mutex_init(&ap->mtx, NULL);
+  pthread_cond_init(&ap->cv, NULL);
+
+#ifdef __linux__
+  ap->fd[0] = ap->fd[1] = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+  if (ap->fd[0] < 0)
+    goto Fail;
+#else
+  if (pipe(ap->fd) < 0)
+    goto Fail;
+  for (i = 0; i < 2; i++) {
+    (void) fcntl(ap->fd[i], F_SETFL, O_NONBLOCK);
+    (void) fcntl(ap->fd[i], F_SETFD, FD_CLOEXEC);
+  }
+#endif
+
+  ap->wv = calloc(nthreads, sizeof(NDB_WORKER));
+  if (!ap->wv)
+    goto Fail;
+  
+  for (i = 0; i < nthreads; i++) {
+    ap->wv[i].ap = ap;
+    ec = pthread_create(&ap->wv[i].tid, NULL, _ndb_async_worker, &ap->wv[i]);
+    if (ec) {
+      errno = ec;
+      goto Fail;
+    }
+    ++ap->nw;
+  }
+  
+  return ap;
+
+ Fail:
+  ec = errno;
+  nss_ndb_async_destroy(ap);
+  errno = ec;
+  return NULL;
+}
+
+
+int
+nss_ndb_async_fd(NSS_NDB_ASYNC *ap) {
+  return ap ? ap->fd[0] : -1;
+}
+
+
+int
+nss_ndb_async_submit(NSS_NDB_ASYNC *ap,
+		     NSS_NDB_REQ *rp) {
+  if (!ap || !rp || !rp->buf ||
+      rp->type < NSS_NDB_GETPWNAM || rp->type > NSS_NDB_GETGRGID ||
+      ((rp->type == NSS_NDB_GETPWNAM || rp->type == NSS_NDB_GETGRNAM) && !rp->name)) {
+    errno = EINVAL;
+    return -1;
+  }
+  
+  rp->status = NS_UNAVAIL;
+  rp->res = 0;
+  rp->result = NULL;
+  rp->next = NULL;
+  
+  memset(&rp->deadline, 0, sizeof(rp->deadline));
+  if (rp->timeout > 0) {
+    clock_gettime(CLOCK_MONOTONIC, &rp->deadline);
+    rp->deadline.tv_sec += rp->timeout/1000;
+    rp->deadline.tv_nsec += (rp->timeout%1000)*1000000L;
+    if (rp->deadline.tv_nsec >= 1000000000L) {
+      ++rp->deadline.tv_sec;
+      rp->deadline.tv_nsec -= 1000000000L;
+    }
+  }
+  
+  pthread_mutex_lock(&ap->mtx);
+  if (ap->stop) {
+    pthread_mutex_unlock(&ap->mtx);
+    errno = ESHUTDOWN;
+    return -1;
+  }
+  rp->state = NDB_REQ_QUEUED;
+  if (ap->qtail)
+    ap->qtail->next = rp;
+  else
+    ap->qhead = rp;
+  ap->qtail = rp;
+  pthread_cond_signal(&ap->cv);
+  pthread_mutex_unlock(&ap->mtx);
+  
+  return 0;
+}
+
+
+/*
+ * Milliseconds until the first deadline of the pending requests, or -1
+ * if none has one. Use it as the timeout of the event loop, and call
+ * nss_ndb_async_poll() when it expires.
+ */
+int
+nss_ndb_async_timeout(NSS_NDB_ASYNC *ap) {
+  NSS_NDB_REQ *rp, *first = NULL;
+  struct timespec now;
+  long long ms;
+  int i;
+
+  
+  pthread_mutex_lock(&ap->mtx);
+  for (i = -1; i < ap->nw; i++) {
+    for (rp = (i < 0 ? ap->qhead : ap->wv[i].cur); rp; rp = (i < 0 ? rp->next : NULL)) {
+      if (!rp->deadline.tv_sec && !rp->deadline.tv_nsec)
+	continue;
+      if (!first ||
+	  rp->deadline.tv_sec < first->deadline.tv_sec ||
+	  (rp->deadline.tv_sec == first->deadline.tv_sec &&
+	   rp->deadline.tv_nsec < first->deadline.tv_nsec))
+	first = rp;
+    }
+  }
+  if (!first) {
+    pthread_mutex_unlock(&ap->mtx);
+    return -1;
+  }
+  
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  ms = (first->deadline.tv_sec - now.tv_sec)*1000LL +
+    (first->deadline.tv_nsec - now.tv_nsec + 999999)/1000000;
+  pthread_mutex_unlock(&ap->mtx);
+  
+  return ms < 0 ? 0 : ms > INT_MAX ? INT_MAX : (int) ms;
+}
+
+
+/*
+ * Wait up to 'timeout' ms (0 = don't, -1 = until something completes)
+ * for completed requests, time out the requests whose deadlines have
+ * passed and call the callbacks of all completed requests. Returns the
+ * number of requests completed.
+ */
+int
+nss_ndb_async_poll(NSS_NDB_ASYNC *ap,
+		   int timeout) {
+  NSS_NDB_REQ *rp, *next, *prev, *done;
+  struct pollfd pfd;
+  struct timespec now;
+  char tmp[64];
+  int i, dt, n = 0;
+
+  
+  if (!ap) {
+    errno = EINVAL;
+    return -1;
+  }
+  
+  if (timeout != 0) {
+    dt = nss_ndb_async_timeout(ap);
+    if (dt >= 0 && (timeout < 0 || dt < timeout))
+      timeout = dt;
+    
+    pfd.fd = ap->fd[0];
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    if (poll(&pfd, 1, timeout) < 0 && errno != EINTR)
+      return -1;
+  }
+  
+  pthread_mutex_lock(&ap->mtx);
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  for (prev = NULL, rp = ap->qhead; rp; rp = next) {
+    next = rp->next;
+    if (!_ndb_async_expired(rp, &now)) {
+      prev = rp;
+      continue;
+    }
+    if (prev)
+      prev->next = next;
+    else
+      ap->qhead = next;
+    if (ap->qtail == rp)
+      ap->qtail = prev;
+    _ndb_async_done(ap, rp, NS_UNAVAIL, ETIMEDOUT);
+  }
+  for (i = 0; i < ap->nw; i++) {
+    rp = ap->wv[i].cur;
+    if (rp && _ndb_async_expired(rp, &now)) {
+      ap->wv[i].cur = NULL;
+      _ndb_async_done(ap, rp, NS_UNAVAIL, ETIMEDOUT);
+    }
+  }
+  
+  while (read(ap->fd[0], tmp, sizeof(tmp)) > 0)
+    ;
+  ap->signaled = 0;
+  done = ap->dhead;
+  ap->dhead = ap->dtail = NULL;
+  pthread_mutex_unlock(&ap->mtx);
+  
+  while ((rp = done) != NULL) {
+    /* The callback may free or resubmit the request */
+    done = rp->next;
+    rp->next = NULL;
+    ++n;
+    if (rp->callback)
+      (*rp->callback)(rp);
+  }
+  
+  return n;
+}
+
+
+
+static int
+gr_addgid(gid_t gid,
+	  gid_t *groupv,
+	  int maxgrp,
+	  int *groupc)
+{
+  int i;
+
+  
+  /* Do not add if already added */
+  for (i = 0; i < *groupc; i++) {
+    if (groupv[i] == gid)
+      return 0;
+  }
+  
+  if (*groupc >= maxgrp)
+    return -1;
+    
+  groupv[*groupc] = gid;
+  ++*groupc;
+  return 1;
+}
+
+
+/*
+ * Get the correctly cased user name via the passwd.bylcname index
+ */
+static char *
+_ndb_canonname(const char *name,
+	       char *buf,
+	       size_t bsize) {
+  char lcname[256];
+  DBT key, val;
+  char *cp;
+  size_t len;
+  int rc;
+
+
+  if (!_ndb_strfold(lcname, name, sizeof(lcname)))
+    return NULL;
+  
+  if (_ndb_open(&ndb_pwd_bylcname, path_passwd_bylcname, 0) < 0)
+    return NULL;
+  
+  memset(&key, 0, sizeof(key));
+  memset(&val, 0, sizeof(val));
+  
+  key.data = lcname;
+  key.size = strlen(lcname);
+
+  rc = _ndb_get(&ndb_pwd_bylcname, &key, &val, 0);
+  if (rc != 0 || !val.data) {
+    cp = NULL;
+    goto End;
+  }
+
+  cp = memchr(val.data, ':', val.size);
+  len = cp ? cp - (char *) val.data : val.size;
+  if (len >= bsize) {
+    cp = NULL;
+    goto End;
+  }
+  
+  memcpy(cp = buf, val.data, len);
+  buf[len] = '\0';
+
+ End:
+  if (!ndb_pwd_bylcname.stayopen)
+    _ndb_close(&ndb_pwd_bylcname);
+  
+  return cp;
+}
+
+
+/* 
+ * usergroups.byname.db format:
+ *   user:gid,gid,gid,...
+ *
+ * Returns a malloc()ed copy of the user's gid list in *gidlist
+ */
+static int
+_ndb_getusergroups(const char *name,
+		   char **gidlist) {
+  DBT key, val;
+  int rc, ec;
+  char *members, *cp;
+  char *nbuf = NULL;
+  char cname[256];
+  
+
+  *gidlist = NULL;
+  
+  if (name == NULL)
+    return NS_NOTFOUND;
+  
+  if (_ndb_open(&ndb_grp_byuser, path_usergroups_byname, 0) < 0) {
+    /* Fall back to looping over all entries via getgrent_r() - slooooow */
+    return NS_UNAVAIL;
+  }
+
+  name = _ndb_stripname(name, &nbuf);
+
+  if (f_casefold == CASEFOLD_ALWAYS &&
+      (cp = _ndb_canonname(name, cname, sizeof(cname))) != NULL)
+    name = cp;
+  
+  memset(&key, 0, sizeof(key));
+  memset(&val, 0, sizeof(val));
+  
+  key.data = (void *) name;
+  key.size = strlen(name);
+
+  val.data = NULL;
+  val.size = 0;
+  
+  rc = _ndb_get(&ndb_grp_byuser, &key, &val, 0);
+  if (rc > 0 && f_casefold == CASEFOLD_FALLBACK &&
+      (cp = _ndb_canonname(name, cname, sizeof(cname))) != NULL &&
+      strcmp(cp, name) != 0) {
+    /* Retry with the user name as spelled in the passwd database */
+    key.data = cp;
+    key.size = strlen(cp);
+    
+    rc = _ndb_get(&ndb_grp_byuser, &key, &val, 0);
+  }
+  
+  if (rc < 0)
+    ec = NS_UNAVAIL;
+  else if (rc > 0)
+    ec = NS_NOTFOUND;
+  else if (val.data == NULL) /* Should not happen */
+    ec = NS_UNAVAIL;
+  else {
+    members = memchr(val.data, ':', val.size);
+    if (members)
+      ++members;
+    else
+      members = (char *) val.data + val.size;
+    
+    *gidlist = strndup(members, val.size - (members - (char *) val.data));
+    ec = *gidlist ? NS_SUCCESS : NS_UNAVAIL;
+  }
+
+  _ndb_close(&ndb_grp_byuser);
+  
+  if (nbuf)
+    free(nbuf);
+
+  return ec;
+}
+
+
+int
+nss_ndb_getgroupmembership(void *res,
+			   void *mdata,
+			   va_list ap) {
+  char *name    = va_arg(ap, char *);
+  gid_t pgid    = va_arg(ap, gid_t);
+  gid_t *groupv = va_arg(ap, gid_t *);
+  int maxgrp    = va_arg(ap, int);
+  int *groupc   = va_arg(ap, int *);
+  
+  char *members, *list, *cp;
+  int rc;
+  
+
+  rc = _ndb_getusergroups(name, &list);
+  if (rc == NS_UNAVAIL)
+    return rc;
+  
+  /* Add primary gid to groupv[] */
+  (void) gr_addgid(pgid, groupv, maxgrp, groupc);
+
+  if (rc != NS_SUCCESS)
+    return rc;
+  
+  members = list;
+  while ((cp = strsep(&members, ",")) != NULL) {
+    gid_t gid;
+    
+    if (sscanf(cp, "%u", &gid) == 1) {
+      (void) gr_addgid(gid, groupv, maxgrp, groupc);
+    }
+  }
+
+  free(list);
+	
+  /* Let following nsswitch backend(s) add more groups(?) */
+  return NS_NOTFOUND;
+}
+
+
+
+/*
+ * netgroup.byname.db format:
+ *   netgroup:(host,user,domain) (host,user,domain) ...
+ *
+ * Nested netgroups are expanded by makendb so each record contains
+ * the complete list of triples for the netgroup.
+ *
+ * netgroup.bytriple.db format:
+ *   netgroup:host,user,domain
+ *
+ * One key for every triple and every combination of fields left out
+ * (NULL) in an innetgr() query - those are stored as "*". Empty
+ * (wildcard) fields are stored as empty strings and host names
+ * in lower case.
+ */
+static __thread char *netgr_list = NULL;
+static __thread char *netgr_next = NULL;
+
+
+/*
+ * Locate the next "(host,user,domain)" triple in a netgroup list
+ */
+static int
+_ndb_netgr_next(const char **lp,
+		const char *fv[3],
+		size_t fl[3]) {
+  const char *cp, *ep;
+  int i;
+
+  
+  while (*lp && (cp = strchr(*lp, '(')) != NULL) {
+    if ((ep = strchr(++cp, ')')) == NULL)
+      break;
+    *lp = ep+1;
+    
+    for (i = 0; i < 3; i++) {
+      fv[i] = cp;
+      fl[i] = strcspn(cp, ",)");
+      cp += fl[i];
+      if (*cp != (i < 2 ? ',' : ')'))
+	break;
+      ++cp;
+    }
+    if (i == 3)
+      return 1;
+  }
+
+  *lp = NULL;
+  return 0;
+}
+
+
+static int
+_ndb_netgr_match(const char *field,
+		 size_t len,
+		 const char *str) {
+  if (!str || !len)
+    return 1;
+
+  return strlen(str) == len && strncmp(field, str, len) == 0;
+}
+
+
+int
+nss_ndb_setnetgrent(void *rv,
+		    void *mdata,
+		    va_list ap) {
+  const char *group = va_arg(ap, const char *);
+  DBT key, val;
+  char *cp;
+  int rc, ec;
+
+
+  if (netgr_list) {
+    free(netgr_list);
+    netgr_list = NULL;
+  }
+  netgr_next = NULL;
+  
+  if (!group)
+    return NS_NOTFOUND;
+  
+  if (_ndb_open(&ndb_ngr_byname, path_netgroup_byname, 0) < 0)
+    return NS_UNAVAIL;
+
+  memset(&key, 0, sizeof(key));
+  memset(&val, 0, sizeof(val));
+  
+  key.data = (char *) group;
+  key.size = strlen(group);
+
+  rc = _ndb_get(&ndb_ngr_byname, &key, &val, 0);
+  if (rc < 0)
+    ec = NS_UNAVAIL;
+  else if (rc > 0 || !val.data)
+    ec = NS_NOTFOUND;
+  else {
+    cp = memchr(val.data, ':', val.size);
+    if (cp)
+      ++cp;
+    else
+      cp = val.data;
+    
+    netgr_list = strndup(cp, val.size - (cp - (char *) val.data));
+    if (!netgr_list)
+      ec = NS_UNAVAIL;
+    else {
+      netgr_next = netgr_list;
+      ec = NS_SUCCESS;
+    }
+  }
+
+  if (!ndb_ngr_byname.stayopen)
+    _ndb_close(&ndb_ngr_byname);
+  
+  return ec;
+}
+
+
+int
+nss_ndb_getnetgrent_r(void *rv,
+		      void *mdata,
+		      va_list ap) {
+  char **hostp  = va_arg(ap, char **);
+  char **userp  = va_arg(ap, char **);
+  char **domp   = va_arg(ap, char **);
+  char *buf     = va_arg(ap, char *);
+  size_t bsize  = va_arg(ap, size_t);
+  int *res      = va_arg(ap, int *);
+  const char *lp, *fv[3];
+  size_t fl[3];
+  char **pv[3];
+  int i;
+
+
+  lp = netgr_next;
+  if (!_ndb_netgr_next(&lp, fv, fl)) {
+    netgr_next = NULL;
+    return NS_NOTFOUND;
+  }
+
+  pv[0] = hostp;
+  pv[1] = userp;
+  pv[2] = domp;
+  
+  for (i = 0; i < 3; i++) {
+    if (!fl[i]) {
+      /* Empty field - matches anything */
+      *pv[i] = NULL;
+      continue;
+    }
+    
+    if (fl[i] >= bsize) {
+      /* Leave netgr_next alone so the caller may retry with a larger buffer */
+      *res = ERANGE;
+      return NS_UNAVAIL;
+    }
+
+    memcpy(*pv[i] = buf, fv[i], fl[i]);
+    buf[fl[i]] = '\0';
+    buf   += fl[i]+1;
+    bsize -= fl[i]+1;
+  }
+
+  netgr_next = (char *) lp;
+  return NS_SUCCESS;
+}
+
+
+int
+nss_ndb_endnetgrent(void *rv,
+		    void *mdata,
+		    va_list ap) {
+  if (netgr_list) {
+    free(netgr_list);
+    netgr_list = NULL;
+  }
+  netgr_next = NULL;
+
+  return _ndb_endent(&ndb_ngr_byname);
+}
+
+
+/*
+ * Check a (host,user,domain) against the flattened list of triples in
+ * netgroup.byname. Only used if the netgroup.bytriple index is missing.
+ */
+static int
+_ndb_innetgr_scan(const char *group,
+		  const char *host,
+		  const char *user,
+		  const char *dom) {
+  DBT key, val;
+  const char *lp, *fv[3];
+  char *list, lchost[256];
+  size_t fl[3];
+  int rc, ec;
+
+
+  if (_ndb_open(&ndb_ngr_byname, path_netgroup_byname, 0) < 0)
+    return NS_UNAVAIL;
+
+  memset(&key, 0, sizeof(key));
+  memset(&val, 0, sizeof(val));
+  
+  key.data = (char *) group;
+  key.size = strlen(group);
+
+  rc = _ndb_get(&ndb_ngr_byname, &key, &val, 0);
+  if (rc < 0)
+    ec = NS_UNAVAIL;
+  else if (rc > 0 || !val.data)
+    ec = NS_NOTFOUND;
+  else if ((list = strndup(val.data, val.size)) == NULL)
+    ec = NS_UNAVAIL;
+  else {
+    ec = NS_NOTFOUND;
+    
+    lp = strchr(list, ':');
+    if (!lp)
+      lp = list;
+    
+    while (ec == NS_NOTFOUND && _ndb_netgr_next(&lp, fv, fl)) {
+      if (fl[0] && fl[0] < sizeof(lchost)) {
+	memcpy(lchost, fv[0], fl[0]);
+	lchost[fl[0]] = '\0';
+	if (_ndb_strfold(lchost, lchost, sizeof(lchost)))
+	  fv[0] = lchost;
+      }
+      
+      if (_ndb_netgr_match(fv[0], fl[0], host) &&
+	  _ndb_netgr_match(fv[1], fl[1], user) &&
+	  _ndb_netgr_match(fv[2], fl[2], dom))
+	ec = NS_SUCCESS;
+    }
+    
+    free(list);
+  }
+
+  if (!ndb_ngr_byname.stayopen)
+    _ndb_close(&ndb_ngr_byname);
+
+  return ec;
+}
+
+
+/*
+ * Each field in the query is either NULL ("*" in the index), or must
+ * match either the exact value or an empty (wildcard) field in a triple.
+ * That is at most 2^3 keyed lookups, with the exact one tried first.
+ */
+int
+nss_ndb_innetgr(void *rv,
+		void *mdata,
+		va_list ap) {
+  const char *group = va_arg(ap, const char *);
+  const char *host  = va_arg(ap, const char *);
+  const char *user  = va_arg(ap, const char *);
+  const char *dom   = va_arg(ap, const char *);
+  int *res = rv;
+  const char *qv[3], *kv[3];
+  char lchost[256], kbuf[1024];
+  DBT key, val;
+  int i, n, rc, ec;
+
+  
+  if (res)
+    *res = 0;
+  
+  if (!group)
+    return NS_NOTFOUND;
+
+  if (host) {
+    if (!_ndb_strfold(lchost, host, sizeof(lchost)))
+      return NS_NOTFOUND;
+    host = lchost;
+  }
+  
+  if (_ndb_open(&ndb_ngr_bytriple, path_netgroup_bytriple, 0) < 0) {
+    ec = _ndb_innetgr_scan(group, host, user, dom);
+    goto End;
+  }
+
+  qv[0] = host;
+  qv[1] = user;
+  qv[2] = dom;
+  
+  ec = NS_NOTFOUND;
+  for (n = 0; n < 8 && ec == NS_NOTFOUND; n++) {
+    for (i = 0; i < 3; i++) {
+      if (!qv[i]) {
+	if (n & (1<<i))
+	  break;
+	kv[i] = "*";
+      } else
+	kv[i] = (n & (1<<i)) ? "" : qv[i];
+    }
+    if (i < 3)
+      continue;
+    
+    rc = snprintf(kbuf, sizeof(kbuf), "%s:%s,%s,%s", group, kv[0], kv[1], kv[2]);
+    if (rc < 0 || rc >= sizeof(kbuf))
+      break;
+    
+    memset(&key, 0, sizeof(key));
+    memset(&val, 0, sizeof(val));
+    
+    if (_ndb_bloom_miss(&ndb_ngr_bytriple, path_netgroup_bytriple, kbuf, rc))
+      continue;
+    
+    key.data = kbuf;
+    key.size = rc;
+
+    rc = _ndb_get(&ndb_ngr_bytriple, &key, &val, 0);
+    if (rc < 0)
+      ec = NS_UNAVAIL;
+    else if (rc == 0)
+      ec = NS_SUCCESS;
+  }
+
+  if (!ndb_ngr_bytriple.stayopen)
+    _ndb_close(&ndb_ngr_bytriple);
+
+ End:
+  if (ec == NS_SUCCESS && res)
+    *res = 1;
+  
+  return ec;
+}
+
+
+
+/*
+ * hosts.byname.db is keyed by the lower case host name (and aliases),
+ * hosts.byaddr.db by the address as printed by inet_ntop(3).
+ */
+static int
+_ndb_gethost_r(NDB *ndb,
+	       const char *path,
+	       void *rv,
+	       void *mdata,
+	       char *key,
+	       int af,
+	       struct hostent *hbuf,
+	       char *buf,
+	       size_t bsize,
+	       int *res,
+	       int *herr) {
+  int rc;
+
+  
+  /* Passed on to str2hostent() */
+  hbuf->h_addrtype = af;
+  
+  rc = _ndb_getkey_r(ndb,
+		     path,
+		     (STR2OBJ) str2hostent,
+		     rv, mdata,
+		     key, hbuf, buf, bsize, res);
+  
+  switch (rc) {
+  case NS_SUCCESS:
+    *herr = NETDB_SUCCESS;
+    break;
+  case NS_NOTFOUND:
+    *herr = HOST_NOT_FOUND;
+    break;
+  default:
+    *herr = NETDB_INTERNAL;
+  }
+
+  return rc;
+}
+
+
+static int
+_ndb_gethostbyname(void *rv,
+		   void *mdata,
+		   const char *name,
+		   int af,
+		   struct hostent *hbuf,
+		   char *buf,
+		   size_t bsize,
+		   int *res,
+		   int *herr) {
+  char lcname[NI_MAXHOST];
+  size_t len;
+
+  
+  if (!name || !_ndb_strfold(lcname, name, sizeof(lcname))) {
+    *herr = HOST_NOT_FOUND;
+    return NS_NOTFOUND;
+  }
+
+  /* Ignore the trailing dot of a fully qualified name */
+  len = strlen(lcname);
+  if (len > 1 && lcname[len-1] == '.')
+    lcname[len-1] = '\0';
+  
+  return _ndb_gethost_r(&ndb_hst_byname,
+			path_hosts_byname,
+			rv, mdata,
+			lcname, af, hbuf, buf, bsize, res, herr);
+}
 
 
 int
-nss_ndb_getpwent_r(void *rv,
+nss_ndb_gethostbyname(void *rv,
+		      void *mdata,
+		      va_list ap) {
+  const char *name      = va_arg(ap, const char *);
+  int af                = va_arg(ap, int);
+  struct hostent *hbuf  = va_arg(ap, struct hostent *);
+  char *buf             = va_arg(ap, char *);
+  size_t bsize          = va_arg(ap, size_t);
+  int *res              = va_arg(ap, int *);
+  int *herr             = va_arg(ap, int *);
+
+  return _ndb_gethostbyname(rv, mdata, name, af, hbuf, buf, bsize, res, herr);
+}
+
+
+static int
+_ndb_gethostbyaddr(void *rv,
+		   void *mdata,
+		   const void *addr,
+		   socklen_t alen,
+		   int af,
+		   struct hostent *hbuf,
+		   char *buf,
+		   size_t bsize,
+		   int *res,
+		   int *herr) {
+  char abuf[INET6_ADDRSTRLEN];
+
+  
+  if (!addr ||
+      (af == AF_INET && alen != sizeof(struct in_addr)) ||
+      (af == AF_INET6 && alen != sizeof(struct in6_addr)) ||
+      !inet_ntop(af, addr, abuf, sizeof(abuf))) {
+    *herr = HOST_NOT_FOUND;
+    return NS_NOTFOUND;
+  }
+  
+  return _ndb_gethost_r(&ndb_hst_byaddr,
+			path_hosts_byaddr,
+			rv, mdata,
+			abuf, af, hbuf, buf, bsize, res, herr);
+}
+
+
+int
+nss_ndb_gethostbyaddr(void *rv,
+		      void *mdata,
+		      va_list ap) {
+  const void *addr      = va_arg(ap, const void *);
+  socklen_t alen        = va_arg(ap, socklen_t);
+  int af                = va_arg(ap, int);
+  struct hostent *hbuf  = va_arg(ap, struct hostent *);
+  char *buf             = va_arg(ap, char *);
+  size_t bsize          = va_arg(ap, size_t);
+  int *res              = va_arg(ap, int *);
+  int *herr             = va_arg(ap, int *);
+
+  return _ndb_gethostbyaddr(rv, mdata, addr, alen, af, hbuf, buf, bsize, res, herr);
+}
+
+
+
+/*
+ * services.byname.db is keyed by "name/proto" (and aliases), and by
+ * plain "name" and "port" for lookups without a protocol (the first
+ * entry in the source file wins). services.byport.db is keyed by
+ * "port/proto" and is also used for enumeration.
+ */
+static int
+_ndb_getservbyname_r(void *rv,
+		     void *mdata,
+		     const char *name,
+		     const char *proto,
+		     struct servent *sbuf,
+		     char *buf,
+		     size_t bsize,
+		     int *res) {
+  char kbuf[256];
+  int rc;
+
+  
+  if (!name)
+    return NS_NOTFOUND;
+  
+  if (proto)
+    rc = snprintf(kbuf, sizeof(kbuf), "%s/%s", name, proto);
+  else
+    rc = snprintf(kbuf, sizeof(kbuf), "%s", name);
+  if (rc < 0 || rc >= sizeof(kbuf))
+    return NS_NOTFOUND;
+  
+  return _ndb_getkey_r(&ndb_svc_byname,
+		       path_services_byname,
+		       (STR2OBJ) str2servent,
+		       rv, mdata,
+		       kbuf, sbuf, buf, bsize, res);
+}
+
+
+int
+nss_ndb_getservbyname_r(void *rv,
+			void *mdata,
+			va_list ap) {
+  const char *name     = va_arg(ap, const char *);
+  const char *proto    = va_arg(ap, const char *);
+  struct servent *sbuf = va_arg(ap, struct servent *);
+  char *buf            = va_arg(ap, char *);
+  size_t bsize         = va_arg(ap, size_t);
+  int *res             = va_arg(ap, int *);
+
+  return _ndb_getservbyname_r(rv, mdata, name, proto, sbuf, buf, bsize, res);
+}
+
+
+static int
+_ndb_getservbyport_r(void *rv,
+		     void *mdata,
+		     int port,
+		     const char *proto,
+		     struct servent *sbuf,
+		     char *buf,
+		     size_t bsize,
+		     int *res) {
+  char kbuf[256];
+  int rc;
+
+  
+  if (!proto) {
+    snprintf(kbuf, sizeof(kbuf), "%u", ntohs((uint16_t) port));
+    
+    return _ndb_getkey_r(&ndb_svc_byname,
+			 path_services_byname,
+			 (STR2OBJ) str2servent,
+			 rv, mdata,
+			 kbuf, sbuf, buf, bsize, res);
+  }
+  
+  rc = snprintf(kbuf, sizeof(kbuf), "%u/%s", ntohs((uint16_t) port), proto);
+  if (rc < 0 || rc >= sizeof(kbuf))
+    return NS_NOTFOUND;
+  
+  return _ndb_getkey_r(&ndb_svc_byport,
+		       path_services_byport,
+		       (STR2OBJ) str2servent,
+		       rv, mdata,
+		       kbuf, sbuf, buf, bsize, res);
+}
+
+
+int
+nss_ndb_getservbyport_r(void *rv,
+			void *mdata,
+			va_list ap) {
+  int port             = va_arg(ap, int);
+  const char *proto    = va_arg(ap, const char *);
+  struct servent *sbuf = va_arg(ap, struct servent *);
+  char *buf            = va_arg(ap, char *);
+  size_t bsize         = va_arg(ap, size_t);
+  int *res             = va_arg(ap, int *);
+
+  return _ndb_getservbyport_r(rv, mdata, port, proto, sbuf, buf, bsize, res);
+}
+
+
+int
+nss_ndb_getservent_r(void *rv,
+		     void *mdata,
+		     va_list ap) {
+  struct servent *sbuf = va_arg(ap, struct servent *);
+  char *buf            = va_arg(ap, char *);
+  size_t bsize         = va_arg(ap, size_t);
+  int *res             = va_arg(ap, int *);
+
+  return _ndb_getent_r(&ndb_svc_byport,
+		       path_services_byport,
+		       (STR2OBJ) str2servent,
+		       rv, mdata,
+		       sbuf, buf, bsize, res);
+}
+
+
+int
+nss_ndb_setservent(void *rv,
 		   void *mdata,
 		   va_list ap) {
-  struct passwd *pbuf = va_arg(ap, struct passwd *);
-  char *buf           = va_arg(ap, char *);         
-  size_t bsize        = va_arg(ap, size_t);         
+  int stayopen = va_arg(ap, int);
+
+  return _ndb_setent(&ndb_svc_byport,
+		     stayopen,
+		     path_services_byport);
+}
+
+
+int
+nss_ndb_endservent(void *rv,
+		   void *mdata,
+		   va_list ap) {
+  return _ndb_endent(&ndb_svc_byport);
+}
+
+
+
+/*
+ * protocols.byname.db is keyed by name (and aliases), protocols.bynumber.db
+ * by number and is also used for enumeration.
+ */
+static int
+_ndb_getprotobyname_r(void *rv,
+		      void *mdata,
+		      const char *name,
+		      struct protoent *pbuf,
+		      char *buf,
+		      size_t bsize,
+		      int *res) {
+
+  
+  if (!name)
+    return NS_NOTFOUND;
+  
+  return _ndb_getkey_r(&ndb_pro_byname,
+		       path_protocols_byname,
+		       (STR2OBJ) str2protoent,
+		       rv, mdata,
+		       (char *) name, pbuf, buf, bsize, res);
+}
+
+
+int
+nss_ndb_getprotobyname_r(void *rv,
+			 void *mdata,
+			 va_list ap) {
+  const char *name      = va_arg(ap, const char *);
+  struct protoent *pbuf = va_arg(ap, struct protoent *);
+  char *buf             = va_arg(ap, char *);
+  size_t bsize          = va_arg(ap, size_t);
+  int *res              = va_arg(ap, int *);
+
+  return _ndb_getprotobyname_r(rv, mdata, name, pbuf, buf, bsize, res);
+}
+
+
+static int
+_ndb_getprotobynumber_r(void *rv,
+			void *mdata,
+			int number,
+			struct protoent *pbuf,
+			char *buf,
+			size_t bsize,
+			int *res) {
+  char nbuf[64];
+
+  
+  snprintf(nbuf, sizeof(nbuf), "%d", number);
+  
+  return _ndb_getkey_r(&ndb_pro_bynumber,
+		       path_protocols_bynumber,
+		       (STR2OBJ) str2protoent,
+		       rv, mdata,
+		       nbuf, pbuf, buf, bsize, res);
+}
+
+
+int
+nss_ndb_getprotobynumber_r(void *rv,
+			   void *mdata,
+			   va_list ap) {
+  int number            = va_arg(ap, int);
+  struct protoent *pbuf = va_arg(ap, struct protoent *);
+  char *buf             = va_arg(ap, char *);
+  size_t bsize          = va_arg(ap, size_t);
+  int *res              = va_arg(ap, int *);
+
+  return _ndb_getprotobynumber_r(rv, mdata, number, pbuf, buf, bsize, res);
+}
+
+
+int
+nss_ndb_getprotoent_r(void *rv,
+		      void *mdata,
+		      va_list ap) {
+  struct protoent *pbuf = va_arg(ap, struct protoent *);
+  char *buf             = va_arg(ap, char *);
+  size_t bsize          = va_arg(ap, size_t);
+  int *res              = va_arg(ap, int *);
+
+  return _ndb_getent_r(&ndb_pro_bynumber,
+		       path_protocols_bynumber,
+		       (STR2OBJ) str2protoent,
+		       rv, mdata,
+		       pbuf, buf, bsize, res);
+}
+
+
+int
+nss_ndb_setprotoent(void *rv,
+		    void *mdata,
+		    va_list ap) {
+  int stayopen = va_arg(ap, int);
+
+  return _ndb_setent(&ndb_pro_bynumber,
+		     stayopen,
+		     path_protocols_bynumber);
+}
+
+
+int
+nss_ndb_endprotoent(void *rv,
+		    void *mdata,
+		    va_list ap) {
+  return _ndb_endent(&ndb_pro_bynumber);
+}
+
+
+
+/*
+ * rpc.byname.db is keyed by name (and aliases), rpc.bynumber.db
+ * by number and is also used for enumeration.
+ */
+static int
+_ndb_getrpcbyname_r(void *rv,
+		    void *mdata,
+		    const char *name,
+		    struct rpcent *rbuf,
+		    char *buf,
+		    size_t bsize,
+		    int *res) {
+
+  
+  if (!name)
+    return NS_NOTFOUND;
+  
+  return _ndb_getkey_r(&ndb_rpc_byname,
+		       path_rpc_byname,
+		       (STR2OBJ) str2rpcent,
+		       rv, mdata,
+		       (char *) name, rbuf, buf, bsize, res);
+}
+
+
+int
+nss_ndb_getrpcbyname_r(void *rv,
+		       void *mdata,
+		       va_list ap) {
+  const char *name    = va_arg(ap, const char *);
+  struct rpcent *rbuf = va_arg(ap, struct rpcent *);
+  char *buf           = va_arg(ap, char *);
+  size_t bsize        = va_arg(ap, size_t);
   int *res            = va_arg(ap, int *);
 
-  return _ndb_getent_r(&ndb_pwd_byname,
-		      path_passwd_byname,
-		      (STR2OBJ) str2passwd,
-		      rv, mdata,
-		      pbuf, buf, bsize, res);
+  return _ndb_getrpcbyname_r(rv, mdata, name, rbuf, buf, bsize, res);
+}
+
+
+static int
+_ndb_getrpcbynumber_r(void *rv,
+		      void *mdata,
+		      int number,
+		      struct rpcent *rbuf,
+		      char *buf,
+		      size_t bsize,
+		      int *res) {
+  char nbuf[64];
+
+  
+  snprintf(nbuf, sizeof(nbuf), "%d", number);
+  
+  return _ndb_getkey_r(&ndb_rpc_bynumber,
+		       path_rpc_bynumber,
+		       (STR2OBJ) str2rpcent,
+		       rv, mdata,
+		       nbuf, rbuf, buf, bsize, res);
+}
+
+
+int
+nss_ndb_getrpcbynumber_r(void *rv,
+			 void *mdata,
+			 va_list ap) {
+  int number          = va_arg(ap, int);
+  struct rpcent *rbuf = va_arg(ap, struct rpcent *);
+  char *buf           = va_arg(ap, char *);
+  size_t bsize        = va_arg(ap, size_t);
+  int *res            = va_arg(ap, int *);
+
+  return _ndb_getrpcbynumber_r(rv, mdata, number, rbuf, buf, bsize, res);
+}
+
+
+int
+nss_ndb_getrpcent_r(void *rv,
+		    void *mdata,
+		    va_list ap) {
+  struct rpcent *rbuf = va_arg(ap, struct rpcent *);
+  char *buf           = va_arg(ap, char *);
+  size_t bsize        = va_arg(ap, size_t);
+  int *res            = va_arg(ap, int *);
+
+  return _ndb_getent_r(&ndb_rpc_bynumber,
+		       path_rpc_bynumber,
+		       (STR2OBJ) str2rpcent,
+		       rv, mdata,
+		       rbuf, buf, bsize, res);
+}
+
+
+int
+nss_ndb_setrpcent(void *rv,
+		  void *mdata,
+		  va_list ap) {
+  int stayopen = va_arg(ap, int);
+
+  return _ndb_setent(&ndb_rpc_bynumber,
+		     stayopen,
+		     path_rpc_bynumber);
+}
+
+
+int
+nss_ndb_endrpcent(void *rv,
+		  void *mdata,
+		  va_list ap) {
+  return _ndb_endent(&ndb_rpc_bynumber);
+}
+
+
+
+#ifdef __linux__
+/*
+ * Native glibc entry points (libnss_ndb.so.2). These call the same
+ * code as the nsdispatch-style functions above, without the va_list.
+ *
+ * glibc wants NSS_STATUS_TRYAGAIN and ERANGE in *errnop when a result
+ * does not fit the caller's buffer (it then retries with a larger one)
+ * and ENOENT when nothing was found.
+ */
+static enum nss_status
+_ndb_nss_status(int rc,
+		int *errnop) {
+  if (rc == NS_SUCCESS)
+    return NSS_STATUS_SUCCESS;
+  
+  if (*errnop == ERANGE)
+    return NSS_STATUS_TRYAGAIN;
+
+  if (rc == NS_NOTFOUND) {
+    *errnop = ENOENT;
+    return NSS_STATUS_NOTFOUND;
+  }
+  
+  return rc == NS_TRYAGAIN ? NSS_STATUS_TRYAGAIN : NSS_STATUS_UNAVAIL;
+}
+
+
+enum nss_status
+_nss_ndb_getpwnam_r(const char *name,
+		    struct passwd *pbuf,
+		    char *buf,
+		    size_t bsize,
+		    int *errnop) {
+  void *rv = NULL;
+  
+  *errnop = 0;
+  return _ndb_nss_status(_ndb_getpwnam_r(&rv, NULL, (char *) name,
+					 pbuf, buf, bsize, errnop),
+			 errnop);
+}
+
+
+enum nss_status
+_nss_ndb_getpwuid_r(uid_t uid,
+		    struct passwd *pbuf,
+		    char *buf,
+		    size_t bsize,
+		    int *errnop) {
+  void *rv = NULL;
+  
+  *errnop = 0;
+  return _ndb_nss_status(_ndb_getpwuid_r(&rv, NULL, uid,
+					 pbuf, buf, bsize, errnop),
+			 errnop);
+}
+
+
+enum nss_status
+_nss_ndb_getpwent_r(struct passwd *pbuf,
+		    char *buf,
+		    size_t bsize,
+		    int *errnop) {
+  void *rv = NULL;
+  
+  *errnop = 0;
+  return _ndb_nss_status(_ndb_getent_r(&ndb_pwd_byname,
+				       path_passwd_byname,
+				       (STR2OBJ) str2passwd,
+				       &rv, NULL,
+				       pbuf, buf, bsize, errnop),
+			 errnop);
+}
+
+
+enum nss_status
+_nss_ndb_setpwent(int stayopen) {
+  return _ndb_setent(&ndb_pwd_byname, stayopen, path_passwd_byname);
+}
+
+
+enum nss_status
+_nss_ndb_endpwent(void) {
+  return _ndb_endent(&ndb_pwd_byname);
+}
+
+
+enum nss_status
+_nss_ndb_getspnam_r(const char *name,
+		    struct spwd *sbuf,
+		    char *buf,
+		    size_t bsize,
+		    int *errnop) {
+  void *rv = NULL;
+  
+  *errnop = 0;
+  return _ndb_nss_status(_ndb_getspnam_r(&rv, NULL, name,
+					 sbuf, buf, bsize, errnop),
+			 errnop);
+}
+
+
+enum nss_status
+_nss_ndb_getspent_r(struct spwd *sbuf,
+		    char *buf,
+		    size_t bsize,
+		    int *errnop) {
+  void *rv = NULL;
+  
+  *errnop = 0;
+  return _ndb_nss_status(_ndb_getent_r(&ndb_spw_byname,
+				       path_shadow_byname,
+				       (STR2OBJ) str2spwd,
+				       &rv, NULL,
+				       sbuf, buf, bsize, errnop),
+			 errnop);
+}
+
+
+enum nss_status
+_nss_ndb_setspent(int stayopen) {
+  return _ndb_setent(&ndb_spw_byname, stayopen, path_shadow_byname);
+}
+
+
+enum nss_status
+_nss_ndb_endspent(void) {
+  return _ndb_endent(&ndb_spw_byname);
 }
 
 
-int
-nss_ndb_setpwent(void *rv,
-		 void *mdata,
-		 va_list ap) {
-  int stayopen = va_arg(ap, int);
+enum nss_status
+_nss_ndb_getgrnam_r(const char *name,
+		    struct group *gbuf,
+		    char *buf,
+		    size_t bsize,
+		    int *errnop) {
+  void *rv = NULL;
+  
+  *errnop = 0;
+  return _ndb_nss_status(_ndb_getgrnam_r(&rv, NULL, (char *) name,
+					 gbuf, buf, bsize, errnop),
+			 errnop);
+}
 
-  return _ndb_setent(&ndb_pwd_byname,
-		    stayopen,
-		    path_passwd_byname);
+
+enum nss_status
+_nss_ndb_getgrgid_r(gid_t gid,
+		    struct group *gbuf,
+		    char *buf,
+		    size_t bsize,
+		    int *errnop) {
+  void *rv = NULL;
+  
+  *errnop = 0;
+  return _ndb_nss_status(_ndb_getgrgid_r(&rv, NULL, gid,
+					 gbuf, buf, bsize, errnop),
+			 errnop);
 }
 
 
-int
-nss_ndb_endpwent(void *rv,
-		 void *mdata,
-		 va_list ap) {
-#if 0
-  int *res = va_arg(ap, int *);
-#endif
+enum nss_status
+_nss_ndb_getgrent_r(struct group *gbuf,
+		    char *buf,
+		    size_t bsize,
+		    int *errnop) {
+  void *rv = NULL;
   
-  return _ndb_endent(&ndb_pwd_byname);
+  *errnop = 0;
+  return _ndb_nss_status(_ndb_getent_r(&ndb_grp_byname,
+				       path_group_byname,
+				       (STR2OBJ) str2group,
+				       &rv, NULL,
+				       gbuf, buf, bsize, errnop),
+			 errnop);
 }
 
 
-
-int
-nss_ndb_getgrnam_r(void *rv,
-		   void *mdata,
-		   va_list ap) {
-  char *name          = va_arg(ap, char *);
-  struct group *gbuf  = va_arg(ap, struct group *);
-  char *buf           = va_arg(ap, char *);
-  size_t bsize        = va_arg(ap, size_t);         
-  int *res            = va_arg(ap, int *);
-  char *cp;
-  char *nbuf = NULL;
-  int rc;
+enum nss_status
+_nss_ndb_setgrent(int stayopen) {
+  return _ndb_setent(&ndb_grp_byname, stayopen, path_group_byname);
+}
 
 
-  _nss_ndb_init();
+enum nss_status
+_nss_ndb_endgrent(void) {
+  return _ndb_endent(&ndb_grp_byname);
+}
+
+
+/*
+ * Append the user's supplementary groups from group.byuser to the
+ * caller's (malloc()ed) array, growing it as needed up to 'limit'
+ * (if > 0). The primary group and gids already present are skipped.
+ */
+enum nss_status
+_nss_ndb_initgroups_dyn(const char *user,
+			gid_t group,
+			long int *start,
+			long int *size,
+			gid_t **groupsp,
+			long int limit,
+			int *errnop) {
+  char *list, *members, *cp;
+  gid_t gid, *groups;
+  long int i, nsize;
+  int rc;
   
-  if (f_strip_workgroup) {
-    size_t len;
-    
-    /* Strip AD workgroup prefix if specified */
-    cp = strchr(name, '\\');
-    if (cp && (f_strip_workgroup[0] == '\0' || /* Accept all workgroups */
-	       cp-name == 0 ||                 /* Empty specified workgroup */
-	       ((len = strlen(f_strip_workgroup)) == cp-name && 
-		strncasecmp(name, f_strip_workgroup, len) == 0))) /* Exact match */
-      name = cp+1;
+
+  rc = _ndb_getusergroups(user, &list);
+  if (rc != NS_SUCCESS) {
+    *errnop = (rc == NS_NOTFOUND ? ENOENT : errno);
+    return _ndb_nss_status(rc, errnop);
   }
-  
-  if (f_strip_realm) {
-    /* Strip realm suffix if specified */
-    cp = strrchr(name, '@');
-    if (cp && (f_strip_realm[0] == '\0' ||        /* Accept all realms */
-	       strcasecmp(cp+1, f_strip_realm) == 0)) /* Exact match */
-      name = nbuf = strndup(name, cp-name);
+
+  members = list;
+  while ((cp = strsep(&members, ",")) != NULL) {
+    if (sscanf(cp, "%u", &gid) != 1 || gid == group)
+      continue;
+
+    for (i = 0; i < *start && (*groupsp)[i] != gid; i++)
+      ;
+    if (i < *start)
+      continue;
+
+    if (*start >= *size) {
+      if (limit > 0 && *size >= limit)
+	break;
+      
+      nsize = *size > 0 ? *size * 2 : 16;
+      if (limit > 0 && nsize > limit)
+	nsize = limit;
+      
+      groups = realloc(*groupsp, nsize * sizeof(gid_t));
+      if (!groups) {
+	free(list);
+	*errnop = ENOMEM;
+	return NSS_STATUS_UNAVAIL;
+      }
+      
+      *groupsp = groups;
+      *size = nsize;
+    }
+    
+    (*groupsp)[(*start)++] = gid;
   }
   
-  rc = _ndb_getkey_r(&ndb_grp_byname,
-		      path_group_byname,
-		      (STR2OBJ) str2group,
-		      rv, mdata,
-		      name, gbuf, buf, bsize, res);
+  free(list);
+  return NSS_STATUS_SUCCESS;
+}
 
-  if (nbuf)
-    free(nbuf);
+
+enum nss_status
+_nss_ndb_gethostbyname2_r(const char *name,
+			  int af,
+			  struct hostent *hbuf,
+			  char *buf,
+			  size_t bsize,
+			  int *errnop,
+			  int *h_errnop) {
+  void *rv = NULL;
   
-  return rc;
+  *errnop = 0;
+  return _ndb_nss_status(_ndb_gethostbyname(&rv, NULL, name, af,
+					    hbuf, buf, bsize, errnop, h_errnop),
+			 errnop);
 }
 
 
-int
-nss_ndb_getgrgid_r(void *rv,
-		   void *mdata,
-		   va_list ap) {
-  gid_t gid          = va_arg(ap, gid_t);
-  struct group *gbuf = va_arg(ap, struct group *);
-  char *buf          = va_arg(ap, char *);
-  size_t bsize       = va_arg(ap, size_t);
-  int *res           = va_arg(ap, int *);
-  int rc;
-  char gidbuf[64];
+enum nss_status
+_nss_ndb_gethostbyname_r(const char *name,
+			 struct hostent *hbuf,
+			 char *buf,
+			 size_t bsize,
+			 int *errnop,
+			 int *h_errnop) {
+  return _nss_ndb_gethostbyname2_r(name, AF_INET,
+				   hbuf, buf, bsize, errnop, h_errnop);
+}
+
+
+enum nss_status
+_nss_ndb_gethostbyaddr_r(const void *addr,
+			 socklen_t alen,
+			 int af,
+			 struct hostent *hbuf,
+			 char *buf,
+			 size_t bsize,
+			 int *errnop,
+			 int *h_errnop) {
+  void *rv = NULL;
   
+  *errnop = 0;
+  return _ndb_nss_status(_ndb_gethostbyaddr(&rv, NULL, addr, alen, af,
+					    hbuf, buf, bsize, errnop, h_errnop),
+			 errnop);
+}
 
-  rc = snprintf(gidbuf, sizeof(gidbuf), "%u", gid);
-  if (rc < 0)
-    return -1;
-  if (rc >= sizeof(gidbuf)) {
-    errno = ENOMEM;
-    return -1;
-  }
+
+enum nss_status
+_nss_ndb_getservbyname_r(const char *name,
+			 const char *proto,
+			 struct servent *sbuf,
+			 char *buf,
+			 size_t bsize,
+			 int *errnop) {
+  void *rv = NULL;
   
-  return _ndb_getkey_r(&ndb_grp_bygid,
-		      path_group_bygid,
-		      (STR2OBJ) str2group,
-		      rv, mdata,
-		      gidbuf, gbuf, buf, bsize, res);
+  *errnop = 0;
+  return _ndb_nss_status(_ndb_getservbyname_r(&rv, NULL, name, proto,
+					      sbuf, buf, bsize, errnop),
+			 errnop);
 }
 
 
-int
-nss_ndb_getgrent_r(void *rv,
-		   void *mdata,
-		   va_list ap) {
-  struct group *gbuf = va_arg(ap, struct group *);
-  char *buf          = va_arg(ap, char *);         
-  size_t bsize       = va_arg(ap, size_t);         
-  int *res           = va_arg(ap, int *);
+enum nss_status
+_nss_ndb_getservbyport_r(int port,
+			 const char *proto,
+			 struct servent *sbuf,
+			 char *buf,
+			 size_t bsize,
+			 int *errnop) {
+  void *rv = NULL;
+  
+  *errnop = 0;
+  return _ndb_nss_status(_ndb_getservbyport_r(&rv, NULL, port, proto,
+					      sbuf, buf, bsize, errnop),
+			 errnop);
+}
+
 
+enum nss_status
+_nss_ndb_getservent_r(struct servent *sbuf,
+		      char *buf,
+		      size_t bsize,
+		      int *errnop) {
+  void *rv = NULL;
   
-  return _ndb_getent_r(&ndb_grp_byname,
-		      path_group_byname,
-		      (STR2OBJ) str2group,
-		      rv, mdata,
-		      gbuf, buf, bsize, res);
+  *errnop = 0;
+  return _ndb_nss_status(_ndb_getent_r(&ndb_svc_byport,
+				       path_services_byport,
+				       (STR2OBJ) str2servent,
+				       &rv, NULL,
+				       sbuf, buf, bsize, errnop),
+			 errnop);
 }
 
 
-int
-nss_ndb_setgrent(void *rv,
-		 void *mdata,
-		 va_list ap) {
-  int stayopen = va_arg(ap, int);
+enum nss_status
+_nss_ndb_setservent(int stayopen) {
+  return _ndb_setent(&ndb_svc_byport, stayopen, path_services_byport);
+}
 
-  return _ndb_setent(&ndb_grp_byname,
-		     stayopen,
-		     path_group_byname);
+
+enum nss_status
+_nss_ndb_endservent(void) {
+  return _ndb_endent(&ndb_svc_byport);
 }
 
 
-int
-nss_ndb_endgrent(void *rv,
-		 void *mdata,
-		 va_list ap) {
-#if 0
-  int *res = va_arg(ap, int *);
-#endif
+enum nss_status
+_nss_ndb_getprotobyname_r(const char *name,
+			  struct protoent *pbuf,
+			  char *buf,
+			  size_t bsize,
+			  int *errnop) {
+  void *rv = NULL;
   
-  return _ndb_endent(&ndb_grp_byname);
+  *errnop = 0;
+  return _ndb_nss_status(_ndb_getprotobyname_r(&rv, NULL, name,
+					       pbuf, buf, bsize, errnop),
+			 errnop);
 }
 
 
-
-static int
-gr_addgid(gid_t gid,
-	  gid_t *groupv,
-	  int maxgrp,
-	  int *groupc)
-{
-  int i;
-
-  
-  /* Do not add if already added */
-  for (i = 0; i < *groupc; i++) {
-    if (groupv[i] == gid)
-      return 0;
-  }
+enum nss_status
+_nss_ndb_getprotobynumber_r(int number,
+			    struct protoent *pbuf,
+			    char *buf,
+			    size_t bsize,
+			    int *errnop) {
+  void *rv = NULL;
   
-  if (*groupc >= maxgrp)
-    return -1;
-    
-  groupv[*groupc] = gid;
-  ++*groupc;
-  return 1;
+  *errnop = 0;
+  return _ndb_nss_status(_ndb_getprotobynumber_r(&rv, NULL, number,
+						 pbuf, buf, bsize, errnop),
+			 errnop);
 }
 
 
-/* 
- * usergroups.byname.db format:
- *   user:gid,gid,gid,...
- */
-int
-nss_ndb_getgroupmembership(void *res,
-			   void *mdata,
-			   va_list ap) {
-  char *name    = va_arg(ap, char *);
-  gid_t pgid    = va_arg(ap, gid_t);
-  gid_t *groupv = va_arg(ap, gid_t *);
-  int maxgrp    = va_arg(ap, int);
-  int *groupc   = va_arg(ap, int *);
-  
-  DBT key, val;
-  int rc;
-  char *members, *cp;
-  char *nbuf = NULL;
+enum nss_status
+_nss_ndb_getprotoent_r(struct protoent *pbuf,
+		       char *buf,
+		       size_t bsize,
+		       int *errnop) {
+  void *rv = NULL;
   
+  *errnop = 0;
+  return _ndb_nss_status(_ndb_getent_r(&ndb_pro_bynumber,
+				       path_protocols_bynumber,
+				       (STR2OBJ) str2protoent,
+				       &rv, NULL,
+				       pbuf, buf, bsize, errnop),
+			 errnop);
+}
 
-  if (name == NULL)
-    return NS_NOTFOUND;
-  
-  if (_ndb_open(&ndb_grp_byuser, path_usergroups_byname, 0) < 0) {
-    /* Fall back to looping over all entries via getgrent_r() - slooooow */
-    return NS_UNAVAIL;
-  }
 
-  /* Add primary gid to groupv[] */
-  (void) gr_addgid(pgid, groupv, maxgrp, groupc);
-  
+enum nss_status
+_nss_ndb_setprotoent(int stayopen) {
+  return _ndb_setent(&ndb_pro_bynumber, stayopen, path_protocols_bynumber);
+}
+
+
+enum nss_status
+_nss_ndb_endprotoent(void) {
+  return _ndb_endent(&ndb_pro_bynumber);
+}
 
-  _nss_ndb_init();
-  
-  if (f_strip_workgroup) {
-    size_t len;
-    
-    /* Strip AD workgroup prefix if specified */
-    cp = strchr(name, '\\');
-    if (cp && (f_strip_workgroup[0] == '\0' || /* Accept all workgroups */
-	       cp-name == 0 || /* Empty workgroup specified (\user) */
-	       ((len = strlen(f_strip_workgroup)) == cp-name && 
-		strncasecmp(name, f_strip_workgroup, len) == 0))) /* Exact match */
-      name = cp+1;
-  }
-  
-  if (f_strip_realm) {
-    /* Strip Kerberos realm suffix if specified */
-    cp = strrchr(name, '@');
-    if (cp && (f_strip_realm[0] == '\0' ||        /* Accept all realms */
-	       strcasecmp(cp+1, f_strip_realm) == 0)) /* Exact match */
-      name = nbuf = strndup(name, cp-name);
-  }
 
+enum nss_status
+_nss_ndb_getrpcbyname_r(const char *name,
+			struct rpcent *rbuf,
+			char *buf,
+			size_t bsize,
+			int *errnop) {
+  void *rv = NULL;
   
-  memset(&key, 0, sizeof(key));
-  memset(&val, 0, sizeof(val));
+  *errnop = 0;
+  return _ndb_nss_status(_ndb_getrpcbyname_r(&rv, NULL, name,
+					     rbuf, buf, bsize, errnop),
+			 errnop);
+}
+
+
+enum nss_status
+_nss_ndb_getrpcbynumber_r(int number,
+			  struct rpcent *rbuf,
+			  char *buf,
+			  size_t bsize,
+			  int *errnop) {
+  void *rv = NULL;
   
-  key.data = name;
-  key.size = strlen(name);
+  *errnop = 0;
+  return _ndb_nss_status(_ndb_getrpcbynumber_r(&rv, NULL, number,
+					       rbuf, buf, bsize, errnop),
+			 errnop);
+}
 
-  val.data = NULL;
-  val.size = 0;
+
+enum nss_status
+_nss_ndb_getrpcent_r(struct rpcent *rbuf,
+		     char *buf,
+		     size_t bsize,
+		     int *errnop) {
+  void *rv = NULL;
   
-  rc = _ndb_get(&ndb_grp_byuser, &key, &val, 0);
-  if (rc < 0) {
-    _ndb_close(&ndb_grp_byuser);
-    if (nbuf)
-      free(nbuf);
-    return NS_UNAVAIL;
-  }
-  else if (rc > 0) {
-    _ndb_close(&ndb_grp_byuser);
-    if (nbuf)
-      free(nbuf);
-    return NS_NOTFOUND;
-  }
+  *errnop = 0;
+  return _ndb_nss_status(_ndb_getent_r(&ndb_rpc_bynumber,
+				       path_rpc_bynumber,
+				       (STR2OBJ) str2rpcent,
+				       &rv, NULL,
+				       rbuf, buf, bsize, errnop),
+			 errnop);
+}
 
-  /* Should not happen */
-  if (val.data == NULL) {
-    _ndb_close(&ndb_grp_byuser);
-    if (nbuf)
-      free(nbuf);
-    return NS_UNAVAIL;
-  }
 
-  members = memchr(val.data, ':', val.size);
-  if (members) {
-    ++members;
+enum nss_status
+_nss_ndb_setrpcent(int stayopen) {
+  return _ndb_setent(&ndb_rpc_bynumber, stayopen, path_rpc_bynumber);
+}
 
-    while ((cp = strsep(&members, ",")) != NULL) {
-      gid_t gid;
-      
-      if (sscanf(cp, "%u", &gid) == 1) {
-	(void) gr_addgid(gid, groupv, maxgrp, groupc);
-      }
-    }
-  }
 
-  _ndb_close(&ndb_grp_byuser);
-  
-  if (nbuf)
-    free(nbuf);
-	
-  /* Let following nsswitch backend(s) add more groups(?) */
-  return NS_NOTFOUND;
+enum nss_status
+_nss_ndb_endrpcent(void) {
+  return _ndb_endent(&ndb_rpc_bynumber);
 }
+#endif
+
+
 
 
 #ifdef __FreeBSD__
@@ -1180,6 +7726,32 @@ nss_module_register(const char *modname,
     { "group", "setgrent",             &nss_ndb_setgrent, 0 },
     { "group", "endgrent",             &nss_ndb_endgrent, 0 },
     { "group", "getgroupmembership",   &nss_ndb_getgroupmembership, 0 }, /* aka getgrouplist */
+
+    { "netgroup", "setnetgrent",       &nss_ndb_setnetgrent, 0 },
+    { "netgroup", "getnetgrent_r",     &nss_ndb_getnetgrent_r, 0 },
+    { "netgroup", "endnetgrent",       &nss_ndb_endnetgrent, 0 },
+    { "netgroup", "innetgr",           &nss_ndb_innetgr, 0 },
+
+    { "hosts", "gethostbyname",        &nss_ndb_gethostbyname, 0 },
+    { "hosts", "gethostbyaddr",        &nss_ndb_gethostbyaddr, 0 },
+
+    { "services", "getservbyname_r",   &nss_ndb_getservbyname_r, 0 },
+    { "services", "getservbyport_r",   &nss_ndb_getservbyport_r, 0 },
+    { "services", "getservent_r",      &nss_ndb_getservent_r, 0 },
+    { "services", "setservent",        &nss_ndb_setservent, 0 },
+    { "services", "endservent",        &nss_ndb_endservent, 0 },
+
+    { "protocols", "getprotobyname_r", &nss_ndb_getprotobyname_r, 0 },
+    { "protocols", "getprotobynumber_r", &nss_ndb_getprotobynumber_r, 0 },
+    { "protocols", "getprotoent_r",    &nss_ndb_getprotoent_r, 0 },
+    { "protocols", "setprotoent",      &nss_ndb_setprotoent, 0 },
+    { "protocols", "endprotoent",      &nss_ndb_endprotoent, 0 },
+
+    { "rpc", "getrpcbyname_r",         &nss_ndb_getrpcbyname_r, 0 },
+    { "rpc", "getrpcbynumber_r",       &nss_ndb_getrpcbynumber_r, 0 },
+    { "rpc", "getrpcent_r",            &nss_ndb_getrpcent_r, 0 },
+    { "rpc", "setrpcent",              &nss_ndb_setrpcent, 0 },
+    { "rpc", "endrpcent",              &nss_ndb_endrpcent, 0 },
   };
   
   *plen = sizeof(mtab)/sizeof(mtab[0]);
@@ -1199,23 +7771,28 @@ nss_module_register(const char *modname,
  *
  *   group     getgrouplist(3)
  *
- * NOT IMPLEMENTED YET:
- *   hosts     getaddrinfo(3), gethostbyaddr(3), gethostbyaddr_r(3),
- *             gethostbyname(3), gethostbyname2(3), gethostbyname_r(3),
- *             getipnodebyaddr(3), getipnodebyname(3)
- *
- *   networks  getnetbyaddr(3), getnetbyaddr_r(3), getnetbyname(3),
- *             getnetbyname_r(3)
+ *   netgroup  getnetgrent(3), getnetgrent_r(3), setnetgrent(3),
+ *             endnetgrent(3), innetgr(3)
  *
- *   shells    getusershell(3)
+ *   hosts     gethostbyaddr(3), gethostbyaddr_r(3), gethostbyname(3),
+ *             gethostbyname2(3), gethostbyname_r(3)
  *
- *   services  getservent(3)
+ *   services  getservbyname(3), getservbyport(3), getservent(3)
  *
  *   rpc       getrpcbyname(3), getrpcbynumber(3), getrpcent(3)
  *
  *   proto     getprotobyname(3), getprotobynumber(3), getprotoent(3)
  *
- *   netgroup  getnetgrent(3), getnetgrent_r(3), setnetgrent(3),
- *             endnetgrent(3), innetgr(3)
+ *   Case-insensitive user & group name lookups via the optional
+ *   passwd.bylcname & group.bylcname indexes (see 'casefold')
+ *
+ * NOT IMPLEMENTED YET:
+ *   hosts     getaddrinfo(3), gethostent(3), getipnodebyaddr(3),
+ *             getipnodebyname(3)
+ *
+ *   networks  getnetbyaddr(3), getnetbyaddr_r(3), getnetbyname(3),
+ *             getnetbyname_r(3)
+ *
+ *   shells    getusershell(3)
  */
 
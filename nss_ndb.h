@@ -53,6 +53,16 @@
 
 #define MAXGRFIELDS 5
 
+/* shadow: name, password and 7 (possibly empty) numeric fields */
+#define MAXSPFIELDS 9
+
+/* Max addresses & names (including aliases) returned in a hostent */
+#define MAXHOSTADDRS   64
+#define MAXHOSTALIASES 64
+
+/* services, protocols & rpc: name, port/number and aliases */
+#define MAXSVFIELDS    66
+
 #ifndef NSS_NDB_CONF_PATH
 #define NSS_NDB_CONF_PATH "/etc/nss_ndb.conf"
 #endif
@@ -67,6 +77,27 @@
 #define PATH_NSS_NDB_GROUP_BY_NAME       NSS_NDB_DBDIR_PATH "/group.byname.db"
 #define PATH_NSS_NDB_USERGROUPS_BY_NAME  NSS_NDB_DBDIR_PATH "/group.byuser.db"
 
+/* Password hashes & aging data (Linux), only readable by root */
+#define PATH_NSS_NDB_SHADOW_BY_NAME      NSS_NDB_DBDIR_PATH "/shadow.byname.db"
+
+/* Optional case-folded (lower case) secondary name indexes */
+#define PATH_NSS_NDB_PASSWD_BY_LCNAME    NSS_NDB_DBDIR_PATH "/passwd.bylcname.db"
+#define PATH_NSS_NDB_GROUP_BY_LCNAME     NSS_NDB_DBDIR_PATH "/group.bylcname.db"
+
+/* Netgroups (nested netgroups flattened by makendb) */
+#define PATH_NSS_NDB_NETGROUP_BY_NAME    NSS_NDB_DBDIR_PATH "/netgroup.byname.db"
+#define PATH_NSS_NDB_NETGROUP_BY_TRIPLE  NSS_NDB_DBDIR_PATH "/netgroup.bytriple.db"
+
+#define PATH_NSS_NDB_HOSTS_BY_NAME       NSS_NDB_DBDIR_PATH "/hosts.byname.db"
+#define PATH_NSS_NDB_HOSTS_BY_ADDR       NSS_NDB_DBDIR_PATH "/hosts.byaddr.db"
+
+#define PATH_NSS_NDB_SERVICES_BY_NAME    NSS_NDB_DBDIR_PATH "/services.byname.db"
+#define PATH_NSS_NDB_SERVICES_BY_PORT    NSS_NDB_DBDIR_PATH "/services.byport.db"
+#define PATH_NSS_NDB_PROTOCOLS_BY_NAME   NSS_NDB_DBDIR_PATH "/protocols.byname.db"
+#define PATH_NSS_NDB_PROTOCOLS_BY_NUMBER NSS_NDB_DBDIR_PATH "/protocols.bynumber.db"
+#define PATH_NSS_NDB_RPC_BY_NAME         NSS_NDB_DBDIR_PATH "/rpc.byname.db"
+#define PATH_NSS_NDB_RPC_BY_NUMBER       NSS_NDB_DBDIR_PATH "/rpc.bynumber.db"
+
 typedef int (*STR2OBJ)(char *str,
 		       size_t len,
 		       void **vp,
@@ -79,6 +110,12 @@ enum setent_constants {
   ENDENT = 2
 };
 
+enum casefold_constants {
+  CASEFOLD_NO       = 0,  /* Exact name matches only */
+  CASEFOLD_FALLBACK = 1,  /* Try the case-folded index if the exact lookup fails */
+  CASEFOLD_ALWAYS   = 2   /* Only use the case-folded index (if available) */
+};
+
 
 extern int
 nss_ndb_getpwnam_r(void *rv,
@@ -135,6 +172,513 @@ nss_ndb_getgroupmembership(void *res,
 			   void *mdata,
 			   va_list ap);
 
+extern int
+nss_ndb_setnetgrent(void *rv,
+		    void *mdata,
+		    va_list ap);
+
+extern int
+nss_ndb_getnetgrent_r(void *rv,
+		      void *mdata,
+		      va_list ap);
+
+extern int
+nss_ndb_endnetgrent(void *rv,
+		    void *mdata,
+		    va_list ap);
+
+extern int
+nss_ndb_innetgr(void *rv,
+		void *mdata,
+		va_list ap);
+
+extern int
+nss_ndb_gethostbyname(void *rv,
+		      void *mdata,
+		      va_list ap);
+
+extern int
+nss_ndb_gethostbyaddr(void *rv,
+		      void *mdata,
+		      va_list ap);
+
+extern int
+nss_ndb_getservbyname_r(void *rv,
+			void *mdata,
+			va_list ap);
+
+extern int
+nss_ndb_getservbyport_r(void *rv,
+			void *mdata,
+			va_list ap);
+
+extern int
+nss_ndb_getservent_r(void *rv,
+		     void *mdata,
+		     va_list ap);
+
+extern int
+nss_ndb_setservent(void *rv,
+		   void *mdata,
+		   va_list ap);
+
+extern int
+nss_ndb_endservent(void *rv,
+		   void *mdata,
+		   va_list ap);
+
+extern int
+nss_ndb_getprotobyname_r(void *rv,
+			 void *mdata,
+			 va_list ap);
+
+extern int
+nss_ndb_getprotobynumber_r(void *rv,
+			   void *mdata,
+			   va_list ap);
+
+extern int
+nss_ndb_getprotoent_r(void *rv,
+		      void *mdata,
+		      va_list ap);
+
+extern int
+nss_ndb_setprotoent(void *rv,
+		    void *mdata,
+		    va_list ap);
+
+extern int
+nss_ndb_endprotoent(void *rv,
+		    void *mdata,
+		    va_list ap);
+
+extern int
+nss_ndb_getrpcbyname_r(void *rv,
+		       void *mdata,
+		       va_list ap);
+
+extern int
+nss_ndb_getrpcbynumber_r(void *rv,
+			 void *mdata,
+			 va_list ap);
+
+extern int
+nss_ndb_getrpcent_r(void *rv,
+		    void *mdata,
+		    va_list ap);
+
+extern int
+nss_ndb_setrpcent(void *rv,
+		  void *mdata,
+		  va_list ap);
+
+extern int
+nss_ndb_endrpcent(void *rv,
+		  void *mdata,
+		  va_list ap);
+
+
+/*
+ * Partitioned enumeration of passwd or group (by name) for bulk
+ * consumers. nss_ndb_partition() splits the map in k key ranges, that
+ * may be scanned concurrently (at most one thread per partition), and
+ * nss_ndb_get{pw,gr}part_r() return up to n records at a time from
+ * partition i (0..k-1), with the strings in buf. They return the
+ * number of records, 0 when the partition is done or -1 (with *res
+ * set) on error.
+ */
+#include <pwd.h>
+#include <grp.h>
+
+typedef struct nss_ndb_part NSS_NDB_PART;
+
+extern NSS_NDB_PART *
+nss_ndb_partition(const char *map,
+		  int k);
+
+extern int
+nss_ndb_partitions(const NSS_NDB_PART *pp);
+
+extern int
+nss_ndb_getpwpart_r(NSS_NDB_PART *pp,
+		    int i,
+		    struct passwd *pv,
+		    int n,
+		    char *buf,
+		    size_t bsize,
+		    int *res);
+
+extern int
+nss_ndb_getgrpart_r(NSS_NDB_PART *pp,
+		    int i,
+		    struct group *gv,
+		    int n,
+		    char *buf,
+		    size_t bsize,
+		    int *res);
+
+extern void
+nss_ndb_partition_free(NSS_NDB_PART *pp);
+
+/*
+ * Range queries on the ids of passwd (passwd.byuid) or group
+ * (group.bygid). nss_ndb_range() returns a cursor over the users or
+ * groups with ids first..last-1, and nss_ndb_get{pw,gr}range_r()
+ * return up to n of them at a time, in id order, like the partition
+ * functions above. The cost is proportional to the number of records
+ * in the range (not the size of the map).
+ */
+typedef struct nss_ndb_range NSS_NDB_RANGE;
+
+extern NSS_NDB_RANGE *
+nss_ndb_range(const char *map,
+	      unsigned long first,
+	      unsigned long last);
+
+extern int
+nss_ndb_getpwrange_r(NSS_NDB_RANGE *qp,
+		     struct passwd *pv,
+		     int n,
+		     char *buf,
+		     size_t bsize,
+		     int *res);
+
+extern int
+nss_ndb_getgrrange_r(NSS_NDB_RANGE *qp,
+		     struct group *gv,
+		     int n,
+		     char *buf,
+		     size_t bsize,
+		     int *res);
+
+extern void
+nss_ndb_range_free(NSS_NDB_RANGE *qp);
+
+/*
+ * Batched lookups: resolve the n uids, gids or names in one call, for
+ * example all the owners of the files in a directory. rv[i] is set to
+ * &pv[i] if it was found (or to the same entry for repeated keys) or
+ * to NULL if not, with the strings in buf. They return the number found,
+ * or -1 (with *res set) on error - ERANGE if buf is too small for all
+ * of them.
+ */
+extern int
+nss_ndb_getpwuids_r(const uid_t *uv,
+		    int n,
+		    struct passwd **rv,
+		    struct passwd *pv,
+		    char *buf,
+		    size_t bsize,
+		    int *res);
+
+extern int
+nss_ndb_getgrgids_r(const gid_t *gv,
+		    int n,
+		    struct group **rv,
+		    struct group *ov,
+		    char *buf,
+		    size_t bsize,
+		    int *res);
+
+extern int
+nss_ndb_getpwnams_r(const char **nv,
+		    int n,
+		    struct passwd **rv,
+		    struct passwd *pv,
+		    char *buf,
+		    size_t bsize,
+		    int *res);
+
+extern int
+nss_ndb_getgrnams_r(const char **nv,
+		    int n,
+		    struct group **rv,
+		    struct group *ov,
+		    char *buf,
+		    size_t bsize,
+		    int *res);
+
+/*
+ * Asynchronous lookups. nss_ndb_async_create() starts a pool of
+ * nthreads (0 for the default) worker threads. A request (owned by the
+ * caller, with a buffer for the strings) is queued with
+ * nss_ndb_async_submit() and comes back, with status set to
+ * NS_SUCCESS, NS_NOTFOUND or NS_UNAVAIL (and res to the errno), from
+ * nss_ndb_async_poll(), which calls its callback in the calling
+ * thread. Event loops can wait for nss_ndb_async_fd() to become
+ * readable, with nss_ndb_async_timeout() as the timeout, and then
+ * call nss_ndb_async_poll(ap, 0). A request with a timeout (ms) that
+ * isn't done in time fails with ETIMEDOUT. The name of a request must
+ * be valid until it is done. nss_ndb_async_destroy() completes the
+ * requests still pending with ECANCELED (calling their callbacks).
+ */
+#include <time.h>
+
+#define NSS_NDB_GETPWNAM 1
+#define NSS_NDB_GETPWUID 2
+#define NSS_NDB_GETGRNAM 3
+#define NSS_NDB_GETGRGID 4
+
+typedef struct nss_ndb_async NSS_NDB_ASYNC;
+
+typedef struct nss_ndb_req {
+  /* Set by the caller */
+  int type;              /* NSS_NDB_GET* */
+  const char *name;
+  unsigned long id;
+  int timeout;           /* Milliseconds, 0 for none */
+  void (*callback)(struct nss_ndb_req *rp);
+  void *xp;              /* For the caller */
+  char *buf;
+  size_t bsize;
+  
+  /* Results */
+  int status;
+  int res;
+  void *result;          /* &pw or &gr, or NULL */
+  struct passwd pw;
+  struct group gr;
+  
+  /* Private */
+  struct nss_ndb_req *next;
+  struct timespec deadline;
+  int state;
+} NSS_NDB_REQ;
+
+extern NSS_NDB_ASYNC *
+nss_ndb_async_create(int nthreads);
+
+extern int
+nss_ndb_async_fd(NSS_NDB_ASYNC *ap);
+
+extern int
+nss_ndb_async_submit(NSS_NDB_ASYNC *ap,
+		     NSS_NDB_REQ *rp);
+
+extern int
+nss_ndb_async_timeout(NSS_NDB_ASYNC *ap);
+
+extern int
+nss_ndb_async_poll(NSS_NDB_ASYNC *ap,
+		   int timeout);
+
+extern void
+nss_ndb_async_destroy(NSS_NDB_ASYNC *ap);
+
+#ifdef __linux__
+#include <pwd.h>
+#include <grp.h>
+#include <netdb.h>
+#include <shadow.h>
+
+extern int
+nss_ndb_getspnam_r(void *rv,
+		   void *mdata,
+		   va_list ap);
+
+extern int
+nss_ndb_getspent_r(void *rv,
+		   void *mdata,
+		   va_list ap);
+
+extern int
+nss_ndb_setspent(void *rv,
+		 void *mdata,
+		 va_list ap);
+
+extern int
+nss_ndb_endspent(void *rv,
+		 void *mdata,
+		 va_list ap);
+
+extern enum nss_status
+_nss_ndb_getpwnam_r(const char *name,
+		    struct passwd *pbuf,
+		    char *buf,
+		    size_t bsize,
+		    int *errnop);
+
+extern enum nss_status
+_nss_ndb_getpwuid_r(uid_t uid,
+		    struct passwd *pbuf,
+		    char *buf,
+		    size_t bsize,
+		    int *errnop);
+
+extern enum nss_status
+_nss_ndb_getpwent_r(struct passwd *pbuf,
+		    char *buf,
+		    size_t bsize,
+		    int *errnop);
+
+extern enum nss_status
+_nss_ndb_setpwent(int stayopen);
+
+extern enum nss_status
+_nss_ndb_endpwent(void);
+
+extern enum nss_status
+_nss_ndb_getspnam_r(const char *name,
+		    struct spwd *sbuf,
+		    char *buf,
+		    size_t bsize,
+		    int *errnop);
+
+extern enum nss_status
+_nss_ndb_getspent_r(struct spwd *sbuf,
+		    char *buf,
+		    size_t bsize,
+		    int *errnop);
+
+extern enum nss_status
+_nss_ndb_setspent(int stayopen);
+
+extern enum nss_status
+_nss_ndb_endspent(void);
+
+extern enum nss_status
+_nss_ndb_getgrnam_r(const char *name,
+		    struct group *gbuf,
+		    char *buf,
+		    size_t bsize,
+		    int *errnop);
+
+extern enum nss_status
+_nss_ndb_getgrgid_r(gid_t gid,
+		    struct group *gbuf,
+		    char *buf,
+		    size_t bsize,
+		    int *errnop);
+
+extern enum nss_status
+_nss_ndb_getgrent_r(struct group *gbuf,
+		    char *buf,
+		    size_t bsize,
+		    int *errnop);
+
+extern enum nss_status
+_nss_ndb_setgrent(int stayopen);
+
+extern enum nss_status
+_nss_ndb_endgrent(void);
+
+extern enum nss_status
+_nss_ndb_initgroups_dyn(const char *user,
+			gid_t group,
+			long int *start,
+			long int *size,
+			gid_t **groupsp,
+			long int limit,
+			int *errnop);
+
+extern enum nss_status
+_nss_ndb_gethostbyname2_r(const char *name,
+			  int af,
+			  struct hostent *hbuf,
+			  char *buf,
+			  size_t bsize,
+			  int *errnop,
+			  int *h_errnop);
+
+extern enum nss_status
+_nss_ndb_gethostbyname_r(const char *name,
+			 struct hostent *hbuf,
+			 char *buf,
+			 size_t bsize,
+			 int *errnop,
+			 int *h_errnop);
+
+extern enum nss_status
+_nss_ndb_gethostbyaddr_r(const void *addr,
+			 socklen_t alen,
+			 int af,
+			 struct hostent *hbuf,
+			 char *buf,
+			 size_t bsize,
+			 int *errnop,
+			 int *h_errnop);
+
+extern enum nss_status
+_nss_ndb_getservbyname_r(const char *name,
+			 const char *proto,
+			 struct servent *sbuf,
+			 char *buf,
+			 size_t bsize,
+			 int *errnop);
+
+extern enum nss_status
+_nss_ndb_getservbyport_r(int port,
+			 const char *proto,
+			 struct servent *sbuf,
+			 char *buf,
+			 size_t bsize,
+			 int *errnop);
+
+extern enum nss_status
+_nss_ndb_getservent_r(struct servent *sbuf,
+		      char *buf,
+		      size_t bsize,
+		      int *errnop);
+
+extern enum nss_status
+_nss_ndb_setservent(int stayopen);
+
+extern enum nss_status
+_nss_ndb_endservent(void);
+
+extern enum nss_status
+_nss_ndb_getprotobyname_r(const char *name,
+			  struct protoent *pbuf,
+			  char *buf,
+			  size_t bsize,
+			  int *errnop);
+
+extern enum nss_status
+_nss_ndb_getprotobynumber_r(int number,
+			    struct protoent *pbuf,
+			    char *buf,
+			    size_t bsize,
+			    int *errnop);
+
+extern enum nss_status
+_nss_ndb_getprotoent_r(struct protoent *pbuf,
+		       char *buf,
+		       size_t bsize,
+		       int *errnop);
+
+extern enum nss_status
+_nss_ndb_setprotoent(int stayopen);
+
+extern enum nss_status
+_nss_ndb_endprotoent(void);
+
+extern enum nss_status
+_nss_ndb_getrpcbyname_r(const char *name,
+			struct rpcent *rbuf,
+			char *buf,
+			size_t bsize,
+			int *errnop);
+
+extern enum nss_status
+_nss_ndb_getrpcbynumber_r(int number,
+			  struct rpcent *rbuf,
+			  char *buf,
+			  size_t bsize,
+			  int *errnop);
+
+extern enum nss_status
+_nss_ndb_getrpcent_r(struct rpcent *rbuf,
+		     char *buf,
+		     size_t bsize,
+		     int *errnop);
+
+extern enum nss_status
+_nss_ndb_setrpcent(int stayopen);
+
+extern enum nss_status
+_nss_ndb_endrpcent(void);
+#endif
+
 #ifdef __FreeBSD__
 extern ns_mtab *
 nss_module_register(const char *modname,
@@ -33,6 +33,7 @@
 #include <stdarg.h>
 #include <string.h>
 #include <errno.h>
+#include <limits.h>
 #include <unistd.h>
 #include <time.h>
 #ifdef __linux__
@@ -41,7 +42,15 @@
 #endif
 #include <pwd.h>
 #include <grp.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#ifdef __FreeBSD__
+#include <rpc/rpc.h>
+#endif
 #include <pthread.h>
+#include <poll.h>
 
 #ifdef WITH_NSS_NDB
 #include "nss_ndb.h"
@@ -52,6 +61,7 @@
 #define MAXPASSWD   1024
 #define MAXGROUP   65536
 #define MAXGRPLIST 65536
+#define MAXHOSTENT  8192
 
 
 char *argv0 = "t_libc";
@@ -143,6 +153,41 @@ c_group(struct group *gp) {
   return 1;
 }
 
+int
+s_hostent(char *buf,
+	  size_t bufsize,
+	  struct hostent *hp) {
+  char abuf[INET6_ADDRSTRLEN];
+  unsigned int p = 0;
+  int i;
+  
+  
+  if (!hp) {
+    snprintf(buf, bufsize, "NULL");
+    return -1;
+  }
+  
+  snprintf(buf, bufsize, "%s:", hp->h_name ? hp->h_name : "<null>");
+  p = strlen(buf);
+  
+  for (i = 0; hp->h_aliases && hp->h_aliases[i]; i++) {
+    snprintf(buf+p, bufsize-p, "%s%s", i > 0 ? "," : "", hp->h_aliases[i]);
+    p += strlen(buf+p);
+  }
+  
+  snprintf(buf+p, bufsize-p, ":");
+  p += strlen(buf+p);
+  
+  for (i = 0; hp->h_addr_list && hp->h_addr_list[i]; i++) {
+    if (!inet_ntop(hp->h_addrtype, hp->h_addr_list[i], abuf, sizeof(abuf)))
+      strcpy(abuf, "<invalid>");
+    snprintf(buf+p, bufsize-p, "%s%s", i > 0 ? "," : "", abuf);
+    p += strlen(buf+p);
+  }
+  
+  return i;
+}
+
 
 static int
 cmp_gid(const void *p1,
@@ -1389,30 +1434,1267 @@ t_getgrouplist(int argc,
 }
 
 
+/*
+ * Arguments: <netgroup> <host> <user> <domain> ("*" = NULL)
+ */
+static const char *
+ngarg(const char *str) {
+  return (!str || strcmp(str, "*") == 0) ? NULL : str;
+}
 
-static struct action {
-  char *name;
-  int (*tf)(int argc, char **argv, void *xp, unsigned long *ncp);
-} actions[] = {
-	       { "getpwnam",     &t_getpwnam },
-	       { "getpwnam_r",   &t_getpwnam_r },
-	       { "getpwuid",     &t_getpwuid },
-	       { "getpwuid_r",   &t_getpwuid_r },
-	       { "getpwent",     &t_getpwent },
-	       { "getpwent_r",   &t_getpwent_r },
-	       { "getgrnam",     &t_getgrnam },
-	       { "getgrnam_r",   &t_getgrnam_r },
-	       { "getgrgid",     &t_getgrgid },
-	       { "getgrgid_r",   &t_getgrgid_r },
-	       { "getgrent",     &t_getgrent },
-	       { "getgrent_r",   &t_getgrent_r },
-	       { "getgrouplist", &t_getgrouplist },
+
+int
+t_innetgr(int argc,
+	  char *argv[],
+	  void *xp,
+	  unsigned long *ncp) {
+  if (argc != 5) {
+    fprintf(stderr, "%s: Error: innetgr: Usage: <netgroup> <host> <user> <domain>\n", argv0);
+    exit(1);
+  }
+  
+  ++*ncp;
+  return innetgr(argv[1], ngarg(argv[2]), ngarg(argv[3]), ngarg(argv[4])) ? 0 : 1;
+}
 
 #ifdef WITH_NSS_NDB
-	       { "ndb_getpwnam_r",   &t_ndb_getpwnam_r },
-	       { "ndb_getpwuid_r",   &t_ndb_getpwuid_r },
-	       { "ndb_getgrnam_r",   &t_ndb_getgrnam_r },
-	       { "ndb_getgrgid_r",   &t_ndb_getgrgid_r },
+
+int
+t_ndb_innetgr(int argc,
+	      char *argv[],
+	      void *xp,
+	      unsigned long *ncp) {
+  int nc, res = 0;
+
+  
+  if (argc != 5) {
+    fprintf(stderr, "%s: Error: ndb_innetgr: Usage: <netgroup> <host> <user> <domain>\n", argv0);
+    exit(1);
+  }
+  
+  nc = t_dispatch("innetgr", &res, argv[1], ngarg(argv[2]), ngarg(argv[3]), ngarg(argv[4]));
+  if (nc != NS_SUCCESS && nc != NS_NOTFOUND) {
+    fprintf(stderr, "%s: Internal Error: t_dispatch(innetgr, \"%s\") returned: %s\n",
+	    argv0, argv[1], nsserror(nc));
+    exit(1);
+  }
+
+  ++*ncp;
+  return (nc == NS_SUCCESS && res) ? 0 : 1;
+}
+#endif
+
+
+/*
+ * Arguments: <host-name> or <address>
+ */
+static int
+r_hostent(const char *fname,
+	  const char *arg,
+	  struct hostent *hp) {
+  char sbuf[MAXHOSTENT];
+
+  
+  if (!hp) {
+    if (f_verbose)
+      fprintf(stderr, "%s: Error: %s(\"%s\"): Host not found\n",
+	      argv0, fname, arg);
+    return 1;
+  }
+  
+  if (f_verbose || f_check)
+    s_hostent(sbuf, sizeof(sbuf), hp);
+  
+  if (f_check && 
+      (!hp->h_name || !hp->h_addr_list || !hp->h_addr_list[0] ||
+       (checkdata && strcmp(sbuf, checkdata) != 0))) {
+    fprintf(stderr, "%s: Error: %s: Returned data failed validation\n",
+	    argv0, sbuf);
+    exit(1);
+  }
+  
+  if (f_verbose > 1) {
+    printf("Returned data:\n  %s\n", sbuf);
+    --f_verbose;
+  }
+  
+  return 0;
+}
+
+
+int
+t_gethostbyname(int argc,
+		char *argv[],
+		void *xp,
+		unsigned long *ncp) {
+  int i, rc = -1;
+  
+  
+  for (i = 1; i < argc; i++) {
+    struct hostent *hp;
+    int trc;
+
+    hp = gethostbyname(argv[i]);
+    ++*ncp;
+    
+    trc = r_hostent("gethostbyname", argv[i], hp);
+    if (rc >= 0 && rc != trc) {
+      fprintf(stderr, "%s: Error: gethostbyname(\"%s\") not yielding similar result as previous\n",
+	      argv0, argv[i]);
+      exit(1);
+    }
+    rc = trc;
+  }
+
+  return rc;
+}
+
+
+int
+t_gethostbyaddr(int argc,
+		char *argv[],
+		void *xp,
+		unsigned long *ncp) {
+  int i, rc = -1;
+  
+  
+  for (i = 1; i < argc; i++) {
+    unsigned char abuf[sizeof(struct in6_addr)];
+    struct hostent *hp;
+    int af, trc;
+
+    af = strchr(argv[i], ':') ? AF_INET6 : AF_INET;
+    if (inet_pton(af, argv[i], abuf) != 1) {
+      fprintf(stderr, "%s: Error: %s: Invalid address\n", argv0, argv[i]);
+      exit(1);
+    }
+    
+    hp = gethostbyaddr(abuf, af == AF_INET6 ? sizeof(struct in6_addr) : sizeof(struct in_addr), af);
+    ++*ncp;
+    
+    trc = r_hostent("gethostbyaddr", argv[i], hp);
+    if (rc >= 0 && rc != trc) {
+      fprintf(stderr, "%s: Error: gethostbyaddr(\"%s\") not yielding similar result as previous\n",
+	      argv0, argv[i]);
+      exit(1);
+    }
+    rc = trc;
+  }
+
+  return rc;
+}
+
+
+#ifdef WITH_NSS_NDB
+int
+t_ndb_gethostbyname(int argc,
+		    char *argv[],
+		    void *xp,
+		    unsigned long *ncp) {
+  char *buf = (char *) xp;
+  int i, rc = -1;
+  
+  
+  for (i = 1; i < argc; i++) {
+    struct hostent hbuf, *hp = NULL;
+    int nc, ec = 0, herr = 0, trc;
+    
+    
+    nc = t_dispatch("gethostbyname", &hp, argv[i], AF_INET, &hbuf, buf, (size_t) n_bufsize, &ec, &herr);
+    if (nc == NS_NOTFOUND)
+      nc = t_dispatch("gethostbyname", &hp, argv[i], AF_INET6, &hbuf, buf, (size_t) n_bufsize, &ec, &herr);
+    if (nc != NS_SUCCESS && nc != NS_NOTFOUND) {
+      fprintf(stderr, "%s: Internal Error: t_dispatch(gethostbyname, \"%s\") returned: %s\n",
+	      argv0, argv[i], nsserror(nc));
+      exit(1);
+    }
+    
+    ++*ncp;
+    
+    trc = r_hostent("ndb_gethostbyname", argv[i], hp);
+    if (rc >= 0 && rc != trc) {
+      fprintf(stderr, "%s: Error: ndb_gethostbyname(\"%s\") not yielding similar result as previous\n",
+	      argv0, argv[i]);
+      exit(1);
+    }
+    rc = trc;
+  }
+
+  return rc;
+}
+
+
+int
+t_ndb_gethostbyaddr(int argc,
+		    char *argv[],
+		    void *xp,
+		    unsigned long *ncp) {
+  char *buf = (char *) xp;
+  int i, rc = -1;
+  
+  
+  for (i = 1; i < argc; i++) {
+    unsigned char abuf[sizeof(struct in6_addr)];
+    struct hostent hbuf, *hp = NULL;
+    int af, nc, ec = 0, herr = 0, trc;
+    socklen_t alen;
+
+    
+    af = strchr(argv[i], ':') ? AF_INET6 : AF_INET;
+    alen = af == AF_INET6 ? sizeof(struct in6_addr) : sizeof(struct in_addr);
+    if (inet_pton(af, argv[i], abuf) != 1) {
+      fprintf(stderr, "%s: Error: %s: Invalid address\n", argv0, argv[i]);
+      exit(1);
+    }
+    
+    nc = t_dispatch("gethostbyaddr", &hp, abuf, alen, af, &hbuf, buf, (size_t) n_bufsize, &ec, &herr);
+    if (nc != NS_SUCCESS && nc != NS_NOTFOUND) {
+      fprintf(stderr, "%s: Internal Error: t_dispatch(gethostbyaddr, \"%s\") returned: %s\n",
+	      argv0, argv[i], nsserror(nc));
+      exit(1);
+    }
+    
+    ++*ncp;
+    
+    trc = r_hostent("ndb_gethostbyaddr", argv[i], hp);
+    if (rc >= 0 && rc != trc) {
+      fprintf(stderr, "%s: Error: ndb_gethostbyaddr(\"%s\") not yielding similar result as previous\n",
+	      argv0, argv[i]);
+      exit(1);
+    }
+    rc = trc;
+  }
+
+  return rc;
+}
+#endif
+
+
+#ifdef WITH_NSS_NDB
+/*
+ * Format "name:alias,alias:value" for the services, protocols & rpc tests
+ */
+static int
+s_named(char *buf,
+	size_t bufsize,
+	const char *name,
+	char **aliases,
+	const char *value) {
+  unsigned int p;
+  int i;
+
+  
+  snprintf(buf, bufsize, "%s:", name ? name : "<null>");
+  p = strlen(buf);
+  
+  for (i = 0; aliases && aliases[i]; i++) {
+    snprintf(buf+p, bufsize-p, "%s%s", i > 0 ? "," : "", aliases[i]);
+    p += strlen(buf+p);
+  }
+  
+  snprintf(buf+p, bufsize-p, ":%s", value);
+  return name != NULL;
+}
+
+
+/*
+ * Look up "name[/proto]" or "number[/proto]" in the services, protocols
+ * or rpc maps
+ */
+static int
+t_ndb_named(const char *method,
+	    int argc,
+	    char *argv[],
+	    void *xp,
+	    unsigned long *ncp) {
+  char *buf = (char *) xp;
+  int i, rc = -1;
+  char sbuf[MAXHOSTENT], vbuf[64];
+  
+  
+  for (i = 1; i < argc; i++) {
+    union {
+      struct servent s;
+      struct protoent p;
+      struct rpcent r;
+    } ebuf;
+    void *ep = NULL;
+    char *arg, *proto;
+    int nc, ec = 0, trc;
+
+    
+    arg = strdup(argv[i]);
+    proto = strchr(arg, '/');
+    if (proto)
+      *proto++ = '\0';
+    
+    if (strcmp(method, "getservbyname_r") == 0)
+      nc = t_dispatch(method, &ep, arg, proto, &ebuf.s, buf, (size_t) n_bufsize, &ec);
+    else if (strcmp(method, "getservbyport_r") == 0)
+      nc = t_dispatch(method, &ep, (int) htons(atoi(arg)), proto, &ebuf.s, buf, (size_t) n_bufsize, &ec);
+    else if (strcmp(method, "getprotobyname_r") == 0)
+      nc = t_dispatch(method, &ep, arg, &ebuf.p, buf, (size_t) n_bufsize, &ec);
+    else if (strcmp(method, "getprotobynumber_r") == 0)
+      nc = t_dispatch(method, &ep, atoi(arg), &ebuf.p, buf, (size_t) n_bufsize, &ec);
+    else if (strcmp(method, "getrpcbyname_r") == 0)
+      nc = t_dispatch(method, &ep, arg, &ebuf.r, buf, (size_t) n_bufsize, &ec);
+    else
+      nc = t_dispatch(method, &ep, atoi(arg), &ebuf.r, buf, (size_t) n_bufsize, &ec);
+    
+    free(arg);
+    
+    if (nc != NS_SUCCESS && nc != NS_NOTFOUND) {
+      fprintf(stderr, "%s: Internal Error: t_dispatch(%s, \"%s\") returned: %s\n",
+	      argv0, method, argv[i], nsserror(nc));
+      exit(1);
+    }
+    
+    ++*ncp;
+    
+    if (!ep) {
+      if (f_verbose)
+	fprintf(stderr, "%s: Error: ndb_%s(\"%s\"): Not found\n",
+		argv0, method, argv[i]);
+      trc = 1;
+    } else {
+      if (f_verbose || f_check) {
+	if (strncmp(method, "getserv", 7) == 0) {
+	  snprintf(vbuf, sizeof(vbuf), "%u/%s", ntohs(ebuf.s.s_port), ebuf.s.s_proto);
+	  trc = !s_named(sbuf, sizeof(sbuf), ebuf.s.s_name, ebuf.s.s_aliases, vbuf);
+	} else if (strncmp(method, "getproto", 8) == 0) {
+	  snprintf(vbuf, sizeof(vbuf), "%d", ebuf.p.p_proto);
+	  trc = !s_named(sbuf, sizeof(sbuf), ebuf.p.p_name, ebuf.p.p_aliases, vbuf);
+	} else {
+	  snprintf(vbuf, sizeof(vbuf), "%d", ebuf.r.r_number);
+	  trc = !s_named(sbuf, sizeof(sbuf), ebuf.r.r_name, ebuf.r.r_aliases, vbuf);
+	}
+	
+	if (f_check && 
+	    (trc || (checkdata && strcmp(sbuf, checkdata) != 0))) {
+	  fprintf(stderr, "%s: Error: %s: Returned data failed validation\n",
+		  argv0, sbuf);
+	  exit(1);
+	}
+	
+	if (f_verbose > 1) {
+	  printf("Returned data:\n  %s\n", sbuf);
+	  --f_verbose;
+	}
+      }
+      
+      trc = 0;
+    }
+
+    if (rc >= 0 && rc != trc) {
+      fprintf(stderr, "%s: Error: ndb_%s(\"%s\") not yielding similar result as previous\n",
+	      argv0, method, argv[i]);
+      exit(1);
+    }
+    
+    rc = trc;
+  }
+
+  return rc;
+}
+
+
+int
+t_ndb_getservbyname_r(int argc,
+		      char *argv[],
+		      void *xp,
+		      unsigned long *ncp) {
+  return t_ndb_named("getservbyname_r", argc, argv, xp, ncp);
+}
+
+
+int
+t_ndb_getservbyport_r(int argc,
+		      char *argv[],
+		      void *xp,
+		      unsigned long *ncp) {
+  return t_ndb_named("getservbyport_r", argc, argv, xp, ncp);
+}
+
+
+int
+t_ndb_getprotobyname_r(int argc,
+		       char *argv[],
+		       void *xp,
+		       unsigned long *ncp) {
+  return t_ndb_named("getprotobyname_r", argc, argv, xp, ncp);
+}
+
+
+int
+t_ndb_getprotobynumber_r(int argc,
+			 char *argv[],
+			 void *xp,
+			 unsigned long *ncp) {
+  return t_ndb_named("getprotobynumber_r", argc, argv, xp, ncp);
+}
+
+
+int
+t_ndb_getrpcbyname_r(int argc,
+		     char *argv[],
+		     void *xp,
+		     unsigned long *ncp) {
+  return t_ndb_named("getrpcbyname_r", argc, argv, xp, ncp);
+}
+
+
+int
+t_ndb_getrpcbynumber_r(int argc,
+		       char *argv[],
+		       void *xp,
+		       unsigned long *ncp) {
+  return t_ndb_named("getrpcbynumber_r", argc, argv, xp, ncp);
+}
+
+
+/*
+ * Partitioned enumeration: argv[1] partitions (default 4) scanned by
+ * as many threads, argv[2] records per batch (default 64).
+ */
+typedef struct part_args {
+  NSS_NDB_PART *pp;
+  int i;
+  int passwd_f;
+  int batch;
+  unsigned long nr;
+  pthread_t tid;
+} PARTARGS;
+
+
+void *
+run_part(void *xp) {
+  PARTARGS *pap = (PARTARGS *) xp;
+  char *buf, sbuf[MAXGROUP];
+  void *ov;
+  int j, n, ec = 0;
+
+
+  buf = malloc(n_bufsize);
+  ov = calloc(pap->batch, pap->passwd_f ? sizeof(struct passwd) : sizeof(struct group));
+  if (!buf || !ov) {
+    fprintf(stderr, "%s: Error: malloc() failed: %s\n", argv0, strerror(errno));
+    exit(1);
+  }
+
+  while ((n = (pap->passwd_f ?
+	       nss_ndb_getpwpart_r(pap->pp, pap->i, ov, pap->batch, buf, n_bufsize, &ec) :
+	       nss_ndb_getgrpart_r(pap->pp, pap->i, ov, pap->batch, buf, n_bufsize, &ec))) > 0) {
+    pap->nr += n;
+    
+    for (j = 0; (f_verbose > 2 || f_check) && j < n; j++) {
+      int ok;
+      
+      if (pap->passwd_f) {
+	struct passwd *pp = (struct passwd *) ov + j;
+	
+	s_passwd(sbuf, sizeof(sbuf), pp);
+	ok = c_passwd(pp);
+      } else {
+	struct group *gp = (struct group *) ov + j;
+	
+	s_group(sbuf, sizeof(sbuf), gp);
+	ok = c_group(gp);
+      }
+      
+      if (f_check && !ok) {
+	fprintf(stderr, "%s: Error: %s: Returned data failed validation\n",
+		argv0, sbuf);
+	exit(1);
+      }
+      if (f_verbose > 2)
+	printf("%d: %s\n", pap->i, sbuf);
+    }
+  }
+  
+  if (n < 0) {
+    fprintf(stderr, "%s: Error: partition %d: %s\n",
+	    argv0, pap->i, strerror(ec));
+    exit(1);
+  }
+
+  free(ov);
+  free(buf);
+  return NULL;
+}
+
+
+int
+t_ndb_getpart(int passwd_f,
+	      int argc,
+	      char *argv[],
+	      void *xp,
+	      unsigned long *ncp) {
+  NSS_NDB_PART *pp;
+  PARTARGS *pav;
+  int i, k = 4, batch = 64;
+  unsigned long nr = 0;
+  
+
+  if (argc > 1 && (k = atoi(argv[1])) < 1) {
+    fprintf(stderr, "%s: Error: %s: Invalid number of partitions\n", argv0, argv[1]);
+    exit(1);
+  }
+  if (argc > 2 && (batch = atoi(argv[2])) < 1) {
+    fprintf(stderr, "%s: Error: %s: Invalid batch size\n", argv0, argv[2]);
+    exit(1);
+  }
+  
+  pp = nss_ndb_partition(passwd_f ? "passwd" : "group", k);
+  if (!pp) {
+    fprintf(stderr, "%s: Error: nss_ndb_partition(%s, %d) failed: %s\n",
+	    argv0, passwd_f ? "passwd" : "group", k, strerror(errno));
+    exit(1);
+  }
+  
+  pav = calloc(k, sizeof(*pav));
+  if (!pav) {
+    fprintf(stderr, "%s: Error: calloc(%d, %lu) failed: %s\n", argv0, k, sizeof(*pav), strerror(errno));
+    exit(1);
+  }
+  
+  for (i = 0; i < k; i++) {
+    pav[i].pp = pp;
+    pav[i].i = i;
+    pav[i].passwd_f = passwd_f;
+    pav[i].batch = batch;
+    
+    if (pthread_create(&pav[i].tid, NULL, run_part, (void *) &pav[i])) {
+      fprintf(stderr, "%s: Error: pthread_create() failed: %s\n", argv0, strerror(errno));
+      exit(1);
+    }
+  }
+  
+  for (i = 0; i < k; i++) {
+    void *res;
+    
+    pthread_join(pav[i].tid, &res);
+    if (f_verbose > 1)
+      fprintf(stderr, "%s: partition %d: %lu records\n", argv0, i, pav[i].nr);
+    nr += pav[i].nr;
+  }
+  
+  if (f_verbose > 1) {
+    fprintf(stderr, "%s: %lu records in %d partitions\n", argv0, nr, k);
+    --f_verbose;
+  }
+  
+  free(pav);
+  nss_ndb_partition_free(pp);
+
+  *ncp += nr;
+  if (!nr) {
+    if (f_verbose)
+      fprintf(stderr, "%s: Error: %s: No entries found\n", argv0, argv[0]);
+    return 1;
+  }
+  
+  return 0;
+}
+
+
+int
+t_ndb_getpwpart(int argc,
+		char *argv[],
+		void *xp,
+		unsigned long *ncp) {
+  return t_ndb_getpart(1, argc, argv, xp, ncp);
+}
+
+
+int
+t_ndb_getgrpart(int argc,
+		char *argv[],
+		void *xp,
+		unsigned long *ncp) {
+  return t_ndb_getpart(0, argc, argv, xp, ncp);
+}
+
+
+/*
+ * Id range query: the users (or groups) with ids argv[1]..argv[2]-1
+ * (default to the end), argv[3] records per batch (default 64)
+ */
+int
+t_ndb_getrange(int passwd_f,
+	       int argc,
+	       char *argv[],
+	       void *xp,
+	       unsigned long *ncp) {
+  NSS_NDB_RANGE *qp;
+  unsigned long first, last = ULONG_MAX, id, pid = 0;
+  char *buf, *ep, sbuf[MAXGROUP];
+  void *ov;
+  int j, n, batch = 64, ec = 0;
+  unsigned long nr = 0;
+
+
+  if (argc < 2) {
+    fprintf(stderr, "%s: Error: %s: Missing first id\n", argv0, argv[0]);
+    exit(1);
+  }
+  first = strtoul(argv[1], &ep, 10);
+  if (ep == argv[1] || *ep) {
+    fprintf(stderr, "%s: Error: %s: Invalid id\n", argv0, argv[1]);
+    exit(1);
+  }
+  if (argc > 2 && *argv[2]) {
+    last = strtoul(argv[2], &ep, 10);
+    if (*ep) {
+      fprintf(stderr, "%s: Error: %s: Invalid id\n", argv0, argv[2]);
+      exit(1);
+    }
+  }
+  if (argc > 3 && (batch = atoi(argv[3])) < 1) {
+    fprintf(stderr, "%s: Error: %s: Invalid batch size\n", argv0, argv[3]);
+    exit(1);
+  }
+  
+  qp = nss_ndb_range(passwd_f ? "passwd" : "group", first, last);
+  if (!qp) {
+    fprintf(stderr, "%s: Error: nss_ndb_range(%s, %lu, %lu) failed: %s\n",
+	    argv0, passwd_f ? "passwd" : "group", first, last, strerror(errno));
+    exit(1);
+  }
+
+  buf = malloc(n_bufsize);
+  ov = calloc(batch, passwd_f ? sizeof(struct passwd) : sizeof(struct group));
+  if (!buf || !ov) {
+    fprintf(stderr, "%s: Error: malloc() failed: %s\n", argv0, strerror(errno));
+    exit(1);
+  }
+
+  while ((n = (passwd_f ?
+	       nss_ndb_getpwrange_r(qp, ov, batch, buf, n_bufsize, &ec) :
+	       nss_ndb_getgrrange_r(qp, ov, batch, buf, n_bufsize, &ec))) > 0) {
+    for (j = 0; j < n; j++) {
+      int ok;
+      
+      if (passwd_f) {
+	struct passwd *pp = (struct passwd *) ov + j;
+	
+	id = pp->pw_uid;
+	s_passwd(sbuf, sizeof(sbuf), pp);
+	ok = c_passwd(pp);
+      } else {
+	struct group *gp = (struct group *) ov + j;
+	
+	id = gp->gr_gid;
+	s_group(sbuf, sizeof(sbuf), gp);
+	ok = c_group(gp);
+      }
+      
+      if (f_check && (!ok || id < first || id >= last || (nr+j > 0 && id <= pid))) {
+	fprintf(stderr, "%s: Error: %s: Returned data failed validation\n",
+		argv0, sbuf);
+	exit(1);
+      }
+      if (f_verbose > 2)
+	printf("%s\n", sbuf);
+      pid = id;
+    }
+    nr += n;
+  }
+  
+  if (n < 0) {
+    fprintf(stderr, "%s: Error: %s: %s\n", argv0, argv[0], strerror(ec));
+    exit(1);
+  }
+  
+  if (f_verbose > 1) {
+    fprintf(stderr, "%s: %lu records in %lu..%lu\n", argv0, nr, first, last);
+    --f_verbose;
+  }
+
+  free(ov);
+  free(buf);
+  nss_ndb_range_free(qp);
+
+  *ncp += nr;
+  if (!nr) {
+    if (f_verbose)
+      fprintf(stderr, "%s: Error: %s: No entries found\n", argv0, argv[0]);
+    return 1;
+  }
+  
+  return 0;
+}
+
+
+int
+t_ndb_getpwrange(int argc,
+		 char *argv[],
+		 void *xp,
+		 unsigned long *ncp) {
+  return t_ndb_getrange(1, argc, argv, xp, ncp);
+}
+
+
+int
+t_ndb_getgrrange(int argc,
+		 char *argv[],
+		 void *xp,
+		 unsigned long *ncp) {
+  return t_ndb_getrange(0, argc, argv, xp, ncp);
+}
+
+
+/*
+ * Batched lookups: the ids argv[1]..argv[2]-1, in random order,
+ * argv[3] per call (default 256), or with 0 one getpwuid_r (getgrgid_r)
+ * call each for comparison. Each id counts as a call.
+ */
+int
+t_ndb_getids(int passwd_f,
+	     int argc,
+	     char *argv[],
+	     void *xp,
+	     unsigned long *ncp) {
+  char *buf = (char *) xp, *ep, sbuf[MAXGROUP];
+  unsigned long first, last, k, nid;
+  unsigned int *idv;
+  void *ov, **rv;
+  int j, n, batch = 256, ec = 0;
+  unsigned long nf = 0;
+
+
+  if (argc < 3) {
+    fprintf(stderr, "%s: Error: %s: Missing first and last id\n", argv0, argv[0]);
+    exit(1);
+  }
+  first = strtoul(argv[1], &ep, 10);
+  if (ep == argv[1] || *ep) {
+    fprintf(stderr, "%s: Error: %s: Invalid id\n", argv0, argv[1]);
+    exit(1);
+  }
+  last = strtoul(argv[2], &ep, 10);
+  if (ep == argv[2] || *ep || last <= first) {
+    fprintf(stderr, "%s: Error: %s: Invalid id\n", argv0, argv[2]);
+    exit(1);
+  }
+  if (argc > 3 && (batch = atoi(argv[3])) < 0) {
+    fprintf(stderr, "%s: Error: %s: Invalid batch size\n", argv0, argv[3]);
+    exit(1);
+  }
+
+  nid = last-first;
+  idv = malloc(nid*sizeof(*idv));
+  rv = calloc(batch ? batch : 1, sizeof(*rv));
+  ov = calloc(batch ? batch : 1, passwd_f ? sizeof(struct passwd) : sizeof(struct group));
+  if (!idv || !rv || !ov) {
+    fprintf(stderr, "%s: Error: malloc() failed: %s\n", argv0, strerror(errno));
+    exit(1);
+  }
+  
+  /* Shuffled, like the owners of the files in a directory */
+  for (k = 0; k < nid; k++)
+    idv[k] = first+k;
+  for (k = nid-1; k > 0; k--) {
+    unsigned long r = random() % (k+1);
+    unsigned int t = idv[k];
+    
+    idv[k] = idv[r];
+    idv[r] = t;
+  }
+  
+  for (k = 0; k < nid; k += n) {
+    n = batch ? batch : 1;
+    if (n > nid-k)
+      n = nid-k;
+    
+    if (batch == 0) {
+      int nc;
+      
+      rv[0] = NULL;
+      if (passwd_f)
+	nc = t_dispatch("getpwuid_r", &rv[0], (uid_t) idv[k], ov, buf, n_bufsize, &ec);
+      else
+	nc = t_dispatch("getgrgid_r", &rv[0], (gid_t) idv[k], ov, buf, n_bufsize, &ec);
+      if (nc != NS_SUCCESS && nc != NS_NOTFOUND) {
+	fprintf(stderr, "%s: Internal Error: t_dispatch(%s, \"%u\") returned: %s\n",
+		argv0, passwd_f ? "getpwuid_r" : "getgrgid_r", idv[k], nsserror(nc));
+	exit(1);
+      }
+    } else {
+      int rc;
+      
+      if (passwd_f)
+	rc = nss_ndb_getpwuids_r((uid_t *) idv+k, n, (struct passwd **) rv, ov, buf, n_bufsize, &ec);
+      else
+	rc = nss_ndb_getgrgids_r((gid_t *) idv+k, n, (struct group **) rv, ov, buf, n_bufsize, &ec);
+      if (rc < 0) {
+	fprintf(stderr, "%s: Error: %s: %s\n", argv0, argv[0], strerror(ec));
+	exit(1);
+      }
+    }
+    
+    for (j = 0; j < n; j++) {
+      int ok;
+      unsigned long id;
+      
+      if (!rv[j])
+	continue;
+      ++nf;
+      
+      if (passwd_f) {
+	struct passwd *pp = (struct passwd *) rv[j];
+	
+	id = pp->pw_uid;
+	s_passwd(sbuf, sizeof(sbuf), pp);
+	ok = c_passwd(pp);
+      } else {
+	struct group *gp = (struct group *) rv[j];
+	
+	id = gp->gr_gid;
+	s_group(sbuf, sizeof(sbuf), gp);
+	ok = c_group(gp);
+      }
+      
+      if (f_check && (!ok || id != idv[k+j])) {
+	fprintf(stderr, "%s: Error: %s: Returned data failed validation\n",
+		argv0, sbuf);
+	exit(1);
+      }
+      if (f_verbose > 2)
+	printf("%u: %s\n", idv[k+j], sbuf);
+    }
+  }
+  
+  if (f_verbose > 1) {
+    fprintf(stderr, "%s: %lu of %lu ids found\n", argv0, nf, nid);
+    --f_verbose;
+  }
+  
+  free(ov);
+  free(rv);
+  free(idv);
+  
+  *ncp += nid;
+  if (!nf) {
+    if (f_verbose)
+      fprintf(stderr, "%s: Error: %s: No entries found\n", argv0, argv[0]);
+    return 1;
+  }
+  
+  return 0;
+}
+
+
+int
+t_ndb_getpwuids(int argc,
+		char *argv[],
+		void *xp,
+		unsigned long *ncp) {
+  return t_ndb_getids(1, argc, argv, xp, ncp);
+}
+
+
+int
+t_ndb_getgrgids(int argc,
+		char *argv[],
+		void *xp,
+		unsigned long *ncp) {
+  return t_ndb_getids(0, argc, argv, xp, ncp);
+}
+
+
+/*
+ * Batched lookup of the names argv[1..], all in one call
+ */
+int
+t_ndb_getnams(int passwd_f,
+	      int argc,
+	      char *argv[],
+	      void *xp,
+	      unsigned long *ncp) {
+  char *buf = (char *) xp, sbuf[MAXGROUP];
+  void *ov, **rv;
+  int j, rc, ec = 0, n = argc-1;
+
+
+  if (n < 1) {
+    fprintf(stderr, "%s: Error: %s: Missing names\n", argv0, argv[0]);
+    exit(1);
+  }
+  
+  rv = calloc(n, sizeof(*rv));
+  ov = calloc(n, passwd_f ? sizeof(struct passwd) : sizeof(struct group));
+  if (!rv || !ov) {
+    fprintf(stderr, "%s: Error: malloc() failed: %s\n", argv0, strerror(errno));
+    exit(1);
+  }
+  
+  if (passwd_f)
+    rc = nss_ndb_getpwnams_r((const char **) argv+1, n, (struct passwd **) rv, ov, buf, n_bufsize, &ec);
+  else
+    rc = nss_ndb_getgrnams_r((const char **) argv+1, n, (struct group **) rv, ov, buf, n_bufsize, &ec);
+  if (rc < 0) {
+    fprintf(stderr, "%s: Error: %s: %s\n", argv0, argv[0], strerror(ec));
+    exit(1);
+  }
+  
+  for (j = 0; j < n; j++) {
+    int ok;
+    
+    if (!rv[j]) {
+      if (f_verbose)
+	fprintf(stderr, "%s: Error: %s(\"%s\"): Not found\n", argv0, argv[0], argv[j+1]);
+      continue;
+    }
+    
+    if (passwd_f) {
+      s_passwd(sbuf, sizeof(sbuf), (struct passwd *) rv[j]);
+      ok = c_passwd((struct passwd *) rv[j]);
+    } else {
+      s_group(sbuf, sizeof(sbuf), (struct group *) rv[j]);
+      ok = c_group((struct group *) rv[j]);
+    }
+    
+    if (f_check && !ok) {
+      fprintf(stderr, "%s: Error: %s: Returned data failed validation\n",
+	      argv0, sbuf);
+      exit(1);
+    }
+    if (f_verbose > 1)
+      printf("%s: %s\n", argv[j+1], sbuf);
+  }
+  if (f_verbose > 1)
+    --f_verbose;
+  
+  free(ov);
+  free(rv);
+  
+  *ncp += n;
+  return rc == n ? 0 : 1;
+}
+
+
+int
+t_ndb_getpwnams(int argc,
+		char *argv[],
+		void *xp,
+		unsigned long *ncp) {
+  return t_ndb_getnams(1, argc, argv, xp, ncp);
+}
+
+
+int
+t_ndb_getgrnams(int argc,
+		char *argv[],
+		void *xp,
+		unsigned long *ncp) {
+  return t_ndb_getnams(0, argc, argv, xp, ncp);
+}
+
+
+/*
+ * Asynchronous lookup load: getpwuid for the uids argv[1]..argv[2]-1
+ * in random order, with argv[3] requests in flight (default 64),
+ * argv[4] worker threads (default 4) and a deadline of argv[5] ms
+ * (default none). Completions are waited for on the completion fd.
+ */
+typedef struct async_load {
+  NSS_NDB_ASYNC *ap;
+  unsigned int *idv;
+  unsigned long nid;
+  unsigned long next;
+  unsigned long nf;
+  unsigned long nnf;
+  unsigned long nto;
+  unsigned long nerr;
+  int timeout;
+} ASYNCLOAD;
+
+
+static void
+async_submit(ASYNCLOAD *alp,
+	     NSS_NDB_REQ *rp) {
+  rp->type = NSS_NDB_GETPWUID;
+  rp->id = alp->idv[alp->next++];
+  rp->timeout = alp->timeout;
+  
+  if (nss_ndb_async_submit(alp->ap, rp) < 0) {
+    fprintf(stderr, "%s: Error: nss_ndb_async_submit() failed: %s\n", argv0, strerror(errno));
+    exit(1);
+  }
+}
+
+
+static void
+async_done(NSS_NDB_REQ *rp) {
+  ASYNCLOAD *alp = (ASYNCLOAD *) rp->xp;
+  char sbuf[MAXPASSWD];
+
+  
+  if (rp->status == NS_SUCCESS) {
+    struct passwd *pp = (struct passwd *) rp->result;
+    
+    ++alp->nf;
+    if (f_verbose > 2 || f_check)
+      s_passwd(sbuf, sizeof(sbuf), pp);
+    if (f_check && (!c_passwd(pp) || pp->pw_uid != rp->id)) {
+      fprintf(stderr, "%s: Error: %s: Returned data failed validation\n",
+	      argv0, sbuf);
+      exit(1);
+    }
+    if (f_verbose > 2)
+      printf("%lu: %s\n", rp->id, sbuf);
+  } else if (rp->status == NS_NOTFOUND)
+    ++alp->nnf;
+  else if (rp->res == ETIMEDOUT)
+    ++alp->nto;
+  else {
+    if (f_verbose)
+      fprintf(stderr, "%s: Error: async getpwuid(%lu): %s\n", argv0, rp->id, strerror(rp->res));
+    ++alp->nerr;
+  }
+  
+  if (alp->next < alp->nid)
+    async_submit(alp, rp);
+}
+
+
+int
+t_ndb_async(int argc,
+	    char *argv[],
+	    void *xp,
+	    unsigned long *ncp) {
+  ASYNCLOAD al;
+  NSS_NDB_REQ *rv;
+  unsigned long first, last, k, ndone = 0;
+  struct pollfd pfd;
+  char *ep;
+  int j, n, inflight = 64, threads = 4;
+
+
+  memset(&al, 0, sizeof(al));
+  
+  if (argc < 3) {
+    fprintf(stderr, "%s: Error: %s: Missing first and last uid\n", argv0, argv[0]);
+    exit(1);
+  }
+  first = strtoul(argv[1], &ep, 10);
+  if (ep == argv[1] || *ep) {
+    fprintf(stderr, "%s: Error: %s: Invalid uid\n", argv0, argv[1]);
+    exit(1);
+  }
+  last = strtoul(argv[2], &ep, 10);
+  if (ep == argv[2] || *ep || last <= first) {
+    fprintf(stderr, "%s: Error: %s: Invalid uid\n", argv0, argv[2]);
+    exit(1);
+  }
+  if (argc > 3 && (inflight = atoi(argv[3])) < 1) {
+    fprintf(stderr, "%s: Error: %s: Invalid number of requests in flight\n", argv0, argv[3]);
+    exit(1);
+  }
+  if (argc > 4 && (threads = atoi(argv[4])) < 1) {
+    fprintf(stderr, "%s: Error: %s: Invalid number of threads\n", argv0, argv[4]);
+    exit(1);
+  }
+  if (argc > 5 && (al.timeout = atoi(argv[5])) < 0) {
+    fprintf(stderr, "%s: Error: %s: Invalid timeout\n", argv0, argv[5]);
+    exit(1);
+  }
+  
+  al.nid = last-first;
+  al.idv = malloc(al.nid*sizeof(*al.idv));
+  rv = calloc(inflight, sizeof(*rv));
+  if (!al.idv || !rv) {
+    fprintf(stderr, "%s: Error: malloc() failed: %s\n", argv0, strerror(errno));
+    exit(1);
+  }
+  for (k = 0; k < al.nid; k++)
+    al.idv[k] = first+k;
+  for (k = al.nid-1; k > 0; k--) {
+    unsigned long r = random() % (k+1);
+    unsigned int t = al.idv[k];
+    
+    al.idv[k] = al.idv[r];
+    al.idv[r] = t;
+  }
+  
+  al.ap = nss_ndb_async_create(threads);
+  if (!al.ap) {
+    fprintf(stderr, "%s: Error: nss_ndb_async_create(%d) failed: %s\n", argv0, threads, strerror(errno));
+    exit(1);
+  }
+  
+  for (j = 0; j < inflight && al.next < al.nid; j++) {
+    rv[j].callback = async_done;
+    rv[j].xp = &al;
+    rv[j].bsize = MAXPASSWD;
+    rv[j].buf = malloc(rv[j].bsize);
+    if (!rv[j].buf) {
+      fprintf(stderr, "%s: Error: malloc() failed: %s\n", argv0, strerror(errno));
+      exit(1);
+    }
+    async_submit(&al, &rv[j]);
+  }
+  
+  /* Like an event loop would */
+  pfd.fd = nss_ndb_async_fd(al.ap);
+  pfd.events = POLLIN;
+  while (ndone < al.nid) {
+    pfd.revents = 0;
+    if (poll(&pfd, 1, nss_ndb_async_timeout(al.ap)) < 0 && errno != EINTR) {
+      fprintf(stderr, "%s: Error: poll() failed: %s\n", argv0, strerror(errno));
+      exit(1);
+    }
+    n = nss_ndb_async_poll(al.ap, 0);
+    if (n < 0) {
+      fprintf(stderr, "%s: Error: nss_ndb_async_poll() failed: %s\n", argv0, strerror(errno));
+      exit(1);
+    }
+    ndone += n;
+  }
+  
+  nss_ndb_async_destroy(al.ap);
+  
+  if (f_verbose > 1) {
+    fprintf(stderr, "%s: %lu requests: %lu found, %lu not found, %lu timed out, %lu failed\n",
+	    argv0, al.nid, al.nf, al.nnf, al.nto, al.nerr);
+    --f_verbose;
+  }
+  
+  for (j = 0; j < inflight; j++)
+    free(rv[j].buf);
+  free(rv);
+  free(al.idv);
+  
+  *ncp += al.nid;
+  return al.nerr || !al.nf ? 1 : 0;
+}
+
+
+#ifdef __linux__
+static int
+s_spwd(char *buf,
+       size_t bufsize,
+       struct spwd *sp) {
+  snprintf(buf, bufsize, "%s:%s:%ld:%ld:%ld:%ld:%ld:%ld",
+	   sp->sp_namp ? sp->sp_namp : "<null>",
+	   sp->sp_pwdp ? sp->sp_pwdp : "<null>",
+	   sp->sp_lstchg, sp->sp_min, sp->sp_max,
+	   sp->sp_warn, sp->sp_inact, sp->sp_expire);
+  
+  return sp->sp_namp && sp->sp_pwdp;
+}
+
+
+int
+t_ndb_getspnam_r(int argc,
+		 char *argv[],
+		 void *xp,
+		 unsigned long *ncp) {
+  char *buf = (char *) xp;
+  int i, rc = -1;
+  char sbuf[MAXPASSWD];
+  
+  
+  for (i = 1; i < argc; i++) {
+    struct spwd spbuf, *sp = NULL;
+    int nc, ec = 0, trc = -1;
+    
+
+    nc = t_dispatch("getspnam_r", &sp, argv[i], &spbuf, buf, (size_t) n_bufsize, &ec);
+    if (nc != NS_SUCCESS && nc != NS_NOTFOUND) {
+      fprintf(stderr, "%s: Internal Error: t_dispatch(getspnam_r, \"%s\") returned: %s%s%s\n",
+	      argv0, argv[i], nsserror(nc), ec ? ": " : "", ec ? strerror(ec) : "");
+      exit(1);
+    }
+    
+    ++*ncp;
+    
+    if (!sp) {
+      if (f_verbose)
+	fprintf(stderr, "%s: Error: ndb_getspnam_r(\"%s\"): User not found\n",
+		argv0, argv[i]);
+      trc = 1;
+    } else {
+      if (f_verbose || f_check) {
+	if (!s_spwd(sbuf, sizeof(sbuf), sp) ||
+	    (f_check && checkdata && strcmp(sbuf, checkdata) != 0)) {
+	  fprintf(stderr, "%s: Error: %s: Returned data failed validation\n",
+		  argv0, sbuf);
+	  exit(1);
+	}
+      }
+      
+      if (f_verbose > 1) {
+	printf("Returned data:\n  %s\n", sbuf);
+	--f_verbose;
+      }
+      
+      trc = 0;
+    }
+
+    if (rc >= 0 && rc != trc) {
+      fprintf(stderr, "%s: Error: ndb_getspnam_r(\"%s\") not yielding similar result as previous\n",
+	      argv0, argv[i]);
+      exit(1);
+    }
+    
+    rc = trc;
+  }
+
+  return rc;
+}
+#endif
+#endif
+
+
+
+static struct action {
+  char *name;
+  int (*tf)(int argc, char **argv, void *xp, unsigned long *ncp);
+} actions[] = {
+	       { "getpwnam",     &t_getpwnam },
+	       { "getpwnam_r",   &t_getpwnam_r },
+	       { "getpwuid",     &t_getpwuid },
+	       { "getpwuid_r",   &t_getpwuid_r },
+	       { "getpwent",     &t_getpwent },
+	       { "getpwent_r",   &t_getpwent_r },
+	       { "getgrnam",     &t_getgrnam },
+	       { "getgrnam_r",   &t_getgrnam_r },
+	       { "getgrgid",     &t_getgrgid },
+	       { "getgrgid_r",   &t_getgrgid_r },
+	       { "getgrent",     &t_getgrent },
+	       { "getgrent_r",   &t_getgrent_r },
+	       { "getgrouplist", &t_getgrouplist },
+	       { "innetgr",      &t_innetgr },
+	       { "gethostbyname", &t_gethostbyname },
+	       { "gethostbyaddr", &t_gethostbyaddr },
+
+#ifdef WITH_NSS_NDB
+	       { "ndb_getpwnam_r",   &t_ndb_getpwnam_r },
+	       { "ndb_getpwuid_r",   &t_ndb_getpwuid_r },
+	       { "ndb_getgrnam_r",   &t_ndb_getgrnam_r },
+	       { "ndb_getgrgid_r",   &t_ndb_getgrgid_r },
+	       { "ndb_getpwpart",    &t_ndb_getpwpart },
+	       { "ndb_getgrpart",    &t_ndb_getgrpart },
+	       { "ndb_getpwrange",   &t_ndb_getpwrange },
+	       { "ndb_getgrrange",   &t_ndb_getgrrange },
+	       { "ndb_getpwuids",    &t_ndb_getpwuids },
+	       { "ndb_getgrgids",    &t_ndb_getgrgids },
+	       { "ndb_getpwnams",    &t_ndb_getpwnams },
+	       { "ndb_getgrnams",    &t_ndb_getgrnams },
+	       { "ndb_async",        &t_ndb_async },
+	       { "ndb_innetgr",      &t_ndb_innetgr },
+	       { "ndb_gethostbyname", &t_ndb_gethostbyname },
+	       { "ndb_gethostbyaddr", &t_ndb_gethostbyaddr },
+	       { "ndb_getservbyname_r", &t_ndb_getservbyname_r },
+	       { "ndb_getservbyport_r", &t_ndb_getservbyport_r },
+	       { "ndb_getprotobyname_r", &t_ndb_getprotobyname_r },
+	       { "ndb_getprotobynumber_r", &t_ndb_getprotobynumber_r },
+	       { "ndb_getrpcbyname_r", &t_ndb_getrpcbyname_r },
+	       { "ndb_getrpcbynumber_r", &t_ndb_getrpcbynumber_r },
+#ifdef __linux__
+	       { "ndb_getspnam_r",   &t_ndb_getspnam_r },
+#endif
 #endif
 
 	       { NULL,           NULL },